@@ -8,13 +8,15 @@ outputFile = open("include/embann_static.h", "w+")
 outputFile.write("/* File auto-generated by generate-static-var.py */\n")
 outputFile.write("#pragma once\n")
 outputFile.write("#include \"embann_data_types.h\"\n")
-outputFile.write("#include \"embann_config.h\"\n\n")
+outputFile.write("#include \"embann_config.h\"\n")
+outputFile.write("#include \"embann_macros.h\"\n\n")
 
 
 numInputNeurons = 0
 numHiddenNeurons = 0
 numHiddenLayers = 0
 numOutputNeurons = 0
+numNetworks = 1
 
 #
 # Read values from Kconfig
@@ -32,94 +34,175 @@ for line in configFile:
     if "CONFIG_NUM_OUTPUT_NEURONS=" in line:
         numOutputNeurons = int(line.split('=')[1])
         print("Number of output neurons =", numOutputNeurons)
+    if "CONFIG_NUM_STATIC_NETWORKS=" in line:
+        numNetworks = int(line.split('=')[1])
+        print("Number of networks =", numNetworks)
 
 
 
 
 #
-# Input layer
+# Scratch space sizes
 #
-outputFile.write("/*\n")
-outputFile.write(" * Input Layer\n")
-outputFile.write(" */\n")
-outputFile.write("static activation_t inputNeurons[CONFIG_NUM_INPUT_NEURONS];\n")
-outputFile.write("static inputLayer_t staticInputLayer = {\n")
-outputFile.write("    .numNeurons = CONFIG_NUM_INPUT_NEURONS,\n")
-outputFile.write("    .activation = inputNeurons\n")
-outputFile.write("};\n\n\n\n\n")
+outputFile.write("#define MAX_BATCH_LAYER_NEURONS ((CONFIG_NUM_HIDDEN_NEURONS > CONFIG_NUM_OUTPUT_NEURONS) ? \\\n")
+outputFile.write("                                    CONFIG_NUM_HIDDEN_NEURONS : CONFIG_NUM_OUTPUT_NEURONS)\n\n")
+outputFile.write("/* Shaped like every layer's weights one after the other */\n")
+outputFile.write("#define NUM_STATIC_GRADIENTS                                                                    \\\n")
+outputFile.write("    ((CONFIG_NUM_HIDDEN_NEURONS * WEIGHT_STRIDE(CONFIG_NUM_INPUT_NEURONS)) +                    \\\n")
+outputFile.write("    ((CONFIG_NUM_HIDDEN_LAYERS - 1U) * CONFIG_NUM_HIDDEN_NEURONS * WEIGHT_STRIDE(CONFIG_NUM_HIDDEN_NEURONS)) + \\\n")
+outputFile.write("    (CONFIG_NUM_OUTPUT_NEURONS * WEIGHT_STRIDE(CONFIG_NUM_HIDDEN_NEURONS)))\n\n\n\n\n")
 
 
 
 #
-# Hidden layer
+# One copy of everything for each network
 #
-for i in range(numHiddenLayers):
+for n in range(numNetworks):
+    #
+    # Input layer
+    #
     outputFile.write("/*\n")
-    outputFile.write(" * Hidden Layer %d\n" % i)
+    outputFile.write(" * Network %d Input Layer\n" % n)
     outputFile.write(" */\n")
-    outputFile.write("static activation_t hiddenNeuronsActivations_%d[CONFIG_NUM_HIDDEN_NEURONS];\n" % i)
-    outputFile.write("static bias_t hiddenNeuronBias_%d[CONFIG_NUM_HIDDEN_NEURONS];\n\n" % i)
+    outputFile.write("static activation_t inputNeurons_%d[CONFIG_NUM_INPUT_NEURONS];\n" % n)
+    outputFile.write("static inputLayer_t staticInputLayer_%d = {\n" % n)
+    outputFile.write("    .numNeurons = CONFIG_NUM_INPUT_NEURONS,\n")
+    outputFile.write("    .activation = inputNeurons_%d\n" % n)
+    outputFile.write("};\n\n\n\n\n")
+
+
+
+    #
+    # Hidden layer
+    #
+    for i in range(numHiddenLayers):
+        outputFile.write("/*\n")
+        outputFile.write(" * Network %d Hidden Layer %d\n" % (n, i))
+        outputFile.write(" */\n")
+        outputFile.write("static activation_t hiddenNeuronsActivations_%d_%d[CONFIG_NUM_HIDDEN_NEURONS];\n" % (n, i))
+        outputFile.write("static bias_t hiddenNeuronBias_%d_%d[CONFIG_NUM_HIDDEN_NEURONS];\n" % (n, i))
 
-    for j in range(numHiddenNeurons):
         if (i == 0):
-            outputFile.write("static weight_t hiddenNeuronWeights_%d_%d[CONFIG_NUM_INPUT_NEURONS];\n" % (i, j))
+            numLayerInputs = "CONFIG_NUM_INPUT_NEURONS"
         else:
-            outputFile.write("static weight_t hiddenNeuronWeights_%d_%d[CONFIG_NUM_HIDDEN_NEURONS];\n" % (i, j))
-    
-    outputFile.write("static weight_t* hiddenNeuronWeights_%d[CONFIG_NUM_HIDDEN_NEURONS] =\n{\n" % i)
-
-    for j in range(numHiddenNeurons - 1):
-        outputFile.write("    hiddenNeuronWeights_%d_%d,\n" % (i, j))
-    outputFile.write("    hiddenNeuronWeights_%d_%d\n" % (i, (numHiddenNeurons - 1)))
-    outputFile.write("};\n\n")
-
-    outputFile.write("static hiddenLayer_t staticHiddenLayer_%d =\n{\n" % i)
-    outputFile.write("    .numNeurons = CONFIG_NUM_HIDDEN_NEURONS,\n")
-    outputFile.write("    .activation = hiddenNeuronsActivations_%d,\n" % i)
-    outputFile.write("    .bias = hiddenNeuronBias_%d,\n" % i)
-    outputFile.write("    .weight = hiddenNeuronWeights_%d,\n" % i)
-    outputFile.write("};\n\n\n")
-
-outputFile.write("static hiddenLayer_t* staticHiddenLayers[CONFIG_NUM_HIDDEN_LAYERS] =\n{\n")
-for i in range(numHiddenLayers - 1):
-    outputFile.write("    &staticHiddenLayer_%d,\n" % i)
-outputFile.write("    &staticHiddenLayer_%d\n" % (numHiddenLayers - 1))
-outputFile.write("};\n\n\n\n\n")
+            numLayerInputs = "CONFIG_NUM_HIDDEN_NEURONS"
+
+        outputFile.write("static weight_t hiddenNeuronWeights_%d_%d[CONFIG_NUM_HIDDEN_NEURONS * WEIGHT_STRIDE(%s)] CACHE_ALIGNMENT;\n" % (n, i, numLayerInputs))
+        outputFile.write("#ifdef CONFIG_REQUANTIZATION\n")
+        outputFile.write("static int32_t hiddenNeuronMultiplier_%d_%d[CONFIG_NUM_HIDDEN_NEURONS];\n" % (n, i))
+        outputFile.write("static int8_t hiddenNeuronExponent_%d_%d[CONFIG_NUM_HIDDEN_NEURONS];\n" % (n, i))
+        outputFile.write("static accumulator_t hiddenNeuronZeroPointOffset_%d_%d[CONFIG_NUM_HIDDEN_NEURONS];\n" % (n, i))
+        outputFile.write("#endif\n\n")
+
+        outputFile.write("static hiddenLayer_t staticHiddenLayer_%d_%d =\n{\n" % (n, i))
+        outputFile.write("    .numNeurons = CONFIG_NUM_HIDDEN_NEURONS,\n")
+        outputFile.write("    .activation = hiddenNeuronsActivations_%d_%d,\n" % (n, i))
+        outputFile.write("    .bias = hiddenNeuronBias_%d_%d,\n" % (n, i))
+        outputFile.write("    .weight = hiddenNeuronWeights_%d_%d,\n" % (n, i))
+        outputFile.write("    .weightStride = WEIGHT_STRIDE(%s),\n" % numLayerInputs)
+        outputFile.write("#ifdef CONFIG_REQUANTIZATION\n")
+        outputFile.write("    .quant = {\n")
+        outputFile.write("        .multiplier = hiddenNeuronMultiplier_%d_%d,\n" % (n, i))
+        outputFile.write("        .exponent = hiddenNeuronExponent_%d_%d,\n" % (n, i))
+        outputFile.write("        .zeroPointOffset = hiddenNeuronZeroPointOffset_%d_%d\n" % (n, i))
+        outputFile.write("    },\n")
+        outputFile.write("#endif\n")
+        outputFile.write("};\n\n\n")
+
+    outputFile.write("static hiddenLayer_t* staticHiddenLayers_%d[CONFIG_NUM_HIDDEN_LAYERS] =\n{\n" % n)
+    for i in range(numHiddenLayers - 1):
+        outputFile.write("    &staticHiddenLayer_%d_%d,\n" % (n, i))
+    outputFile.write("    &staticHiddenLayer_%d_%d\n" % (n, numHiddenLayers - 1))
+    outputFile.write("};\n\n\n\n\n")
+
+
+    #
+    # Output Layer
+    #
+    outputFile.write("/*\n")
+    outputFile.write(" * Network %d Output Layer\n" % n)
+    outputFile.write(" */\n")
+    outputFile.write("static activation_t outputNeuronsActivations_%d[CONFIG_NUM_OUTPUT_NEURONS];\n" % n)
+    outputFile.write("static bias_t outputNeuronBias_%d[CONFIG_NUM_OUTPUT_NEURONS];\n" % n)
+    outputFile.write("static weight_t outputNeuronWeights_%d[CONFIG_NUM_OUTPUT_NEURONS * WEIGHT_STRIDE(CONFIG_NUM_HIDDEN_NEURONS)] CACHE_ALIGNMENT;\n" % n)
+    outputFile.write("#ifdef CONFIG_REQUANTIZATION\n")
+    outputFile.write("static int32_t outputNeuronMultiplier_%d[CONFIG_NUM_OUTPUT_NEURONS];\n" % n)
+    outputFile.write("static int8_t outputNeuronExponent_%d[CONFIG_NUM_OUTPUT_NEURONS];\n" % n)
+    outputFile.write("static accumulator_t outputNeuronZeroPointOffset_%d[CONFIG_NUM_OUTPUT_NEURONS];\n" % n)
+    outputFile.write("#endif\n\n")
+
+    outputFile.write("static outputLayer_t staticOutputLayer_%d =\n{\n" % n)
+    outputFile.write("    .numNeurons = CONFIG_NUM_OUTPUT_NEURONS,\n")
+    outputFile.write("    .activation = outputNeuronsActivations_%d,\n" % n)
+    outputFile.write("    .bias = outputNeuronBias_%d,\n" % n)
+    outputFile.write("    .weight = outputNeuronWeights_%d,\n" % n)
+    outputFile.write("    .weightStride = WEIGHT_STRIDE(CONFIG_NUM_HIDDEN_NEURONS),\n")
+    outputFile.write("#ifdef CONFIG_REQUANTIZATION\n")
+    outputFile.write("    .quant = {\n")
+    outputFile.write("        .multiplier = outputNeuronMultiplier_%d,\n" % n)
+    outputFile.write("        .exponent = outputNeuronExponent_%d,\n" % n)
+    outputFile.write("        .zeroPointOffset = outputNeuronZeroPointOffset_%d\n" % n)
+    outputFile.write("    },\n")
+    outputFile.write("#endif\n")
+    outputFile.write("};\n\n\n\n\n")
+
+
+    #
+    # Training data and embann_forwardPropagateBatch() scratch space
+    #
+    outputFile.write("/*\n")
+    outputFile.write(" * Network %d Working Memory\n" % n)
+    outputFile.write(" */\n")
+    outputFile.write("static activation_t staticTrainingFeatures_%d[CONFIG_NUM_TRAINING_DATA_SETS * TRAINING_DATA_STRIDE(CONFIG_NUM_TRAINING_DATA_ENTRIES)] CACHE_ALIGNMENT;\n" % n)
+    outputFile.write("static numOutputs_t staticTrainingLabels_%d[CONFIG_NUM_TRAINING_DATA_SETS];\n" % n)
+    outputFile.write("static numTrainingDataSets_t staticTrainingOrder_%d[CONFIG_NUM_TRAINING_DATA_SETS];\n" % n)
+    outputFile.write("static activation_t batchActivations_%d[2][CONFIG_BATCH_SIZE * MAX_BATCH_LAYER_NEURONS] CACHE_ALIGNMENT;\n" % n)
+    outputFile.write("static accumulator_t batchAccumulators_%d[CONFIG_BATCH_SIZE * MAX_BATCH_LAYER_NEURONS] CACHE_ALIGNMENT;\n" % n)
+    outputFile.write("static accumulator_t staticGradients_%d[NUM_STATIC_GRADIENTS] CACHE_ALIGNMENT;\n" % n)
+    outputFile.write("\n\n\n\n")
+
 
 
 #
-# Output Layer
+# Each network's own weights and biases, for embann_init() to point its layers
+# back at after embann_loadNetwork() has pointed them into a file mapping
 #
-outputFile.write("/*\n")
-outputFile.write(" * Output Layer\n")
-outputFile.write(" */\n")
-outputFile.write("static activation_t outputNeuronsActivations[CONFIG_NUM_OUTPUT_NEURONS];\n")
-outputFile.write("static bias_t outputNeuronBias[CONFIG_NUM_OUTPUT_NEURONS];\n\n")
-
-for i in range(numOutputNeurons):
-    outputFile.write("static weight_t outputNeuronWeights_%d[CONFIG_NUM_HIDDEN_NEURONS];\n" % i)
-
-outputFile.write("static weight_t* outputNeuronWeights[CONFIG_NUM_OUTPUT_NEURONS] =\n{\n")
-
-for i in range(numOutputNeurons - 1):
-    outputFile.write("    outputNeuronWeights_%d,\n" % i)
-outputFile.write("    outputNeuronWeights_%d\n" % (numOutputNeurons - 1))
-outputFile.write("};\n\n")
-
-outputFile.write("static outputLayer_t staticOutputLayer =\n{\n")
-outputFile.write("    .numNeurons = CONFIG_NUM_OUTPUT_NEURONS,\n")
-outputFile.write("    .activation = outputNeuronsActivations,\n")
-outputFile.write("    .bias = outputNeuronBias,\n")
-outputFile.write("    .weight = outputNeuronWeights\n")
+outputFile.write("static weight_t* const staticLayerWeights[CONFIG_NUM_STATIC_NETWORKS][CONFIG_NUM_HIDDEN_LAYERS + 1] = {\n")
+for n in range(numNetworks):
+    outputFile.write("    {")
+    for i in range(numHiddenLayers):
+        outputFile.write(" hiddenNeuronWeights_%d_%d," % (n, i))
+    outputFile.write(" outputNeuronWeights_%d },\n" % n)
+outputFile.write("};\n")
+outputFile.write("static bias_t* const staticLayerBiases[CONFIG_NUM_STATIC_NETWORKS][CONFIG_NUM_HIDDEN_LAYERS + 1] = {\n")
+for n in range(numNetworks):
+    outputFile.write("    {")
+    for i in range(numHiddenLayers):
+        outputFile.write(" hiddenNeuronBias_%d_%d," % (n, i))
+    outputFile.write(" outputNeuronBias_%d },\n" % n)
 outputFile.write("};\n\n\n\n\n")
 
 
 
 #
-# Network structure
+# Network structures
 #
-outputFile.write("static network_t staticNetwork = {\n")
-outputFile.write("    .inputLayer = &staticInputLayer,\n")
-outputFile.write("    .hiddenLayer = staticHiddenLayers,\n")
-outputFile.write("    .outputLayer = &staticOutputLayer\n")
+outputFile.write("static network_t staticNetworks[CONFIG_NUM_STATIC_NETWORKS] = {\n")
+for n in range(numNetworks):
+    outputFile.write("    {\n")
+    outputFile.write("        .inputLayer = &staticInputLayer_%d,\n" % n)
+    outputFile.write("        .hiddenLayer = staticHiddenLayers_%d,\n" % n)
+    outputFile.write("        .outputLayer = &staticOutputLayer_%d,\n" % n)
+    outputFile.write("        .trainingData = {\n")
+    outputFile.write("            .features = staticTrainingFeatures_%d,\n" % n)
+    outputFile.write("            .labels = staticTrainingLabels_%d,\n" % n)
+    outputFile.write("            .order = staticTrainingOrder_%d,\n" % n)
+    outputFile.write("            .capacity = CONFIG_NUM_TRAINING_DATA_SETS\n")
+    outputFile.write("        },\n")
+    outputFile.write("        .batchScratch = {\n")
+    outputFile.write("            .activations = { batchActivations_%d[0], batchActivations_%d[1] },\n" % (n, n))
+    outputFile.write("            .accumulators = batchAccumulators_%d\n" % n)
+    outputFile.write("        },\n")
+    outputFile.write("        .gradients = staticGradients_%d\n" % n)
+    outputFile.write("    },\n")
 outputFile.write("};\n")
@@ -28,41 +28,155 @@
 #endif // ARDUINO
 
 #include "embann_config.h"
+#if defined(CONFIG_MODEL_PUBLISHING) || defined(CONFIG_INFERENCE_ENGINE)
+#include <stdatomic.h>
+#endif
 #include "embann_data_types.h"
 #include "embann_macros.h"
 #include "embann_quirks.h"
+#include "embann_activation.h"
 
 
 
-int embann_init(numInputs_t numInputNeurons,
+int embann_init(network_t** ppNetwork,
+                numInputs_t numInputNeurons,
                 numHiddenNeurons_t numHiddenNeurons, 
                 numLayers_t numHiddenLayers,
                 numOutputs_t numOutputNeurons);
-int embann_calculateNetworkResponse(void);
-int embann_forwardPropagate(void);
-int embann_printNetwork(void);
-int embann_trainDriverInTime(activation_t learningRate, uint32_t numSeconds);
-int embann_trainDriverInError(activation_t learningRate, activation_t desiredCost);
+int embann_freeNetwork(network_t* pNetwork);
+int embann_calculateNetworkResponse(network_t* pNetwork);
+int embann_forwardPropagate(network_t* pNetwork);
+int embann_setActivationFunction(network_t* pNetwork, numLayers_t layer, activationFunction_t function);
+layerDescriptor_t embann_describeLayer(const network_t* pNetwork, numLayers_t layer);
+weight_t embann_getWeight(const layerDescriptor_t* pLayer, uint32_t neuron, uint32_t input);
+int embann_quantizeMultiplier(double realMultiplier, int32_t* pMultiplier, int8_t* pExponent);
+#ifdef CONFIG_REQUANTIZATION
+int embann_setRequantization(network_t* pNetwork, numLayers_t layer, const int32_t* pMultiplier,
+                                const int8_t* pExponent, uint32_t numScales, activation_t zeroPoint);
+int embann_setInputZeroPoint(network_t* pNetwork, activation_t zeroPoint);
+int embann_resetRequantization(network_t* pNetwork);
+int embann_updateZeroPointOffsets(network_t* pNetwork);
+#endif
+#ifdef QUANTIZATION_SOURCE
+int embann_calibrate(network_t* pNetwork, const activation_t* pInputs, uint32_t numSamples,
+                        activationRange_t* pRanges);
+int embann_saveQuantizedNetwork(const network_t* pNetwork, const activationRange_t* pRanges, const char* pPath);
+int embann_writeQuantizedHeader(const network_t* pNetwork, const activationRange_t* pRanges, const char* pPath);
+#endif
+#ifdef QUANTIZATION_TARGET
+int embann_loadQuantizedLayers(network_t* pNetwork, const quantizedLayer_t* pLayers, numLayers_t numLayers,
+                                uint8_t inputZeroPoint);
+int embann_loadQuantizedNetwork(network_t* pNetwork, const char* pPath, float* pInputScale);
+#endif
+int embann_forwardPropagateBatch(network_t* pNetwork, const activation_t* pInputs, uint32_t numSamples,
+                                    activation_t* pOutputs, numOutputs_t* pResponses);
+int embann_forwardPropagateBatchScratch(const network_t* pNetwork, const batchScratch_t* pScratch,
+                                        const activation_t* pInputs, uint32_t numSamples,
+                                        activation_t* pOutputs, numOutputs_t* pResponses);
+int embann_allocBatchScratch(batchScratch_t* pScratch, const network_t* pNetwork);
+int embann_freeBatchScratch(batchScratch_t* pScratch);
+int embann_initSession(inferenceSession_t** ppSession, const network_t* pNetwork);
+int embann_freeSession(inferenceSession_t* pSession);
+int embann_forwardPropagateSession(inferenceSession_t* pSession, const activation_t* pInputs);
+#ifdef CONFIG_MODEL_PUBLISHING
+int embann_initPublisher(modelPublisher_t* pPublisher, network_t* pNetwork);
+int embann_publishNetwork(modelPublisher_t* pPublisher, network_t* pNetwork);
+int embann_reclaimNetworks(modelPublisher_t* pPublisher);
+int embann_freePublisher(modelPublisher_t* pPublisher);
+int embann_acquireNetwork(modelPublisher_t* pPublisher, uint32_t reader, const network_t** ppNetwork);
+int embann_releaseNetwork(modelPublisher_t* pPublisher, uint32_t reader);
+int embann_forwardPropagatePublished(modelPublisher_t* pPublisher, uint32_t reader, inferenceSession_t* pSession,
+                                        const activation_t* pInputs);
+#endif
+#ifdef CONFIG_INFERENCE_ENGINE
+int embann_initEngine(inferenceEngine_t** ppEngine, const network_t* pNetwork, uint32_t numWorkers,
+                        uint32_t maxBatchSize, uint32_t maxWaitMicros);
+int embann_freeEngine(inferenceEngine_t* pEngine);
+int embann_submitInference(inferenceEngine_t* pEngine, inferenceRequest_t* pRequest);
+int embann_waitInference(inferenceEngine_t* pEngine, inferenceRequest_t* pRequest);
+#endif
+#ifdef CONFIG_SPARSE_WEIGHTS
+int embann_pruneNetwork(network_t* pNetwork, weight_t threshold);
+bool embann_isPruned(const network_t* pNetwork);
+void embann_setLayerWeights(network_t* pNetwork, numLayers_t layer, weight_t* pWeight,
+                            const sparseWeights_t* pSparse);
+int embann_allocSparseWeights(sparseWeights_t* pSparse, uint32_t numNeurons, uint32_t numBlocks);
+void embann_freeSparseWeights(sparseWeights_t* pSparse);
+accumulator_t embann_sparseDotProduct(const sparseWeights_t* pSparse, uint32_t neuron, const activation_t* pInput,
+                                        uint32_t numInputs);
+#endif
+accumulator_t embann_dotProduct(const activation_t* pActivation, const weight_t* pWeight, uint32_t numInputs);
+void embann_accumulateGradient(accumulator_t* pGradient, const activation_t* pActivation, accumulator_t error,
+                                uint32_t numInputs);
+void embann_applyGradients(weight_t* pWeight, accumulator_t* pGradient, uint32_t numWeights);
+void embann_convertToActivations(activation_t* pActivation, const float* pValue, uint32_t numValues);
+void embann_gemm(const layerDescriptor_t* pLayer, uint32_t numSamples, accumulator_t* pAccum);
+int embann_initKernels(void);
+#ifdef CONFIG_PARALLEL_LAYERS
+int embann_setNumThreads(uint32_t numThreads);
+uint32_t embann_getNumThreads(void);
+#endif
+bool embann_isKernelVariantSupported(kernelVariant_t variant);
+int embann_setKernelVariant(kernelVariant_t variant);
+kernelVariant_t embann_getKernelVariant(void);
+const char* embann_getKernelVariantName(void);
+int embann_saveNetwork(const network_t* pNetwork, const char* pPath);
+int embann_loadNetwork(network_t* pNetwork, const char* pPath);
+int embann_saveDataset(const network_t* pNetwork, const char* pPath);
+int embann_loadDataset(network_t* pNetwork, const char* pPath);
+#ifdef CONFIG_MAP_DATASET_FILES
+int embann_adviseDataset(const network_t* pNetwork, datasetAccess_t access);
+#endif
+int embann_exportSource(const network_t* pNetwork, const char* pPath, const char* pFunctionName);
+int embann_printNetwork(const network_t* pNetwork);
+int embann_trainDriverInTime(network_t* pNetwork, activation_t learningRate, uint32_t numSeconds,
+                                uint32_t batchSize);
+int embann_trainDriverInError(network_t* pNetwork, activation_t learningRate, activation_t desiredCost,
+                                uint32_t batchSize);
+#ifdef CONFIG_PARALLEL_TRAINING
+int embann_trainDriverParallel(network_t* pNetwork, activation_t learningRate, uint32_t numSeconds,
+                                uint32_t batchSize, uint32_t numThreads, float* pSamplesPerSecond);
+int embann_trainDriverInBatches(network_t* pNetwork, activation_t learningRate, uint32_t numBatches,
+                                uint32_t batchSize, uint32_t numThreads);
+#endif
 int embann_tanhDerivative(activation_t inputValue, weight_t* outputValue);
-int embann_errorReporting(numOutputs_t correctResponse);
-int embann_printInputNeuronDetails(numInputs_t neuronNum);
-int embann_printOutputNeuronDetails(numOutputs_t neuronNum);
-int embann_printHiddenNeuronDetails(numLayers_t layerNum, numHiddenNeurons_t neuronNum);
+int embann_errorReporting(const network_t* pNetwork, numOutputs_t correctResponse);
+int embann_printInputNeuronDetails(const network_t* pNetwork, numInputs_t neuronNum);
+int embann_printOutputNeuronDetails(const network_t* pNetwork, numOutputs_t neuronNum);
+int embann_printHiddenNeuronDetails(const network_t* pNetwork, numLayers_t layerNum, numHiddenNeurons_t neuronNum);
 int embann_benchmark(void);
-int embann_inputRaw(activation_t data[]);
-int embann_inputMinMaxScale(activation_t data[], activation_t min, activation_t max);
-int embann_inputStandardizeScale(activation_t data[], float mean, float stdDev);
-int embann_getTrainingDataMean(float* mean);
-int embann_getTrainingDataStdDev(float* stdDev);
-int embann_getTrainingDataMax(activation_t* max);
-int embann_getTrainingDataMin(activation_t* min);
+int embann_inputRaw(network_t* pNetwork, activation_t data[]);
+int embann_inputMinMaxScale(network_t* pNetwork, activation_t data[], activation_t min, activation_t max);
+int embann_inputStandardizeScale(network_t* pNetwork, activation_t data[], float mean, float stdDev);
+int embann_bindInput(network_t* pNetwork, const activation_t* pInputs);
+#ifdef ACTIVATION_IS_FLOAT
+int embann_bindInputMinMaxScale(network_t* pNetwork, const activation_t* pInputs,
+                                activation_t min, activation_t max);
+int embann_bindInputStandardizeScale(network_t* pNetwork, const activation_t* pInputs, float mean, float stdDev);
+#endif
+int embann_unbindInput(network_t* pNetwork);
+int embann_getTrainingDataMean(const network_t* pNetwork, float* mean);
+int embann_getTrainingDataStdDev(const network_t* pNetwork, float* stdDev);
+int embann_getTrainingDataMax(const network_t* pNetwork, activation_t* max);
+int embann_getTrainingDataMin(const network_t* pNetwork, activation_t* min);
 #ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
-int embann_addTrainingData(activation_t data[], uint32_t numElements, numOutputs_t correctResponse);
+int embann_addTrainingData(network_t* pNetwork, activation_t data[], uint32_t numElements,
+                            numOutputs_t correctResponse);
+#endif
+int embann_copyTrainingData(network_t* pNetwork, activation_t data[], uint32_t numElements,
+                            numOutputs_t correctResponse);
+int embann_allocTrainingData(network_t* pNetwork, numTrainingDataSets_t numSets,
+                                numTrainingDataEntries_t numEntries);
+int embann_clearTrainingData(network_t* pNetwork);
+int embann_shuffleTrainingData(network_t* pNetwork);
+#ifdef CONFIG_DATASET_IMPORT
+int embann_importCsv(network_t* pNetwork, const char* pPath, uint32_t numThreads);
+int embann_importRaw(network_t* pNetwork, const char* pPath, rawSampleFormat_t format,
+                        numTrainingDataEntries_t numEntries, uint32_t numThreads);
 #endif
-int embann_copyTrainingData(activation_t data[], uint32_t numElements, numOutputs_t correctResponse);
-int embann_shuffleTrainingData(void);
 int* embann_getErrno(void);
-int embann_getRandomDataSet(trainingData_t** dataSet);
+int embann_getRandomDataSet(const network_t* pNetwork, numTrainingDataSets_t* pIndex);
+int embann_getNextDataSet(network_t* pNetwork, numTrainingDataSets_t* pIndex);
 
 
 #ifndef ARDUINO
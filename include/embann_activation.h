@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+    embann_activation.h - EMbedded Backpropogating Artificial Neural Network.
+    Copyright Peter Frost 2019
+*/
+
+#ifndef Embann_activation_h
+#define Embann_activation_h
+
+#include "embann_data_types.h"
+#include "embann_macros.h"
+
+/* LEAKY_RELU passes 1 / 2^LEAKY_RELU_SHIFT of negative inputs */
+#define LEAKY_RELU_SHIFT 3U
+
+/*
+ * The epilogue of every layer kernel: bias add, requantization, activation
+ * function and a saturating narrow to activation_t, applied to each
+ * accumulator as it's finished rather than in a separate pass.
+ *
+ * Integer builds treat the (requantized) accumulator as being in activation
+ * units relative to the zero point, so TANH is a hard tanh (the saturating
+ * narrow, with a floor of 1 for unsigned activations), SOFTSIGN is scaled to
+ * the headroom above the zero point and RELU clamps at the zero point. Float
+ * builds keep the tanh(x * PI) of the original _squash, through a rational
+ * approximation that is within 1e-4 of tanhf.
+ */
+static ALWAYS_INLINE activation_t _saturateActivation(accumulator_t accum)
+{
+#ifdef ACTIVATION_IS_FLOAT
+    return (activation_t) accum;
+#else
+    accum = (accum > MAX_ACTIVATION) ? MAX_ACTIVATION : accum;
+    accum = (accum < MIN_ACTIVATION) ? MIN_ACTIVATION : accum;
+    return (activation_t) accum;
+#endif
+}
+
+#ifdef ACTIVATION_IS_FLOAT
+/* Lambert's continued fraction for tanh, clamped where it reaches +-1 */
+static ALWAYS_INLINE accumulator_t _tanhApprox(accumulator_t x)
+{
+    x = (x > 4.97F) ? 4.97F : x;
+    x = (x < -4.97F) ? -4.97F : x;
+    const accumulator_t x2 = x * x;
+
+    return (x * (135135.0F + (x2 * (17325.0F + (x2 * (378.0F + x2)))))) /
+            (135135.0F + (x2 * (62370.0F + (x2 * (3150.0F + (x2 * 28.0F))))));
+}
+#endif
+
+#ifdef CONFIG_REQUANTIZATION
+/* gemmlowp's SaturatingRoundingDoublingHighMul, round(a * b / 2^31) */
+static ALWAYS_INLINE int32_t _roundingDoublingHighMul(int32_t a, int32_t b)
+{
+    const bool overflow = (a == b) && (a == INT32_MIN);
+    const int64_t ab = (int64_t) a * b;
+    const int32_t nudge = (ab >= 0) ? (1 << 30) : (1 - (1 << 30));
+    const int32_t high = (int32_t) ((ab + nudge) / (1LL << 31));
+
+    return overflow ? INT32_MAX : high;
+}
+
+/* gemmlowp's RoundingDivideByPOT, x / 2^shift rounded half away from 0 */
+static ALWAYS_INLINE int32_t _roundingShiftRight(int32_t x, int32_t shift)
+{
+    const int32_t mask = (int32_t) ((1U << shift) - 1U);
+    const int32_t remainder = x & mask;
+    const int32_t threshold = (mask >> 1) + ((x < 0) ? 1 : 0);
+
+    return (x >> shift) + ((remainder > threshold) ? 1 : 0);
+}
+
+static ALWAYS_INLINE int32_t _requantize(int32_t accum, int32_t multiplier, int8_t exponent)
+{
+    const int32_t leftShift = (exponent > 0) ? exponent : 0;
+    const int32_t rightShift = (exponent > 0) ? 0 : -exponent;
+
+    return _roundingShiftRight(_roundingDoublingHighMul(accum * (1 << leftShift), multiplier), rightShift);
+}
+#endif
+
+/*
+ * embann_activate() for an accumulator that already has the bias and zero
+ * point offset added, with the neuron's requantization passed by value, so
+ * generated code with them as constants doesn't need a layerDescriptor_t.
+ * multiplier, exponent and zeroPoint are unused without CONFIG_REQUANTIZATION.
+ */
+static ALWAYS_INLINE activation_t embann_activateBiased(accumulator_t accum, activationFunction_t function,
+                                                        int32_t multiplier, int8_t exponent,
+                                                        activation_t zeroPoint)
+{
+#ifdef CONFIG_REQUANTIZATION
+    accum = _requantize(accum, multiplier, exponent);
+#else
+    (void) multiplier;
+    (void) exponent;
+    (void) zeroPoint;
+#endif
+
+    switch (function)
+    {
+        case TANH:
+#ifdef ACTIVATION_IS_FLOAT
+            accum = _tanhApprox(accum * PI);
+#endif
+            break;
+        case SOFTSIGN:
+#ifdef ACTIVATION_IS_FLOAT
+            accum = accum / (1.0F + ((accum < 0) ? -accum : accum));
+#else
+        {
+#ifdef CONFIG_REQUANTIZATION
+            const int64_t headroom = (int64_t) MAX_ACTIVATION - zeroPoint;
+#else
+            const int64_t headroom = (int64_t) MAX_ACTIVATION;
+#endif
+            /* Magnitude taken unsigned, negating an INT32_MIN accumulator overflows */
+            const uint64_t magnitude = (accum < 0) ? (0U - (uint64_t) accum) : (uint64_t) accum;
+            const uint64_t scaled = ((uint64_t) headroom * magnitude) / ((uint64_t) headroom + magnitude);
+            accum = (accum < 0) ? -(accumulator_t) scaled : (accumulator_t) scaled;
+        }
+#endif
+            break;
+        case RELU:
+            accum = (accum > 0) ? accum : 0;
+            break;
+        case LEAKY_RELU:
+            accum = (accum > 0) ? accum : (accum / (accumulator_t) (1U << LEAKY_RELU_SHIFT));
+            break;
+        default:
+            break;
+    }
+#ifdef CONFIG_REQUANTIZATION
+    accum += zeroPoint;
+#endif
+#ifdef ACTIVATION_IS_UNSIGNED
+    /*
+     * Floor of 1 as in the original _squash, the integer trainer's weight
+     * update is activation * error, so a 0 would freeze every weight fed by it
+     */
+    accum = ((function == TANH) && (accum < 1)) ? 1 : accum;
+#endif
+    return _saturateActivation(accum);
+}
+
+static ALWAYS_INLINE activation_t embann_activate(const layerDescriptor_t* pLayer, uint32_t neuron,
+                                                    accumulator_t accum, activationFunction_t function)
+{
+    accum += (accumulator_t) pLayer->bias[neuron];
+#ifdef CONFIG_REQUANTIZATION
+    accum += pLayer->quant.zeroPointOffset[neuron];
+    return embann_activateBiased(accum, function, pLayer->quant.multiplier[neuron],
+                                    pLayer->quant.exponent[neuron], pLayer->quant.zeroPoint);
+#else
+    return embann_activateBiased(accum, function, 0, 0, 0);
+#endif
+}
+
+/*
+ * embann_activate() over pLayer's neurons firstNeuron to firstNeuron +
+ * numNeurons. The switch is outside the loop so each case is its own
+ * straight line loop for the vectoriser.
+ */
+static ALWAYS_INLINE void _activateRowAs(activation_t* pActivation, const accumulator_t* pAccum,
+                                            const layerDescriptor_t* pLayer, uint32_t firstNeuron,
+                                            uint32_t numNeurons, activationFunction_t function)
+{
+    for (uint32_t i = 0; i < numNeurons; i++)
+    {
+        pActivation[i] = embann_activate(pLayer, firstNeuron + i, pAccum[i], function);
+    }
+}
+
+static ALWAYS_INLINE void embann_activateRow(activation_t* pActivation, const accumulator_t* pAccum,
+                                                const layerDescriptor_t* pLayer, uint32_t firstNeuron,
+                                                uint32_t numNeurons)
+{
+    switch (pLayer->activationFunction)
+    {
+        case TANH:
+            _activateRowAs(pActivation, pAccum, pLayer, firstNeuron, numNeurons, TANH);
+            break;
+        case SOFTSIGN:
+            _activateRowAs(pActivation, pAccum, pLayer, firstNeuron, numNeurons, SOFTSIGN);
+            break;
+        case RELU:
+            _activateRowAs(pActivation, pAccum, pLayer, firstNeuron, numNeurons, RELU);
+            break;
+        case LEAKY_RELU:
+            _activateRowAs(pActivation, pAccum, pLayer, firstNeuron, numNeurons, LEAKY_RELU);
+            break;
+        default:
+            break;
+    }
+}
+
+#endif // Embann_activation_h
@@ -5,7 +5,7 @@
 #define CONFIG_ERROR_CHECK_SET_ERRNO 1
 #define CONFIG_MALLOC_CHECK_ABORT 1
 #define CONFIG_ACTIVATION_DATA_TYPE_UINT8 1
-#define CONFIG_BIAS_DATA_TYPE_UINT32 1
+#define CONFIG_BIAS_DATA_TYPE_INT32 1
 #define CONFIG_WEIGHT_DATA_TYPE_INT8 1
 #define CONFIG_ACCUMULATOR_DATA_TYPE_INT32 1
 #define CONFIG_NUM_INPUTS_DATA_TYPE_UINT16 1
@@ -15,9 +15,33 @@
 #define CONFIG_NUM_TRAINING_DATA_SETS_TYPE_UINT32 1
 #define CONFIG_NUM_TRAINING_DATA_ENTRIES_TYPE_UINT32 1
 #define CONFIG_MEMORY_ALLOCATION_STATIC 1
+#define CONFIG_CACHE_LINE_SIZE 64
+#define CONFIG_WEIGHT_ROW_PADDING 1
+#define CONFIG_MAP_NETWORK_FILES 1
 #define CONFIG_NUM_INPUT_NEURONS 15
 #define CONFIG_NUM_HIDDEN_NEURONS 10
 #define CONFIG_NUM_HIDDEN_LAYERS 5
 #define CONFIG_NUM_OUTPUT_NEURONS 3
 #define CONFIG_NUM_TRAINING_DATA_SETS 3
-#define CONFIG_NUM_TRAINING_DATA_ENTRIES 10
+#define CONFIG_NUM_TRAINING_DATA_ENTRIES 15
+#define CONFIG_NUM_STATIC_NETWORKS 1
+#define CONFIG_NUM_STATIC_SESSIONS 4
+#define CONFIG_DEFAULT_ACTIVATION_FUNCTION_TANH 1
+#define CONFIG_REQUANTIZATION 1
+#define CONFIG_BATCH_SIZE 16
+#define CONFIG_GEMM_TILE_SAMPLES 32
+#define CONFIG_GEMM_TILE_NEURONS 64
+#define CONFIG_GEMM_TILE_INPUTS 256
+#define CONFIG_MODEL_PUBLISHING 1
+#define CONFIG_NUM_MODEL_READERS 4
+#define CONFIG_PARALLEL_LAYERS 1
+#define CONFIG_PARALLEL_NUM_THREADS 0
+#define CONFIG_PARALLEL_MIN_LAYER_WEIGHTS 65536
+#define CONFIG_INFERENCE_ENGINE 1
+#define CONFIG_ENGINE_QUEUE_SIZE 256
+#define CONFIG_ENGINE_NUM_WORKERS 2
+#define CONFIG_ENGINE_MAX_BATCH_SIZE 16
+#define CONFIG_ENGINE_MAX_WAIT_US 500
+#define CONFIG_PARALLEL_TRAINING 1
+#define CONFIG_DATASET_IMPORT 1
+#define CONFIG_SHUFFLE_BLOCK_SIZE 0
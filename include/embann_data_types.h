@@ -277,6 +277,18 @@ typedef double accumulator_t;
 #endif
 
 
+/* Float networks can be quantized, see embann_saveQuantizedNetwork() */
+#if defined(ACTIVATION_IS_FLOAT) && defined(WEIGHT_IS_FLOAT) && defined(BIAS_IS_FLOAT)
+#define QUANTIZATION_SOURCE
+#endif
+
+/* The u8 activation, s8 weight, s32 bias networks that quantization produces can be loaded */
+#if defined(CONFIG_REQUANTIZATION) && defined(CONFIG_ACTIVATION_DATA_TYPE_UINT8) && \
+    defined(CONFIG_WEIGHT_DATA_TYPE_INT8) && defined(CONFIG_BIAS_DATA_TYPE_INT32)
+#define QUANTIZATION_TARGET
+#endif
+
+
 
 
 #ifdef CONFIG_NUM_OUTPUTS_DATA_TYPE_UINT8
@@ -367,28 +379,50 @@ typedef enum
 {
     SOFTSIGN,
     RELU,
-    LEAKY_RELU
+    LEAKY_RELU,
+    TANH,
+    NUM_ACTIVATION_FUNCTIONS
 } activationFunction_t;
 
-typedef struct trainingData
-{
-    numOutputs_t correctResponse;
-    numInputs_t length;
-#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-    activation_t data[CONFIG_NUM_TRAINING_DATA_ENTRIES];
+#if defined(CONFIG_DEFAULT_ACTIVATION_FUNCTION_SOFTSIGN)
+#define DEFAULT_ACTIVATION_FUNCTION SOFTSIGN
+#elif defined(CONFIG_DEFAULT_ACTIVATION_FUNCTION_RELU)
+#define DEFAULT_ACTIVATION_FUNCTION RELU
+#elif defined(CONFIG_DEFAULT_ACTIVATION_FUNCTION_LEAKY_RELU)
+#define DEFAULT_ACTIVATION_FUNCTION LEAKY_RELU
 #else
-    struct trainingData* next;
-    activation_t* data;
+#define DEFAULT_ACTIVATION_FUNCTION TANH
 #endif
-} trainingData_t;
 
+typedef enum
+{
+    KERNEL_VARIANT_SCALAR,
+    KERNEL_VARIANT_SSE4_2,
+    KERNEL_VARIANT_AVX2,
+    KERNEL_VARIANT_AVX512,
+    NUM_KERNEL_VARIANTS
+} kernelVariant_t;
+
+/*
+ * Every training sample in one block, see TRAINING_DATA_FEATURES(). Static
+ * builds have room for CONFIG_NUM_TRAINING_DATA_SETS in embann_static.h,
+ * dynamic ones grow the block on the heap as samples are added.
+ */
 typedef struct 
 {
-    trainingData_t* head;
-#ifndef CONFIG_MEMORY_ALLOCATION_STATIC
-    trainingData_t* tail;
-#endif
+    activation_t* features;     /* capacity rows of featureStride, each starting on a cache line */
+    numOutputs_t* labels;       /* Each sample's correct response */
     numTrainingDataSets_t numSets;
+    numTrainingDataSets_t capacity;
+    numTrainingDataEntries_t numEntries;    /* Features in each sample, all the same as the first */
+    uint32_t featureStride;
+    numTrainingDataSets_t* order;           /* This epoch's shuffled sample indices, see embann_getNextDataSet() */
+    numTrainingDataSets_t numOrdered;       /* numSets when order was shuffled, 0 if it needs shuffling */
+    numTrainingDataSets_t nextInOrder;
+#ifdef CONFIG_MAP_DATASET_FILES
+    void* pFileMapping;         /* features and labels point into this when it's not NULL, see embann_loadDataset() */
+    size_t fileMappingSize;
+#endif
 } trainingDataCollection_t;
 
 typedef struct
@@ -400,18 +434,65 @@ typedef struct
     activation_t* groupTotal;
 } downscaler_t;
 
+/*
+ * Maps a layer's accumulators to its activations as
+ *     activation = ((accum + zeroPointOffset + bias) * multiplier * 2^(exponent - 31)) + zeroPoint
+ * with multiplier, exponent and zeroPointOffset stored per neuron.
+ */
+typedef struct
+{
+    int32_t* multiplier;            /* Q0.31, in [2^30, 2^31) or 0 */
+    int8_t* exponent;               /* Power of 2 applied after the multiplier, positive shifts left */
+    accumulator_t* zeroPointOffset; /* -(input zero point) * sum(weight row), see embann_updateZeroPointOffsets() */
+    activation_t zeroPoint;         /* Activation value that represents 0 */
+} quantParams_t;
+
 typedef struct
 {
     numInputs_t numNeurons;
     activation_t* activation;
+    const activation_t* boundInput;     /* Read in place of activation when set, see embann_bindInput() */
+#ifdef ACTIVATION_IS_FLOAT
+    bool isBoundInputScaled;            /* boundInput is used as (boundInput - inputOffset) * inputScale */
+    activation_t inputOffset;
+    activation_t inputScale;
+#endif
+#ifdef CONFIG_REQUANTIZATION
+    activation_t zeroPoint;
+#endif
 } inputLayer_t;
 
+#ifdef CONFIG_SPARSE_WEIGHTS
+/*
+ * A pruned layer's weights, only the CONFIG_SPARSE_BLOCK_SIZE long blocks of
+ * each row that aren't all zero. Neuron i has blocks rowStart[i] up to
+ * rowStart[i + 1], block b covering the inputs from blockInput[b] on, which
+ * is always a multiple of the block size.
+ */
+typedef struct
+{
+    uint32_t* rowStart;         /* numNeurons + 1 entries, NULL while the layer is dense */
+    uint32_t* blockInput;
+    weight_t* blockWeights;     /* Cache line aligned, zero padded past the last input */
+    uint32_t numBlocks;
+    void* pAllocation;          /* What to free, NULL when the blocks are in a file mapping */
+} sparseWeights_t;
+#endif
+
 typedef struct
 {
     numHiddenNeurons_t numNeurons;
     activation_t* activation;
     bias_t* bias;
-    weight_t** weight;
+    weight_t* weight;           /* Row-major, cache line aligned, numNeurons rows of weightStride */
+    uint32_t weightStride;
+    activationFunction_t activationFunction;
+#ifdef CONFIG_REQUANTIZATION
+    quantParams_t quant;
+#endif
+#ifdef CONFIG_SPARSE_WEIGHTS
+    sparseWeights_t sparse;     /* Used instead of weight, which is NULL, once pruned */
+#endif
 } hiddenLayer_t;
 
 typedef struct
@@ -419,9 +500,61 @@ typedef struct
     numOutputs_t numNeurons;
     activation_t* activation;
     bias_t* bias;
-    weight_t** weight;
+    weight_t* weight;           /* Row-major, cache line aligned, numNeurons rows of weightStride */
+    uint32_t weightStride;
+    activationFunction_t activationFunction;
+#ifdef CONFIG_REQUANTIZATION
+    quantParams_t quant;
+#endif
+#ifdef CONFIG_SPARSE_WEIGHTS
+    sparseWeights_t sparse;     /* Used instead of weight, which is NULL, once pruned */
+#endif
 } outputLayer_t;
 
+/* Everything one layer's forward pass needs, whichever kind of layer it is */
+typedef struct
+{
+    const activation_t* input;
+    uint32_t numInputs;
+    activation_t* activation;
+    const bias_t* bias;
+    const weight_t* weight;
+    uint32_t weightStride;
+    uint32_t numNeurons;
+    activationFunction_t activationFunction;
+#ifdef CONFIG_REQUANTIZATION
+    quantParams_t quant;
+#endif
+#ifdef CONFIG_SPARSE_WEIGHTS
+    const sparseWeights_t* sparse;  /* NULL for dense layers */
+#endif
+} layerDescriptor_t;
+
+/* The smallest and largest activation of one layer over a calibration set */
+typedef struct
+{
+    float min;
+    float max;
+} activationRange_t;
+
+/*
+ * One layer of a quantized network, fixed at u8 activations, s8 weights and
+ * s32 biases whatever this build's types are, as embann_writeQuantizedHeader()
+ * generates them
+ */
+typedef struct
+{
+    uint32_t numInputs;
+    uint32_t numNeurons;
+    activationFunction_t activationFunction;
+    const int8_t* weight;       /* numNeurons rows of numInputs, no padding */
+    const int32_t* bias;
+    const int32_t* multiplier;
+    const int8_t* exponent;
+    uint8_t zeroPoint;
+    float scale;                /* Real value of 1 activation step */
+} quantizedLayer_t;
+
 typedef struct
 {
     numLayers_t numLayers;
@@ -429,13 +562,167 @@ typedef struct
     numOutputs_t networkResponse;
 } networkProperties_t;
 
+/* Working memory for embann_forwardPropagateBatch(), CONFIG_BATCH_SIZE samples of the widest layer */
+typedef struct
+{
+    activation_t* activations[2];   /* Ping-pong buffers, each layer reads one and writes the other */
+    accumulator_t* accumulators;
+} batchScratch_t;
+
 typedef struct
 {
     networkProperties_t properties;
     inputLayer_t* inputLayer;
     outputLayer_t* outputLayer;
     hiddenLayer_t** hiddenLayer;
+    trainingDataCollection_t trainingData;
+#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
+    batchScratch_t batchScratch;
+    accumulator_t* gradients;   /* Training's working memory, shaped like every layer's weights one after the other */
+#endif
+#ifdef CONFIG_MAP_NETWORK_FILES
+    void* pFileMapping;         /* Weights and biases point into this when it's not NULL, see embann_loadNetwork() */
+    size_t fileMappingSize;
+#endif
 } network_t;
 
+/*
+ * One thread's activations for running a network it shares with others, see
+ * embann_initSession(). The network itself is only ever read.
+ */
+typedef struct
+{
+    const network_t* pNetwork;
+    activation_t** activation;  /* numHiddenLayers + 1 layers of outputs, the output layer last */
+    numOutputs_t networkResponse;
+} inferenceSession_t;
+
+#ifdef CONFIG_MODEL_PUBLISHING
+/*
+ * The network one reader is using, or NULL. Each is on its own cache line so
+ * readers announcing and releasing networks don't invalidate each other's.
+ */
+typedef struct
+{
+    _Alignas(CONFIG_CACHE_LINE_SIZE) _Atomic(network_t*) pNetwork;
+} readerSlot_t;
+
+/*
+ * Hands the latest network to inference threads without them ever waiting,
+ * see embann_publishNetwork(). Only the publishing thread touches retired.
+ */
+typedef struct
+{
+    _Atomic(network_t*) current;
+    readerSlot_t reading[CONFIG_NUM_MODEL_READERS];
+    network_t* retired[CONFIG_NUM_MODEL_READERS + 1U];      /* Replaced, but maybe still being read */
+    uint32_t numRetired;
+} modelPublisher_t;
+#endif
+
+#ifdef CONFIG_INFERENCE_ENGINE
+/* Worker threads and their queue, only used through the embann_*Engine() functions */
+typedef struct inferenceEngine inferenceEngine_t;
+
+/*
+ * One sample for embann_submitInference(). The caller fills in the first four
+ * and keeps the request, its inputs and outputs alive until it's completed.
+ */
+typedef struct inferenceRequest
+{
+    const activation_t* pInputs;    /* inputLayer->numNeurons activations */
+    activation_t* pOutputs;         /* Optional, gets outputLayer->numNeurons activations */
+    void (*pCallback)(struct inferenceRequest* pRequest);  /* Called by the worker, or NULL to wait instead */
+    void* pContext;                 /* Not used by embann, for the callback */
+    numOutputs_t networkResponse;
+    int err;
+    atomic_bool done;               /* Only set for requests without a callback */
+    uint64_t submitMicros;
+} inferenceRequest_t;
+#endif
+
+/*
+ * Start of a file written by embann_saveNetwork(), all in the host's byte
+ * order. A table of numHiddenLayers + 1 networkFileLayer_t follows at
+ * headerSize bytes in, then the weight and bias blocks, each starting on a
+ * multiple of alignment bytes.
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerSize;        /* sizeof(networkFileHeader_t), so later versions can grow it */
+    uint8_t activationType;     /* Kind and size of each type, see embann_storage.c */
+    uint8_t weightType;
+    uint8_t biasType;
+    uint8_t flags;
+    uint32_t alignment;
+    uint32_t numInputs;
+    uint32_t numHiddenNeurons;
+    uint32_t numHiddenLayers;
+    uint32_t numOutputs;
+    uint32_t inputZeroPoint;
+    uint64_t fileSize;
+} networkFileHeader_t;
+
+typedef struct
+{
+    uint32_t numInputs;
+    uint32_t numNeurons;
+    uint32_t weightStride;      /* Weight blocks are stored exactly as they are in memory */
+    uint32_t activationFunction;
+    uint32_t zeroPoint;
+    uint32_t sparseBlockSize;   /* 0 for dense layers */
+    uint32_t numBlocks;
+    uint64_t weightOffset;      /* From the start of the file, sparse layers' blockWeights */
+    uint64_t biasOffset;
+    uint64_t multiplierOffset;  /* Both 0 without requantization */
+    uint64_t exponentOffset;
+    uint64_t rowStartOffset;    /* Both 0 for dense layers */
+    uint64_t blockInputOffset;
+} networkFileLayer_t;
+
+/*
+ * Start of a file written by embann_saveDataset(), all in the host's byte
+ * order. The features follow as numSets rows of featureStride entries, then
+ * the labels, each block starting on a multiple of alignment bytes.
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerSize;        /* sizeof(datasetFileHeader_t), so later versions can grow it */
+    uint8_t activationType;     /* Kind and size of activation_t and numOutputs_t, see embann_storage.c */
+    uint8_t labelType;
+    uint16_t reserved;
+    uint32_t alignment;
+    uint32_t numEntries;
+    uint32_t featureStride;
+    uint64_t numSets;
+    uint64_t featuresOffset;    /* From the start of the file */
+    uint64_t labelsOffset;
+    uint64_t fileSize;
+} datasetFileHeader_t;
+
+#ifdef CONFIG_DATASET_IMPORT
+/* How each feature is stored in a file for embann_importRaw() */
+typedef enum
+{
+    RAW_SAMPLE_UINT8,
+    RAW_SAMPLE_FLOAT32      /* Little endian IEEE 754 */
+} rawSampleFormat_t;
+#endif
+
+#ifdef CONFIG_MAP_DATASET_FILES
+/* How training is about to read a mapped dataset, see embann_adviseDataset() */
+typedef enum
+{
+    DATASET_ACCESS_NORMAL,
+    DATASET_ACCESS_SEQUENTIAL,  /* Whole epochs or statistics, read ahead */
+    DATASET_ACCESS_RANDOM,      /* Samples drawn at random, don't read ahead */
+    DATASET_ACCESS_WILL_NEED    /* Start reading the whole file in now */
+} datasetAccess_t;
+#endif
+
 
 #endif //Embann_data_types_h
\ No newline at end of file
@@ -99,14 +99,97 @@
 
 #if __GNUC__ >= 3
     #define MAX_ALIGNMENT __attribute__ ((aligned(__BIGGEST_ALIGNMENT__)))
+    #define CACHE_ALIGNMENT __attribute__ ((aligned(CONFIG_CACHE_LINE_SIZE)))
     #define WEAK_FUNCTION __attribute__((weak))
+    #define ALWAYS_INLINE inline __attribute__((always_inline))
+    #define THREAD_LOCAL __thread
 #else
     #define MAX_ALIGNMENT
+    #define CACHE_ALIGNMENT
     #define WEAK_FUNCTION
+    #define ALWAYS_INLINE inline
+    #define THREAD_LOCAL _Thread_local
 #endif
 
 
 
+/* _Pragma() with the arguments of the macro it's used in substituted first */
+#define EMBANN_PRAGMA(x) _Pragma(#x)
+
+/*
+ * Splits the for loop that follows over embann_getNumThreads() threads, when
+ * the layer it works through has at least CONFIG_PARALLEL_MIN_LAYER_WEIGHTS
+ */
+#if defined(CONFIG_PARALLEL_LAYERS) && defined(_OPENMP)
+    #define PARALLEL_FOR_LAYER(numWeights) EMBANN_PRAGMA(omp parallel for schedule(static)                  \
+                                                        if ((numWeights) >= CONFIG_PARALLEL_MIN_LAYER_WEIGHTS) \
+                                                        num_threads(embann_getNumThreads()))
+#else
+    #define PARALLEL_FOR_LAYER(numWeights)
+#endif
+
+/* Splits the for loop that follows over numThreads threads, handing out iterations as threads finish */
+#if defined(CONFIG_DATASET_IMPORT) && defined(_OPENMP)
+    #define PARALLEL_FOR_CHUNKS(numThreads) EMBANN_PRAGMA(omp parallel for schedule(dynamic) num_threads(numThreads))
+#else
+    #define PARALLEL_FOR_CHUNKS(numThreads)
+#endif
+
+
+
+/* Round x up to the next multiple of n */
+#define ROUND_UP_TO_MULTIPLE(x, n) ((((x) + (n) - 1U) / (n)) * (n))
+
+/* Round x up to the next whole number of cache lines */
+#define ROUND_UP_TO_CACHE_LINE(x) ROUND_UP_TO_MULTIPLE(x, CONFIG_CACHE_LINE_SIZE)
+
+/* 
+ * Number of weights between the start of one neuron's weight row and the next,
+ * every layer stores its weights as one row-major block of numNeurons * stride
+ */
+#ifdef CONFIG_WEIGHT_ROW_PADDING
+    #define WEIGHT_STRIDE(numInputs) (ROUND_UP_TO_CACHE_LINE((numInputs) * sizeof(weight_t)) / sizeof(weight_t))
+#else
+    #define WEIGHT_STRIDE(numInputs) (numInputs)
+#endif
+
+/* Number of activations between one training sample's features and the next */
+#define TRAINING_DATA_STRIDE(numEntries) \
+    (ROUND_UP_TO_CACHE_LINE((numEntries) * sizeof(activation_t)) / sizeof(activation_t))
+
+/* The features of sample i in the trainingDataCollection_t at pData */
+#define TRAINING_DATA_FEATURES(pData, i) (&(pData)->features[(size_t) (i) * (pData)->featureStride])
+
+
+
+/* Describes the layer pOut, fed by the activations of pIn, both can be any kind of layer */
+#ifdef CONFIG_REQUANTIZATION
+    #define LAYER_DESCRIPTOR_QUANT(pOut) .quant = (pOut)->quant,
+#else
+    #define LAYER_DESCRIPTOR_QUANT(pOut)
+#endif
+
+#ifdef CONFIG_SPARSE_WEIGHTS
+    #define LAYER_DESCRIPTOR_SPARSE(pOut) .sparse = ((pOut)->sparse.rowStart != NULL) ? &(pOut)->sparse : NULL,
+#else
+    #define LAYER_DESCRIPTOR_SPARSE(pOut)
+#endif
+
+#define LAYER_DESCRIPTOR(pIn, pOut) ((layerDescriptor_t) {   \
+        .input = (pIn)->activation,                         \
+        .numInputs = (pIn)->numNeurons,                     \
+        .activation = (pOut)->activation,                   \
+        .bias = (pOut)->bias,                               \
+        .weight = (pOut)->weight,                           \
+        .weightStride = (pOut)->weightStride,               \
+        .numNeurons = (pOut)->numNeurons,                   \
+        LAYER_DESCRIPTOR_QUANT(pOut)                        \
+        LAYER_DESCRIPTOR_SPARSE(pOut)                       \
+        .activationFunction = (pOut)->activationFunction    \
+    })
+
+
+
  #define max(a,b) \
    ({__typeof__ (a) _a = (a); \
      __typeof__ (b) _b = (b); \
@@ -51,5 +51,18 @@ void timersub(struct timeval *a, struct timeval *b, struct timeval *c);
 
 
 
+/* MSVCRT has no aligned_alloc(), and its aligned blocks have to go back through _aligned_free() */
+#ifdef _WIN32
+#include <malloc.h>
+#define EMBANN_ALIGNED_ALLOC(alignment, size) _aligned_malloc((size), (alignment))
+#define EMBANN_ALIGNED_FREE(ptr) _aligned_free(ptr)
+#else
+#define EMBANN_ALIGNED_ALLOC(alignment, size) aligned_alloc((alignment), (size))
+#define EMBANN_ALIGNED_FREE(ptr) free(ptr)
+#endif // _WIN32
+
+
+
+
 
 #endif // Embann_quirks_h
\ No newline at end of file
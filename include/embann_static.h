@@ -2,255 +2,258 @@
 #pragma once
 #include "embann_data_types.h"
 #include "embann_config.h"
+#include "embann_macros.h"
+
+#define MAX_BATCH_LAYER_NEURONS ((CONFIG_NUM_HIDDEN_NEURONS > CONFIG_NUM_OUTPUT_NEURONS) ? \
+                                    CONFIG_NUM_HIDDEN_NEURONS : CONFIG_NUM_OUTPUT_NEURONS)
+
+/* Shaped like every layer's weights one after the other */
+#define NUM_STATIC_GRADIENTS                                                                    \
+    ((CONFIG_NUM_HIDDEN_NEURONS * WEIGHT_STRIDE(CONFIG_NUM_INPUT_NEURONS)) +                    \
+    ((CONFIG_NUM_HIDDEN_LAYERS - 1U) * CONFIG_NUM_HIDDEN_NEURONS * WEIGHT_STRIDE(CONFIG_NUM_HIDDEN_NEURONS)) + \
+    (CONFIG_NUM_OUTPUT_NEURONS * WEIGHT_STRIDE(CONFIG_NUM_HIDDEN_NEURONS)))
+
+
+
 
 /*
- * Input Layer
+ * Network 0 Input Layer
  */
-static activation_t inputNeurons[CONFIG_NUM_INPUT_NEURONS];
-static inputLayer_t staticInputLayer = {
+static activation_t inputNeurons_0[CONFIG_NUM_INPUT_NEURONS];
+static inputLayer_t staticInputLayer_0 = {
     .numNeurons = CONFIG_NUM_INPUT_NEURONS,
-    .activation = inputNeurons
+    .activation = inputNeurons_0
 };
 
 
 
 
 /*
- * Hidden Layer 0
+ * Network 0 Hidden Layer 0
  */
-static activation_t hiddenNeuronsActivations_0[CONFIG_NUM_HIDDEN_NEURONS];
-static bias_t hiddenNeuronBias_0[CONFIG_NUM_HIDDEN_NEURONS];
-
-static weight_t hiddenNeuronWeights_0_0[CONFIG_NUM_INPUT_NEURONS];
-static weight_t hiddenNeuronWeights_0_1[CONFIG_NUM_INPUT_NEURONS];
-static weight_t hiddenNeuronWeights_0_2[CONFIG_NUM_INPUT_NEURONS];
-static weight_t hiddenNeuronWeights_0_3[CONFIG_NUM_INPUT_NEURONS];
-static weight_t hiddenNeuronWeights_0_4[CONFIG_NUM_INPUT_NEURONS];
-static weight_t hiddenNeuronWeights_0_5[CONFIG_NUM_INPUT_NEURONS];
-static weight_t hiddenNeuronWeights_0_6[CONFIG_NUM_INPUT_NEURONS];
-static weight_t hiddenNeuronWeights_0_7[CONFIG_NUM_INPUT_NEURONS];
-static weight_t hiddenNeuronWeights_0_8[CONFIG_NUM_INPUT_NEURONS];
-static weight_t hiddenNeuronWeights_0_9[CONFIG_NUM_INPUT_NEURONS];
-static weight_t* hiddenNeuronWeights_0[CONFIG_NUM_HIDDEN_NEURONS] =
-{
-    hiddenNeuronWeights_0_0,
-    hiddenNeuronWeights_0_1,
-    hiddenNeuronWeights_0_2,
-    hiddenNeuronWeights_0_3,
-    hiddenNeuronWeights_0_4,
-    hiddenNeuronWeights_0_5,
-    hiddenNeuronWeights_0_6,
-    hiddenNeuronWeights_0_7,
-    hiddenNeuronWeights_0_8,
-    hiddenNeuronWeights_0_9
-};
-
-static hiddenLayer_t staticHiddenLayer_0 =
+static activation_t hiddenNeuronsActivations_0_0[CONFIG_NUM_HIDDEN_NEURONS];
+static bias_t hiddenNeuronBias_0_0[CONFIG_NUM_HIDDEN_NEURONS];
+static weight_t hiddenNeuronWeights_0_0[CONFIG_NUM_HIDDEN_NEURONS * WEIGHT_STRIDE(CONFIG_NUM_INPUT_NEURONS)] CACHE_ALIGNMENT;
+#ifdef CONFIG_REQUANTIZATION
+static int32_t hiddenNeuronMultiplier_0_0[CONFIG_NUM_HIDDEN_NEURONS];
+static int8_t hiddenNeuronExponent_0_0[CONFIG_NUM_HIDDEN_NEURONS];
+static accumulator_t hiddenNeuronZeroPointOffset_0_0[CONFIG_NUM_HIDDEN_NEURONS];
+#endif
+
+static hiddenLayer_t staticHiddenLayer_0_0 =
 {
     .numNeurons = CONFIG_NUM_HIDDEN_NEURONS,
-    .activation = hiddenNeuronsActivations_0,
-    .bias = hiddenNeuronBias_0,
-    .weight = hiddenNeuronWeights_0,
+    .activation = hiddenNeuronsActivations_0_0,
+    .bias = hiddenNeuronBias_0_0,
+    .weight = hiddenNeuronWeights_0_0,
+    .weightStride = WEIGHT_STRIDE(CONFIG_NUM_INPUT_NEURONS),
+#ifdef CONFIG_REQUANTIZATION
+    .quant = {
+        .multiplier = hiddenNeuronMultiplier_0_0,
+        .exponent = hiddenNeuronExponent_0_0,
+        .zeroPointOffset = hiddenNeuronZeroPointOffset_0_0
+    },
+#endif
 };
 
 
 /*
- * Hidden Layer 1
+ * Network 0 Hidden Layer 1
  */
-static activation_t hiddenNeuronsActivations_1[CONFIG_NUM_HIDDEN_NEURONS];
-static bias_t hiddenNeuronBias_1[CONFIG_NUM_HIDDEN_NEURONS];
-
-static weight_t hiddenNeuronWeights_1_0[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_1_1[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_1_2[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_1_3[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_1_4[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_1_5[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_1_6[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_1_7[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_1_8[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_1_9[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t* hiddenNeuronWeights_1[CONFIG_NUM_HIDDEN_NEURONS] =
-{
-    hiddenNeuronWeights_1_0,
-    hiddenNeuronWeights_1_1,
-    hiddenNeuronWeights_1_2,
-    hiddenNeuronWeights_1_3,
-    hiddenNeuronWeights_1_4,
-    hiddenNeuronWeights_1_5,
-    hiddenNeuronWeights_1_6,
-    hiddenNeuronWeights_1_7,
-    hiddenNeuronWeights_1_8,
-    hiddenNeuronWeights_1_9
-};
-
-static hiddenLayer_t staticHiddenLayer_1 =
+static activation_t hiddenNeuronsActivations_0_1[CONFIG_NUM_HIDDEN_NEURONS];
+static bias_t hiddenNeuronBias_0_1[CONFIG_NUM_HIDDEN_NEURONS];
+static weight_t hiddenNeuronWeights_0_1[CONFIG_NUM_HIDDEN_NEURONS * WEIGHT_STRIDE(CONFIG_NUM_HIDDEN_NEURONS)] CACHE_ALIGNMENT;
+#ifdef CONFIG_REQUANTIZATION
+static int32_t hiddenNeuronMultiplier_0_1[CONFIG_NUM_HIDDEN_NEURONS];
+static int8_t hiddenNeuronExponent_0_1[CONFIG_NUM_HIDDEN_NEURONS];
+static accumulator_t hiddenNeuronZeroPointOffset_0_1[CONFIG_NUM_HIDDEN_NEURONS];
+#endif
+
+static hiddenLayer_t staticHiddenLayer_0_1 =
 {
     .numNeurons = CONFIG_NUM_HIDDEN_NEURONS,
-    .activation = hiddenNeuronsActivations_1,
-    .bias = hiddenNeuronBias_1,
-    .weight = hiddenNeuronWeights_1,
+    .activation = hiddenNeuronsActivations_0_1,
+    .bias = hiddenNeuronBias_0_1,
+    .weight = hiddenNeuronWeights_0_1,
+    .weightStride = WEIGHT_STRIDE(CONFIG_NUM_HIDDEN_NEURONS),
+#ifdef CONFIG_REQUANTIZATION
+    .quant = {
+        .multiplier = hiddenNeuronMultiplier_0_1,
+        .exponent = hiddenNeuronExponent_0_1,
+        .zeroPointOffset = hiddenNeuronZeroPointOffset_0_1
+    },
+#endif
 };
 
 
 /*
- * Hidden Layer 2
+ * Network 0 Hidden Layer 2
  */
-static activation_t hiddenNeuronsActivations_2[CONFIG_NUM_HIDDEN_NEURONS];
-static bias_t hiddenNeuronBias_2[CONFIG_NUM_HIDDEN_NEURONS];
-
-static weight_t hiddenNeuronWeights_2_0[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_2_1[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_2_2[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_2_3[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_2_4[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_2_5[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_2_6[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_2_7[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_2_8[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_2_9[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t* hiddenNeuronWeights_2[CONFIG_NUM_HIDDEN_NEURONS] =
-{
-    hiddenNeuronWeights_2_0,
-    hiddenNeuronWeights_2_1,
-    hiddenNeuronWeights_2_2,
-    hiddenNeuronWeights_2_3,
-    hiddenNeuronWeights_2_4,
-    hiddenNeuronWeights_2_5,
-    hiddenNeuronWeights_2_6,
-    hiddenNeuronWeights_2_7,
-    hiddenNeuronWeights_2_8,
-    hiddenNeuronWeights_2_9
-};
-
-static hiddenLayer_t staticHiddenLayer_2 =
+static activation_t hiddenNeuronsActivations_0_2[CONFIG_NUM_HIDDEN_NEURONS];
+static bias_t hiddenNeuronBias_0_2[CONFIG_NUM_HIDDEN_NEURONS];
+static weight_t hiddenNeuronWeights_0_2[CONFIG_NUM_HIDDEN_NEURONS * WEIGHT_STRIDE(CONFIG_NUM_HIDDEN_NEURONS)] CACHE_ALIGNMENT;
+#ifdef CONFIG_REQUANTIZATION
+static int32_t hiddenNeuronMultiplier_0_2[CONFIG_NUM_HIDDEN_NEURONS];
+static int8_t hiddenNeuronExponent_0_2[CONFIG_NUM_HIDDEN_NEURONS];
+static accumulator_t hiddenNeuronZeroPointOffset_0_2[CONFIG_NUM_HIDDEN_NEURONS];
+#endif
+
+static hiddenLayer_t staticHiddenLayer_0_2 =
 {
     .numNeurons = CONFIG_NUM_HIDDEN_NEURONS,
-    .activation = hiddenNeuronsActivations_2,
-    .bias = hiddenNeuronBias_2,
-    .weight = hiddenNeuronWeights_2,
+    .activation = hiddenNeuronsActivations_0_2,
+    .bias = hiddenNeuronBias_0_2,
+    .weight = hiddenNeuronWeights_0_2,
+    .weightStride = WEIGHT_STRIDE(CONFIG_NUM_HIDDEN_NEURONS),
+#ifdef CONFIG_REQUANTIZATION
+    .quant = {
+        .multiplier = hiddenNeuronMultiplier_0_2,
+        .exponent = hiddenNeuronExponent_0_2,
+        .zeroPointOffset = hiddenNeuronZeroPointOffset_0_2
+    },
+#endif
 };
 
 
 /*
- * Hidden Layer 3
+ * Network 0 Hidden Layer 3
  */
-static activation_t hiddenNeuronsActivations_3[CONFIG_NUM_HIDDEN_NEURONS];
-static bias_t hiddenNeuronBias_3[CONFIG_NUM_HIDDEN_NEURONS];
-
-static weight_t hiddenNeuronWeights_3_0[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_3_1[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_3_2[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_3_3[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_3_4[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_3_5[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_3_6[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_3_7[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_3_8[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_3_9[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t* hiddenNeuronWeights_3[CONFIG_NUM_HIDDEN_NEURONS] =
-{
-    hiddenNeuronWeights_3_0,
-    hiddenNeuronWeights_3_1,
-    hiddenNeuronWeights_3_2,
-    hiddenNeuronWeights_3_3,
-    hiddenNeuronWeights_3_4,
-    hiddenNeuronWeights_3_5,
-    hiddenNeuronWeights_3_6,
-    hiddenNeuronWeights_3_7,
-    hiddenNeuronWeights_3_8,
-    hiddenNeuronWeights_3_9
-};
-
-static hiddenLayer_t staticHiddenLayer_3 =
+static activation_t hiddenNeuronsActivations_0_3[CONFIG_NUM_HIDDEN_NEURONS];
+static bias_t hiddenNeuronBias_0_3[CONFIG_NUM_HIDDEN_NEURONS];
+static weight_t hiddenNeuronWeights_0_3[CONFIG_NUM_HIDDEN_NEURONS * WEIGHT_STRIDE(CONFIG_NUM_HIDDEN_NEURONS)] CACHE_ALIGNMENT;
+#ifdef CONFIG_REQUANTIZATION
+static int32_t hiddenNeuronMultiplier_0_3[CONFIG_NUM_HIDDEN_NEURONS];
+static int8_t hiddenNeuronExponent_0_3[CONFIG_NUM_HIDDEN_NEURONS];
+static accumulator_t hiddenNeuronZeroPointOffset_0_3[CONFIG_NUM_HIDDEN_NEURONS];
+#endif
+
+static hiddenLayer_t staticHiddenLayer_0_3 =
 {
     .numNeurons = CONFIG_NUM_HIDDEN_NEURONS,
-    .activation = hiddenNeuronsActivations_3,
-    .bias = hiddenNeuronBias_3,
-    .weight = hiddenNeuronWeights_3,
+    .activation = hiddenNeuronsActivations_0_3,
+    .bias = hiddenNeuronBias_0_3,
+    .weight = hiddenNeuronWeights_0_3,
+    .weightStride = WEIGHT_STRIDE(CONFIG_NUM_HIDDEN_NEURONS),
+#ifdef CONFIG_REQUANTIZATION
+    .quant = {
+        .multiplier = hiddenNeuronMultiplier_0_3,
+        .exponent = hiddenNeuronExponent_0_3,
+        .zeroPointOffset = hiddenNeuronZeroPointOffset_0_3
+    },
+#endif
 };
 
 
 /*
- * Hidden Layer 4
+ * Network 0 Hidden Layer 4
  */
-static activation_t hiddenNeuronsActivations_4[CONFIG_NUM_HIDDEN_NEURONS];
-static bias_t hiddenNeuronBias_4[CONFIG_NUM_HIDDEN_NEURONS];
-
-static weight_t hiddenNeuronWeights_4_0[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_4_1[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_4_2[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_4_3[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_4_4[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_4_5[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_4_6[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_4_7[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_4_8[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t hiddenNeuronWeights_4_9[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t* hiddenNeuronWeights_4[CONFIG_NUM_HIDDEN_NEURONS] =
+static activation_t hiddenNeuronsActivations_0_4[CONFIG_NUM_HIDDEN_NEURONS];
+static bias_t hiddenNeuronBias_0_4[CONFIG_NUM_HIDDEN_NEURONS];
+static weight_t hiddenNeuronWeights_0_4[CONFIG_NUM_HIDDEN_NEURONS * WEIGHT_STRIDE(CONFIG_NUM_HIDDEN_NEURONS)] CACHE_ALIGNMENT;
+#ifdef CONFIG_REQUANTIZATION
+static int32_t hiddenNeuronMultiplier_0_4[CONFIG_NUM_HIDDEN_NEURONS];
+static int8_t hiddenNeuronExponent_0_4[CONFIG_NUM_HIDDEN_NEURONS];
+static accumulator_t hiddenNeuronZeroPointOffset_0_4[CONFIG_NUM_HIDDEN_NEURONS];
+#endif
+
+static hiddenLayer_t staticHiddenLayer_0_4 =
 {
-    hiddenNeuronWeights_4_0,
-    hiddenNeuronWeights_4_1,
-    hiddenNeuronWeights_4_2,
-    hiddenNeuronWeights_4_3,
-    hiddenNeuronWeights_4_4,
-    hiddenNeuronWeights_4_5,
-    hiddenNeuronWeights_4_6,
-    hiddenNeuronWeights_4_7,
-    hiddenNeuronWeights_4_8,
-    hiddenNeuronWeights_4_9
+    .numNeurons = CONFIG_NUM_HIDDEN_NEURONS,
+    .activation = hiddenNeuronsActivations_0_4,
+    .bias = hiddenNeuronBias_0_4,
+    .weight = hiddenNeuronWeights_0_4,
+    .weightStride = WEIGHT_STRIDE(CONFIG_NUM_HIDDEN_NEURONS),
+#ifdef CONFIG_REQUANTIZATION
+    .quant = {
+        .multiplier = hiddenNeuronMultiplier_0_4,
+        .exponent = hiddenNeuronExponent_0_4,
+        .zeroPointOffset = hiddenNeuronZeroPointOffset_0_4
+    },
+#endif
 };
 
-static hiddenLayer_t staticHiddenLayer_4 =
+
+static hiddenLayer_t* staticHiddenLayers_0[CONFIG_NUM_HIDDEN_LAYERS] =
 {
-    .numNeurons = CONFIG_NUM_HIDDEN_NEURONS,
-    .activation = hiddenNeuronsActivations_4,
-    .bias = hiddenNeuronBias_4,
-    .weight = hiddenNeuronWeights_4,
+    &staticHiddenLayer_0_0,
+    &staticHiddenLayer_0_1,
+    &staticHiddenLayer_0_2,
+    &staticHiddenLayer_0_3,
+    &staticHiddenLayer_0_4
 };
 
 
-static hiddenLayer_t* staticHiddenLayers[CONFIG_NUM_HIDDEN_LAYERS] =
+
+
+/*
+ * Network 0 Output Layer
+ */
+static activation_t outputNeuronsActivations_0[CONFIG_NUM_OUTPUT_NEURONS];
+static bias_t outputNeuronBias_0[CONFIG_NUM_OUTPUT_NEURONS];
+static weight_t outputNeuronWeights_0[CONFIG_NUM_OUTPUT_NEURONS * WEIGHT_STRIDE(CONFIG_NUM_HIDDEN_NEURONS)] CACHE_ALIGNMENT;
+#ifdef CONFIG_REQUANTIZATION
+static int32_t outputNeuronMultiplier_0[CONFIG_NUM_OUTPUT_NEURONS];
+static int8_t outputNeuronExponent_0[CONFIG_NUM_OUTPUT_NEURONS];
+static accumulator_t outputNeuronZeroPointOffset_0[CONFIG_NUM_OUTPUT_NEURONS];
+#endif
+
+static outputLayer_t staticOutputLayer_0 =
 {
-    &staticHiddenLayer_0,
-    &staticHiddenLayer_1,
-    &staticHiddenLayer_2,
-    &staticHiddenLayer_3,
-    &staticHiddenLayer_4
+    .numNeurons = CONFIG_NUM_OUTPUT_NEURONS,
+    .activation = outputNeuronsActivations_0,
+    .bias = outputNeuronBias_0,
+    .weight = outputNeuronWeights_0,
+    .weightStride = WEIGHT_STRIDE(CONFIG_NUM_HIDDEN_NEURONS),
+#ifdef CONFIG_REQUANTIZATION
+    .quant = {
+        .multiplier = outputNeuronMultiplier_0,
+        .exponent = outputNeuronExponent_0,
+        .zeroPointOffset = outputNeuronZeroPointOffset_0
+    },
+#endif
 };
 
 
 
 
 /*
- * Output Layer
+ * Network 0 Working Memory
  */
-static activation_t outputNeuronsActivations[CONFIG_NUM_OUTPUT_NEURONS];
-static bias_t outputNeuronBias[CONFIG_NUM_OUTPUT_NEURONS];
+static activation_t staticTrainingFeatures_0[CONFIG_NUM_TRAINING_DATA_SETS * TRAINING_DATA_STRIDE(CONFIG_NUM_TRAINING_DATA_ENTRIES)] CACHE_ALIGNMENT;
+static numOutputs_t staticTrainingLabels_0[CONFIG_NUM_TRAINING_DATA_SETS];
+static numTrainingDataSets_t staticTrainingOrder_0[CONFIG_NUM_TRAINING_DATA_SETS];
+static activation_t batchActivations_0[2][CONFIG_BATCH_SIZE * MAX_BATCH_LAYER_NEURONS] CACHE_ALIGNMENT;
+static accumulator_t batchAccumulators_0[CONFIG_BATCH_SIZE * MAX_BATCH_LAYER_NEURONS] CACHE_ALIGNMENT;
+static accumulator_t staticGradients_0[NUM_STATIC_GRADIENTS] CACHE_ALIGNMENT;
 
-static weight_t outputNeuronWeights_0[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t outputNeuronWeights_1[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t outputNeuronWeights_2[CONFIG_NUM_HIDDEN_NEURONS];
-static weight_t* outputNeuronWeights[CONFIG_NUM_OUTPUT_NEURONS] =
-{
-    outputNeuronWeights_0,
-    outputNeuronWeights_1,
-    outputNeuronWeights_2
-};
 
-static outputLayer_t staticOutputLayer =
-{
-    .numNeurons = CONFIG_NUM_OUTPUT_NEURONS,
-    .activation = outputNeuronsActivations,
-    .bias = outputNeuronBias,
-    .weight = outputNeuronWeights
+
+
+static weight_t* const staticLayerWeights[CONFIG_NUM_STATIC_NETWORKS][CONFIG_NUM_HIDDEN_LAYERS + 1] = {
+    { hiddenNeuronWeights_0_0, hiddenNeuronWeights_0_1, hiddenNeuronWeights_0_2, hiddenNeuronWeights_0_3, hiddenNeuronWeights_0_4, outputNeuronWeights_0 },
+};
+static bias_t* const staticLayerBiases[CONFIG_NUM_STATIC_NETWORKS][CONFIG_NUM_HIDDEN_LAYERS + 1] = {
+    { hiddenNeuronBias_0_0, hiddenNeuronBias_0_1, hiddenNeuronBias_0_2, hiddenNeuronBias_0_3, hiddenNeuronBias_0_4, outputNeuronBias_0 },
 };
 
 
 
 
-static network_t staticNetwork = {
-    .inputLayer = &staticInputLayer,
-    .hiddenLayer = staticHiddenLayers,
-    .outputLayer = &staticOutputLayer
+static network_t staticNetworks[CONFIG_NUM_STATIC_NETWORKS] = {
+    {
+        .inputLayer = &staticInputLayer_0,
+        .hiddenLayer = staticHiddenLayers_0,
+        .outputLayer = &staticOutputLayer_0,
+        .trainingData = {
+            .features = staticTrainingFeatures_0,
+            .labels = staticTrainingLabels_0,
+            .order = staticTrainingOrder_0,
+            .capacity = CONFIG_NUM_TRAINING_DATA_SETS
+        },
+        .batchScratch = {
+            .activations = { batchActivations_0[0], batchActivations_0[1] },
+            .accumulators = batchAccumulators_0
+        },
+        .gradients = staticGradients_0
+    },
 };
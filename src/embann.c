@@ -11,23 +11,37 @@
 
 
 
-/* errno value specifically for internal embann errors */
-static int embann_errno = EOK;
-/* Pointer to the current network */
-network_t* pNetworkGlobal;
-/* Structure of pointers to training data */
-trainingDataCollection_t trainingDataCollection = {
-    .head = NULL,
+/* errno value specifically for internal embann errors, each thread has its own */
+static THREAD_LOCAL int embann_errno = EOK;
+
+
+/* Instantiates _sumAndSquashLayer() for one shape of layer */
+#define DEFINE_SUM_AND_SQUASH(name, numInputs, numNeurons, weightStride)                 \
+    static int name(const layerDescriptor_t* pLayer)                                    \
+    {                                                                                   \
+        return _sumAndSquashLayer(pLayer, (numInputs), (numNeurons), (weightStride));   \
+    }
+
 #ifndef CONFIG_MEMORY_ALLOCATION_STATIC
-    .tail = NULL,
+/* Nothing is known about the sizes until runtime, so one copy does every layer */
+#define _sumAndSquashInput _sumAndSquashHidden
+#define _sumAndSquashOutput _sumAndSquashHidden
 #endif
-    .numSets = 0U
-};
 
 
-static int embann_sumAndSquashHidden(hiddenLayer_t* input, hiddenLayer_t* output, numHiddenNeurons_t numInputs, numHiddenNeurons_t numOutputs);
-static int embann_sumAndSquashOutput(hiddenLayer_t* input, outputLayer_t* output, numHiddenNeurons_t numInputs, numOutputs_t numOutputs);
-static int embann_sumAndSquashInput(inputLayer_t* input, hiddenLayer_t* output, numInputs_t numInputs, numHiddenNeurons_t numOutputs);
+static ALWAYS_INLINE int _sumAndSquashLayer(const layerDescriptor_t* pLayer, uint32_t numInputs,
+                                            uint32_t numNeurons, uint32_t weightStride);
+static int _sumAndSquashInput(const layerDescriptor_t* pLayer);
+static int _sumAndSquashHidden(const layerDescriptor_t* pLayer);
+static int _sumAndSquashOutput(const layerDescriptor_t* pLayer);
+#ifdef ACTIVATION_IS_FLOAT
+static int _sumAndSquashScaledInput(const layerDescriptor_t* pLayer, activation_t offset, activation_t scale);
+#endif
+#ifdef CONFIG_SPARSE_WEIGHTS
+static int _sumAndSquashSparse(const layerDescriptor_t* pLayer);
+#endif
+static void _batchLayer(const layerDescriptor_t* pLayer, uint32_t numSamples, accumulator_t* pAccum);
+static numOutputs_t _mostLikelyOutput(const activation_t* pActivation, numOutputs_t numOutputs);
 
 
 
@@ -40,90 +54,248 @@ int main(int argc, char const *argv[])
     gettimeofday(&tv, NULL);
     srandom(tv.tv_usec ^ tv.tv_sec);  /* Seed the PRNG */
     
+    network_t* pNetwork;
+
     EMBANN_ERROR_CHECK(embann_benchmark());
 #ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-    EMBANN_ERROR_CHECK(embann_init(CONFIG_NUM_INPUT_NEURONS, 
+    EMBANN_ERROR_CHECK(embann_init(&pNetwork,
+                                    CONFIG_NUM_INPUT_NEURONS, 
                                     CONFIG_NUM_HIDDEN_NEURONS, 
                                     CONFIG_NUM_HIDDEN_LAYERS, 
                                     CONFIG_NUM_OUTPUT_NEURONS));
 #else
-    EMBANN_ERROR_CHECK(embann_init(15U, 10U, 5U, 3U));
+    EMBANN_ERROR_CHECK(embann_init(&pNetwork, 15U, 10U, 5U, 3U));
 #endif
-    EMBANN_ERROR_CHECK(embann_printNetwork());
-    EMBANN_ERROR_CHECK(embann_forwardPropagate());
-    EMBANN_ERROR_CHECK(embann_printNetwork());
+    EMBANN_ERROR_CHECK(embann_printNetwork(pNetwork));
+    EMBANN_ERROR_CHECK(embann_forwardPropagate(pNetwork));
+    EMBANN_ERROR_CHECK(embann_printNetwork(pNetwork));
 
+    const uint32_t numInputs = pNetwork->inputLayer->numNeurons;
 #ifdef CONFIG_MEMORY_ALLOCATION_STATIC
     activation_t randomData[CONFIG_NUM_INPUT_NEURONS];
 #else
-    activation_t randomData[pNetworkGlobal->inputLayer->numNeurons];
+    activation_t* randomData = (activation_t*) malloc(numInputs * sizeof(activation_t));
+    EMBANN_MALLOC_CHECK(randomData);
 #endif
     activation_t retval;
     float fretval;
-    for (uint8_t i = 0; i < NUM_ARRAY_ELEMENTS(randomData); i++)
+    for (uint32_t i = 0; i < numInputs; i++)
     {
         randomData[i] = random();
     }
 
 #ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
-    EMBANN_ERROR_CHECK(embann_addTrainingData(randomData, NUM_ARRAY_ELEMENTS(randomData), 0));
+    EMBANN_ERROR_CHECK(embann_addTrainingData(pNetwork, randomData, numInputs, 0));
 #endif
-    EMBANN_ERROR_CHECK(embann_copyTrainingData(randomData, NUM_ARRAY_ELEMENTS(randomData), 0));
-    EMBANN_ERROR_CHECK(embann_getTrainingDataMax(&retval));
-    EMBANN_ERROR_CHECK(embann_getTrainingDataMin(&retval));
-    EMBANN_ERROR_CHECK(embann_getTrainingDataMean(&fretval));
-    EMBANN_ERROR_CHECK(embann_getTrainingDataStdDev(&fretval));
+    EMBANN_ERROR_CHECK(embann_copyTrainingData(pNetwork, randomData, numInputs, 0));
+    EMBANN_ERROR_CHECK(embann_getTrainingDataMax(pNetwork, &retval));
+    EMBANN_ERROR_CHECK(embann_getTrainingDataMin(pNetwork, &retval));
+    EMBANN_ERROR_CHECK(embann_getTrainingDataMean(pNetwork, &fretval));
+    EMBANN_ERROR_CHECK(embann_getTrainingDataStdDev(pNetwork, &fretval));
 
 #ifdef ACTIVATION_IS_FLOAT
-    EMBANN_ERROR_CHECK(embann_trainDriverInTime(0.01, 1, true));
-    EMBANN_ERROR_CHECK(embann_trainDriverInError(0.01, 0.1, true));
+    EMBANN_ERROR_CHECK(embann_trainDriverInTime(pNetwork, 0.01, 1, 16U));
+    EMBANN_ERROR_CHECK(embann_trainDriverInError(pNetwork, 0.01, 0.1, 1U));
 #elif defined(ACTIVATION_IS_SIGNED) || defined(ACTIVATION_IS_UNSIGNED)
-    EMBANN_ERROR_CHECK(embann_trainDriverInError(1, 1));
-    EMBANN_ERROR_CHECK(embann_trainDriverInTime(1, 1));
+    EMBANN_ERROR_CHECK(embann_trainDriverInError(pNetwork, 1, 1, 1U));
+    EMBANN_ERROR_CHECK(embann_trainDriverInTime(pNetwork, 1, 1, 16U));
 #endif
 
-    EMBANN_ERROR_CHECK(embann_printNetwork());
-    EMBANN_ERROR_CHECK(embann_printInputNeuronDetails(0));
-    EMBANN_ERROR_CHECK(embann_printOutputNeuronDetails(0));
-    EMBANN_ERROR_CHECK(embann_printHiddenNeuronDetails(0, 0));
-    EMBANN_ERROR_CHECK(embann_errorReporting(0));
+    numOutputs_t batchResponses[4];
+    /* One sample after another, numInputs activations each */
+#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
+    activation_t batchData[NUM_ARRAY_ELEMENTS(batchResponses) * CONFIG_NUM_INPUT_NEURONS];
+#else
+    activation_t* batchData = (activation_t*) malloc(NUM_ARRAY_ELEMENTS(batchResponses) * numInputs *
+                                                        sizeof(activation_t));
+    EMBANN_MALLOC_CHECK(batchData);
+#endif
+    for (uint32_t i = 0; i < (NUM_ARRAY_ELEMENTS(batchResponses) * numInputs); i++)
+    {
+        batchData[i] = random();
+    }
+    EMBANN_ERROR_CHECK(embann_forwardPropagateBatch(pNetwork, batchData, NUM_ARRAY_ELEMENTS(batchResponses),
+                                                    NULL, batchResponses));
+    EMBANN_LOGI(TAG, "Batch responses: %d %d %d %d", batchResponses[0], batchResponses[1],
+                                                    batchResponses[2], batchResponses[3]);
+
+    EMBANN_ERROR_CHECK(embann_bindInput(pNetwork, batchData));
+    EMBANN_ERROR_CHECK(embann_forwardPropagate(pNetwork));
+    EMBANN_LOGI(TAG, "Bound input response: %d", pNetwork->properties.networkResponse);
+    EMBANN_ERROR_CHECK(embann_unbindInput(pNetwork));
+
+    inferenceSession_t* pSession;
+    EMBANN_ERROR_CHECK(embann_initSession(&pSession, pNetwork));
+    for (uint8_t i = 0; i < NUM_ARRAY_ELEMENTS(batchResponses); i++)
+    {
+        EMBANN_ERROR_CHECK(embann_forwardPropagateSession(pSession, &batchData[i * numInputs]));
+        batchResponses[i] = pSession->networkResponse;
+    }
+    EMBANN_LOGI(TAG, "Session responses: %d %d %d %d", batchResponses[0], batchResponses[1],
+                                                    batchResponses[2], batchResponses[3]);
+#ifdef CONFIG_MODEL_PUBLISHING
+    modelPublisher_t publisher;
+    EMBANN_ERROR_CHECK(embann_initPublisher(&publisher, pNetwork));
+    EMBANN_ERROR_CHECK(embann_forwardPropagatePublished(&publisher, 0U, pSession, batchData));
+    EMBANN_LOGI(TAG, "Published network response: %d", pSession->networkResponse);
+#endif
+#ifdef CONFIG_INFERENCE_ENGINE
+    inferenceEngine_t* pEngine;
+    inferenceRequest_t requests[NUM_ARRAY_ELEMENTS(batchResponses)];
+    EMBANN_ERROR_CHECK(embann_initEngine(&pEngine, pNetwork, CONFIG_ENGINE_NUM_WORKERS,
+                                            CONFIG_ENGINE_MAX_BATCH_SIZE, CONFIG_ENGINE_MAX_WAIT_US));
+    for (uint8_t i = 0; i < NUM_ARRAY_ELEMENTS(requests); i++)
+    {
+        requests[i].pInputs = &batchData[i * numInputs];
+        requests[i].pOutputs = NULL;
+        requests[i].pCallback = NULL;
+        EMBANN_ERROR_CHECK(embann_submitInference(pEngine, &requests[i]));
+    }
+    for (uint8_t i = 0; i < NUM_ARRAY_ELEMENTS(requests); i++)
+    {
+        EMBANN_ERROR_CHECK(embann_waitInference(pEngine, &requests[i]));
+        batchResponses[i] = requests[i].networkResponse;
+    }
+    EMBANN_ERROR_CHECK(embann_freeEngine(pEngine));
+    EMBANN_LOGI(TAG, "Engine responses: %d %d %d %d", batchResponses[0], batchResponses[1],
+                                                    batchResponses[2], batchResponses[3]);
+#endif
+    EMBANN_ERROR_CHECK(embann_freeSession(pSession));
+#ifdef CONFIG_SPARSE_WEIGHTS
+    /*
+     * A pruned copy of the network has to give the same outputs as a dense
+     * copy with the same weights zeroed, and as itself saved and reloaded
+     */
+    const char* pDensePath = "embann_demo_dense.bin";
+    const char* pPrunedPath = "embann_demo_pruned.bin";
+#ifdef WEIGHT_IS_FLOAT
+    const weight_t threshold = 0.25f;
+#else
+    const weight_t threshold = MAX_WEIGHT / 4;
+#endif
+    network_t* pCopies[3];  /* Dense, pruned, and pruned then reloaded */
+    bool isMatching = true;
+
+    EMBANN_ERROR_CHECK(embann_saveNetwork(pNetwork, pDensePath));
+    for (uint8_t i = 0; i < NUM_ARRAY_ELEMENTS(pCopies); i++)
+    {
+        EMBANN_ERROR_CHECK(embann_init(&pCopies[i], pNetwork->inputLayer->numNeurons,
+                                        pNetwork->hiddenLayer[0]->numNeurons, pNetwork->properties.numHiddenLayers,
+                                        pNetwork->outputLayer->numNeurons));
+    }
+    EMBANN_ERROR_CHECK(embann_loadNetwork(pCopies[0], pDensePath));
+    EMBANN_ERROR_CHECK(embann_loadNetwork(pCopies[1], pDensePath));
+    EMBANN_ERROR_CHECK(embann_pruneNetwork(pCopies[1], threshold));
+    EMBANN_ERROR_CHECK(embann_saveNetwork(pCopies[1], pPrunedPath));
+    EMBANN_ERROR_CHECK(embann_loadNetwork(pCopies[2], pPrunedPath));
+
+    for (numLayers_t layer = 0; layer <= pCopies[0]->properties.numHiddenLayers; layer++)
+    {
+        const layerDescriptor_t dense = embann_describeLayer(pCopies[0], layer);
+        const layerDescriptor_t pruned = embann_describeLayer(pCopies[1], layer);
+        // Deviation from MISRA C2012 11.8, the descriptor points at this network's own layers
+        // cppcheck-suppress misra-c2012-11.8
+        weight_t* pWeights = (weight_t*) dense.weight;
+
+        for (uint32_t i = 0; i < dense.numNeurons; i++)
+        {
+            for (uint32_t j = 0; j < dense.numInputs; j++)
+            {
+                pWeights[(i * dense.weightStride) + j] = embann_getWeight(&pruned, i, j);
+            }
+        }
+    }
+#ifdef CONFIG_REQUANTIZATION
+    EMBANN_ERROR_CHECK(embann_updateZeroPointOffsets(pCopies[0]));
+#endif
+
+    for (uint8_t i = 0; i < NUM_ARRAY_ELEMENTS(batchResponses); i++)
+    {
+        for (uint8_t j = 0; j < NUM_ARRAY_ELEMENTS(pCopies); j++)
+        {
+            EMBANN_ERROR_CHECK(embann_inputRaw(pCopies[j], &batchData[i * numInputs]));
+            EMBANN_ERROR_CHECK(embann_forwardPropagate(pCopies[j]));
+        }
+        for (uint8_t j = 1; j < NUM_ARRAY_ELEMENTS(pCopies); j++)
+        {
+            isMatching = isMatching && (memcmp(pCopies[0]->outputLayer->activation, pCopies[j]->outputLayer->activation,
+                                        pNetwork->outputLayer->numNeurons * sizeof(activation_t)) == 0);
+        }
+    }
+    if (isMatching)
+    {
+        EMBANN_LOGI(TAG, "Pruned network matches the dense and reloaded networks");
+    }
+    else
+    {
+        EMBANN_LOGE(TAG, "Pruned network doesn't match the dense and reloaded networks");
+    }
+    EMBANN_ERROR_CHECK(isMatching ? EOK : EIO);
+
+    for (uint8_t i = 0; i < NUM_ARRAY_ELEMENTS(pCopies); i++)
+    {
+        EMBANN_ERROR_CHECK(embann_freeNetwork(pCopies[i]));
+    }
+    (void) remove(pDensePath);
+    (void) remove(pPrunedPath);
+#endif
+#ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
+    free(batchData);
+    free(randomData);
+#endif
+
+    EMBANN_ERROR_CHECK(embann_printNetwork(pNetwork));
+    EMBANN_ERROR_CHECK(embann_printInputNeuronDetails(pNetwork, 0));
+    EMBANN_ERROR_CHECK(embann_printOutputNeuronDetails(pNetwork, 0));
+    EMBANN_ERROR_CHECK(embann_printHiddenNeuronDetails(pNetwork, 0, 0));
+    EMBANN_ERROR_CHECK(embann_errorReporting(pNetwork, 0));
+#ifdef CONFIG_MODEL_PUBLISHING
+    EMBANN_ERROR_CHECK(embann_freePublisher(&publisher));
+#else
+    EMBANN_ERROR_CHECK(embann_freeNetwork(pNetwork));
+#endif
 }
 #endif
 
 
 
 
-int embann_forwardPropagate(void)
+int embann_forwardPropagate(network_t* pNetwork)
 {
-    EMBANN_ERROR_CHECK(embann_sumAndSquashInput(
-                            pNetworkGlobal->inputLayer, 
-                            pNetworkGlobal->hiddenLayer[0],
-                            pNetworkGlobal->inputLayer->numNeurons, 
-                            pNetworkGlobal->hiddenLayer[0]->numNeurons));
+    const numLayers_t lastHiddenLayer = pNetwork->properties.numHiddenLayers - 1U;
+    const inputLayer_t* pInputLayer = pNetwork->inputLayer;
+    layerDescriptor_t layer = LAYER_DESCRIPTOR(pInputLayer, pNetwork->hiddenLayer[0]);
+
+    if (pInputLayer->boundInput != NULL)
+    {
+        layer.input = pInputLayer->boundInput;
+    }
+#ifdef ACTIVATION_IS_FLOAT
+    if ((pInputLayer->boundInput != NULL) && pInputLayer->isBoundInputScaled)
+    {
+        EMBANN_ERROR_CHECK(_sumAndSquashScaledInput(&layer, pInputLayer->inputOffset, pInputLayer->inputScale));
+    }
+    else
+#endif
+    {
+        EMBANN_ERROR_CHECK(_sumAndSquashInput(&layer));
+    }
 
     EMBANN_LOGD(TAG, "Done Input -> 1st Hidden Layer");
-    for (uint8_t i = 1; i < pNetworkGlobal->properties.numHiddenLayers; i++)
+    for (uint8_t i = 1; i < pNetwork->properties.numHiddenLayers; i++)
     {
-        EMBANN_ERROR_CHECK(embann_sumAndSquashHidden(
-                            pNetworkGlobal->hiddenLayer[i - 1U],
-                            pNetworkGlobal->hiddenLayer[i],
-                            pNetworkGlobal->hiddenLayer[i - 1U]->numNeurons,
-                            pNetworkGlobal->hiddenLayer[i]->numNeurons));
+        layer = LAYER_DESCRIPTOR(pNetwork->hiddenLayer[i - 1U], pNetwork->hiddenLayer[i]);
+        EMBANN_ERROR_CHECK(_sumAndSquashHidden(&layer));
 
         EMBANN_LOGD(TAG, "Done Hidden Layer %d -> Hidden Layer %d", i - 1U, i);
     }
 
-    
-
-    EMBANN_ERROR_CHECK(embann_sumAndSquashOutput(
-        pNetworkGlobal->hiddenLayer[pNetworkGlobal->properties.numHiddenLayers - 1U],
-        pNetworkGlobal->outputLayer, 
-        pNetworkGlobal->hiddenLayer[pNetworkGlobal->properties.numHiddenLayers - 1U]->numNeurons,
-        pNetworkGlobal->outputLayer->numNeurons));
+    layer = LAYER_DESCRIPTOR(pNetwork->hiddenLayer[lastHiddenLayer], pNetwork->outputLayer);
+    EMBANN_ERROR_CHECK(_sumAndSquashOutput(&layer));
 
-    embann_calculateNetworkResponse();
+    embann_calculateNetworkResponse(pNetwork);
 
-    EMBANN_LOGD(TAG, "Done Hidden Layer %d -> Output Layer", pNetworkGlobal->properties.numHiddenLayers);
+    EMBANN_LOGD(TAG, "Done Hidden Layer %d -> Output Layer", pNetwork->properties.numHiddenLayers);
 
     return EOK;
 }
@@ -132,121 +304,385 @@ int embann_forwardPropagate(void)
 
 
 
-static int embann_sumAndSquashInput(inputLayer_t* input, hiddenLayer_t* output, numInputs_t numInputs, numHiddenNeurons_t numOutputs)
+/*
+ * The forward pass of every layer. Always inlined into the instantiations
+ * below, so static builds, where every size is a Kconfig constant, get a copy
+ * per layer shape with constant trip counts.
+ */
+static ALWAYS_INLINE int _sumAndSquashLayer(const layerDescriptor_t* pLayer, uint32_t numInputs,
+                                            uint32_t numNeurons, uint32_t weightStride)
 {
+#ifdef CONFIG_SPARSE_WEIGHTS
+    if (pLayer->sparse != NULL)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return _sumAndSquashSparse(pLayer);
+    }
+#endif
+
+    PARALLEL_FOR_LAYER(numNeurons * numInputs)
+    for (uint32_t i = 0; i < numNeurons; i++)
+    {
+        const weight_t* pWeightRow = &pLayer->weight[i * weightStride];
+
+        EMBANN_LOGV(TAG, "[%d] In activation = 0x%x, Out weight = 0x%x", 
+                                                i, pLayer->input, pWeightRow);
+
+        const accumulator_t accum = embann_dotProduct(pLayer->input, pWeightRow, numInputs);
+
+        EMBANN_LOGV(TAG, "[%d] Accumulated = %" ACCUMULATOR_PRINT, i, accum);
+
+        pLayer->activation[i] = embann_activate(pLayer, i, accum, pLayer->activationFunction);
+        EMBANN_LOGD(TAG, "[%d] SumAndSquash Output %" ACTIVATION_PRINT, i, pLayer->activation[i]);
+    }
+    return EOK;
+}
+
 #ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-    accumulator_t accum[CONFIG_NUM_HIDDEN_NEURONS];
+DEFINE_SUM_AND_SQUASH(_sumAndSquashInput, CONFIG_NUM_INPUT_NEURONS, CONFIG_NUM_HIDDEN_NEURONS,
+                        WEIGHT_STRIDE(CONFIG_NUM_INPUT_NEURONS))
+DEFINE_SUM_AND_SQUASH(_sumAndSquashHidden, CONFIG_NUM_HIDDEN_NEURONS, CONFIG_NUM_HIDDEN_NEURONS,
+                        WEIGHT_STRIDE(CONFIG_NUM_HIDDEN_NEURONS))
+DEFINE_SUM_AND_SQUASH(_sumAndSquashOutput, CONFIG_NUM_HIDDEN_NEURONS, CONFIG_NUM_OUTPUT_NEURONS,
+                        WEIGHT_STRIDE(CONFIG_NUM_HIDDEN_NEURONS))
 #else
-    accumulator_t accum[numOutputs];
+DEFINE_SUM_AND_SQUASH(_sumAndSquashHidden, pLayer->numInputs, pLayer->numNeurons, pLayer->weightStride)
 #endif
-    
-    for (numHiddenNeurons_t i = 0; i < numOutputs; i++)
+
+
+
+
+
+#ifdef CONFIG_SPARSE_WEIGHTS
+/* _sumAndSquashLayer() for a pruned layer, only the blocks left in each row are multiplied */
+static int _sumAndSquashSparse(const layerDescriptor_t* pLayer)
+{
+    PARALLEL_FOR_LAYER(pLayer->sparse->numBlocks * CONFIG_SPARSE_BLOCK_SIZE)
+    for (uint32_t i = 0; i < pLayer->numNeurons; i++)
     {
-        accum[i] = 0;
+        const accumulator_t accum = embann_sparseDotProduct(pLayer->sparse, i, pLayer->input, pLayer->numInputs);
 
-        for (numInputs_t j = 0; j < numInputs; j++)
-        {
-            EMBANN_LOGV(TAG, "[%d] [%d] In activation = 0x%x, Out weight = 0x%x", 
-                                                    i, j, &input->activation[i], &output->weight[i][j]);
-            EMBANN_LOGV(TAG, "[%d] [%d] In activation = %" ACTIVATION_PRINT " Out weight = %" WEIGHT_PRINT,
-                                                    i, j, input->activation[i], output->weight[i][j]);
+        EMBANN_LOGV(TAG, "[%d] Accumulated = %" ACCUMULATOR_PRINT, i, accum);
 
-            accum[i] += input->activation[i] * output->weight[i][j];
-        }
+        pLayer->activation[i] = embann_activate(pLayer, i, accum, pLayer->activationFunction);
+        EMBANN_LOGD(TAG, "[%d] SumAndSquash Output %" ACTIVATION_PRINT, i, pLayer->activation[i]);
     }
+    return EOK;
+}
+#endif
+
+
+
+
 
-    for (numHiddenNeurons_t i = 0; i < numOutputs; i++)
-    {
 #ifdef ACTIVATION_IS_FLOAT
-        output->activation[i] = tanhf(accum[i] * PI);
-#else
-        accum[i] = (accum[i] > MAX_ACTIVATION) ? MAX_ACTIVATION : accum[i];
-        output->activation[i] = (accum[i] <= 0) ? 1 : accum[i];
+/*
+ * The first layer reading a bound input as (input - offset) * scale. The
+ * offset is taken off each input as it's accumulated and the scale applied
+ * once per neuron, so the inputs are never scaled into a buffer of their own.
+ */
+static int _sumAndSquashScaledInput(const layerDescriptor_t* pLayer, activation_t offset, activation_t scale)
+{
+    PARALLEL_FOR_LAYER(pLayer->numNeurons * pLayer->numInputs)
+    for (uint32_t i = 0; i < pLayer->numNeurons; i++)
+    {
+        activation_t sum = 0;
+
+#ifdef CONFIG_SPARSE_WEIGHTS
+        if (pLayer->sparse != NULL)
+        {
+            const sparseWeights_t* pSparse = pLayer->sparse;
+
+            for (uint32_t b = pSparse->rowStart[i]; b < pSparse->rowStart[i + 1U]; b++)
+            {
+                const weight_t* pBlockWeights = &pSparse->blockWeights[b * CONFIG_SPARSE_BLOCK_SIZE];
+                const uint32_t firstInput = pSparse->blockInput[b];
+                const uint32_t lastInput = min(pLayer->numInputs, firstInput + CONFIG_SPARSE_BLOCK_SIZE);
+
+                for (uint32_t j = firstInput; j < lastInput; j++)
+                {
+                    sum += (pLayer->input[j] - offset) * pBlockWeights[j - firstInput];
+                }
+            }
+        }
+        else
 #endif
-        EMBANN_LOGD(TAG, "[%d] SumAndSquash Output %" ACTIVATION_PRINT, i, output->activation[i]);
+        {
+            const weight_t* pWeightRow = &pLayer->weight[i * pLayer->weightStride];
+
+            for (uint32_t j = 0; j < pLayer->numInputs; j++)
+            {
+                sum += (pLayer->input[j] - offset) * pWeightRow[j];
+            }
+        }
+
+        const accumulator_t accum = (accumulator_t) (sum * scale);
+        EMBANN_LOGV(TAG, "[%d] Accumulated = %" ACCUMULATOR_PRINT, i, accum);
+
+        pLayer->activation[i] = embann_activate(pLayer, i, accum, pLayer->activationFunction);
+        EMBANN_LOGD(TAG, "[%d] SumAndSquash Output %" ACTIVATION_PRINT, i, pLayer->activation[i]);
     }
     return EOK;
 }
+#endif
 
 
 
 
 
-static int embann_sumAndSquashHidden(hiddenLayer_t* input, hiddenLayer_t* output, numHiddenNeurons_t numInputs, numHiddenNeurons_t numOutputs)
+/*
+ * Runs numSamples input rows (each inputLayer->numNeurons long) through the
+ * network, CONFIG_BATCH_SIZE at a time. Each layer is a matrix-matrix product
+ * done by embann_gemm(), so every weight is loaded once per batch instead of
+ * once per sample.
+ *
+ * pOutputs (numSamples rows of outputLayer->numNeurons) and pResponses
+ * (numSamples entries) are both optional. The activations stored in the
+ * network itself are left untouched.
+ */
+int embann_forwardPropagateBatch(network_t* pNetwork, const activation_t* pInputs, uint32_t numSamples,
+                                    activation_t* pOutputs, numOutputs_t* pResponses)
 {
 #ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-    accumulator_t accum[CONFIG_NUM_HIDDEN_NEURONS];
+    return embann_forwardPropagateBatchScratch(pNetwork, &pNetwork->batchScratch, pInputs, numSamples,
+                                                pOutputs, pResponses);
 #else
-    accumulator_t accum[numOutputs];
+    batchScratch_t scratch;
+
+    int err = embann_allocBatchScratch(&scratch, pNetwork);
+    if (err == EOK)
+    {
+        err = embann_forwardPropagateBatchScratch(pNetwork, &scratch, pInputs, numSamples, pOutputs, pResponses);
+        (void) embann_freeBatchScratch(&scratch);
+    }
+    return err;
 #endif
-    
-    // TODO, add biasing
+}
 
-    for (numHiddenNeurons_t i = 0; i < numOutputs; i++)
+
+
+
+
+/*
+ * embann_forwardPropagateBatch() with its working memory in pScratch, so the
+ * network is only read. Threads batching on one network at once each need
+ * their own scratch.
+ */
+int embann_forwardPropagateBatchScratch(const network_t* pNetwork, const batchScratch_t* pScratch,
+                                        const activation_t* pInputs, uint32_t numSamples,
+                                        activation_t* pOutputs, numOutputs_t* pResponses)
+{
+    if ((pNetwork == NULL) || (pScratch == NULL) || (pInputs == NULL) || (numSamples == 0U))
     {
-        accum[i] = 0;
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
 
-        for (numHiddenNeurons_t j = 0; j < numInputs; j++)
+    const numInputs_t numInputs = pNetwork->inputLayer->numNeurons;
+    const numOutputs_t numOutputs = pNetwork->outputLayer->numNeurons;
+    const numLayers_t numHiddenLayers = pNetwork->properties.numHiddenLayers;
+
+    for (uint32_t firstSample = 0; firstSample < numSamples; firstSample += CONFIG_BATCH_SIZE)
+    {
+        const uint32_t batchSize = min(numSamples - firstSample, (uint32_t) CONFIG_BATCH_SIZE);
+        const activation_t* pLayerInput = &pInputs[firstSample * numInputs];
+        uint32_t numLayerInputs = numInputs;
+        uint8_t currentScratch = 0;
+
+        /* Each layer reads and writes rows of the batch, not its own activations */
+        for (numLayers_t i = 0; i < numHiddenLayers; i++)
         {
-            EMBANN_LOGV(TAG, "[%d] [%d] In activation = 0x%x, Out weight = 0x%x", 
-                                                    i, j, &input->activation[i], &output->weight[i][j]);
-            EMBANN_LOGV(TAG, "[%d] [%d] In activation = %" ACTIVATION_PRINT " Out weight = %" WEIGHT_PRINT,
-                                                    i, j, input->activation[i], output->weight[i][j]);
+            layerDescriptor_t layer = LAYER_DESCRIPTOR(pNetwork->inputLayer, pNetwork->hiddenLayer[i]);
+            layer.input = pLayerInput;
+            layer.numInputs = numLayerInputs;
+            layer.activation = pScratch->activations[currentScratch];
+
+            _batchLayer(&layer, batchSize, pScratch->accumulators);
 
-            accum[i] += input->activation[i] * output->weight[i][j];
+            pLayerInput = layer.activation;
+            numLayerInputs = layer.numNeurons;
+            currentScratch ^= 1U;
         }
+
+        activation_t* pBatchOutput = (pOutputs != NULL) ? &pOutputs[firstSample * numOutputs] : 
+                                                            pScratch->activations[currentScratch];
+
+        layerDescriptor_t layer = LAYER_DESCRIPTOR(pNetwork->inputLayer, pNetwork->outputLayer);
+        layer.input = pLayerInput;
+        layer.numInputs = numLayerInputs;
+        layer.activation = pBatchOutput;
+
+        _batchLayer(&layer, batchSize, pScratch->accumulators);
+
+        if (pResponses != NULL)
+        {
+            for (uint32_t i = 0; i < batchSize; i++)
+            {
+                pResponses[firstSample + i] = _mostLikelyOutput(&pBatchOutput[i * numOutputs], numOutputs);
+            }
+        }
+
+        EMBANN_LOGD(TAG, "Done batch of %d samples starting at %d", batchSize, firstSample);
     }
+    return EOK;
+}
+
+
 
-    for (numHiddenNeurons_t i = 0; i < numOutputs; i++)
+
+
+/*
+ * One layer of a batch, numSamples rows of inputs to numSamples rows of
+ * activations. Pruned layers don't have the dense rows embann_gemm() packs,
+ * so they go a sample at a time instead.
+ */
+static void _batchLayer(const layerDescriptor_t* pLayer, uint32_t numSamples, accumulator_t* pAccum)
+{
+#ifdef CONFIG_SPARSE_WEIGHTS
+    if (pLayer->sparse != NULL)
     {
-#ifdef ACTIVATION_IS_FLOAT
-        output->activation[i] = tanhf(accum[i] * PI);
-#else
-        accum[i] = (accum[i] > MAX_ACTIVATION) ? MAX_ACTIVATION : accum[i];
-        output->activation[i] = (accum[i] <= 0) ? 1 : accum[i];
+        layerDescriptor_t sample = *pLayer;
+
+        for (uint32_t i = 0; i < numSamples; i++)
+        {
+            sample.input = &pLayer->input[i * pLayer->numInputs];
+            sample.activation = &pLayer->activation[i * pLayer->numNeurons];
+            (void) _sumAndSquashSparse(&sample);
+        }
+    }
+    else
 #endif
-        EMBANN_LOGD(TAG, "[%d] SumAndSquash Output %" ACTIVATION_PRINT, i, output->activation[i]);
+    {
+        embann_gemm(pLayer, numSamples, pAccum);
+    }
+}
+
+
+
+
+
+/*
+ * Allocates enough scratch for CONFIG_BATCH_SIZE samples of pNetwork's widest
+ * layer. This is always from the heap, static networks have their own
+ * batchScratch for embann_forwardPropagateBatch() already.
+ */
+int embann_allocBatchScratch(batchScratch_t* pScratch, const network_t* pNetwork)
+{
+    if ((pScratch == NULL) || (pNetwork == NULL))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
     }
+
+    uint32_t maxNeurons = pNetwork->outputLayer->numNeurons;
+    for (numLayers_t i = 0; i < pNetwork->properties.numHiddenLayers; i++)
+    {
+        maxNeurons = max(maxNeurons, (uint32_t) pNetwork->hiddenLayer[i]->numNeurons);
+    }
+
+    /* Accumulators go first so they keep malloc's alignment */
+    accumulator_t* pBlock = (accumulator_t*) malloc(CONFIG_BATCH_SIZE * maxNeurons * 
+                                                    (sizeof(accumulator_t) + (2U * sizeof(activation_t))));
+    EMBANN_MALLOC_CHECK(pBlock);
+    pScratch->accumulators = pBlock;
+    pScratch->activations[0] = (activation_t*) &pBlock[CONFIG_BATCH_SIZE * maxNeurons];
+    pScratch->activations[1] = &pScratch->activations[0][CONFIG_BATCH_SIZE * maxNeurons];
     return EOK;
 }
 
 
 
 
-static int embann_sumAndSquashOutput(hiddenLayer_t* input, outputLayer_t* output, numHiddenNeurons_t numInputs, numOutputs_t numOutputs)
+
+int embann_freeBatchScratch(batchScratch_t* pScratch)
 {
-#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-    accumulator_t accum[CONFIG_NUM_OUTPUT_NEURONS];
-#else
-    accumulator_t accum[numOutputs];
-#endif
-    
-    // TODO, add biasing
+    if (pScratch == NULL)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
 
-    for (numOutputs_t i = 0; i < numOutputs; i++)
+    free(pScratch->accumulators);
+    pScratch->accumulators = NULL;
+    pScratch->activations[0] = NULL;
+    pScratch->activations[1] = NULL;
+    return EOK;
+}
+
+
+
+
+
+/*
+ * As embann_forwardPropagate(), but the inputs are read from pInputs and every
+ * layer's activations go to pSession, so the network is only read. Any number
+ * of threads can run one network like this at once, each with its own
+ * session, as long as nothing trains or loads into the network meanwhile.
+ */
+int embann_forwardPropagateSession(inferenceSession_t* pSession, const activation_t* pInputs)
+{
+    if ((pSession == NULL) || (pInputs == NULL))
     {
-        accum[i] = 0;
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
 
-        for (numHiddenNeurons_t j = 0; j < numInputs; j++)
-        {
-            EMBANN_LOGV(TAG, "[%d] [%d] In activation = 0x%x, Out weight = 0x%x", 
-                                                    i, j, &input->activation[i], &output->weight[i][j]);
-            EMBANN_LOGV(TAG, "[%d] [%d] In activation = %" ACTIVATION_PRINT " Out weight = %" WEIGHT_PRINT,
-                                                    i, j, input->activation[i], output->weight[i][j]);
+    const network_t* pNetwork = pSession->pNetwork;
+    const numLayers_t numHiddenLayers = pNetwork->properties.numHiddenLayers;
+    layerDescriptor_t layer = embann_describeLayer(pNetwork, 0U);
 
-            accum[i] += input->activation[i] * output->weight[i][j];
-        }
+    layer.input = pInputs;
+    layer.activation = pSession->activation[0];
+    EMBANN_ERROR_CHECK(_sumAndSquashInput(&layer));
+
+    for (numLayers_t i = 1; i < numHiddenLayers; i++)
+    {
+        layer = embann_describeLayer(pNetwork, i);
+        layer.input = pSession->activation[i - 1U];
+        layer.activation = pSession->activation[i];
+        EMBANN_ERROR_CHECK(_sumAndSquashHidden(&layer));
     }
 
-    for (numOutputs_t i = 0; i < numOutputs; i++)
+    layer = embann_describeLayer(pNetwork, numHiddenLayers);
+    layer.input = pSession->activation[numHiddenLayers - 1U];
+    layer.activation = pSession->activation[numHiddenLayers];
+    EMBANN_ERROR_CHECK(_sumAndSquashOutput(&layer));
+
+    pSession->networkResponse = _mostLikelyOutput(layer.activation, (numOutputs_t) layer.numNeurons);
+    return EOK;
+}
+
+
+
+
+
+/*
+ * Layers 0 to numHiddenLayers - 1 are the hidden layers, numHiddenLayers is
+ * the output layer.
+ */
+int embann_setActivationFunction(network_t* pNetwork, numLayers_t layer, activationFunction_t function)
+{
+    const numLayers_t numHiddenLayers = pNetwork->properties.numHiddenLayers;
+
+    if ((layer > numHiddenLayers) || (function >= NUM_ACTIVATION_FUNCTIONS))
     {
-#ifdef ACTIVATION_IS_FLOAT
-        output->activation[i] = tanhf(accum[i] * PI);
-#else
-        accum[i] = (accum[i] > MAX_ACTIVATION) ? MAX_ACTIVATION : accum[i];
-        output->activation[i] = (accum[i] <= 0) ? 1 : accum[i];
-#endif
-        EMBANN_LOGD(TAG, "[%d] SumAndSquash Output %" ACTIVATION_PRINT, i, output->activation[i]);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    if (layer < numHiddenLayers)
+    {
+        pNetwork->hiddenLayer[layer]->activationFunction = function;
+    }
+    else
+    {
+        pNetwork->outputLayer->activationFunction = function;
     }
     return EOK;
 }
@@ -255,23 +691,84 @@ static int embann_sumAndSquashOutput(hiddenLayer_t* input, outputLayer_t* output
 
 
 
+/* Layer numbered as in embann_setActivationFunction(), fed by the layer before it */
+layerDescriptor_t embann_describeLayer(const network_t* pNetwork, numLayers_t layer)
+{
+    const numLayers_t numHiddenLayers = pNetwork->properties.numHiddenLayers;
+    layerDescriptor_t descriptor;
+
+    if (layer == 0U)
+    {
+        descriptor = LAYER_DESCRIPTOR(pNetwork->inputLayer, pNetwork->hiddenLayer[0]);
+    }
+    else if (layer < numHiddenLayers)
+    {
+        descriptor = LAYER_DESCRIPTOR(pNetwork->hiddenLayer[layer - 1U], pNetwork->hiddenLayer[layer]);
+    }
+    else
+    {
+        descriptor = LAYER_DESCRIPTOR(pNetwork->hiddenLayer[numHiddenLayers - 1U], pNetwork->outputLayer);
+    }
+    return descriptor;
+}
+
+
+
+
+
+/* The weight from input to neuron in pLayer, pruned or not */
+weight_t embann_getWeight(const layerDescriptor_t* pLayer, uint32_t neuron, uint32_t input)
+{
+#ifdef CONFIG_SPARSE_WEIGHTS
+    const sparseWeights_t* pSparse = pLayer->sparse;
+
+    if (pSparse != NULL)
+    {
+        weight_t weight = 0;
+
+        for (uint32_t b = pSparse->rowStart[neuron]; b < pSparse->rowStart[neuron + 1U]; b++)
+        {
+            if ((input >= pSparse->blockInput[b]) && ((input - pSparse->blockInput[b]) < CONFIG_SPARSE_BLOCK_SIZE))
+            {
+                weight = pSparse->blockWeights[(b * CONFIG_SPARSE_BLOCK_SIZE) + (input - pSparse->blockInput[b])];
+            }
+        }
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return weight;
+    }
+#endif
+    return pLayer->weight[(neuron * pLayer->weightStride) + input];
+}
+
+
+
+
+
+int embann_calculateNetworkResponse(network_t* pNetwork)
+{
+    pNetwork->properties.networkResponse = _mostLikelyOutput(pNetwork->outputLayer->activation,
+                                                                    pNetwork->outputLayer->numNeurons);
+    return EOK;
+}
 
-int embann_calculateNetworkResponse(void)
+
+
+
+
+static numOutputs_t _mostLikelyOutput(const activation_t* pActivation, numOutputs_t numOutputs)
 {
     numOutputs_t mostLikelyOutput = 0;
 
-    for (numOutputs_t i = 0; i < pNetworkGlobal->outputLayer->numNeurons; i++)
+    for (numOutputs_t i = 0; i < numOutputs; i++)
     {
-        if (pNetworkGlobal->outputLayer->activation[i] >
-            pNetworkGlobal->outputLayer->activation[mostLikelyOutput])
+        if (pActivation[i] > pActivation[mostLikelyOutput])
         {
             mostLikelyOutput = i;
         }
-        EMBANN_LOGV(TAG, "neuron[%d]: %" ACTIVATION_PRINT "likely: %d", i, pNetworkGlobal->outputLayer->activation[i], mostLikelyOutput);
+        EMBANN_LOGV(TAG, "neuron[%d]: %" ACTIVATION_PRINT "likely: %d", i, pActivation[i], mostLikelyOutput);
     }
-    
-    pNetworkGlobal->properties.networkResponse = mostLikelyOutput;
-    return EOK;
+    return mostLikelyOutput;
 }
 
 
@@ -1,354 +1,634 @@
 #include "embann.h"
 #include "embann_log.h"
 
+#if defined(CONFIG_MAP_DATASET_FILES) && !defined(_WIN32) && !defined(ARDUINO)
+#define MAP_DATASET_FILES
+#include <sys/mman.h>
+#endif
+
 #define TAG "Embann Data Management"
 
-extern network_t* pNetworkGlobal;
-extern trainingDataCollection_t trainingDataCollection;
+#ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
+static int _growTrainingData(trainingDataCollection_t* pTrainingData);
+#endif
+static void _shuffleRange(numTrainingDataSets_t* pOrder, numTrainingDataSets_t numIndices);
+#if (CONFIG_SHUFFLE_BLOCK_SIZE > 1)
+static void _expandBlocks(numTrainingDataSets_t* pOrder, numTrainingDataSets_t numSets);
+#endif
+static numTrainingDataSets_t _randomBelow(numTrainingDataSets_t limit);
 
-static trainingData_t trainingData[CONFIG_NUM_TRAINING_DATA_SETS];
 
+/* The embann_input*() functions copy into the network's own input buffer, and undo embann_bindInput() */
+int embann_inputRaw(network_t* pNetwork, activation_t data[])
+{
+    pNetwork->inputLayer->boundInput = NULL;
+    for (uint32_t i = 0; i < pNetwork->inputLayer->numNeurons; i++)
+    {
+        pNetwork->inputLayer->activation[i] = data[i];
+        EMBANN_LOGD(TAG, "Input [%d] = %" ACTIVATION_PRINT, i, pNetwork->inputLayer->activation[i]);
+    }
+    return EOK;
+}
 
-int embann_inputRaw(activation_t data[])
+int embann_inputMinMaxScale(network_t* pNetwork, activation_t data[], activation_t min, activation_t max)
 {
-    for (uint32_t i = 0; i < pNetworkGlobal->inputLayer->numNeurons; i++)
+    pNetwork->inputLayer->boundInput = NULL;
+    for (uint32_t i = 0; i < pNetwork->inputLayer->numNeurons; i++)
     {
-        pNetworkGlobal->inputLayer->activation[i] = data[i];
-        EMBANN_LOGD(TAG, "Input [%d] = %" ACTIVATION_PRINT, i, pNetworkGlobal->inputLayer->activation[i]);
+        pNetwork->inputLayer->activation[i] = (data[i] - min) / (max - min);
+        EMBANN_LOGD(TAG, "Input [%d] = %" ACTIVATION_PRINT, i, pNetwork->inputLayer->activation[i]);
     }
     return EOK;
 }
 
-int embann_inputMinMaxScale(activation_t data[], activation_t min, activation_t max)
+int embann_inputStandardizeScale(network_t* pNetwork, activation_t data[], float mean, float stdDev)
 {
-    for (uint32_t i = 0; i < pNetworkGlobal->inputLayer->numNeurons; i++)
+    pNetwork->inputLayer->boundInput = NULL;
+    for (uint32_t i = 0; i < pNetwork->inputLayer->numNeurons; i++)
     {
-        pNetworkGlobal->inputLayer->activation[i] = (data[i] - min) / (max - min);
-        EMBANN_LOGD(TAG, "Input [%d] = %" ACTIVATION_PRINT, i, pNetworkGlobal->inputLayer->activation[i]);
+        pNetwork->inputLayer->activation[i] = (data[i] - mean) / stdDev;
+        EMBANN_LOGD(TAG, "Input [%d] = %" ACTIVATION_PRINT, i, pNetwork->inputLayer->activation[i]);
     }
     return EOK;
 }
 
-int embann_inputStandardizeScale(activation_t data[], float mean, float stdDev)
+/*
+ * Makes embann_forwardPropagate() read the inputs straight from pInputs, which
+ * the caller keeps alive and can refill between calls, instead of them being
+ * copied into the network first. Cache line aligned buffers are the fastest.
+ */
+int embann_bindInput(network_t* pNetwork, const activation_t* pInputs)
 {
-    for (uint32_t i = 0; i < pNetworkGlobal->inputLayer->numNeurons; i++)
+    if ((pNetwork == NULL) || (pInputs == NULL))
     {
-        pNetworkGlobal->inputLayer->activation[i] = (data[i] - mean) / stdDev;
-        EMBANN_LOGD(TAG, "Input [%d] = %" ACTIVATION_PRINT, i, pNetworkGlobal->inputLayer->activation[i]);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
     }
+
+    pNetwork->inputLayer->boundInput = pInputs;
+#ifdef ACTIVATION_IS_FLOAT
+    pNetwork->inputLayer->isBoundInputScaled = false;
+#endif
     return EOK;
 }
 
-int embann_getTrainingDataMean(float* mean)
+#ifdef ACTIVATION_IS_FLOAT
+/*
+ * embann_bindInput() with the inputs min-max scaled as embann_inputMinMaxScale()
+ * would, but as the first layer accumulates them rather than in a pass of its own
+ */
+int embann_bindInputMinMaxScale(network_t* pNetwork, const activation_t* pInputs,
+                                activation_t min, activation_t max)
 {
-    float tempMean;
-    uint32_t sum = 0;
-    trainingData_t* pTrainingData = trainingDataCollection.head;
+    const int err = embann_bindInput(pNetwork, pInputs);
 
-    if (pTrainingData != NULL)
+    if (err == EOK)
     {
-        tempMean = pTrainingData->data[0];
+        pNetwork->inputLayer->inputOffset = min;
+        pNetwork->inputLayer->inputScale = 1.0F / (max - min);
+        pNetwork->inputLayer->isBoundInputScaled = true;
     }
-    else
+    return err;
+}
+
+/* As embann_bindInputMinMaxScale(), but scaled like embann_inputStandardizeScale() */
+int embann_bindInputStandardizeScale(network_t* pNetwork, const activation_t* pInputs, float mean, float stdDev)
+{
+    const int err = embann_bindInput(pNetwork, pInputs);
+
+    if (err == EOK)
+    {
+        pNetwork->inputLayer->inputOffset = mean;
+        pNetwork->inputLayer->inputScale = 1.0F / stdDev;
+        pNetwork->inputLayer->isBoundInputScaled = true;
+    }
+    return err;
+}
+#endif
+
+int embann_unbindInput(network_t* pNetwork)
+{
+    if (pNetwork == NULL)
     {
         // Deviation from MISRA C2012 15.5 for reasonably simple error return values
         // cppcheck-suppress misra-c2012-15.5
-        return ENOENT;
+        return EINVAL;
     }
 
-    if (pTrainingData->length == 0)
+    pNetwork->inputLayer->boundInput = NULL;
+    return EOK;
+}
+
+int embann_getTrainingDataMean(const network_t* pNetwork, float* mean)
+{
+    const trainingDataCollection_t* pTrainingData = &pNetwork->trainingData;
+    float sum = 0.0F;
+
+    if (pTrainingData->numSets == 0U)
     {
         // Deviation from MISRA C2012 15.5 for reasonably simple error return values
         // cppcheck-suppress misra-c2012-15.5
         return ENOENT;
     }
 
-#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-    const numTrainingDataSets_t numSets = trainingDataCollection.numSets;
-    for (numTrainingDataSets_t i = 0; i < numSets; i++)
-#else
-    while (pTrainingData != NULL)
-#endif
+    for (numTrainingDataSets_t i = 0; i < pTrainingData->numSets; i++)
     {
-        const numTrainingDataEntries_t numEntries = pTrainingData->length;
-        
-        for (numTrainingDataEntries_t j = 0; j < numEntries; j++)
+        const activation_t* pFeatures = TRAINING_DATA_FEATURES(pTrainingData, i);
+        float sampleSum = 0.0F;
+
+        for (numTrainingDataEntries_t j = 0; j < pTrainingData->numEntries; j++)
         {
-            sum += pTrainingData->data[j];
+            sampleSum += (float) pFeatures[j];
         }
-        tempMean += (float)sum / numEntries;
-        sum = 0;
-
-#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-        pTrainingData += sizeof(trainingData_t);
-#else
-        pTrainingData = pTrainingData->next;
-#endif
+        sum += sampleSum;
     }
 
-    tempMean /= trainingDataCollection.numSets;
-
-    *mean = tempMean;
-
+    *mean = sum / ((float) pTrainingData->numSets * (float) pTrainingData->numEntries);
     return EOK;
 }
 
-int embann_getTrainingDataStdDev(float* stdDev)
+int embann_getTrainingDataStdDev(const network_t* pNetwork, float* stdDev)
 {
-    float sumofSquares = 0.0F;
+    const trainingDataCollection_t* pTrainingData = &pNetwork->trainingData;
+    float sumOfSquares = 0.0F;
     float mean;
-    trainingData_t* pTrainingData = trainingDataCollection.head;
 
-    if (pTrainingData != NULL)
-    {
-        *stdDev = pTrainingData->data[0];
-    }
-    else
+    if (embann_getTrainingDataMean(pNetwork, &mean) != EOK)
     {
         // Deviation from MISRA C2012 15.5 for reasonably simple error return values
         // cppcheck-suppress misra-c2012-15.5
         return ENOENT;
     }
 
-    if (pTrainingData->length == 0)
+    for (numTrainingDataSets_t i = 0; i < pTrainingData->numSets; i++)
+    {
+        const activation_t* pFeatures = TRAINING_DATA_FEATURES(pTrainingData, i);
+
+        for (numTrainingDataEntries_t j = 0; j < pTrainingData->numEntries; j++)
+        {
+            const float deviation = (float) pFeatures[j] - mean;
+            sumOfSquares += deviation * deviation;
+        }
+    }
+
+    *stdDev = sqrtf(sumOfSquares / ((float) pTrainingData->numSets * (float) pTrainingData->numEntries));
+    return EOK;
+}
+
+int embann_getTrainingDataMax(const network_t* pNetwork, activation_t* max)
+{
+    const trainingDataCollection_t* pTrainingData = &pNetwork->trainingData;
+
+    if (pTrainingData->numSets == 0U)
     {
         // Deviation from MISRA C2012 15.5 for reasonably simple error return values
         // cppcheck-suppress misra-c2012-15.5
         return ENOENT;
     }
 
-    if (embann_getTrainingDataMean(&mean) != EOK)
+    activation_t tempMax = pTrainingData->features[0];
+    for (numTrainingDataSets_t i = 0; i < pTrainingData->numSets; i++)
+    {
+        const activation_t* pFeatures = TRAINING_DATA_FEATURES(pTrainingData, i);
+
+        for (numTrainingDataEntries_t j = 0; j < pTrainingData->numEntries; j++)
+        {
+            tempMax = (pFeatures[j] > tempMax) ? pFeatures[j] : tempMax;
+        }
+    }
+
+    *max = tempMax;
+    return EOK;
+}
+
+int embann_getTrainingDataMin(const network_t* pNetwork, activation_t* min)
+{
+    const trainingDataCollection_t* pTrainingData = &pNetwork->trainingData;
+
+    if (pTrainingData->numSets == 0U)
     {
         // Deviation from MISRA C2012 15.5 for reasonably simple error return values
         // cppcheck-suppress misra-c2012-15.5
         return ENOENT;
     }
-    
 
-#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-    const numTrainingDataSets_t numSets = trainingDataCollection.numSets;
-    for (numTrainingDataSets_t i = 0; i < numSets; i++)
-#else
-    while (pTrainingData != NULL)
-#endif
+    activation_t tempMin = pTrainingData->features[0];
+    for (numTrainingDataSets_t i = 0; i < pTrainingData->numSets; i++)
     {
-        const numTrainingDataEntries_t numEntries = pTrainingData->length;
-        
-        for (numTrainingDataEntries_t j = 0; j < numEntries; j++)
+        const activation_t* pFeatures = TRAINING_DATA_FEATURES(pTrainingData, i);
+
+        for (numTrainingDataEntries_t j = 0; j < pTrainingData->numEntries; j++)
         {
-            sumofSquares += powf((float)pTrainingData->data[j] - mean, 2.0F);
+            tempMin = (pFeatures[j] < tempMin) ? pFeatures[j] : tempMin;
         }
-        sumofSquares /= numEntries;
-
-#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-        pTrainingData += sizeof(trainingData_t);
-#else
-        pTrainingData = pTrainingData->next;
-#endif
     }
 
-    *stdDev = sqrtf(sumofSquares);
-
+    *min = tempMin;
     return EOK;
 }
 
-int embann_getTrainingDataMax(activation_t* max)
+
+#ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
+/*
+ * The same as embann_copyTrainingData() now that every sample lives in the
+ * network's own block, so data can be reused as soon as this returns
+ */
+int embann_addTrainingData(network_t* pNetwork, activation_t* data, uint32_t numElements,
+                            numOutputs_t correctResponse)
 {
-    trainingData_t* pTrainingData = trainingDataCollection.head;
-    activation_t tempMax;
+    return embann_copyTrainingData(pNetwork, data, numElements, correctResponse);
+}
+#endif
 
-    if (pTrainingData != NULL)
-    {
-        tempMax = pTrainingData->data[0];
-    }
-    else
+/*
+ * Appends a copy of data to the network's training samples. Every sample has
+ * to have as many entries as the first one, EINVAL otherwise.
+ */
+int embann_copyTrainingData(network_t* pNetwork, activation_t data[], uint32_t numElements,
+                            numOutputs_t correctResponse)
+{
+    trainingDataCollection_t* pTrainingData = &pNetwork->trainingData;
+
+    if (numElements == 0U)
     {
         // Deviation from MISRA C2012 15.5 for reasonably simple error return values
         // cppcheck-suppress misra-c2012-15.5
         return ENOENT;
     }
 
-    if (pTrainingData->length == 0)
+#ifdef CONFIG_MAP_DATASET_FILES
+    if (pTrainingData->pFileMapping != NULL)
     {
+        EMBANN_LOGE(TAG, "Training samples mapped from a file can't be added to");
         // Deviation from MISRA C2012 15.5 for reasonably simple error return values
         // cppcheck-suppress misra-c2012-15.5
-        return ENOENT;
+        return EROFS;
     }
-    
-#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-    const numTrainingDataSets_t numSets = trainingDataCollection.numSets;
-    for (numTrainingDataSets_t i = 0; i < numSets; i++)
-#else
-    while (pTrainingData != NULL)
 #endif
+
+    if ((pTrainingData->numSets != 0U) && (numElements != pTrainingData->numEntries))
     {
-        const numTrainingDataEntries_t numEntries = pTrainingData->length;
-        
-        for (numTrainingDataEntries_t j = 0; j < numEntries; j++)
-        {
-            if (pTrainingData->data[j] > tempMax)
-            {
-                tempMax = pTrainingData->data[j];
-            }
-        }
+        EMBANN_LOGE(TAG, "Training samples need %d entries, like the first", pTrainingData->numEntries);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
 
 #ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-        pTrainingData += sizeof(trainingData_t);
-#else
-        pTrainingData = pTrainingData->next;
+#if (CONFIG_NUM_TRAINING_DATA_SETS == 0) || (CONFIG_NUM_TRAINING_DATA_ENTRIES == 0)
+#error "Training data dimensions cannot be equal to 0"
 #endif
+    if ((pTrainingData->numSets >= pTrainingData->capacity) ||
+        (numElements > CONFIG_NUM_TRAINING_DATA_ENTRIES))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOMEM;
     }
+#endif
 
-    *max = tempMax;
+    if (pTrainingData->numSets == 0U)
+    {
+        pTrainingData->numEntries = numElements;
+        pTrainingData->featureStride = TRAINING_DATA_STRIDE(numElements);
+    }
+
+#ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
+    if (pTrainingData->numSets == pTrainingData->capacity)
+    {
+        const int err = _growTrainingData(pTrainingData);
+        if (err != EOK)
+        {
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return err;
+        }
+    }
+#endif
 
+    activation_t* pFeatures = TRAINING_DATA_FEATURES(pTrainingData, pTrainingData->numSets);
+    memcpy(pFeatures, data, numElements * sizeof(activation_t));
+    /* So embann_saveDataset() writes out the padding as zeros */
+    memset(&pFeatures[numElements], 0, (pTrainingData->featureStride - numElements) * sizeof(activation_t));
+    pTrainingData->labels[pTrainingData->numSets] = correctResponse;
+    pTrainingData->numSets++;
     return EOK;
 }
 
-int embann_getTrainingDataMin(activation_t* min)
+/*
+ * Replaces the training samples with numSets zeroed samples of numEntries, to
+ * be filled in place through TRAINING_DATA_FEATURES() and the labels. Static
+ * builds have to have room for them already, ENOMEM otherwise.
+ */
+int embann_allocTrainingData(network_t* pNetwork, numTrainingDataSets_t numSets,
+                                numTrainingDataEntries_t numEntries)
 {
-    trainingData_t* pTrainingData = trainingDataCollection.head;
-    if (pTrainingData != NULL)
-    {
-        *min = pTrainingData->data[0];
-    }
-    else
+    trainingDataCollection_t* pTrainingData = &pNetwork->trainingData;
+    const uint32_t featureStride = TRAINING_DATA_STRIDE(numEntries);
+
+    if (numEntries == 0U)
     {
         // Deviation from MISRA C2012 15.5 for reasonably simple error return values
         // cppcheck-suppress misra-c2012-15.5
-        return ENOENT;
+        return EINVAL;
     }
 
-    if (pTrainingData->length == 0)
+#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
+    if ((numSets > pTrainingData->capacity) || (numEntries > CONFIG_NUM_TRAINING_DATA_ENTRIES))
     {
         // Deviation from MISRA C2012 15.5 for reasonably simple error return values
         // cppcheck-suppress misra-c2012-15.5
-        return ENOENT;
+        return ENOMEM;
     }
-
-#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-    const numTrainingDataSets_t numSets = trainingDataCollection.numSets;
-    for (numTrainingDataSets_t i = 0; i < numSets; i++)
-#else
-    while (pTrainingData != NULL)
 #endif
-    {
-        const numTrainingDataEntries_t numEntries = pTrainingData->length;
-        
-        for (numTrainingDataEntries_t j = 0; j < numEntries; j++)
-        {
-            if (pTrainingData->data[j] < *min)
-            {
-                *min = pTrainingData->data[j];
-            }
-        }
 
-#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-        pTrainingData += sizeof(trainingData_t);
-#else
-        pTrainingData = pTrainingData->next;
-#endif
+    (void) embann_clearTrainingData(pNetwork);
+#ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
+    /* At least one row, as an empty allocation may come back NULL */
+    const size_t featureBytes = (size_t) max(numSets, 1U) * featureStride * sizeof(activation_t);
+
+    pTrainingData->features = (activation_t*) EMBANN_ALIGNED_ALLOC(CONFIG_CACHE_LINE_SIZE, featureBytes);
+    EMBANN_MALLOC_CHECK(pTrainingData->features);
+    pTrainingData->labels = (numOutputs_t*) malloc((size_t) max(numSets, 1U) * sizeof(numOutputs_t));
+    if (pTrainingData->labels == NULL)
+    {
+        EMBANN_ALIGNED_FREE(pTrainingData->features);
+        pTrainingData->features = NULL;
     }
+    EMBANN_MALLOC_CHECK(pTrainingData->labels);
+    pTrainingData->capacity = numSets;
+#endif
 
+    memset(pTrainingData->features, 0, (size_t) numSets * featureStride * sizeof(activation_t));
+    memset(pTrainingData->labels, 0, (size_t) numSets * sizeof(numOutputs_t));
+    pTrainingData->numSets = numSets;
+    pTrainingData->numEntries = numEntries;
+    pTrainingData->featureStride = featureStride;
     return EOK;
 }
 
 
+
+
+
+/*
+ * Forgets every training sample. Dynamic builds give the block back to the
+ * heap, or unmap it if it came from embann_loadDataset().
+ */
+int embann_clearTrainingData(network_t* pNetwork)
+{
+    trainingDataCollection_t* pTrainingData = &pNetwork->trainingData;
+
 #ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
-int embann_addTrainingData(activation_t* data, uint32_t numElements, numOutputs_t correctResponse)
+#ifdef MAP_DATASET_FILES
+    if (pTrainingData->pFileMapping != NULL)
+    {
+        (void) munmap(pTrainingData->pFileMapping, pTrainingData->fileMappingSize);
+        pTrainingData->pFileMapping = NULL;
+    }
+    else
+#endif
+    {
+        EMBANN_ALIGNED_FREE(pTrainingData->features);
+        free(pTrainingData->labels);
+    }
+    free(pTrainingData->order);
+    pTrainingData->features = NULL;
+    pTrainingData->labels = NULL;
+    pTrainingData->order = NULL;
+    pTrainingData->capacity = 0U;
+#endif
+    pTrainingData->numSets = 0U;
+    pTrainingData->numOrdered = 0U;
+    return EOK;
+}
+
+
+
+
+
+/*
+ * Starts a new epoch, visiting every training sample once in a fresh random
+ * order drawn from random(). The samples themselves stay where they are,
+ * only the order embann_getNextDataSet() hands them out in is shuffled.
+ * With CONFIG_SHUFFLE_BLOCK_SIZE the order of the blocks is shuffled, then
+ * the samples within each block.
+ */
+int embann_shuffleTrainingData(network_t* pNetwork)
 {
-    trainingData_t* trainingDataNode = (trainingData_t*) malloc(sizeof(trainingData_t));
-    EMBANN_MALLOC_CHECK(trainingDataNode);
+    trainingDataCollection_t* pTrainingData = &pNetwork->trainingData;
+    const numTrainingDataSets_t numSets = pTrainingData->numSets;
 
-    if (numElements == 0U)
+    if (numSets == 0U)
     {
         // Deviation from MISRA C2012 15.5 for reasonably simple error return values
         // cppcheck-suppress misra-c2012-15.5
         return ENOENT;
     }
 
-    trainingDataNode->next = NULL;
-    trainingDataNode->data = data;
-    trainingDataNode->length = numElements;
-    trainingDataNode->correctResponse = correctResponse;
+#ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
+    /* Reshuffling the same samples reuses the order, so only the first shuffle after a change can fail */
+    if (pTrainingData->numOrdered != numSets)
+    {
+        numTrainingDataSets_t* pOrder = (numTrainingDataSets_t*) realloc(pTrainingData->order,
+                                                                            numSets * sizeof(numTrainingDataSets_t));
+        EMBANN_MALLOC_CHECK(pOrder);
+        pTrainingData->order = pOrder;
+    }
+#endif
+
+#if (CONFIG_SHUFFLE_BLOCK_SIZE > 1)
+    const numTrainingDataSets_t numBlocks = (numSets / CONFIG_SHUFFLE_BLOCK_SIZE) +
+                                            (((numSets % CONFIG_SHUFFLE_BLOCK_SIZE) != 0U) ? 1U : 0U);
 
-    if (trainingDataCollection.head == NULL)
+    for (numTrainingDataSets_t i = 0; i < numBlocks; i++)
     {
-        trainingDataCollection.head = trainingDataNode;
-        trainingDataCollection.tail = trainingDataNode;
+        pTrainingData->order[i] = i;
     }
-    else
+    _shuffleRange(pTrainingData->order, numBlocks);
+    _expandBlocks(pTrainingData->order, numSets);
+#else
+    for (numTrainingDataSets_t i = 0; i < numSets; i++)
     {
-        trainingDataCollection.tail->next = trainingDataNode;
-        trainingDataCollection.tail = trainingDataNode;
+        pTrainingData->order[i] = i;
     }
-    ++trainingDataCollection.numSets;
+    _shuffleRange(pTrainingData->order, numSets);
+#endif
+
+    pTrainingData->numOrdered = numSets;
+    pTrainingData->nextInOrder = 0U;
     return EOK;
 }
-#endif
 
-int embann_copyTrainingData(activation_t data[], uint32_t numElements, numOutputs_t correctResponse)
+
+
+
+
+/*
+ * The next sample of this epoch, for TRAINING_DATA_FEATURES() and the labels.
+ * Shuffles for a new epoch once every sample has been handed out, or when
+ * samples have been added or replaced since the last shuffle.
+ */
+int embann_getNextDataSet(network_t* pNetwork, numTrainingDataSets_t* pIndex)
 {
-#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-#if (CONFIG_NUM_TRAINING_DATA_SETS == 0) || (CONFIG_NUM_TRAINING_DATA_ENTRIES == 0)
-#error "Training data dimensions cannot be equal to 0"
-#endif
-    trainingData_t* trainingDataNode = &trainingData[trainingDataCollection.numSets];
-#else
-    trainingData_t* trainingDataNode = (trainingData_t*) malloc(sizeof(trainingData_t));
-    EMBANN_MALLOC_CHECK(trainingDataNode);
-#endif
+    trainingDataCollection_t* pTrainingData = &pNetwork->trainingData;
 
-    if (numElements == 0U)
+    if ((pTrainingData->numOrdered != pTrainingData->numSets) ||
+        (pTrainingData->nextInOrder >= pTrainingData->numOrdered))
+    {
+        const int err = embann_shuffleTrainingData(pNetwork);
+        if (err != EOK)
+        {
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return err;
+        }
+    }
+
+    *pIndex = pTrainingData->order[pTrainingData->nextInOrder];
+    pTrainingData->nextInOrder++;
+    return EOK;
+}
+
+
+
+
+
+/*
+ * Picks a training sample at random, for TRAINING_DATA_FEATURES() and the
+ * labels. Samples can come up more than once before others come up at all,
+ * embann_getNextDataSet() visits each once per epoch.
+ */
+int embann_getRandomDataSet(const network_t* pNetwork, numTrainingDataSets_t* pIndex)
+{
+    if (pNetwork->trainingData.numSets == 0U)
     {
         // Deviation from MISRA C2012 15.5 for reasonably simple error return values
         // cppcheck-suppress misra-c2012-15.5
         return ENOENT;
     }
 
+    *pIndex = (numTrainingDataSets_t) (random() % pNetwork->trainingData.numSets);
+    return EOK;
+}
+
+
+
+
+
 #ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
-    trainingDataNode->data = (activation_t*) malloc(numElements * sizeof(activation_t));
-    trainingDataNode->next = NULL;
-#endif
-    trainingDataNode->length = numElements;
-    trainingDataNode->correctResponse = correctResponse;
-    memcpy(trainingDataNode->data, data, numElements * sizeof(activation_t));
+/* Doubles the room for samples, moving the ones there already into the new block */
+static int _growTrainingData(trainingDataCollection_t* pTrainingData)
+{
+    const numTrainingDataSets_t capacity = (pTrainingData->capacity == 0U) ? 16U : (pTrainingData->capacity * 2U);
+    const size_t rowBytes = pTrainingData->featureStride * sizeof(activation_t);
 
-    if (trainingDataCollection.head == NULL)
+    if (capacity < pTrainingData->capacity)
     {
-        trainingDataCollection.head = trainingDataNode;
-#ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
-        trainingDataCollection.tail = trainingDataNode;
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOMEM;
     }
-    else
+
+    activation_t* pFeatures = (activation_t*) EMBANN_ALIGNED_ALLOC(CONFIG_CACHE_LINE_SIZE, capacity * rowBytes);
+    EMBANN_MALLOC_CHECK(pFeatures);
+    numOutputs_t* pLabels = (numOutputs_t*) realloc(pTrainingData->labels, capacity * sizeof(numOutputs_t));
+    if (pLabels == NULL)
     {
-        trainingDataCollection.tail->next = trainingDataNode;
-        trainingDataCollection.tail = trainingDataNode;
-#endif
+        EMBANN_ALIGNED_FREE(pFeatures);
+    }
+    EMBANN_MALLOC_CHECK(pLabels);
+
+    if (pTrainingData->features != NULL)
+    {
+        memcpy(pFeatures, pTrainingData->features, pTrainingData->numSets * rowBytes);
+        EMBANN_ALIGNED_FREE(pTrainingData->features);
     }
-    trainingDataCollection.numSets++;
+    pTrainingData->features = pFeatures;
+    pTrainingData->labels = pLabels;
+    pTrainingData->capacity = capacity;
     return EOK;
 }
+#endif
+
+
+
 
-int embann_shuffleTrainingData(void)
+
+/* Fisher-Yates, every order of the numIndices indices at pOrder is equally likely */
+static void _shuffleRange(numTrainingDataSets_t* pOrder, numTrainingDataSets_t numIndices)
 {
-    return EOK;
+    for (numTrainingDataSets_t i = numIndices; i > 1U; i--)
+    {
+        const numTrainingDataSets_t j = _randomBelow(i);
+        const numTrainingDataSets_t swap = pOrder[i - 1U];
+
+        pOrder[i - 1U] = pOrder[j];
+        pOrder[j] = swap;
+    }
 }
 
 
 
 
 
-int embann_getRandomDataSet(trainingData_t** dataSet)
+#if (CONFIG_SHUFFLE_BLOCK_SIZE > 1)
+/*
+ * Replaces the shuffled block numbers at the start of pOrder with the indices
+ * of the samples in each block, shuffled within the block. Works backwards so
+ * it can be done in place, as no block starts before its own number's slot.
+ * Only the last block can be short, which moves every block after it down.
+ */
+static void _expandBlocks(numTrainingDataSets_t* pOrder, numTrainingDataSets_t numSets)
 {
-    if (trainingDataCollection.numSets == 0)
+    const uint64_t blockSize = CONFIG_SHUFFLE_BLOCK_SIZE;
+    const numTrainingDataSets_t numBlocks = (numSets / CONFIG_SHUFFLE_BLOCK_SIZE) +
+                                            (((numSets % CONFIG_SHUFFLE_BLOCK_SIZE) != 0U) ? 1U : 0U);
+    const uint64_t shortfall = ((uint64_t) numBlocks * blockSize) - numSets;
+    numTrainingDataSets_t lastBlockSlot = 0U;
+
+    for (numTrainingDataSets_t slot = 0; slot < numBlocks; slot++)
     {
-        return ENOENT;
+        lastBlockSlot = (pOrder[slot] == (numBlocks - 1U)) ? slot : lastBlockSlot;
     }
-    else
+
+    for (numTrainingDataSets_t slot = numBlocks; slot > 0U; slot--)
     {
-#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-        *dataSet = &trainingData[random() % trainingDataCollection.numSets];
-        return EOK;
-#endif
+        const numTrainingDataSets_t block = pOrder[slot - 1U];
+        const uint64_t start = ((uint64_t) (slot - 1U) * blockSize) - (((slot - 1U) > lastBlockSlot) ? shortfall : 0U);
+        const uint64_t firstSample = (uint64_t) block * blockSize;
+        const numTrainingDataSets_t numSamples = (numTrainingDataSets_t) (min((uint64_t) numSets,
+                                                                                firstSample + blockSize) - firstSample);
+
+        for (numTrainingDataSets_t i = 0; i < numSamples; i++)
+        {
+            pOrder[start + i] = (numTrainingDataSets_t) (firstSample + i);
+        }
+        _shuffleRange(&pOrder[start], numSamples);
     }
-}
\ No newline at end of file
+}
+#endif
+
+
+
+
+
+/*
+ * random() only has 31 bits, so two of them for anything that might need
+ * more. Draws past the last whole multiple of limit are thrown away, so every
+ * result is equally likely.
+ */
+static numTrainingDataSets_t _randomBelow(numTrainingDataSets_t limit)
+{
+    const bool isWide = ((uint64_t) limit > 0x7FFFFFFFULL);
+    const uint64_t range = isWide ? (1ULL << 62U) : (1ULL << 31U);
+    const uint64_t numUsable = range - (range % limit);
+    uint64_t bits;
+
+    do
+    {
+        bits = isWide ? (((uint64_t) random() << 31U) | (uint64_t) random()) : (uint64_t) random();
+    } while (bits >= numUsable);
+    return (numTrainingDataSets_t) (bits % limit);
+}
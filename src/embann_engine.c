@@ -0,0 +1,603 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+    embann_engine.c - EMbedded Backpropogating Artificial Neural Network.
+    Copyright Peter Frost 2019
+*/
+
+/* For sem_clockwait(), has to come before anything includes the system headers */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "embann.h"
+#include "embann_log.h"
+
+#define TAG "Embann Engine"
+
+/*
+ * Requests go through a bounded multi-producer multi-consumer ring, where
+ * each cell's sequence number says whether it's free for the producer at that
+ * position or full for the consumer at it, so neither side ever takes a lock.
+ * The semaphore counts requests in the ring and is only there so idle
+ * workers can sleep.
+ */
+
+#ifdef CONFIG_INFERENCE_ENGINE
+#if defined(_WIN32) || defined(ARDUINO)
+#error "The inference engine needs POSIX threads and semaphores"
+#endif
+#if ((CONFIG_ENGINE_QUEUE_SIZE & (CONFIG_ENGINE_QUEUE_SIZE - 1)) != 0) || (CONFIG_ENGINE_QUEUE_SIZE < 2)
+#error "Inference engine queue size must be a power of 2"
+#endif
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <time.h>
+
+/* glibc 2.30 added sem_clockwait(), which waits on the monotonic clock */
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ >= 30)))
+#define HAVE_SEM_CLOCKWAIT
+#endif
+
+typedef struct
+{
+    atomic_size_t sequence;
+    inferenceRequest_t* pRequest;
+} queueCell_t;
+
+typedef struct
+{
+    inferenceEngine_t* pEngine;
+    pthread_t thread;
+    batchScratch_t scratch;
+    inferenceRequest_t** pBatch;    /* maxBatchSize requests, packed into pInputs */
+    activation_t* pInputs;
+    activation_t* pOutputs;
+    numOutputs_t* pResponses;
+} engineWorker_t;
+
+struct inferenceEngine
+{
+    /* Submitting and working threads each write their own cache line */
+    atomic_size_t enqueuePos CACHE_ALIGNMENT;
+    atomic_size_t dequeuePos CACHE_ALIGNMENT;
+    queueCell_t cells[CONFIG_ENGINE_QUEUE_SIZE] CACHE_ALIGNMENT;
+    sem_t numQueued;
+    atomic_bool stopping;
+    pthread_mutex_t doneMutex;      /* Only for embann_waitInference() sleeping */
+    pthread_cond_t doneCondition;
+    const network_t* pNetwork;
+    uint32_t numWorkers;
+    uint32_t maxBatchSize;
+    uint32_t maxWaitMicros;
+    engineWorker_t* pWorkers;
+};
+
+
+static bool _enqueue(inferenceEngine_t* pEngine, inferenceRequest_t* pRequest);
+static inferenceRequest_t* _dequeue(inferenceEngine_t* pEngine);
+static inferenceRequest_t* _takeRequest(inferenceEngine_t* pEngine);
+static bool _waitForRequestUntil(inferenceEngine_t* pEngine, uint64_t deadlineMicros);
+static uint32_t _gatherBatch(engineWorker_t* pWorker, inferenceRequest_t* pFirst);
+static void _runBatch(engineWorker_t* pWorker, uint32_t numSamples);
+static void* _workerThread(void* pArg);
+static int _initWorker(engineWorker_t* pWorker, inferenceEngine_t* pEngine);
+static void _freeWorker(engineWorker_t* pWorker);
+static uint64_t _monotonicMicros(void);
+
+
+
+
+
+/*
+ * Starts numWorkers threads running requests through pNetwork, in batches of
+ * up to maxBatchSize. A worker that has a request waits at most maxWaitMicros
+ * from when it was submitted for the batch to fill up, so that's roughly the
+ * most batching adds to a request's latency. pNetwork is only read, and
+ * mustn't be trained or loaded into until embann_freeEngine().
+ */
+int embann_initEngine(inferenceEngine_t** ppEngine, const network_t* pNetwork, uint32_t numWorkers,
+                        uint32_t maxBatchSize, uint32_t maxWaitMicros)
+{
+    if ((ppEngine == NULL) || (pNetwork == NULL) || (numWorkers == 0U) || (maxBatchSize == 0U))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    inferenceEngine_t* pEngine = (inferenceEngine_t*) EMBANN_ALIGNED_ALLOC(CONFIG_CACHE_LINE_SIZE,
+                                                        ROUND_UP_TO_CACHE_LINE(sizeof(inferenceEngine_t)));
+    EMBANN_MALLOC_CHECK(pEngine);
+    pEngine->pWorkers = (engineWorker_t*) calloc(numWorkers, sizeof(engineWorker_t));
+    EMBANN_MALLOC_CHECK(pEngine->pWorkers);
+
+    for (size_t i = 0; i < CONFIG_ENGINE_QUEUE_SIZE; i++)
+    {
+        atomic_init(&pEngine->cells[i].sequence, i);
+    }
+    atomic_init(&pEngine->enqueuePos, 0U);
+    atomic_init(&pEngine->dequeuePos, 0U);
+    atomic_init(&pEngine->stopping, false);
+    (void) sem_init(&pEngine->numQueued, 0, 0U);
+    (void) pthread_mutex_init(&pEngine->doneMutex, NULL);
+    (void) pthread_cond_init(&pEngine->doneCondition, NULL);
+    pEngine->pNetwork = pNetwork;
+    pEngine->numWorkers = 0U;
+    pEngine->maxBatchSize = maxBatchSize;
+    pEngine->maxWaitMicros = maxWaitMicros;
+
+    int err = EOK;
+    for (uint32_t i = 0; (i < numWorkers) && (err == EOK); i++)
+    {
+        err = _initWorker(&pEngine->pWorkers[i], pEngine);
+        if (err == EOK)
+        {
+            pEngine->numWorkers++;
+        }
+    }
+
+    if (err != EOK)
+    {
+        EMBANN_LOGE(TAG, "Could only start %d of %d workers", pEngine->numWorkers, numWorkers);
+        (void) embann_freeEngine(pEngine);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return err;
+    }
+
+    *ppEngine = pEngine;
+    return EOK;
+}
+
+
+
+
+
+/*
+ * Completes everything already submitted, then stops the workers and frees
+ * pEngine. Nothing may be submitted once this has been called.
+ */
+int embann_freeEngine(inferenceEngine_t* pEngine)
+{
+    if (pEngine == NULL)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    /* One extra count with an empty queue tells a worker to stop, and it passes it on */
+    atomic_store(&pEngine->stopping, true);
+    (void) sem_post(&pEngine->numQueued);
+
+    for (uint32_t i = 0; i < pEngine->numWorkers; i++)
+    {
+        (void) pthread_join(pEngine->pWorkers[i].thread, NULL);
+        _freeWorker(&pEngine->pWorkers[i]);
+    }
+
+    (void) sem_destroy(&pEngine->numQueued);
+    (void) pthread_mutex_destroy(&pEngine->doneMutex);
+    (void) pthread_cond_destroy(&pEngine->doneCondition);
+    free(pEngine->pWorkers);
+    EMBANN_ALIGNED_FREE(pEngine);
+    return EOK;
+}
+
+
+
+
+
+/*
+ * Queues pRequest for a worker and returns straight away, from any number of
+ * threads at once. When the worker's done, pRequest->err, networkResponse
+ * and pOutputs are filled in and pCallback is called on the worker's thread,
+ * or embann_waitInference() returns if there's no callback. EAGAIN if the
+ * queue is full.
+ */
+int embann_submitInference(inferenceEngine_t* pEngine, inferenceRequest_t* pRequest)
+{
+    if ((pEngine == NULL) || (pRequest == NULL) || (pRequest->pInputs == NULL))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    if (atomic_load_explicit(&pEngine->stopping, memory_order_relaxed))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ECANCELED;
+    }
+
+    pRequest->err = EOK;
+    pRequest->networkResponse = 0U;
+    atomic_store_explicit(&pRequest->done, false, memory_order_relaxed);
+    pRequest->submitMicros = _monotonicMicros();
+
+    if (!_enqueue(pEngine, pRequest))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EAGAIN;
+    }
+
+    (void) sem_post(&pEngine->numQueued);
+    return EOK;
+}
+
+
+
+
+
+/* Blocks until a request submitted without a callback has been completed */
+int embann_waitInference(inferenceEngine_t* pEngine, inferenceRequest_t* pRequest)
+{
+    if ((pEngine == NULL) || (pRequest == NULL) || (pRequest->pCallback != NULL))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    if (!atomic_load_explicit(&pRequest->done, memory_order_acquire))
+    {
+        (void) pthread_mutex_lock(&pEngine->doneMutex);
+        while (!atomic_load_explicit(&pRequest->done, memory_order_acquire))
+        {
+            (void) pthread_cond_wait(&pEngine->doneCondition, &pEngine->doneMutex);
+        }
+        (void) pthread_mutex_unlock(&pEngine->doneMutex);
+    }
+    return pRequest->err;
+}
+
+
+
+
+
+static bool _enqueue(inferenceEngine_t* pEngine, inferenceRequest_t* pRequest)
+{
+    size_t pos = atomic_load_explicit(&pEngine->enqueuePos, memory_order_relaxed);
+
+    for (;;)
+    {
+        queueCell_t* pCell = &pEngine->cells[pos & (CONFIG_ENGINE_QUEUE_SIZE - 1U)];
+        const size_t sequence = atomic_load_explicit(&pCell->sequence, memory_order_acquire);
+        const intptr_t difference = (intptr_t) sequence - (intptr_t) pos;
+
+        if (difference == 0)
+        {
+            /* Free for this position, if no other producer gets it first */
+            if (atomic_compare_exchange_weak_explicit(&pEngine->enqueuePos, &pos, pos + 1U,
+                                                        memory_order_relaxed, memory_order_relaxed))
+            {
+                pCell->pRequest = pRequest;
+                atomic_store_explicit(&pCell->sequence, pos + 1U, memory_order_release);
+                // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+                // cppcheck-suppress misra-c2012-15.5
+                return true;
+            }
+        }
+        else if (difference < 0)
+        {
+            /* Still holding the request from a lap ago, so the queue is full */
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&pEngine->enqueuePos, memory_order_relaxed);
+        }
+    }
+}
+
+
+
+
+
+static inferenceRequest_t* _dequeue(inferenceEngine_t* pEngine)
+{
+    size_t pos = atomic_load_explicit(&pEngine->dequeuePos, memory_order_relaxed);
+
+    for (;;)
+    {
+        queueCell_t* pCell = &pEngine->cells[pos & (CONFIG_ENGINE_QUEUE_SIZE - 1U)];
+        const size_t sequence = atomic_load_explicit(&pCell->sequence, memory_order_acquire);
+        const intptr_t difference = (intptr_t) sequence - (intptr_t) (pos + 1U);
+
+        if (difference == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&pEngine->dequeuePos, &pos, pos + 1U,
+                                                        memory_order_relaxed, memory_order_relaxed))
+            {
+                inferenceRequest_t* pRequest = pCell->pRequest;
+                /* Free for the producer one lap on */
+                atomic_store_explicit(&pCell->sequence, pos + CONFIG_ENGINE_QUEUE_SIZE, memory_order_release);
+                // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+                // cppcheck-suppress misra-c2012-15.5
+                return pRequest;
+            }
+        }
+        else if (difference < 0)
+        {
+            /* Empty, or the producer at this position hasn't finished writing it yet */
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return NULL;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&pEngine->dequeuePos, memory_order_relaxed);
+        }
+    }
+}
+
+
+
+
+
+/*
+ * Takes the request that the count just taken from numQueued was for, or
+ * returns NULL if it was embann_freeEngine()'s stop count.
+ */
+static inferenceRequest_t* _takeRequest(inferenceEngine_t* pEngine)
+{
+    inferenceRequest_t* pRequest = _dequeue(pEngine);
+
+    while (pRequest == NULL)
+    {
+        if (atomic_load(&pEngine->stopping) &&
+            (atomic_load(&pEngine->enqueuePos) == atomic_load(&pEngine->dequeuePos)))
+        {
+            /* Leave the stop count for the next worker */
+            (void) sem_post(&pEngine->numQueued);
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return NULL;
+        }
+
+        /* A producer ahead of the one that posted is still writing its cell */
+        (void) sched_yield();
+        pRequest = _dequeue(pEngine);
+    }
+    return pRequest;
+}
+
+
+
+
+
+/* Takes a count from numQueued, giving up at deadlineMicros on the monotonic clock */
+static bool _waitForRequestUntil(inferenceEngine_t* pEngine, uint64_t deadlineMicros)
+{
+    if (sem_trywait(&pEngine->numQueued) == 0)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return true;
+    }
+
+    const uint64_t nowMicros = _monotonicMicros();
+    if (nowMicros >= deadlineMicros)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return false;
+    }
+
+#ifdef HAVE_SEM_CLOCKWAIT
+    const struct timespec deadline = {
+        .tv_sec = (time_t) (deadlineMicros / 1000000U),
+        .tv_nsec = (long) ((deadlineMicros % 1000000U) * 1000U)
+    };
+
+    int ret;
+    do
+    {
+        ret = sem_clockwait(&pEngine->numQueued, CLOCK_MONOTONIC, &deadline);
+    } while ((ret != 0) && (errno == EINTR));
+#else
+    /*
+     * sem_timedwait() only takes the wall clock, so it's waited on again
+     * until the monotonic deadline has really passed. A step forwards then
+     * can't end the wait early, though a step backwards still stretches it.
+     */
+    int ret = -1;
+    uint64_t remainingMicros = deadlineMicros - nowMicros;
+
+    while ((ret != 0) && (remainingMicros > 0U))
+    {
+        const uint64_t remainingNanos = remainingMicros * 1000U;
+        struct timespec deadline;
+        (void) clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += (time_t) ((deadline.tv_nsec + remainingNanos) / 1000000000U);
+        deadline.tv_nsec = (long) ((deadline.tv_nsec + remainingNanos) % 1000000000U);
+
+        ret = sem_timedwait(&pEngine->numQueued, &deadline);
+
+        const uint64_t afterMicros = _monotonicMicros();
+        remainingMicros = (afterMicros < deadlineMicros) ? (deadlineMicros - afterMicros) : 0U;
+    }
+#endif
+
+    return (ret == 0);
+}
+
+
+
+
+
+/*
+ * Fills the worker's batch, starting with pFirst, until it's maxBatchSize
+ * long or pFirst has been waiting maxWaitMicros
+ */
+static uint32_t _gatherBatch(engineWorker_t* pWorker, inferenceRequest_t* pFirst)
+{
+    inferenceEngine_t* pEngine = pWorker->pEngine;
+    const uint64_t deadlineMicros = pFirst->submitMicros + pEngine->maxWaitMicros;
+    uint32_t numSamples = 1U;
+    bool gathering = true;
+
+    pWorker->pBatch[0] = pFirst;
+    while (gathering && (numSamples < pEngine->maxBatchSize))
+    {
+        gathering = _waitForRequestUntil(pEngine, deadlineMicros);
+        if (gathering)
+        {
+            inferenceRequest_t* pRequest = _takeRequest(pEngine);
+            gathering = (pRequest != NULL);
+            if (gathering)
+            {
+                pWorker->pBatch[numSamples] = pRequest;
+                numSamples++;
+            }
+        }
+    }
+    return numSamples;
+}
+
+
+
+
+
+static void _runBatch(engineWorker_t* pWorker, uint32_t numSamples)
+{
+    inferenceEngine_t* pEngine = pWorker->pEngine;
+    const numInputs_t numInputs = pEngine->pNetwork->inputLayer->numNeurons;
+    const numOutputs_t numOutputs = pEngine->pNetwork->outputLayer->numNeurons;
+    bool anyWaiting = false;
+
+    for (uint32_t i = 0; i < numSamples; i++)
+    {
+        memcpy(&pWorker->pInputs[i * numInputs], pWorker->pBatch[i]->pInputs, numInputs * sizeof(activation_t));
+    }
+
+    const int err = embann_forwardPropagateBatchScratch(pEngine->pNetwork, &pWorker->scratch, pWorker->pInputs,
+                                                        numSamples, pWorker->pOutputs, pWorker->pResponses);
+    EMBANN_LOGD(TAG, "Ran batch of %d", numSamples);
+
+    /* The request belongs to its submitter again as soon as it's completed, so nothing touches it after */
+    for (uint32_t i = 0; i < numSamples; i++)
+    {
+        inferenceRequest_t* pRequest = pWorker->pBatch[i];
+
+        pRequest->err = err;
+        pRequest->networkResponse = pWorker->pResponses[i];
+        if (pRequest->pOutputs != NULL)
+        {
+            memcpy(pRequest->pOutputs, &pWorker->pOutputs[i * numOutputs], numOutputs * sizeof(activation_t));
+        }
+
+        if (pRequest->pCallback != NULL)
+        {
+            pRequest->pCallback(pRequest);
+        }
+        else
+        {
+            atomic_store_explicit(&pRequest->done, true, memory_order_release);
+            anyWaiting = true;
+        }
+    }
+
+    if (anyWaiting)
+    {
+        /* Taking the mutex means no waiter can be between checking done and sleeping */
+        (void) pthread_mutex_lock(&pEngine->doneMutex);
+        (void) pthread_cond_broadcast(&pEngine->doneCondition);
+        (void) pthread_mutex_unlock(&pEngine->doneMutex);
+    }
+}
+
+
+
+
+
+static void* _workerThread(void* pArg)
+{
+    engineWorker_t* pWorker = (engineWorker_t*) pArg;
+    inferenceEngine_t* pEngine = pWorker->pEngine;
+    bool running = true;
+
+    while (running)
+    {
+        while (sem_wait(&pEngine->numQueued) != 0)
+        {
+            /* Only ever interrupted by signals */
+        }
+
+        inferenceRequest_t* pFirst = _takeRequest(pEngine);
+        running = (pFirst != NULL);
+        if (running)
+        {
+            _runBatch(pWorker, _gatherBatch(pWorker, pFirst));
+        }
+    }
+    return NULL;
+}
+
+
+
+
+
+static int _initWorker(engineWorker_t* pWorker, inferenceEngine_t* pEngine)
+{
+    const network_t* pNetwork = pEngine->pNetwork;
+    const uint32_t maxBatchSize = pEngine->maxBatchSize;
+
+    pWorker->pEngine = pEngine;
+    int err = embann_allocBatchScratch(&pWorker->scratch, pNetwork);
+    if (err != EOK)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return err;
+    }
+    pWorker->pBatch = (inferenceRequest_t**) malloc(maxBatchSize * sizeof(inferenceRequest_t*));
+    EMBANN_MALLOC_CHECK(pWorker->pBatch);
+    pWorker->pInputs = (activation_t*) malloc(maxBatchSize * pNetwork->inputLayer->numNeurons *
+                                                sizeof(activation_t));
+    EMBANN_MALLOC_CHECK(pWorker->pInputs);
+    pWorker->pOutputs = (activation_t*) malloc(maxBatchSize * pNetwork->outputLayer->numNeurons *
+                                                sizeof(activation_t));
+    EMBANN_MALLOC_CHECK(pWorker->pOutputs);
+    pWorker->pResponses = (numOutputs_t*) malloc(maxBatchSize * sizeof(numOutputs_t));
+    EMBANN_MALLOC_CHECK(pWorker->pResponses);
+
+    err = pthread_create(&pWorker->thread, NULL, _workerThread, pWorker);
+    if (err != 0)
+    {
+        _freeWorker(pWorker);
+    }
+    return err;
+}
+
+
+
+
+
+static void _freeWorker(engineWorker_t* pWorker)
+{
+    (void) embann_freeBatchScratch(&pWorker->scratch);
+    free(pWorker->pBatch);
+    free(pWorker->pInputs);
+    free(pWorker->pOutputs);
+    free(pWorker->pResponses);
+}
+
+
+
+
+
+static uint64_t _monotonicMicros(void)
+{
+    struct timespec now;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t) now.tv_sec * 1000000U) + ((uint64_t) now.tv_nsec / 1000U);
+}
+#endif // CONFIG_INFERENCE_ENGINE
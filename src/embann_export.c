@@ -0,0 +1,343 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+    embann_export.c - EMbedded Backpropogating Artificial Neural Network.
+    Copyright Peter Frost 2019
+*/
+
+#include "embann.h"
+#include "embann_log.h"
+#include <ctype.h>
+
+#define TAG "Embann Export"
+
+/*
+ * Layers with more multiply accumulates than this are written as constant
+ * bound loops rather than unrolled, the compiler still sees every dimension
+ * but the source doesn't grow with the square of the layer size
+ */
+#define EXPORT_UNROLL_LIMIT 4096U
+
+/* Enough digits for values to read back exactly, the same type on both ends */
+#if defined(WEIGHT_IS_FLOAT)
+#define WRITE_WEIGHT(pFile, value) fprintf(pFile, " %.17g,", (double) (value))
+#elif defined(WEIGHT_IS_SIGNED)
+#define WRITE_WEIGHT(pFile, value) fprintf(pFile, " %lld,", (long long) (value))
+#else
+#define WRITE_WEIGHT(pFile, value) fprintf(pFile, " %lluU,", (unsigned long long) (value))
+#endif
+
+#if defined(BIAS_IS_FLOAT)
+#define WRITE_BIAS(pFile, value) fprintf(pFile, " %.17g,", (double) (value))
+#elif defined(BIAS_IS_SIGNED)
+#define WRITE_BIAS(pFile, value) fprintf(pFile, " %lld,", (long long) (value))
+#else
+#define WRITE_BIAS(pFile, value) fprintf(pFile, " %lluU,", (unsigned long long) (value))
+#endif
+
+#if defined(ACCUMULATOR_IS_FLOAT)
+#define WRITE_ACCUMULATOR(pFile, value) fprintf(pFile, " %.17g,", (double) (value))
+#elif defined(ACCUMULATOR_IS_SIGNED)
+#define WRITE_ACCUMULATOR(pFile, value) fprintf(pFile, " %lld,", (long long) (value))
+#else
+#define WRITE_ACCUMULATOR(pFile, value) fprintf(pFile, " %lluU,", (unsigned long long) (value))
+#endif
+
+static const char* const functionNames[NUM_ACTIVATION_FUNCTIONS] = {
+    [SOFTSIGN] = "SOFTSIGN", [RELU] = "RELU", [LEAKY_RELU] = "LEAKY_RELU", [TANH] = "TANH"
+};
+
+
+static bool _isIdentifier(const char* pName);
+static int _writeSource(const network_t* pNetwork, FILE* pFile, const char* pFunctionName);
+static void _writeLayerData(const network_t* pNetwork, FILE* pFile, numLayers_t layer);
+static void _writeLayer(const network_t* pNetwork, FILE* pFile, numLayers_t layer, const char* pInput,
+                        const char* pOutput);
+static void _writeNeuron(const network_t* pNetwork, FILE* pFile, numLayers_t layer, const char* pNeuron,
+                            const char* pInput, const char* pOutput, const char* pIndent);
+static void _writeMostLikelyOutput(FILE* pFile, numOutputs_t numOutputs, bool unroll);
+static bool _unrollLayer(const layerDescriptor_t* pLayer);
+
+
+
+
+
+/*
+ * Writes the network as a C translation unit defining
+ *     numOutputs_t pFunctionName(const activation_t* pInputs, activation_t* pOutputs)
+ * which forward propagates pInputs, writes the output layer to pOutputs and
+ * returns the index of the largest output, like embann_forwardPropagate() and
+ * embann_getMostLikelyOutput() together.
+ *
+ * The weights and biases are static const, so they live in .rodata, and
+ * every dimension is a constant, so layers up to EXPORT_UNROLL_LIMIT
+ * multiply accumulates are unrolled into straight line code. The generated
+ * function needs nothing initialising, but it does need an embann.h with the
+ * same embann_config.h types as the network it was exported from.
+ */
+int embann_exportSource(const network_t* pNetwork, const char* pPath, const char* pFunctionName)
+{
+    if ((pPath == NULL) || !_isIdentifier(pFunctionName))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    FILE* pFile = fopen(pPath, "w");
+    if (pFile == NULL)
+    {
+        EMBANN_LOGE(TAG, "Couldn't open %s", pPath);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EIO;
+    }
+
+    int err = _writeSource(pNetwork, pFile, pFunctionName);
+    if ((fclose(pFile) != 0) && (err == EOK))
+    {
+        err = EIO;
+    }
+    return err;
+}
+
+
+
+
+
+static bool _isIdentifier(const char* pName)
+{
+    if ((pName == NULL) || !(isalpha((unsigned char) pName[0]) || (pName[0] == '_')))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return false;
+    }
+
+    for (const char* pChar = pName; *pChar != '\0'; pChar++)
+    {
+        if (!isalnum((unsigned char) *pChar) && (*pChar != '_'))
+        {
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return false;
+        }
+    }
+    return true;
+}
+
+
+
+
+
+static int _writeSource(const network_t* pNetwork, FILE* pFile, const char* pFunctionName)
+{
+    const numLayers_t numHiddenLayers = pNetwork->properties.numHiddenLayers;
+    const layerDescriptor_t outputLayer = embann_describeLayer(pNetwork, numHiddenLayers);
+    char input[24];
+    char output[24];
+
+    fprintf(pFile, "/* File auto-generated by embann_exportSource() */\n");
+    fprintf(pFile, "#include \"embann.h\"\n\n");
+    fprintf(pFile, "numOutputs_t %s(const activation_t* pInputs, activation_t* pOutputs);\n", pFunctionName);
+
+    for (numLayers_t layer = 0; layer <= numHiddenLayers; layer++)
+    {
+        _writeLayerData(pNetwork, pFile, layer);
+    }
+
+    fprintf(pFile, "\n\n\n\n\n");
+    fprintf(pFile, "numOutputs_t %s(const activation_t* pInputs, activation_t* pOutputs)\n{\n", pFunctionName);
+    for (numLayers_t layer = 0; layer < numHiddenLayers; layer++)
+    {
+        fprintf(pFile, "    activation_t hidden_%u[%uU];\n", (unsigned) layer,
+                (unsigned) embann_describeLayer(pNetwork, layer).numNeurons);
+    }
+    fprintf(pFile, "    accumulator_t accum;\n");
+
+    for (numLayers_t layer = 0; layer <= numHiddenLayers; layer++)
+    {
+        if (layer == 0U)
+        {
+            (void) snprintf(input, sizeof(input), "pInputs");
+        }
+        else
+        {
+            (void) snprintf(input, sizeof(input), "hidden_%u", (unsigned) layer - 1U);
+        }
+        if (layer == numHiddenLayers)
+        {
+            (void) snprintf(output, sizeof(output), "pOutputs");
+        }
+        else
+        {
+            (void) snprintf(output, sizeof(output), "hidden_%u", (unsigned) layer);
+        }
+        _writeLayer(pNetwork, pFile, layer, input, output);
+    }
+
+    _writeMostLikelyOutput(pFile, (numOutputs_t) outputLayer.numNeurons, _unrollLayer(&outputLayer));
+    fprintf(pFile, "}\n");
+
+    return (ferror(pFile) != 0) ? EIO : EOK;
+}
+
+
+
+
+
+/* The layer's weights without the row padding, biases and requantization as static const arrays */
+static void _writeLayerData(const network_t* pNetwork, FILE* pFile, numLayers_t layer)
+{
+    const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+    const unsigned numNeurons = descriptor.numNeurons;
+    const unsigned numInputs = descriptor.numInputs;
+
+    fprintf(pFile, "\n\n\n\n/*\n * Layer %u, %u inputs, %u neurons, %s\n */\n", (unsigned) layer, numInputs,
+            numNeurons, functionNames[descriptor.activationFunction]);
+    fprintf(pFile, "static const weight_t CACHE_ALIGNMENT exportedWeights_%u[%uU][%uU] = {\n", (unsigned) layer,
+            numNeurons, numInputs);
+    for (uint32_t i = 0; i < descriptor.numNeurons; i++)
+    {
+        fprintf(pFile, "    {");
+        for (uint32_t j = 0; j < descriptor.numInputs; j++)
+        {
+            WRITE_WEIGHT(pFile, embann_getWeight(&descriptor, i, j));
+        }
+        fprintf(pFile, " },\n");
+    }
+
+    fprintf(pFile, "};\nstatic const bias_t exportedBias_%u[%uU] = {\n   ", (unsigned) layer, numNeurons);
+    for (uint32_t i = 0; i < descriptor.numNeurons; i++)
+    {
+        WRITE_BIAS(pFile, descriptor.bias[i]);
+    }
+#ifdef CONFIG_REQUANTIZATION
+    fprintf(pFile, "\n};\nstatic const accumulator_t exportedZeroPointOffset_%u[%uU] = {\n   ", (unsigned) layer,
+            numNeurons);
+    for (uint32_t i = 0; i < descriptor.numNeurons; i++)
+    {
+        WRITE_ACCUMULATOR(pFile, descriptor.quant.zeroPointOffset[i]);
+    }
+    fprintf(pFile, "\n};\nstatic const int32_t exportedMultiplier_%u[%uU] = {\n   ", (unsigned) layer, numNeurons);
+    for (uint32_t i = 0; i < descriptor.numNeurons; i++)
+    {
+        fprintf(pFile, " %ld,", (long) descriptor.quant.multiplier[i]);
+    }
+    fprintf(pFile, "\n};\nstatic const int8_t exportedExponent_%u[%uU] = {\n   ", (unsigned) layer, numNeurons);
+    for (uint32_t i = 0; i < descriptor.numNeurons; i++)
+    {
+        fprintf(pFile, " %d,", (int) descriptor.quant.exponent[i]);
+    }
+#endif
+    fprintf(pFile, "\n};\n");
+}
+
+
+
+
+
+static void _writeLayer(const network_t* pNetwork, FILE* pFile, numLayers_t layer, const char* pInput,
+                        const char* pOutput)
+{
+    const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+    char neuron[16];
+
+    fprintf(pFile, "\n    /* Layer %u */\n", (unsigned) layer);
+    if (_unrollLayer(&descriptor))
+    {
+        for (uint32_t i = 0; i < descriptor.numNeurons; i++)
+        {
+            if (i > 0U)
+            {
+                fprintf(pFile, "\n");
+            }
+            (void) snprintf(neuron, sizeof(neuron), "%uU", (unsigned) i);
+            _writeNeuron(pNetwork, pFile, layer, neuron, pInput, pOutput, "    ");
+        }
+    }
+    else
+    {
+        fprintf(pFile, "    for (uint32_t i = 0; i < %uU; i++)\n    {\n", (unsigned) descriptor.numNeurons);
+        _writeNeuron(pNetwork, pFile, layer, "i", pInput, pOutput, "        ");
+        fprintf(pFile, "    }\n");
+    }
+}
+
+
+
+
+
+/*
+ * One neuron of the layer, the same sum embann_dotProduct() does followed by
+ * embann_activate(), pNeuron being either a constant or the loop variable
+ */
+static void _writeNeuron(const network_t* pNetwork, FILE* pFile, numLayers_t layer, const char* pNeuron,
+                            const char* pInput, const char* pOutput, const char* pIndent)
+{
+    const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+    const unsigned index = (unsigned) layer;
+
+#ifdef CONFIG_REQUANTIZATION
+    fprintf(pFile, "%saccum = (accumulator_t) exportedBias_%u[%s] + exportedZeroPointOffset_%u[%s];\n", pIndent,
+            index, pNeuron, index, pNeuron);
+#else
+    fprintf(pFile, "%saccum = (accumulator_t) exportedBias_%u[%s];\n", pIndent, index, pNeuron);
+#endif
+    if (_unrollLayer(&descriptor))
+    {
+        for (uint32_t j = 0; j < descriptor.numInputs; j++)
+        {
+            fprintf(pFile, "%saccum += %s[%u] * exportedWeights_%u[%s][%u];\n", pIndent, pInput, (unsigned) j,
+                    index, pNeuron, (unsigned) j);
+        }
+    }
+    else
+    {
+        fprintf(pFile, "%sfor (uint32_t j = 0; j < %uU; j++)\n%s{\n", pIndent, (unsigned) descriptor.numInputs,
+                pIndent);
+        fprintf(pFile, "%s    accum += %s[j] * exportedWeights_%u[%s][j];\n%s}\n", pIndent, pInput, index, pNeuron,
+                pIndent);
+    }
+
+#ifdef CONFIG_REQUANTIZATION
+    fprintf(pFile, "%s%s[%s] = embann_activateBiased(accum, %s, exportedMultiplier_%u[%s], exportedExponent_%u[%s], "
+            "%ld);\n", pIndent, pOutput, pNeuron, functionNames[descriptor.activationFunction], index, pNeuron, index,
+            pNeuron, (long) descriptor.quant.zeroPoint);
+#else
+    fprintf(pFile, "%s%s[%s] = embann_activateBiased(accum, %s, 0, 0, 0);\n", pIndent, pOutput, pNeuron,
+            functionNames[descriptor.activationFunction]);
+#endif
+}
+
+
+
+
+
+static void _writeMostLikelyOutput(FILE* pFile, numOutputs_t numOutputs, bool unroll)
+{
+    fprintf(pFile, "\n    numOutputs_t mostLikelyOutput = 0;\n");
+    if (unroll)
+    {
+        for (numOutputs_t i = 1; i < numOutputs; i++)
+        {
+            fprintf(pFile, "    mostLikelyOutput = (pOutputs[%u] > pOutputs[mostLikelyOutput]) ? %uU : "
+                    "mostLikelyOutput;\n", (unsigned) i, (unsigned) i);
+        }
+    }
+    else
+    {
+        fprintf(pFile, "    for (numOutputs_t i = 1; i < %uU; i++)\n    {\n", (unsigned) numOutputs);
+        fprintf(pFile, "        mostLikelyOutput = (pOutputs[i] > pOutputs[mostLikelyOutput]) ? i : "
+                "mostLikelyOutput;\n    }\n");
+    }
+    fprintf(pFile, "    return mostLikelyOutput;\n");
+}
+
+
+
+
+
+static bool _unrollLayer(const layerDescriptor_t* pLayer)
+{
+    return ((uint64_t) pLayer->numInputs * pLayer->numNeurons) <= EXPORT_UNROLL_LIMIT;
+}
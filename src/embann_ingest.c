@@ -0,0 +1,588 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+    embann_ingest.c - EMbedded Backpropogating Artificial Neural Network.
+    Copyright Peter Frost 2019
+*/
+
+#include "embann.h"
+#include "embann_log.h"
+#include <ctype.h>
+
+#define TAG "Embann Ingest"
+
+#ifdef CONFIG_DATASET_IMPORT
+/* Each thread gets a few chunks, so one that's slow to parse doesn't hold the rest up */
+#define CHUNKS_PER_THREAD 4U
+
+/* Features in a raw record are followed by the label as a little endian uint32_t */
+#define RAW_LABEL_BYTES 4U
+
+
+typedef struct
+{
+    const char* pStart;             /* CSV only, always the start of a line */
+    const char* pEnd;
+    uint64_t firstSample;
+    uint64_t numSamples;
+    int err;
+} importChunk_t;
+
+
+static int _readFile(const char* pPath, char** ppText, size_t* pSize);
+static int _importCsvChunks(network_t* pNetwork, importChunk_t* pChunks, uint32_t numChunks, uint32_t numThreads,
+                            numTrainingDataEntries_t numEntries);
+static void _splitCsv(const char* pStart, const char* pEnd, importChunk_t* pChunks, uint32_t numChunks);
+static const char* _skipCsvHeader(const char* pText, const char* pEnd);
+static uint32_t _countCsvColumns(const char* pText, const char* pEnd);
+static uint64_t _countCsvRows(const importChunk_t* pChunk);
+static int _parseCsvChunk(network_t* pNetwork, const importChunk_t* pChunk, float* pValue);
+static bool _parseCsvRow(const char* pLine, const char* pLineEnd, float* pValue, uint32_t numValues,
+                            uint32_t numOutputs, numOutputs_t* pLabel);
+static const char* _nextLine(const char* pLine, const char* pEnd);
+static bool _isBlankLine(const char* pLine, const char* pLineEnd);
+static const char* _skipSpaces(const char* pText, const char* pEnd);
+static int _parseRawChunk(network_t* pNetwork, const uint8_t* pData, rawSampleFormat_t format,
+                            const importChunk_t* pChunk, float* pValue);
+static uint32_t _readLittleEndian32(const uint8_t* pData);
+static uint32_t _numOutputs(const network_t* pNetwork);
+
+
+
+
+
+/*
+ * Replaces the network's training samples with the rows of a CSV file, each
+ * row being the features then the correct response as a whole number. Every
+ * row has to have a feature for each input neuron, EINVAL otherwise, and a
+ * first line that doesn't start with a number is skipped as a header. The file is split into chunks
+ * that numThreads threads parse straight into the training store.
+ */
+int embann_importCsv(network_t* pNetwork, const char* pPath, uint32_t numThreads)
+{
+    char* pText;
+    size_t size;
+
+    if ((pPath == NULL) || (numThreads == 0U))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    int err = _readFile(pPath, &pText, &size);
+    if (err != EOK)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return err;
+    }
+
+    const char* pEnd = &pText[size];
+    const char* pRows = _skipCsvHeader(pText, pEnd);
+    const uint32_t numColumns = _countCsvColumns(pRows, pEnd);
+    const uint32_t numChunks = numThreads * CHUNKS_PER_THREAD;
+    importChunk_t* pChunks = (importChunk_t*) calloc(numChunks, sizeof(importChunk_t));
+
+    if (pChunks == NULL)
+    {
+        err = ENOMEM;
+    }
+    else if (numColumns < 2U)
+    {
+        EMBANN_LOGE(TAG, "%s needs at least one feature and a label in each row", pPath);
+        err = EINVAL;
+    }
+    else if ((numColumns - 1U) != pNetwork->inputLayer->numNeurons)
+    {
+        EMBANN_LOGE(TAG, "%s has %lu features in each row, the input layer has %lu neurons", pPath,
+                    (unsigned long) (numColumns - 1U), (unsigned long) pNetwork->inputLayer->numNeurons);
+        err = EINVAL;
+    }
+    else
+    {
+        _splitCsv(pRows, pEnd, pChunks, numChunks);
+        err = _importCsvChunks(pNetwork, pChunks, numChunks, numThreads, numColumns - 1U);
+        if (err == EINVAL)
+        {
+            EMBANN_LOGE(TAG, "%s isn't rows of %lu numbers then a label below %lu", pPath,
+                        (unsigned long) (numColumns - 1U), (unsigned long) _numOutputs(pNetwork));
+        }
+    }
+    free(pChunks);
+    free(pText);
+    return err;
+}
+
+
+
+
+
+/*
+ * Replaces the network's training samples with the records of a raw file,
+ * each numEntries features in format then the correct response as a little
+ * endian uint32_t. numEntries has to be the number of input neurons, EINVAL
+ * otherwise. Float features are rounded and saturated into activation_t by
+ * embann_convertToActivations(), bytes are taken as they are.
+ */
+int embann_importRaw(network_t* pNetwork, const char* pPath, rawSampleFormat_t format,
+                        numTrainingDataEntries_t numEntries, uint32_t numThreads)
+{
+    const size_t featureBytes = (format == RAW_SAMPLE_FLOAT32) ? sizeof(float) : sizeof(uint8_t);
+    const size_t recordBytes = ((size_t) numEntries * featureBytes) + RAW_LABEL_BYTES;
+    char* pText;
+    size_t size;
+
+    if ((pPath == NULL) || (numEntries == 0U) || (numThreads == 0U) ||
+        ((format != RAW_SAMPLE_UINT8) && (format != RAW_SAMPLE_FLOAT32)))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    /* Narrower samples would have training and the statistics read on into the next one */
+    if (numEntries != pNetwork->inputLayer->numNeurons)
+    {
+        EMBANN_LOGE(TAG, "%lu features per sample don't fit an input layer of %lu neurons",
+                    (unsigned long) numEntries, (unsigned long) pNetwork->inputLayer->numNeurons);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    int err = _readFile(pPath, &pText, &size);
+    if ((err == EOK) && ((size % recordBytes) != 0U))
+    {
+        EMBANN_LOGE(TAG, "%s isn't a whole number of %lu byte records", pPath, (unsigned long) recordBytes);
+        err = EINVAL;
+    }
+    if ((err == EOK) && ((numTrainingDataSets_t) (size / recordBytes) != (size / recordBytes)))
+    {
+        err = ENOMEM;
+    }
+    if (err == EOK)
+    {
+        err = embann_allocTrainingData(pNetwork, (numTrainingDataSets_t) (size / recordBytes), numEntries);
+    }
+    if (err != EOK)
+    {
+        free(pText);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return err;
+    }
+
+    const uint64_t numSamples = size / recordBytes;
+    const uint32_t numChunks = numThreads * CHUNKS_PER_THREAD;
+    importChunk_t* pChunks = (importChunk_t*) calloc(numChunks, sizeof(importChunk_t));
+    err = (pChunks == NULL) ? ENOMEM : EOK;
+
+    for (uint32_t chunk = 0; (err == EOK) && (chunk < numChunks); chunk++)
+    {
+        pChunks[chunk].firstSample = (numSamples * chunk) / numChunks;
+        pChunks[chunk].numSamples = ((numSamples * (chunk + 1U)) / numChunks) - pChunks[chunk].firstSample;
+    }
+
+    if (err == EOK)
+    {
+        PARALLEL_FOR_CHUNKS(numThreads)
+        for (uint32_t chunk = 0; chunk < numChunks; chunk++)
+        {
+            float* pValue = (float*) malloc((size_t) numEntries * sizeof(float));
+            pChunks[chunk].err = (pValue == NULL) ? ENOMEM :
+                                    _parseRawChunk(pNetwork, (const uint8_t*) pText, format, &pChunks[chunk], pValue);
+            free(pValue);
+        }
+    }
+
+    for (uint32_t chunk = 0; (pChunks != NULL) && (chunk < numChunks); chunk++)
+    {
+        err = (err == EOK) ? pChunks[chunk].err : err;
+    }
+    if (err == EINVAL)
+    {
+        EMBANN_LOGE(TAG, "%s has labels of %lu or more", pPath, (unsigned long) _numOutputs(pNetwork));
+    }
+    if (err != EOK)
+    {
+        (void) embann_clearTrainingData(pNetwork);
+    }
+    free(pChunks);
+    free(pText);
+    return err;
+}
+
+
+
+
+
+/* The whole of pPath, on the heap with a NUL after it so the number parsers always stop */
+static int _readFile(const char* pPath, char** ppText, size_t* pSize)
+{
+    FILE* pFile = fopen(pPath, "rb");
+    long size = -1;
+
+    if (pFile == NULL)
+    {
+        EMBANN_LOGE(TAG, "Couldn't open %s", pPath);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOENT;
+    }
+
+    if (fseek(pFile, 0L, SEEK_END) == 0)
+    {
+        size = ftell(pFile);
+    }
+    char* pText = (size >= 0L) ? (char*) malloc((size_t) size + 1U) : NULL;
+    int err = (size < 0L) ? EIO : ((pText == NULL) ? ENOMEM : EOK);
+
+    if ((err == EOK) &&
+        ((fseek(pFile, 0L, SEEK_SET) != 0) || (fread(pText, 1U, (size_t) size, pFile) != (size_t) size)))
+    {
+        err = EIO;
+    }
+    (void) fclose(pFile);
+
+    if (err != EOK)
+    {
+        free(pText);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return err;
+    }
+
+    pText[size] = '\0';
+    *ppText = pText;
+    *pSize = (size_t) size;
+    return EOK;
+}
+
+
+
+
+
+/*
+ * Counts every chunk's rows in parallel so each knows which sample it starts
+ * at, sizes the training store to match, then parses them all in parallel
+ */
+static int _importCsvChunks(network_t* pNetwork, importChunk_t* pChunks, uint32_t numChunks, uint32_t numThreads,
+                            numTrainingDataEntries_t numEntries)
+{
+    uint64_t numSamples = 0U;
+    int err = EOK;
+
+    PARALLEL_FOR_CHUNKS(numThreads)
+    for (uint32_t chunk = 0; chunk < numChunks; chunk++)
+    {
+        pChunks[chunk].numSamples = _countCsvRows(&pChunks[chunk]);
+    }
+
+    for (uint32_t chunk = 0; chunk < numChunks; chunk++)
+    {
+        pChunks[chunk].firstSample = numSamples;
+        numSamples += pChunks[chunk].numSamples;
+    }
+
+    if ((numTrainingDataSets_t) numSamples != numSamples)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOMEM;
+    }
+
+    err = embann_allocTrainingData(pNetwork, (numTrainingDataSets_t) numSamples, numEntries);
+    if (err != EOK)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return err;
+    }
+
+    PARALLEL_FOR_CHUNKS(numThreads)
+    for (uint32_t chunk = 0; chunk < numChunks; chunk++)
+    {
+        float* pValue = (float*) malloc((size_t) numEntries * sizeof(float));
+        pChunks[chunk].err = (pValue == NULL) ? ENOMEM : _parseCsvChunk(pNetwork, &pChunks[chunk], pValue);
+        free(pValue);
+    }
+
+    for (uint32_t chunk = 0; chunk < numChunks; chunk++)
+    {
+        err = (err == EOK) ? pChunks[chunk].err : err;
+    }
+    if (err != EOK)
+    {
+        (void) embann_clearTrainingData(pNetwork);
+    }
+    return err;
+}
+
+
+
+
+
+/* Roughly equal chunks, each moved on to the start of the next line so no row is split */
+static void _splitCsv(const char* pStart, const char* pEnd, importChunk_t* pChunks, uint32_t numChunks)
+{
+    const size_t size = (size_t) (pEnd - pStart);
+
+    pChunks[0].pStart = pStart;
+    for (uint32_t chunk = 1; chunk < numChunks; chunk++)
+    {
+        const char* pSplit = &pStart[((uint64_t) size * chunk) / numChunks];
+
+        /* Already at the start of a line if the character before ends one */
+        pSplit = ((pSplit > pStart) && (pSplit[-1] != '\n')) ? _nextLine(pSplit, pEnd) : pSplit;
+        pChunks[chunk].pStart = (pSplit > pChunks[chunk - 1U].pStart) ? pSplit : pChunks[chunk - 1U].pStart;
+        pChunks[chunk - 1U].pEnd = pChunks[chunk].pStart;
+    }
+    pChunks[numChunks - 1U].pEnd = pEnd;
+}
+
+
+
+
+
+static const char* _skipCsvHeader(const char* pText, const char* pEnd)
+{
+    const char* pFirst = _skipSpaces(pText, pEnd);
+    const bool isNumber = (pFirst < pEnd) && ((isdigit((unsigned char) *pFirst) != 0) || (*pFirst == '-') ||
+                                                (*pFirst == '+') || (*pFirst == '.'));
+
+    return isNumber ? pText : _nextLine(pText, pEnd);
+}
+
+
+
+
+
+/* Columns in the first line with anything on it */
+static uint32_t _countCsvColumns(const char* pText, const char* pEnd)
+{
+    const char* pLine = pText;
+    uint32_t numColumns = 0U;
+
+    while ((pLine < pEnd) && _isBlankLine(pLine, _nextLine(pLine, pEnd)))
+    {
+        pLine = _nextLine(pLine, pEnd);
+    }
+
+    if (pLine < pEnd)
+    {
+        const char* pLineEnd = _nextLine(pLine, pEnd);
+
+        numColumns = 1U;
+        for (const char* p = pLine; p < pLineEnd; p++)
+        {
+            numColumns += (*p == ',') ? 1U : 0U;
+        }
+    }
+    return numColumns;
+}
+
+
+
+
+
+static uint64_t _countCsvRows(const importChunk_t* pChunk)
+{
+    uint64_t numRows = 0U;
+
+    for (const char* pLine = pChunk->pStart; pLine < pChunk->pEnd; pLine = _nextLine(pLine, pChunk->pEnd))
+    {
+        numRows += _isBlankLine(pLine, _nextLine(pLine, pChunk->pEnd)) ? 0U : 1U;
+    }
+    return numRows;
+}
+
+
+
+
+
+/* Parses each row into pValue, then converts it into the sample _countCsvRows() said it would be */
+static int _parseCsvChunk(network_t* pNetwork, const importChunk_t* pChunk, float* pValue)
+{
+    trainingDataCollection_t* pTrainingData = &pNetwork->trainingData;
+    const uint32_t numOutputs = _numOutputs(pNetwork);
+    uint64_t sample = pChunk->firstSample;
+
+    for (const char* pLine = pChunk->pStart; pLine < pChunk->pEnd; pLine = _nextLine(pLine, pChunk->pEnd))
+    {
+        const char* pLineEnd = _nextLine(pLine, pChunk->pEnd);
+
+        if (!_isBlankLine(pLine, pLineEnd))
+        {
+            if (!_parseCsvRow(pLine, pLineEnd, pValue, pTrainingData->numEntries, numOutputs,
+                                &pTrainingData->labels[sample]))
+            {
+                // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+                // cppcheck-suppress misra-c2012-15.5
+                return EINVAL;
+            }
+            embann_convertToActivations(TRAINING_DATA_FEATURES(pTrainingData, sample), pValue,
+                                        pTrainingData->numEntries);
+            sample++;
+        }
+    }
+    return EOK;
+}
+
+
+
+
+
+/*
+ * Exactly numValues numbers then a label below numOutputs, separated by
+ * commas with optional spaces around them. The text always ends in a NUL, so
+ * strtof() and strtoul() stop at pLineEnd at the latest.
+ */
+static bool _parseCsvRow(const char* pLine, const char* pLineEnd, float* pValue, uint32_t numValues,
+                            uint32_t numOutputs, numOutputs_t* pLabel)
+{
+    const char* p = pLine;
+    bool valid = true;
+
+    for (uint32_t column = 0; valid && (column <= numValues); column++)
+    {
+        char* pFieldEnd = NULL;
+
+        p = _skipSpaces(p, pLineEnd);
+        /* Checked first, as both parsers would skip a newline looking for a number */
+        valid = (p < pLineEnd) && (*p != ',') && (*p != '\r') && (*p != '\n');
+        if (valid && (column < numValues))
+        {
+            pValue[column] = strtof(p, &pFieldEnd);
+        }
+        else if (valid)
+        {
+            const unsigned long label = strtoul(p, &pFieldEnd, 10);
+            valid = (*p != '-') && (label < numOutputs);
+            *pLabel = (numOutputs_t) label;
+        }
+
+        if (valid)
+        {
+            valid = (pFieldEnd != p);
+            p = _skipSpaces(pFieldEnd, pLineEnd);
+        }
+        if (valid && (column < numValues))
+        {
+            valid = (p < pLineEnd) && (*p == ',');
+            p++;
+        }
+    }
+
+    if (valid)
+    {
+        while ((p < pLineEnd) && (*p == '\r'))
+        {
+            p++;
+        }
+        valid = (p == pLineEnd) || (*p == '\n');
+    }
+    return valid;
+}
+
+
+
+
+
+/* Just past the end of pLine's newline, or pEnd if it hasn't got one */
+static const char* _nextLine(const char* pLine, const char* pEnd)
+{
+    const char* pNewline = (const char*) memchr(pLine, '\n', (size_t) (pEnd - pLine));
+
+    return (pNewline != NULL) ? &pNewline[1] : pEnd;
+}
+
+
+
+
+
+static bool _isBlankLine(const char* pLine, const char* pLineEnd)
+{
+    bool isBlank = true;
+
+    for (const char* p = pLine; isBlank && (p < pLineEnd); p++)
+    {
+        isBlank = (*p == ' ') || (*p == '\t') || (*p == '\r') || (*p == '\n');
+    }
+    return isBlank;
+}
+
+
+
+
+
+static const char* _skipSpaces(const char* pText, const char* pEnd)
+{
+    const char* p = pText;
+
+    while ((p < pEnd) && ((*p == ' ') || (*p == '\t')))
+    {
+        p++;
+    }
+    return p;
+}
+
+
+
+
+
+/* Decodes the chunk's samples into pValue one at a time, then converts them into the store */
+static int _parseRawChunk(network_t* pNetwork, const uint8_t* pData, rawSampleFormat_t format,
+                            const importChunk_t* pChunk, float* pValue)
+{
+    trainingDataCollection_t* pTrainingData = &pNetwork->trainingData;
+    const uint32_t numEntries = pTrainingData->numEntries;
+    const size_t featureBytes = (format == RAW_SAMPLE_FLOAT32) ? sizeof(float) : sizeof(uint8_t);
+    const size_t recordBytes = ((size_t) numEntries * featureBytes) + RAW_LABEL_BYTES;
+    const uint32_t numOutputs = _numOutputs(pNetwork);
+    int err = EOK;
+
+    for (uint64_t sample = pChunk->firstSample; sample < (pChunk->firstSample + pChunk->numSamples); sample++)
+    {
+        const uint8_t* pRecord = &pData[sample * recordBytes];
+        const uint32_t label = _readLittleEndian32(&pRecord[(size_t) numEntries * featureBytes]);
+
+        for (uint32_t i = 0; i < numEntries; i++)
+        {
+            if (format == RAW_SAMPLE_FLOAT32)
+            {
+                const uint32_t bits = _readLittleEndian32(&pRecord[i * sizeof(float)]);
+                memcpy(&pValue[i], &bits, sizeof(float));
+            }
+            else
+            {
+                pValue[i] = (float) pRecord[i];
+            }
+        }
+
+        embann_convertToActivations(TRAINING_DATA_FEATURES(pTrainingData, sample), pValue, numEntries);
+        pTrainingData->labels[sample] = (numOutputs_t) label;
+        err = (label < numOutputs) ? err : EINVAL;
+    }
+    return err;
+}
+
+
+
+
+
+/* Byte by byte, so it's right on hosts of either byte order and compiles to a plain load on little endian ones */
+static uint32_t _readLittleEndian32(const uint8_t* pData)
+{
+    return (uint32_t) pData[0] | ((uint32_t) pData[1] << 8U) | ((uint32_t) pData[2] << 16U) |
+            ((uint32_t) pData[3] << 24U);
+}
+
+
+
+
+
+static uint32_t _numOutputs(const network_t* pNetwork)
+{
+    return embann_describeLayer(pNetwork, pNetwork->properties.numHiddenLayers).numNeurons;
+}
+#endif // CONFIG_DATASET_IMPORT
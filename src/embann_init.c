@@ -4,24 +4,45 @@
 #include "embann_static.h"
 #endif
 
+#if defined(CONFIG_MAP_NETWORK_FILES) && !defined(_WIN32) && !defined(ARDUINO)
+#define MAP_NETWORK_FILES
+#include <sys/mman.h>
+#endif
+
 #define TAG "Embann Init"
 
-extern network_t* pNetworkGlobal;
+#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
+/* Which of staticNetworks embann_init() has handed out */
+static bool staticNetworkInUse[CONFIG_NUM_STATIC_NETWORKS];
+#endif
 
 
 static void _printInputLayer(inputLayer_t* pInputLayer);
 static void _printHiddenLayer(hiddenLayer_t* pHiddenLayer);
 static void _printHiddenNeuronParams(hiddenLayer_t* pHiddenLayer, numHiddenNeurons_t j, numHiddenNeurons_t k);
-static void _printConnectedHiddenLayer(numLayers_t layerNum);
+static void _printConnectedHiddenLayer(const network_t* pNetwork, numLayers_t layerNum);
 static void _printOutputLayer(outputLayer_t* pOutputLayer);
 
-static int embann_initInputToHiddenLayer(numHiddenNeurons_t numHiddenNeurons, numInputs_t numInputNeurons);
-static int embann_initInputLayer(numInputs_t numInputNeurons);
-static int embann_initOutputLayer(numOutputs_t numOutputNeurons, numHiddenNeurons_t numHiddenNeurons);
+#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
+static network_t* _claimStaticNetwork(void);
+#else
+static weight_t* _allocWeights(uint32_t numNeurons, uint32_t weightStride);
+#ifdef CONFIG_REQUANTIZATION
+static int _allocQuantParams(quantParams_t* pQuant, uint32_t numNeurons);
+static void _freeQuantParams(quantParams_t* pQuant);
+#endif
+#endif
+
+static int embann_initInputToHiddenLayer(network_t* pNetwork, numHiddenNeurons_t numHiddenNeurons,
+                                            numInputs_t numInputNeurons);
+static int embann_initInputLayer(network_t* pNetwork, numInputs_t numInputNeurons);
+static int embann_initOutputLayer(network_t* pNetwork, numOutputs_t numOutputNeurons,
+                                    numHiddenNeurons_t numHiddenNeurons);
 #if (defined(CONFIG_MEMORY_ALLOCATION_STATIC) && (CONFIG_NUM_HIDDEN_LAYERS > 1)) || defined(CONFIG_MEMORY_ALLOCATION_DYNAMIC)
-static int embann_initHiddenToHiddenLayer(numHiddenNeurons_t numHiddenNeurons, numLayers_t numHiddenLayers);
+static int embann_initHiddenToHiddenLayer(network_t* pNetwork, numHiddenNeurons_t numHiddenNeurons,
+                                            numLayers_t numHiddenLayers);
 #endif
-static int embann_initHiddenLayer(numHiddenNeurons_t numHiddenNeurons,
+static int embann_initHiddenLayer(network_t* pNetwork, numHiddenNeurons_t numHiddenNeurons,
 #if (defined(CONFIG_MEMORY_ALLOCATION_STATIC) && (CONFIG_NUM_HIDDEN_LAYERS > 1)) || defined(CONFIG_MEMORY_ALLOCATION_DYNAMIC)
                                     numLayers_t numHiddenLayers,
 #endif
@@ -34,12 +55,23 @@ static int embann_initHiddenLayer(numHiddenNeurons_t numHiddenNeurons,
 
 
 
-int embann_init(numInputs_t numInputNeurons,
+/*
+ * Sets up a network and returns it in *ppNetwork, every other function takes
+ * it as its first argument. Networks share nothing, so separate threads can
+ * each use their own at the same time, but one network must only be used by
+ * one thread at a time, other than through embann_forwardPropagateSession().
+ *
+ * Static builds hand out the CONFIG_NUM_STATIC_NETWORKS networks in
+ * embann_static.h, returning ENOMEM when they're all in use. embann_init()
+ * and embann_freeNetwork() must not race each other in static builds.
+ */
+int embann_init(network_t** ppNetwork,
+                numInputs_t numInputNeurons,
                 numHiddenNeurons_t numHiddenNeurons, 
                 numLayers_t numHiddenLayers,
                 numOutputs_t numOutputNeurons)
 {
-    if ((numInputNeurons == 0U) || (numHiddenNeurons == 0U) || 
+    if ((ppNetwork == NULL) || (numInputNeurons == 0U) || (numHiddenNeurons == 0U) || 
         (numHiddenLayers == 0U) || (numOutputNeurons == 0U))
     {
         // Deviation from MISRA C2012 15.5 for reasonably simple error return values
@@ -50,29 +82,57 @@ int embann_init(numInputs_t numInputNeurons,
 #ifdef CONFIG_MEMORY_ALLOCATION_STATIC
 #if (CONFIG_NUM_INPUT_NEURONS == 0) || (CONFIG_NUM_HIDDEN_NEURONS == 0) || (CONFIG_NUM_OUTPUT_NEURONS == 0) || (CONFIG_NUM_HIDDEN_LAYERS == 0)
 #error "Layer dimensions cannot be equal to 0"
+#endif
+#if (CONFIG_NUM_STATIC_NETWORKS == 0)
+#error "Number of static networks cannot be equal to 0"
 #endif
 
-    pNetworkGlobal = &staticNetwork;
+    network_t* pNetwork = _claimStaticNetwork();
+    if (pNetwork == NULL)
+    {
+        EMBANN_LOGE(TAG, "All %d static networks are in use", CONFIG_NUM_STATIC_NETWORKS);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOMEM;
+    }
 #else
-    network_t* pNetwork = (network_t*) malloc(sizeof(network_t) + 
-                                 (sizeof(hiddenLayer_t) * numHiddenLayers));
+    network_t* pNetwork = (network_t*) malloc(sizeof(network_t));
     EMBANN_MALLOC_CHECK(pNetwork);
-    pNetworkGlobal = pNetwork;
+    pNetwork->hiddenLayer = (hiddenLayer_t**) malloc(sizeof(hiddenLayer_t*) * numHiddenLayers);
+    EMBANN_MALLOC_CHECK(pNetwork->hiddenLayer);
+    pNetwork->trainingData.features = NULL;
+    pNetwork->trainingData.labels = NULL;
+    pNetwork->trainingData.capacity = 0U;
+    pNetwork->trainingData.order = NULL;
+#ifdef CONFIG_MAP_DATASET_FILES
+    pNetwork->trainingData.pFileMapping = NULL;
+#endif
+#ifdef CONFIG_MAP_NETWORK_FILES
+    pNetwork->pFileMapping = NULL;
 #endif
+#endif
+    pNetwork->trainingData.numSets = 0U;
+    pNetwork->trainingData.numEntries = 0U;
+    pNetwork->trainingData.numOrdered = 0U;
 
-    EMBANN_ERROR_CHECK(embann_initInputLayer(numInputNeurons));
-    EMBANN_ERROR_CHECK(embann_initHiddenLayer(numHiddenNeurons,
+    EMBANN_ERROR_CHECK(embann_initKernels());
+    EMBANN_ERROR_CHECK(embann_initInputLayer(pNetwork, numInputNeurons));
+    EMBANN_ERROR_CHECK(embann_initHiddenLayer(pNetwork, numHiddenNeurons,
 #if (defined(CONFIG_MEMORY_ALLOCATION_STATIC) && (CONFIG_NUM_HIDDEN_LAYERS > 1)) || defined(CONFIG_MEMORY_ALLOCATION_DYNAMIC)
                                                 numHiddenLayers,
 #endif
                                                 numInputNeurons));
-    EMBANN_ERROR_CHECK(embann_initOutputLayer(numOutputNeurons,
+    EMBANN_ERROR_CHECK(embann_initOutputLayer(pNetwork, numOutputNeurons,
                                                 numHiddenNeurons));
 
-    pNetworkGlobal->properties.numLayers = numHiddenLayers + 2U;
-    pNetworkGlobal->properties.numHiddenLayers = numHiddenLayers;
-    pNetworkGlobal->properties.networkResponse = 0U;
+    pNetwork->properties.numLayers = numHiddenLayers + 2U;
+    pNetwork->properties.numHiddenLayers = numHiddenLayers;
+    pNetwork->properties.networkResponse = 0U;
 
+#ifdef CONFIG_REQUANTIZATION
+    EMBANN_ERROR_CHECK(embann_resetRequantization(pNetwork));
+#endif
+    *ppNetwork = pNetwork;
     return EOK;
 }
 
@@ -80,39 +140,148 @@ int embann_init(numInputs_t numInputNeurons,
 
 
 
-static int embann_initInputLayer(numInputs_t numInputNeurons)
+/*
+ * Releases everything embann_init() and embann_loadNetwork() gave pNetwork,
+ * including its training data
+ */
+int embann_freeNetwork(network_t* pNetwork)
+{
+    if (pNetwork == NULL)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+#ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
+    const numLayers_t numHiddenLayers = pNetwork->properties.numHiddenLayers;
+
+    for (numLayers_t i = 0; i <= numHiddenLayers; i++)
+    {
+        layerDescriptor_t descriptor = embann_describeLayer(pNetwork, i);
+
+#ifdef CONFIG_MAP_NETWORK_FILES
+        /* The originals went when the first file was mapped, see embann_loadNetwork() */
+        if (pNetwork->pFileMapping == NULL)
+#endif
+        {
+            // Deviation from MISRA C2012 11.8, the descriptor points at this network's own layers
+            // cppcheck-suppress misra-c2012-11.8
+            EMBANN_ALIGNED_FREE((weight_t*) descriptor.weight);
+            // cppcheck-suppress misra-c2012-11.8
+            free((bias_t*) descriptor.bias);
+        }
+        free(descriptor.activation);
+#ifdef CONFIG_REQUANTIZATION
+        _freeQuantParams(&descriptor.quant);
+#endif
+#ifdef CONFIG_SPARSE_WEIGHTS
+        if (descriptor.sparse != NULL)
+        {
+            // cppcheck-suppress misra-c2012-11.8
+            embann_freeSparseWeights((sparseWeights_t*) descriptor.sparse);
+        }
+#endif
+    }
+
+    /* Not in the loop above, describing a layer looks at the one before it */
+    for (numLayers_t i = 0; i < numHiddenLayers; i++)
+    {
+        free(pNetwork->hiddenLayer[i]);
+    }
+    free(pNetwork->outputLayer);
+    free(pNetwork->inputLayer->activation);
+    free(pNetwork->inputLayer);
+    free(pNetwork->hiddenLayer);
+    (void) embann_clearTrainingData(pNetwork);
+#endif
+
+#ifdef MAP_NETWORK_FILES
+    if (pNetwork->pFileMapping != NULL)
+    {
+        (void) munmap(pNetwork->pFileMapping, pNetwork->fileMappingSize);
+        pNetwork->pFileMapping = NULL;
+    }
+#endif
+
+#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
+    for (uint32_t i = 0; i < CONFIG_NUM_STATIC_NETWORKS; i++)
+    {
+        if (pNetwork == &staticNetworks[i])
+        {
+            staticNetworkInUse[i] = false;
+        }
+    }
+#else
+    free(pNetwork);
+#endif
+    return EOK;
+}
+
+
+
+
+
+#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
+/* The first free network, with its layers pointing back at its own weights and biases */
+static network_t* _claimStaticNetwork(void)
+{
+    for (uint32_t i = 0; i < CONFIG_NUM_STATIC_NETWORKS; i++)
+    {
+        if (!staticNetworkInUse[i])
+        {
+            network_t* pNetwork = &staticNetworks[i];
+
+            staticNetworkInUse[i] = true;
+            for (numLayers_t layer = 0; layer < CONFIG_NUM_HIDDEN_LAYERS; layer++)
+            {
+                pNetwork->hiddenLayer[layer]->weight = staticLayerWeights[i][layer];
+                pNetwork->hiddenLayer[layer]->bias = staticLayerBiases[i][layer];
+            }
+            pNetwork->outputLayer->weight = staticLayerWeights[i][CONFIG_NUM_HIDDEN_LAYERS];
+            pNetwork->outputLayer->bias = staticLayerBiases[i][CONFIG_NUM_HIDDEN_LAYERS];
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return pNetwork;
+        }
+    }
+    return NULL;
+}
+#endif
+
+
+
+
+
+static int embann_initInputLayer(network_t* pNetwork, numInputs_t numInputNeurons)
 {
     inputLayer_t* pInputLayer;
 #ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-    pInputLayer = staticNetwork.inputLayer;
+    pInputLayer = pNetwork->inputLayer;
 #else
-    uNeuron_t* pNeuron;
-    pInputLayer = (inputLayer_t*) malloc(sizeof(inputLayer_t) + 
-                                                (sizeof(uNeuron_t*) * numInputNeurons));
+    pInputLayer = (inputLayer_t*) malloc(sizeof(inputLayer_t));
     EMBANN_MALLOC_CHECK(pInputLayer);
+    pInputLayer->activation = (activation_t*) malloc(sizeof(activation_t) * numInputNeurons);
+    EMBANN_MALLOC_CHECK(pInputLayer->activation);
     pInputLayer->numNeurons = numInputNeurons;
 #endif
+    pInputLayer->boundInput = NULL;
 
     _printInputLayer(pInputLayer);
 
     for (numInputs_t i = 0; i < numInputNeurons; i++)
     {
-#ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
-        pNeuron = (uNeuron_t*) malloc(sizeof(uNeuron_t));
-        EMBANN_MALLOC_CHECK(pNeuron);
-        pInputLayer->neuron[i] = pNeuron;
-#endif
         pInputLayer->activation[i] = RAND_ACTIVATION();
         EMBANN_LOGD(TAG, "act [%d] = %" ACTIVATION_PRINT, i, pInputLayer->activation[i]);
     }
 
 #ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
-    pNetworkGlobal->inputLayer = pInputLayer;
+    pNetwork->inputLayer = pInputLayer;
 #endif
 
     for (numInputs_t k = 0; k < numInputNeurons; k++)
     {
-        EMBANN_LOGI(TAG, "act [%d] = %" ACTIVATION_PRINT, k, pNetworkGlobal->inputLayer->activation[k]);
+        EMBANN_LOGI(TAG, "act [%d] = %" ACTIVATION_PRINT, k, pNetwork->inputLayer->activation[k]);
     }
 
     EMBANN_LOGI(TAG, "done input");
@@ -124,18 +293,18 @@ static int embann_initInputLayer(numInputs_t numInputNeurons)
 
 
 
-static int embann_initHiddenLayer(numHiddenNeurons_t numHiddenNeurons,
+static int embann_initHiddenLayer(network_t* pNetwork, numHiddenNeurons_t numHiddenNeurons,
 #if (defined(CONFIG_MEMORY_ALLOCATION_STATIC) && (CONFIG_NUM_HIDDEN_LAYERS > 1)) || defined(CONFIG_MEMORY_ALLOCATION_DYNAMIC)
                             numLayers_t numHiddenLayers,
 #endif
                             numInputs_t numInputNeurons)
 {
-    EMBANN_ERROR_CHECK(embann_initInputToHiddenLayer(numHiddenNeurons, numInputNeurons));
+    EMBANN_ERROR_CHECK(embann_initInputToHiddenLayer(pNetwork, numHiddenNeurons, numInputNeurons));
 
 #if (defined(CONFIG_MEMORY_ALLOCATION_STATIC) && (CONFIG_NUM_HIDDEN_LAYERS > 1)) || defined(CONFIG_MEMORY_ALLOCATION_DYNAMIC)
     if (numHiddenLayers > 1U)
     {
-        EMBANN_ERROR_CHECK(embann_initHiddenToHiddenLayer(numHiddenNeurons, numHiddenLayers));
+        EMBANN_ERROR_CHECK(embann_initHiddenToHiddenLayer(pNetwork, numHiddenNeurons, numHiddenLayers));
     }
 #endif
     return EOK;
@@ -146,55 +315,59 @@ static int embann_initHiddenLayer(numHiddenNeurons_t numHiddenNeurons,
 
 
 
-static int embann_initInputToHiddenLayer(numHiddenNeurons_t numHiddenNeurons, numInputs_t numInputNeurons)
+static int embann_initInputToHiddenLayer(network_t* pNetwork, numHiddenNeurons_t numHiddenNeurons,
+                                            numInputs_t numInputNeurons)
 {
     hiddenLayer_t* pHiddenLayer;
 #ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-    pHiddenLayer = staticNetwork.hiddenLayer[0];
+    pHiddenLayer = pNetwork->hiddenLayer[0];
 #else
-    wNeuron_t* pNeuron;
-    neuronParams_t* pHiddenLayerParams;
-    pHiddenLayer = (hiddenLayer_t*) malloc(sizeof(hiddenLayer_t) + (sizeof(wNeuron_t*) * numHiddenNeurons));
+    pHiddenLayer = (hiddenLayer_t*) malloc(sizeof(hiddenLayer_t));
     EMBANN_MALLOC_CHECK(pHiddenLayer);
+    pHiddenLayer->activation = (activation_t*) malloc(sizeof(activation_t) * numHiddenNeurons);
+    EMBANN_MALLOC_CHECK(pHiddenLayer->activation);
+    pHiddenLayer->bias = (bias_t*) malloc(sizeof(bias_t) * numHiddenNeurons);
+    EMBANN_MALLOC_CHECK(pHiddenLayer->bias);
+    pHiddenLayer->weightStride = WEIGHT_STRIDE(numInputNeurons);
+    pHiddenLayer->weight = _allocWeights(numHiddenNeurons, pHiddenLayer->weightStride);
+    EMBANN_MALLOC_CHECK(pHiddenLayer->weight);
+#ifdef CONFIG_SPARSE_WEIGHTS
+    pHiddenLayer->sparse = (sparseWeights_t) { .rowStart = NULL };
+#endif
+#ifdef CONFIG_REQUANTIZATION
+    EMBANN_ERROR_CHECK(_allocQuantParams(&pHiddenLayer->quant, numHiddenNeurons));
+#endif
     pHiddenLayer->numNeurons = numHiddenNeurons;
 #endif
+    pHiddenLayer->activationFunction = DEFAULT_ACTIVATION_FUNCTION;
     _printHiddenLayer(pHiddenLayer);
 
 
     for (numHiddenNeurons_t j = 0; j < numHiddenNeurons; j++)
     {
-#ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
-        pNeuron = (wNeuron_t*) malloc(sizeof(wNeuron_t) + (sizeof(neuronParams_t*) * numInputNeurons));
-        EMBANN_MALLOC_CHECK(pNeuron);
-        pHiddenLayer->neuron[j] = pNeuron;
-#endif
+        weight_t* pWeightRow = &pHiddenLayer->weight[j * pHiddenLayer->weightStride];
         pHiddenLayer->activation[j] = RAND_ACTIVATION();
 
         EMBANN_LOGD(TAG, "act [%d] = %" ACTIVATION_PRINT, j, pHiddenLayer->activation[j]);
 
         for (numInputs_t k = 0; k < numInputNeurons; k++)
         {
-#ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
-            pHiddenLayerParams = (neuronParams_t*) malloc(sizeof(neuronParams_t));
-            EMBANN_MALLOC_CHECK(pHiddenLayerParams);
-            pHiddenLayer->neuron[j]->params[k] = pHiddenLayerParams;
-#endif
-            pHiddenLayer->bias[j] = RAND_BIAS();
-            pHiddenLayer->weight[j][k] = RAND_WEIGHT();
+            pHiddenLayer->bias[j] = 0;
+            pWeightRow[k] = RAND_WEIGHT();
 
             _printHiddenNeuronParams(pHiddenLayer, j, k);
         }
     }
 
 #ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
-    pNetworkGlobal->hiddenLayer[0] = pHiddenLayer;
+    pNetwork->hiddenLayer[0] = pHiddenLayer;
 #endif
     for (uint16_t k = 0; k < numHiddenNeurons; k++)
     {
-        EMBANN_LOGI(TAG, "act [%d] = %" ACTIVATION_PRINT, k, pNetworkGlobal->hiddenLayer[0]->activation[k]);
+        EMBANN_LOGI(TAG, "act [%d] = %" ACTIVATION_PRINT, k, pNetwork->hiddenLayer[0]->activation[k]);
     }
 
-    _printConnectedHiddenLayer(0);
+    _printConnectedHiddenLayer(pNetwork, 0);
     EMBANN_LOGI(TAG, "done hidden");
     return EOK;
 }
@@ -206,61 +379,62 @@ static int embann_initInputToHiddenLayer(numHiddenNeurons_t numHiddenNeurons, nu
 
 
 #if (defined(CONFIG_MEMORY_ALLOCATION_STATIC) && (CONFIG_NUM_HIDDEN_LAYERS > 1)) || defined(CONFIG_MEMORY_ALLOCATION_DYNAMIC)
-static int embann_initHiddenToHiddenLayer(numHiddenNeurons_t numHiddenNeurons, numLayers_t numHiddenLayers)
+static int embann_initHiddenToHiddenLayer(network_t* pNetwork, numHiddenNeurons_t numHiddenNeurons,
+                                            numLayers_t numHiddenLayers)
 {
     hiddenLayer_t* pHiddenLayer;
-#ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
-    wNeuron_t* pNeuron;
-    neuronParams_t* pHiddenLayerParams;
-#endif
     
     for (numLayers_t i = 1; i < numHiddenLayers; i++)
     {
 #ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-        pHiddenLayer = staticNetwork.hiddenLayer[i];
+        pHiddenLayer = pNetwork->hiddenLayer[i];
 #else
-        pHiddenLayer = (hiddenLayer_t*) malloc(sizeof(hiddenLayer_t) + 
-                                                (sizeof(wNeuron_t*) * numHiddenNeurons));
+        pHiddenLayer = (hiddenLayer_t*) malloc(sizeof(hiddenLayer_t));
         EMBANN_MALLOC_CHECK(pHiddenLayer);
+        pHiddenLayer->activation = (activation_t*) malloc(sizeof(activation_t) * numHiddenNeurons);
+        EMBANN_MALLOC_CHECK(pHiddenLayer->activation);
+        pHiddenLayer->bias = (bias_t*) malloc(sizeof(bias_t) * numHiddenNeurons);
+        EMBANN_MALLOC_CHECK(pHiddenLayer->bias);
+        pHiddenLayer->weightStride = WEIGHT_STRIDE(numHiddenNeurons);
+        pHiddenLayer->weight = _allocWeights(numHiddenNeurons, pHiddenLayer->weightStride);
+        EMBANN_MALLOC_CHECK(pHiddenLayer->weight);
+#ifdef CONFIG_SPARSE_WEIGHTS
+        pHiddenLayer->sparse = (sparseWeights_t) { .rowStart = NULL };
+#endif
+#ifdef CONFIG_REQUANTIZATION
+        EMBANN_ERROR_CHECK(_allocQuantParams(&pHiddenLayer->quant, numHiddenNeurons));
+#endif
 #endif
         _printHiddenLayer(pHiddenLayer);
         pHiddenLayer->numNeurons = numHiddenNeurons;
+        pHiddenLayer->activationFunction = DEFAULT_ACTIVATION_FUNCTION;
 
         for (numHiddenNeurons_t j = 0; j < numHiddenNeurons; j++)
         {    
-#ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
-            pNeuron = (wNeuron_t*) malloc(sizeof(wNeuron_t) + (sizeof(neuronParams_t*) * numHiddenNeurons));
-            EMBANN_MALLOC_CHECK(pNeuron);
-            pHiddenLayer->neuron[j] = pNeuron;
-#endif
+            weight_t* pWeightRow = &pHiddenLayer->weight[j * pHiddenLayer->weightStride];
             pHiddenLayer->activation[j] = RAND_ACTIVATION();
 
             EMBANN_LOGD(TAG, "act [%d] = %" ACTIVATION_PRINT, j, pHiddenLayer->activation[j]);
 
             for (numHiddenNeurons_t k = 0; k < numHiddenNeurons; k++)
             {
-#ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
-                pHiddenLayerParams = (neuronParams_t*) malloc(sizeof(neuronParams_t));
-                EMBANN_MALLOC_CHECK(pHiddenLayerParams);
-                pHiddenLayer->neuron[j]->params[k] = pHiddenLayerParams;
-#endif
                 _printHiddenNeuronParams(pHiddenLayer, j, k);
 
-                pHiddenLayer->bias[j] = RAND_BIAS();
-                pHiddenLayer->weight[j][k] = RAND_WEIGHT();
+                pHiddenLayer->bias[j] = 0;
+                pWeightRow[k] = RAND_WEIGHT();
                 EMBANN_LOGD(TAG, "act [%d] = %" ACTIVATION_PRINT, j, pHiddenLayer->activation[j]);
             }
         }
 
         EMBANN_LOGI(TAG, "done hidden");
 #ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
-        pNetworkGlobal->hiddenLayer[i] = pHiddenLayer;
+        pNetwork->hiddenLayer[i] = pHiddenLayer;
 #endif
-        _printConnectedHiddenLayer(i);
+        _printConnectedHiddenLayer(pNetwork, i);
 
         for (uint16_t k = 0; k < (numHiddenNeurons - 1U); k++)
         {
-            EMBANN_LOGI(TAG, "act [%d] = %" ACTIVATION_PRINT, k, pNetworkGlobal->hiddenLayer[i]->activation[k]);
+            EMBANN_LOGI(TAG, "act [%d] = %" ACTIVATION_PRINT, k, pNetwork->hiddenLayer[i]->activation[k]);
         }
     }
     return EOK;
@@ -273,53 +447,56 @@ static int embann_initHiddenToHiddenLayer(numHiddenNeurons_t numHiddenNeurons, n
 
 
 
-static int embann_initOutputLayer(numOutputs_t numOutputNeurons, numHiddenNeurons_t numHiddenNeurons)
+static int embann_initOutputLayer(network_t* pNetwork, numOutputs_t numOutputNeurons,
+                                    numHiddenNeurons_t numHiddenNeurons)
 {
     outputLayer_t* pOutputLayer;
 #ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-    pOutputLayer = staticNetwork.outputLayer;
+    pOutputLayer = pNetwork->outputLayer;
 #else
-    wNeuron_t* pNeuron;
-    neuronParams_t* pOutputLayerParams;
-    pOutputLayer = (outputLayer_t*) malloc(sizeof(outputLayer_t) + 
-                                                        (sizeof(wNeuron_t*) * numOutputNeurons));
+    pOutputLayer = (outputLayer_t*) malloc(sizeof(outputLayer_t));
     EMBANN_MALLOC_CHECK(pOutputLayer);
+    pOutputLayer->activation = (activation_t*) malloc(sizeof(activation_t) * numOutputNeurons);
+    EMBANN_MALLOC_CHECK(pOutputLayer->activation);
+    pOutputLayer->bias = (bias_t*) malloc(sizeof(bias_t) * numOutputNeurons);
+    EMBANN_MALLOC_CHECK(pOutputLayer->bias);
+    pOutputLayer->weightStride = WEIGHT_STRIDE(numHiddenNeurons);
+    pOutputLayer->weight = _allocWeights(numOutputNeurons, pOutputLayer->weightStride);
+    EMBANN_MALLOC_CHECK(pOutputLayer->weight);
+#ifdef CONFIG_SPARSE_WEIGHTS
+    pOutputLayer->sparse = (sparseWeights_t) { .rowStart = NULL };
+#endif
+#ifdef CONFIG_REQUANTIZATION
+    EMBANN_ERROR_CHECK(_allocQuantParams(&pOutputLayer->quant, numOutputNeurons));
+#endif
 #endif
 
     pOutputLayer->numNeurons = numOutputNeurons;
+    pOutputLayer->activationFunction = DEFAULT_ACTIVATION_FUNCTION;
 
     _printOutputLayer(pOutputLayer);
 
     for (numOutputs_t i = 0; i < numOutputNeurons; i++)
     {
-#ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
-        pNeuron = (wNeuron_t*) malloc(sizeof(wNeuron_t) + (sizeof(neuronParams_t*) * numHiddenNeurons));
-        EMBANN_MALLOC_CHECK(pNeuron);
-        pOutputLayer->neuron[i] = pNeuron;
-#endif
+        weight_t* pWeightRow = &pOutputLayer->weight[i * pOutputLayer->weightStride];
 
         pOutputLayer->activation[i] = RAND_ACTIVATION();
         EMBANN_LOGD(TAG, "act [%d] = %" ACTIVATION_PRINT, i, pOutputLayer->activation[i]);
         
         for (numHiddenNeurons_t j = 0; j < numHiddenNeurons; j++)
         {
-#ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
-            pOutputLayerParams = (neuronParams_t*) malloc(sizeof(neuronParams_t));
-            EMBANN_MALLOC_CHECK(pOutputLayerParams);
-            pOutputLayer->neuron[i]->params[j] = pOutputLayerParams;
-#endif
-            pOutputLayer->bias[i] = RAND_BIAS();
-            pOutputLayer->weight[i][j] = RAND_WEIGHT();
+            pOutputLayer->bias[i] = 0;
+            pWeightRow[j] = RAND_WEIGHT();
         }
     }
     
 #ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
-    pNetworkGlobal->outputLayer = pOutputLayer;
+    pNetwork->outputLayer = pOutputLayer;
 #endif
 
     for (uint16_t k = 0; k < numOutputNeurons; k++)
     {
-        EMBANN_LOGI(TAG, "act [%d] = %" ACTIVATION_PRINT, k, pNetworkGlobal->outputLayer->activation[k]);
+        EMBANN_LOGI(TAG, "act [%d] = %" ACTIVATION_PRINT, k, pNetwork->outputLayer->activation[k]);
     }
 
     EMBANN_LOGI(TAG, "done output");
@@ -330,6 +507,45 @@ static int embann_initOutputLayer(numOutputs_t numOutputNeurons, numHiddenNeuron
 
 
 
+#ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
+static weight_t* _allocWeights(uint32_t numNeurons, uint32_t weightStride)
+{
+    const size_t numBytes = ROUND_UP_TO_CACHE_LINE(numNeurons * weightStride * sizeof(weight_t));
+    weight_t* pWeights = (weight_t*) EMBANN_ALIGNED_ALLOC(CONFIG_CACHE_LINE_SIZE, numBytes);
+
+    if (pWeights != NULL)
+    {
+        /* Zero the padding at the end of each row so it never contributes to a sum */
+        memset(pWeights, 0, numBytes);
+    }
+    return pWeights;
+}
+
+#ifdef CONFIG_REQUANTIZATION
+static int _allocQuantParams(quantParams_t* pQuant, uint32_t numNeurons)
+{
+    pQuant->multiplier = (int32_t*) malloc(sizeof(int32_t) * numNeurons);
+    EMBANN_MALLOC_CHECK(pQuant->multiplier);
+    pQuant->exponent = (int8_t*) malloc(sizeof(int8_t) * numNeurons);
+    EMBANN_MALLOC_CHECK(pQuant->exponent);
+    pQuant->zeroPointOffset = (accumulator_t*) malloc(sizeof(accumulator_t) * numNeurons);
+    EMBANN_MALLOC_CHECK(pQuant->zeroPointOffset);
+    return EOK;
+}
+
+static void _freeQuantParams(quantParams_t* pQuant)
+{
+    free(pQuant->multiplier);
+    free(pQuant->exponent);
+    free(pQuant->zeroPointOffset);
+}
+#endif
+#endif
+
+
+
+
+
 static void _printInputLayer(inputLayer_t* pInputLayer)
 {
 #pragma GCC diagnostic push
@@ -366,20 +582,20 @@ static void _printHiddenNeuronParams(hiddenLayer_t* pHiddenLayer, numHiddenNeuro
     // cppcheck-suppress misra-c2012-11.4
     EMBANN_LOGV(TAG, "params bias 0x%x, weight 0x%x", 
                         (uint32_t) &pHiddenLayer->bias[j],
-                        (uint32_t) &pHiddenLayer->weight[j][k]);
+                        (uint32_t) &pHiddenLayer->weight[(j * pHiddenLayer->weightStride) + k]);
 #pragma GCC diagnostic pop
 }
 
 
 
 
-static void _printConnectedHiddenLayer(numLayers_t layerNum)
+static void _printConnectedHiddenLayer(const network_t* pNetwork, numLayers_t layerNum)
 {
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wpointer-to-int-cast"
     // MISRA C 2012 11.4 - deliberate cast from pointer to integer
     // cppcheck-suppress misra-c2012-11.4
-    EMBANN_LOGI(TAG, "hiddenlayer[%d]: 0x%x", layerNum, (uint32_t) &pNetworkGlobal->hiddenLayer[layerNum]);
+    EMBANN_LOGI(TAG, "hiddenlayer[%d]: 0x%x", layerNum, (uint32_t) &pNetwork->hiddenLayer[layerNum]);
 #pragma GCC diagnostic pop
 }
 
@@ -0,0 +1,1052 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+    embann_kernels.c - EMbedded Backpropogating Artificial Neural Network.
+    Copyright Peter Frost 2019
+*/
+
+#include "embann.h"
+#include "embann_log.h"
+
+#define TAG "Embann Kernels"
+
+#if defined(CONFIG_PARALLEL_LAYERS) && defined(_OPENMP)
+#include <omp.h>
+#endif
+
+
+/*
+ * On x86 with GCC / Clang every variant is compiled into the same binary using
+ * target attributes, and embann_initKernels() picks one with cpuid. Anything
+ * else only gets the scalar kernels, and whatever the compiler does with them.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define KERNEL_RUNTIME_DISPATCH
+#include <immintrin.h>
+#define TARGET_SSE4_2 __attribute__((target("sse4.2")))
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vnni")))
+#endif
+
+/*
+ * The hand written SIMD kernels only exist for the u8 activation, s8 weight,
+ * s32 accumulator layout described in embann_data_types.h, every other
+ * combination of types gets the scalar bodies compiled for each target.
+ */
+#if defined(CONFIG_ACTIVATION_DATA_TYPE_UINT8) && defined(CONFIG_WEIGHT_DATA_TYPE_INT8) && \
+    defined(CONFIG_ACCUMULATOR_DATA_TYPE_INT32)
+#define KERNEL_TYPES_U8_S8_S32
+#endif
+
+/* All float builds only get hand written embann_gemm() micro-kernels */
+#if defined(CONFIG_ACTIVATION_DATA_TYPE_FLOAT) && defined(CONFIG_WEIGHT_DATA_TYPE_FLOAT) && \
+    defined(CONFIG_ACCUMULATOR_DATA_TYPE_FLOAT)
+#define KERNEL_TYPES_F32
+#endif
+
+/* Converting to activations only depends on the activation type */
+#ifdef CONFIG_ACTIVATION_DATA_TYPE_UINT8
+#define KERNEL_ACTIVATION_U8
+#endif
+
+/*
+ * embann_gemm() register tile, GEMM_MR samples by GEMM_NR neurons, with the
+ * inputs packed in groups of GEMM_KU so that one VPDPBUSD lane covers one
+ * group. Float builds multiply an input at a time, so their groups are one
+ * input, broadcast against a row of GEMM_NR weights. The cache tiles from
+ * Kconfig are rounded up to match.
+ */
+#define GEMM_MR 4U
+#define GEMM_NR 16U
+#ifdef KERNEL_TYPES_F32
+#define GEMM_KU 1U
+#else
+#define GEMM_KU 4U
+#endif
+#define GEMM_TILE_SAMPLES ROUND_UP_TO_MULTIPLE(CONFIG_GEMM_TILE_SAMPLES, GEMM_MR)
+#define GEMM_TILE_NEURONS ROUND_UP_TO_MULTIPLE(CONFIG_GEMM_TILE_NEURONS, GEMM_NR)
+#define GEMM_TILE_INPUTS ROUND_UP_TO_MULTIPLE(CONFIG_GEMM_TILE_INPUTS, GEMM_KU)
+
+
+typedef accumulator_t (*dotProductKernel_t)(const activation_t* pActivation, const weight_t* pWeight,
+                                                uint32_t numInputs);
+typedef void (*accumulateGradientKernel_t)(accumulator_t* pGradient, const activation_t* pActivation,
+                                            accumulator_t error, uint32_t numInputs);
+typedef void (*applyGradientsKernel_t)(weight_t* pWeight, accumulator_t* pGradient, uint32_t numWeights);
+typedef void (*gemmMicroKernel_t)(uint32_t numInputGroups, const activation_t* pInputPanel,
+                                    const weight_t* pWeightPanel, accumulator_t* pTile);
+typedef void (*convertKernel_t)(activation_t* pActivation, const float* pValue, uint32_t numValues);
+
+typedef struct
+{
+    const char* name;
+    dotProductKernel_t dotProduct;
+    accumulateGradientKernel_t accumulateGradient;
+    applyGradientsKernel_t applyGradients;
+    gemmMicroKernel_t gemmMicroKernel;
+    convertKernel_t convert;
+} kernelTable_t;
+
+
+static ALWAYS_INLINE accumulator_t _dotProductBody(const activation_t* pActivation, const weight_t* pWeight,
+                                                    uint32_t numInputs);
+static ALWAYS_INLINE void _accumulateGradientBody(accumulator_t* pGradient, const activation_t* pActivation,
+                                                    accumulator_t error, uint32_t numInputs);
+static ALWAYS_INLINE void _applyGradientsBody(weight_t* pWeight, accumulator_t* pGradient, uint32_t numWeights);
+static ALWAYS_INLINE void _gemmMicroKernelBody(uint32_t numInputGroups, const activation_t* pInputPanel,
+                                                const weight_t* pWeightPanel, accumulator_t* pTile);
+static ALWAYS_INLINE void _convertBody(activation_t* pActivation, const float* pValue, uint32_t numValues);
+static void _packInputs(activation_t* pPacked, const activation_t* pInput, uint32_t numInputs,
+                        uint32_t numSamples, uint32_t numTileInputs);
+static void _packWeights(weight_t* pPacked, const weight_t* pWeight, uint32_t weightStride,
+                            uint32_t numNeurons, uint32_t numTileInputs);
+static void _storeTile(accumulator_t* pTile, const layerDescriptor_t* pLayer, uint32_t firstSample,
+                        uint32_t firstNeuron, accumulator_t* pAccum, uint32_t numSamples, uint32_t numNeurons,
+                        bool firstBlock, bool lastBlock);
+static accumulator_t _dotProductScalar(const activation_t* pActivation, const weight_t* pWeight,
+                                        uint32_t numInputs);
+static void _accumulateGradientScalar(accumulator_t* pGradient, const activation_t* pActivation,
+                                      accumulator_t error, uint32_t numInputs);
+static void _applyGradientsScalar(weight_t* pWeight, accumulator_t* pGradient, uint32_t numWeights);
+static void _gemmMicroKernelScalar(uint32_t numInputGroups, const activation_t* pInputPanel,
+                                    const weight_t* pWeightPanel, accumulator_t* pTile);
+static void _convertScalar(activation_t* pActivation, const float* pValue, uint32_t numValues);
+#ifdef KERNEL_RUNTIME_DISPATCH
+static TARGET_SSE4_2 accumulator_t _dotProductSse4(const activation_t* pActivation, const weight_t* pWeight,
+                                                    uint32_t numInputs);
+static TARGET_SSE4_2 void _accumulateGradientSse4(accumulator_t* pGradient, const activation_t* pActivation,
+                                                  accumulator_t error, uint32_t numInputs);
+static TARGET_SSE4_2 void _applyGradientsSse4(weight_t* pWeight, accumulator_t* pGradient, uint32_t numWeights);
+static TARGET_SSE4_2 void _gemmMicroKernelSse4(uint32_t numInputGroups, const activation_t* pInputPanel,
+                                                const weight_t* pWeightPanel, accumulator_t* pTile);
+static TARGET_SSE4_2 void _convertSse4(activation_t* pActivation, const float* pValue, uint32_t numValues);
+static TARGET_AVX2 accumulator_t _dotProductAvx2(const activation_t* pActivation, const weight_t* pWeight,
+                                                    uint32_t numInputs);
+static TARGET_AVX2 void _accumulateGradientAvx2(accumulator_t* pGradient, const activation_t* pActivation,
+                                                accumulator_t error, uint32_t numInputs);
+static TARGET_AVX2 void _applyGradientsAvx2(weight_t* pWeight, accumulator_t* pGradient, uint32_t numWeights);
+static TARGET_AVX2 void _gemmMicroKernelAvx2(uint32_t numInputGroups, const activation_t* pInputPanel,
+                                                const weight_t* pWeightPanel, accumulator_t* pTile);
+static TARGET_AVX2 void _convertAvx2(activation_t* pActivation, const float* pValue, uint32_t numValues);
+static TARGET_AVX512 accumulator_t _dotProductAvx512(const activation_t* pActivation, const weight_t* pWeight,
+                                                        uint32_t numInputs);
+static TARGET_AVX512 void _accumulateGradientAvx512(accumulator_t* pGradient, const activation_t* pActivation,
+                                                    accumulator_t error, uint32_t numInputs);
+static TARGET_AVX512 void _applyGradientsAvx512(weight_t* pWeight, accumulator_t* pGradient, uint32_t numWeights);
+static TARGET_AVX512 void _gemmMicroKernelAvx512(uint32_t numInputGroups, const activation_t* pInputPanel,
+                                                    const weight_t* pWeightPanel, accumulator_t* pTile);
+static TARGET_AVX512 void _convertAvx512(activation_t* pActivation, const float* pValue, uint32_t numValues);
+#endif
+
+
+static const kernelTable_t kernelTables[NUM_KERNEL_VARIANTS] = {
+    [KERNEL_VARIANT_SCALAR] = { "scalar", _dotProductScalar, _accumulateGradientScalar, _applyGradientsScalar,
+                                _gemmMicroKernelScalar, _convertScalar },
+#ifdef KERNEL_RUNTIME_DISPATCH
+    [KERNEL_VARIANT_SSE4_2] = { "SSE4.2", _dotProductSse4, _accumulateGradientSse4, _applyGradientsSse4,
+                                _gemmMicroKernelSse4, _convertSse4 },
+    [KERNEL_VARIANT_AVX2] = { "AVX2", _dotProductAvx2, _accumulateGradientAvx2, _applyGradientsAvx2,
+                                _gemmMicroKernelAvx2, _convertAvx2 },
+    [KERNEL_VARIANT_AVX512] = { "AVX-512", _dotProductAvx512, _accumulateGradientAvx512, _applyGradientsAvx512,
+                                _gemmMicroKernelAvx512, _convertAvx512 },
+#endif
+};
+
+/* Scalar until embann_initKernels() has had a look at the CPU */
+static kernelVariant_t kernelVariant = KERNEL_VARIANT_SCALAR;
+static dotProductKernel_t pDotProduct = _dotProductScalar;
+static accumulateGradientKernel_t pAccumulateGradient = _accumulateGradientScalar;
+static applyGradientsKernel_t pApplyGradients = _applyGradientsScalar;
+static gemmMicroKernel_t pGemmMicroKernel = _gemmMicroKernelScalar;
+static convertKernel_t pConvert = _convertScalar;
+/* So the kernels aren't swapped under threads running networks set up earlier */
+static bool kernelsChosen = false;
+#ifdef CONFIG_PARALLEL_LAYERS
+/* Threads each wide layer is split across, 0 for OpenMP's default */
+static uint32_t numLayerThreads = CONFIG_PARALLEL_NUM_THREADS;
+#endif
+
+
+
+
+
+/* Picks the best kernels the CPU supports, only on the first call */
+int embann_initKernels(void)
+{
+    kernelVariant_t bestVariant = KERNEL_VARIANT_SCALAR;
+
+    if (kernelsChosen)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EOK;
+    }
+
+    for (int variant = KERNEL_VARIANT_SCALAR; variant < NUM_KERNEL_VARIANTS; variant++)
+    {
+        if (embann_isKernelVariantSupported((kernelVariant_t) variant))
+        {
+            bestVariant = (kernelVariant_t) variant;
+        }
+    }
+
+    EMBANN_ERROR_CHECK(embann_setKernelVariant(bestVariant));
+    EMBANN_LOGI(TAG, "Using %s kernels", embann_getKernelVariantName());
+    kernelsChosen = true;
+    return EOK;
+}
+
+
+
+
+
+bool embann_isKernelVariantSupported(kernelVariant_t variant)
+{
+    bool supported = false;
+
+#ifdef KERNEL_RUNTIME_DISPATCH
+    __builtin_cpu_init();
+#endif
+
+    switch (variant)
+    {
+        case KERNEL_VARIANT_SCALAR:
+            supported = true;
+            break;
+#ifdef KERNEL_RUNTIME_DISPATCH
+        case KERNEL_VARIANT_SSE4_2:
+            supported = __builtin_cpu_supports("sse4.2");
+            break;
+        case KERNEL_VARIANT_AVX2:
+            supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+            break;
+        case KERNEL_VARIANT_AVX512:
+            supported = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+                        __builtin_cpu_supports("avx512vnni");
+            break;
+#endif
+        default:
+            break;
+    }
+    return supported;
+}
+
+
+
+
+
+int embann_setKernelVariant(kernelVariant_t variant)
+{
+    if ((variant >= NUM_KERNEL_VARIANTS) || !embann_isKernelVariantSupported(variant))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOTSUP;
+    }
+
+    kernelVariant = variant;
+    pDotProduct = kernelTables[variant].dotProduct;
+    pAccumulateGradient = kernelTables[variant].accumulateGradient;
+    pApplyGradients = kernelTables[variant].applyGradients;
+    pGemmMicroKernel = kernelTables[variant].gemmMicroKernel;
+    pConvert = kernelTables[variant].convert;
+    return EOK;
+}
+
+
+
+
+
+kernelVariant_t embann_getKernelVariant(void)
+{
+    return kernelVariant;
+}
+
+
+
+
+
+const char* embann_getKernelVariantName(void)
+{
+    return kernelTables[kernelVariant].name;
+}
+
+
+
+
+
+
+#ifdef CONFIG_PARALLEL_LAYERS
+/*
+ * Sets how many threads layers of at least CONFIG_PARALLEL_MIN_LAYER_WEIGHTS
+ * are split across, 0 for OpenMP's default. Set it before running networks,
+ * not while they're running.
+ */
+int embann_setNumThreads(uint32_t numThreads)
+{
+    numLayerThreads = numThreads;
+    return EOK;
+}
+
+
+
+
+
+uint32_t embann_getNumThreads(void)
+{
+#ifdef _OPENMP
+    return (numLayerThreads != 0U) ? numLayerThreads : (uint32_t) omp_get_max_threads();
+#else
+    return 1U;
+#endif
+}
+#endif
+
+
+
+
+
+accumulator_t embann_dotProduct(const activation_t* pActivation, const weight_t* pWeight, uint32_t numInputs)
+{
+    return pDotProduct(pActivation, pWeight, numInputs);
+}
+
+
+
+
+
+/* Adds what backpropagating error through pActivation would take off a row of weights to pGradient */
+void embann_accumulateGradient(accumulator_t* pGradient, const activation_t* pActivation, accumulator_t error,
+                                uint32_t numInputs)
+{
+    pAccumulateGradient(pGradient, pActivation, error, numInputs);
+}
+
+
+
+
+
+/* Takes numWeights of pGradient off pWeight, leaving those gradients zeroed */
+void embann_applyGradients(weight_t* pWeight, accumulator_t* pGradient, uint32_t numWeights)
+{
+    pApplyGradients(pWeight, pGradient, numWeights);
+}
+
+
+
+
+
+/*
+ * Rounds each value to the nearest activation_t, ties to even, saturating
+ * at the type's limits. NaNs come out as the smallest activation.
+ */
+void embann_convertToActivations(activation_t* pActivation, const float* pValue, uint32_t numValues)
+{
+    pConvert(pActivation, pValue, numValues);
+}
+
+
+
+
+
+/*
+ * Runs one layer over a batch: pLayer->input is numSamples rows of numInputs
+ * activations, and pLayer->activation gets numSamples rows of numNeurons,
+ * each the layer's weight row dotted with the inputs, then passed through
+ * embann_activate() as the tile is stored.
+ *
+ * The weights are packed GEMM_TILE_NEURONS x GEMM_TILE_INPUTS at a time, and
+ * reused by every block of GEMM_TILE_SAMPLES packed inputs, so both stay in
+ * cache while the micro-kernel works through them one register tile at a
+ * time. Packing zero-pads every edge, the micro-kernel never sees a
+ * partial tile.
+ *
+ * pAccum (numSamples rows of numNeurons) only holds partial sums while a
+ * layer has more than GEMM_TILE_INPUTS inputs, it's untouched otherwise.
+ */
+void embann_gemm(const layerDescriptor_t* pLayer, uint32_t numSamples, accumulator_t* pAccum)
+{
+    const activation_t* pInput = pLayer->input;
+    const uint32_t numInputs = pLayer->numInputs;
+    const weight_t* pWeight = pLayer->weight;
+    const uint32_t weightStride = pLayer->weightStride;
+    const uint32_t numOutputs = pLayer->numNeurons;
+
+    activation_t packedInputs[GEMM_TILE_SAMPLES * GEMM_TILE_INPUTS] CACHE_ALIGNMENT;
+    weight_t packedWeights[GEMM_TILE_NEURONS * GEMM_TILE_INPUTS] CACHE_ALIGNMENT;
+    accumulator_t tile[GEMM_MR * GEMM_NR] CACHE_ALIGNMENT;
+
+    for (uint32_t firstNeuron = 0; firstNeuron < numOutputs; firstNeuron += GEMM_TILE_NEURONS)
+    {
+        const uint32_t numNeurons = min(numOutputs - firstNeuron, (uint32_t) GEMM_TILE_NEURONS);
+
+        for (uint32_t firstInput = 0; firstInput < numInputs; firstInput += GEMM_TILE_INPUTS)
+        {
+            const uint32_t numTileInputs = min(numInputs - firstInput, (uint32_t) GEMM_TILE_INPUTS);
+            const uint32_t numInputGroups = ROUND_UP_TO_MULTIPLE(numTileInputs, GEMM_KU) / GEMM_KU;
+
+            _packWeights(packedWeights, &pWeight[(firstNeuron * weightStride) + firstInput], weightStride,
+                            numNeurons, numTileInputs);
+
+            for (uint32_t firstSample = 0; firstSample < numSamples; firstSample += GEMM_TILE_SAMPLES)
+            {
+                const uint32_t numTileSamples = min(numSamples - firstSample, (uint32_t) GEMM_TILE_SAMPLES);
+
+                _packInputs(packedInputs, &pInput[(firstSample * numInputs) + firstInput], numInputs,
+                            numTileSamples, numTileInputs);
+
+                for (uint32_t neuron = 0; neuron < numNeurons; neuron += GEMM_NR)
+                {
+                    for (uint32_t sample = 0; sample < numTileSamples; sample += GEMM_MR)
+                    {
+                        pGemmMicroKernel(numInputGroups, &packedInputs[sample * numInputGroups * GEMM_KU],
+                                            &packedWeights[neuron * numInputGroups * GEMM_KU], tile);
+
+                        _storeTile(tile, pLayer, firstSample + sample, firstNeuron + neuron, pAccum,
+                                    min(numTileSamples - sample, GEMM_MR), min(numNeurons - neuron, GEMM_NR),
+                                    (firstInput == 0U), ((firstInput + numTileInputs) == numInputs));
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+
+
+
+/*
+ * Packs numSamples rows into panels of GEMM_MR samples, each panel laid out
+ * as [inputGroup][sample][GEMM_KU], zero-padded out to whole panels and groups
+ */
+static void _packInputs(activation_t* pPacked, const activation_t* pInput, uint32_t numInputs,
+                        uint32_t numSamples, uint32_t numTileInputs)
+{
+    const uint32_t numPackedSamples = ROUND_UP_TO_MULTIPLE(numSamples, GEMM_MR);
+    const uint32_t numPackedInputs = ROUND_UP_TO_MULTIPLE(numTileInputs, GEMM_KU);
+
+    for (uint32_t sample = 0; sample < numPackedSamples; sample++)
+    {
+        activation_t* pPanel = &pPacked[(sample / GEMM_MR) * GEMM_MR * numPackedInputs];
+
+        for (uint32_t input = 0; input < numPackedInputs; input++)
+        {
+            const bool inRange = (sample < numSamples) && (input < numTileInputs);
+
+            pPanel[((input / GEMM_KU) * GEMM_MR * GEMM_KU) + ((sample % GEMM_MR) * GEMM_KU) + (input % GEMM_KU)] =
+                inRange ? pInput[(sample * numInputs) + input] : 0;
+        }
+    }
+}
+
+/* As above, with panels of GEMM_NR neurons laid out as [inputGroup][neuron][GEMM_KU] */
+static void _packWeights(weight_t* pPacked, const weight_t* pWeight, uint32_t weightStride,
+                            uint32_t numNeurons, uint32_t numTileInputs)
+{
+    const uint32_t numPackedNeurons = ROUND_UP_TO_MULTIPLE(numNeurons, GEMM_NR);
+    const uint32_t numPackedInputs = ROUND_UP_TO_MULTIPLE(numTileInputs, GEMM_KU);
+
+    for (uint32_t neuron = 0; neuron < numPackedNeurons; neuron++)
+    {
+        weight_t* pPanel = &pPacked[(neuron / GEMM_NR) * GEMM_NR * numPackedInputs];
+
+        for (uint32_t input = 0; input < numPackedInputs; input++)
+        {
+            const bool inRange = (neuron < numNeurons) && (input < numTileInputs);
+
+            pPanel[((input / GEMM_KU) * GEMM_NR * GEMM_KU) + ((neuron % GEMM_NR) * GEMM_KU) + (input % GEMM_KU)] =
+                inRange ? pWeight[(neuron * weightStride) + input] : 0;
+        }
+    }
+}
+
+/*
+ * Adds the partial sums of earlier blocks of inputs to the valid part of a
+ * tile, then either keeps it for the next block or, once every input is in,
+ * runs the epilogue straight from the tile into the layer's activations.
+ */
+static void _storeTile(accumulator_t* pTile, const layerDescriptor_t* pLayer, uint32_t firstSample,
+                        uint32_t firstNeuron, accumulator_t* pAccum, uint32_t numSamples, uint32_t numNeurons,
+                        bool firstBlock, bool lastBlock)
+{
+    for (uint32_t sample = 0; sample < numSamples; sample++)
+    {
+        const uint32_t rowOffset = ((firstSample + sample) * pLayer->numNeurons) + firstNeuron;
+        accumulator_t* pTileRow = &pTile[sample * GEMM_NR];
+        accumulator_t* pAccumRow = &pAccum[rowOffset];
+
+        if (!firstBlock)
+        {
+            for (uint32_t neuron = 0; neuron < numNeurons; neuron++)
+            {
+                pTileRow[neuron] += pAccumRow[neuron];
+            }
+        }
+
+        if (lastBlock)
+        {
+            embann_activateRow(&pLayer->activation[rowOffset], pTileRow, pLayer, firstNeuron, numNeurons);
+        }
+        else
+        {
+            memcpy(pAccumRow, pTileRow, numNeurons * sizeof(accumulator_t));
+        }
+    }
+}
+
+
+
+
+
+/*
+ * Reference implementations, every SIMD kernel must give exactly the same
+ * result as these. The one exception is the float micro-kernels, which fuse
+ * each multiply-add and so can differ in the last bit. They're always inlined
+ * so that each target below gets its own auto-vectorised copy.
+ */
+static ALWAYS_INLINE accumulator_t _dotProductBody(const activation_t* pActivation, const weight_t* pWeight,
+                                                    uint32_t numInputs)
+{
+    accumulator_t accum = 0;
+
+    for (uint32_t i = 0; i < numInputs; i++)
+    {
+        accum += pActivation[i] * pWeight[i];
+    }
+    return accum;
+}
+
+static ALWAYS_INLINE void _accumulateGradientBody(accumulator_t* pGradient, const activation_t* pActivation,
+                                                    accumulator_t error, uint32_t numInputs)
+{
+    for (uint32_t i = 0; i < numInputs; i++)
+    {
+        pGradient[i] += pActivation[i] * error;
+    }
+}
+
+static ALWAYS_INLINE void _applyGradientsBody(weight_t* pWeight, accumulator_t* pGradient, uint32_t numWeights)
+{
+    for (uint32_t i = 0; i < numWeights; i++)
+    {
+        pWeight[i] -= (weight_t) pGradient[i];
+        pGradient[i] = 0;
+    }
+}
+
+static ALWAYS_INLINE void _gemmMicroKernelBody(uint32_t numInputGroups, const activation_t* pInputPanel,
+                                                const weight_t* pWeightPanel, accumulator_t* pTile)
+{
+    accumulator_t accum[GEMM_MR][GEMM_NR] = {{0}};
+
+    for (uint32_t group = 0; group < numInputGroups; group++)
+    {
+        const activation_t* pInputGroup = &pInputPanel[group * GEMM_MR * GEMM_KU];
+        const weight_t* pWeightGroup = &pWeightPanel[group * GEMM_NR * GEMM_KU];
+
+        for (uint32_t sample = 0; sample < GEMM_MR; sample++)
+        {
+            for (uint32_t neuron = 0; neuron < GEMM_NR; neuron++)
+            {
+                for (uint32_t input = 0; input < GEMM_KU; input++)
+                {
+                    accum[sample][neuron] += pInputGroup[(sample * GEMM_KU) + input] *
+                                                pWeightGroup[(neuron * GEMM_KU) + input];
+                }
+            }
+        }
+    }
+    memcpy(pTile, accum, sizeof(accum));
+}
+
+static ALWAYS_INLINE void _convertBody(activation_t* pActivation, const float* pValue, uint32_t numValues)
+{
+    for (uint32_t i = 0; i < numValues; i++)
+    {
+#ifdef ACTIVATION_IS_FLOAT
+        pActivation[i] = (activation_t) pValue[i];
+#else
+        /* Every comparison with a NaN is false, so they fall through to the bottom */
+        pActivation[i] = (pValue[i] >= (float) MAX_ACTIVATION) ? MAX_ACTIVATION :
+                            ((pValue[i] > (float) MIN_ACTIVATION) ? (activation_t) nearbyintf(pValue[i]) :
+                            MIN_ACTIVATION);
+#endif
+    }
+}
+
+static accumulator_t _dotProductScalar(const activation_t* pActivation, const weight_t* pWeight,
+                                        uint32_t numInputs)
+{
+    return _dotProductBody(pActivation, pWeight, numInputs);
+}
+
+static void _accumulateGradientScalar(accumulator_t* pGradient, const activation_t* pActivation,
+                                      accumulator_t error, uint32_t numInputs)
+{
+    _accumulateGradientBody(pGradient, pActivation, error, numInputs);
+}
+
+static void _applyGradientsScalar(weight_t* pWeight, accumulator_t* pGradient, uint32_t numWeights)
+{
+    _applyGradientsBody(pWeight, pGradient, numWeights);
+}
+
+static void _gemmMicroKernelScalar(uint32_t numInputGroups, const activation_t* pInputPanel,
+                                    const weight_t* pWeightPanel, accumulator_t* pTile)
+{
+    _gemmMicroKernelBody(numInputGroups, pInputPanel, pWeightPanel, pTile);
+}
+
+static void _convertScalar(activation_t* pActivation, const float* pValue, uint32_t numValues)
+{
+    _convertBody(pActivation, pValue, numValues);
+}
+
+
+
+
+
+#ifdef KERNEL_RUNTIME_DISPATCH
+/*
+ * PMOVZXBW / PMOVSXBW widen both operands to s16 and PMADDWD multiplies and
+ * pairwise adds them exactly into s32, 8 MACs per instruction.
+ */
+static TARGET_SSE4_2 accumulator_t _dotProductSse4(const activation_t* pActivation, const weight_t* pWeight,
+                                                    uint32_t numInputs)
+{
+#ifdef KERNEL_TYPES_U8_S8_S32
+    __m128i accum = _mm_setzero_si128();
+    uint32_t i = 0;
+
+    for (; (i + 8U) <= numInputs; i += 8U)
+    {
+        const __m128i activation = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*) &pActivation[i]));
+        const __m128i weight = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*) &pWeight[i]));
+        accum = _mm_add_epi32(accum, _mm_madd_epi16(activation, weight));
+    }
+
+    accum = _mm_add_epi32(accum, _mm_shuffle_epi32(accum, _MM_SHUFFLE(1, 0, 3, 2)));
+    accum = _mm_add_epi32(accum, _mm_shuffle_epi32(accum, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    return _mm_cvtsi128_si32(accum) + _dotProductBody(&pActivation[i], &pWeight[i], numInputs - i);
+#else
+    return _dotProductBody(pActivation, pWeight, numInputs);
+#endif
+}
+
+static TARGET_SSE4_2 void _accumulateGradientSse4(accumulator_t* pGradient, const activation_t* pActivation,
+                                                  accumulator_t error, uint32_t numInputs)
+{
+    _accumulateGradientBody(pGradient, pActivation, error, numInputs);
+}
+
+static TARGET_SSE4_2 void _applyGradientsSse4(weight_t* pWeight, accumulator_t* pGradient, uint32_t numWeights)
+{
+    _applyGradientsBody(pWeight, pGradient, numWeights);
+}
+
+/*
+ * An input group of 2 neurons widens to one xmm of s16, so PMADDWD against a
+ * sample's GEMM_KU activations, repeated twice, leaves each neuron's sum in a
+ * pair of lanes, which PHADDD folds together. 16 accumulators and the weights
+ * don't fit in 16 registers, so the tile is done 8 neurons at a time. Float
+ * builds broadcast each input against 4 neurons per register, with no FMA
+ * before AVX2.
+ */
+static TARGET_SSE4_2 void _gemmMicroKernelSse4(uint32_t numInputGroups, const activation_t* pInputPanel,
+                                                const weight_t* pWeightPanel, accumulator_t* pTile)
+{
+#ifdef KERNEL_TYPES_U8_S8_S32
+    for (uint32_t firstNeuron = 0; firstNeuron < GEMM_NR; firstNeuron += 8U)
+    {
+        __m128i accum[GEMM_MR][2];
+
+        for (uint32_t sample = 0; sample < GEMM_MR; sample++)
+        {
+            accum[sample][0] = _mm_setzero_si128();
+            accum[sample][1] = _mm_setzero_si128();
+        }
+
+        for (uint32_t group = 0; group < numInputGroups; group++)
+        {
+            const weight_t* pWeightGroup = &pWeightPanel[(group * GEMM_NR * GEMM_KU) + (firstNeuron * GEMM_KU)];
+            __m128i weight[4];
+
+            for (uint32_t i = 0; i < 4U; i++)
+            {
+                weight[i] = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*) &pWeightGroup[i * 2U * GEMM_KU]));
+            }
+
+            for (uint32_t sample = 0; sample < GEMM_MR; sample++)
+            {
+                int32_t activations;
+                memcpy(&activations, &pInputPanel[(group * GEMM_MR * GEMM_KU) + (sample * GEMM_KU)],
+                        sizeof(activations));
+                const __m128i activation = _mm_cvtepu8_epi16(_mm_set1_epi32(activations));
+
+                for (uint32_t i = 0; i < 2U; i++)
+                {
+                    accum[sample][i] = _mm_add_epi32(accum[sample][i],
+                                                    _mm_hadd_epi32(_mm_madd_epi16(activation, weight[2U * i]),
+                                                                    _mm_madd_epi16(activation, weight[(2U * i) + 1U])));
+                }
+            }
+        }
+
+        for (uint32_t sample = 0; sample < GEMM_MR; sample++)
+        {
+            _mm_storeu_si128((__m128i*) &pTile[(sample * GEMM_NR) + firstNeuron], accum[sample][0]);
+            _mm_storeu_si128((__m128i*) &pTile[(sample * GEMM_NR) + firstNeuron + 4U], accum[sample][1]);
+        }
+    }
+#elif defined(KERNEL_TYPES_F32)
+    for (uint32_t firstNeuron = 0; firstNeuron < GEMM_NR; firstNeuron += 8U)
+    {
+        __m128 accum[GEMM_MR][2];
+
+        for (uint32_t sample = 0; sample < GEMM_MR; sample++)
+        {
+            accum[sample][0] = _mm_setzero_ps();
+            accum[sample][1] = _mm_setzero_ps();
+        }
+
+        for (uint32_t input = 0; input < numInputGroups; input++)
+        {
+            const weight_t* pWeightRow = &pWeightPanel[(input * GEMM_NR) + firstNeuron];
+            const __m128 weight[2] = { _mm_loadu_ps(pWeightRow), _mm_loadu_ps(&pWeightRow[4]) };
+
+            for (uint32_t sample = 0; sample < GEMM_MR; sample++)
+            {
+                const __m128 activation = _mm_set1_ps(pInputPanel[(input * GEMM_MR) + sample]);
+                accum[sample][0] = _mm_add_ps(accum[sample][0], _mm_mul_ps(activation, weight[0]));
+                accum[sample][1] = _mm_add_ps(accum[sample][1], _mm_mul_ps(activation, weight[1]));
+            }
+        }
+
+        for (uint32_t sample = 0; sample < GEMM_MR; sample++)
+        {
+            _mm_storeu_ps(&pTile[(sample * GEMM_NR) + firstNeuron], accum[sample][0]);
+            _mm_storeu_ps(&pTile[(sample * GEMM_NR) + firstNeuron + 4U], accum[sample][1]);
+        }
+    }
+#else
+    _gemmMicroKernelBody(numInputGroups, pInputPanel, pWeightPanel, pTile);
+#endif
+}
+
+/*
+ * MAXPS returns its second operand when either is a NaN, so clamping against
+ * zero first zeroes them. CVTPS2DQ then rounds ties to even like nearbyintf(),
+ * and the packs can't saturate as everything is already 0 - 255.
+ */
+static TARGET_SSE4_2 void _convertSse4(activation_t* pActivation, const float* pValue, uint32_t numValues)
+{
+#ifdef KERNEL_ACTIVATION_U8
+    const __m128 low = _mm_setzero_ps();
+    const __m128 high = _mm_set1_ps((float) MAX_ACTIVATION);
+    uint32_t i = 0;
+
+    for (; (i + 16U) <= numValues; i += 16U)
+    {
+        __m128i value[4];
+
+        for (uint32_t j = 0; j < 4U; j++)
+        {
+            value[j] = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(&pValue[i + (j * 4U)]), low), high));
+        }
+        _mm_storeu_si128((__m128i*) &pActivation[i], _mm_packus_epi16(_mm_packs_epi32(value[0], value[1]),
+                                                                        _mm_packs_epi32(value[2], value[3])));
+    }
+    _convertBody(&pActivation[i], &pValue[i], numValues - i);
+#else
+    _convertBody(pActivation, pValue, numValues);
+#endif
+}
+
+
+
+
+
+/*
+ * VPMADDUBSW saturates its pairwise sums to s16, and 2 * 255 * 127 does not
+ * fit, so this is the SSE4.2 kernel at twice the width rather than the
+ * u8 * s8 instruction, 16 MACs per instruction.
+ */
+static TARGET_AVX2 accumulator_t _dotProductAvx2(const activation_t* pActivation, const weight_t* pWeight,
+                                                    uint32_t numInputs)
+{
+#ifdef KERNEL_TYPES_U8_S8_S32
+    __m256i accum = _mm256_setzero_si256();
+    uint32_t i = 0;
+
+    for (; (i + 16U) <= numInputs; i += 16U)
+    {
+        const __m256i activation = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) &pActivation[i]));
+        const __m256i weight = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) &pWeight[i]));
+        accum = _mm256_add_epi32(accum, _mm256_madd_epi16(activation, weight));
+    }
+
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(accum), _mm256_extracti128_si256(accum, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    return _mm_cvtsi128_si32(sum) + _dotProductBody(&pActivation[i], &pWeight[i], numInputs - i);
+#else
+    return _dotProductBody(pActivation, pWeight, numInputs);
+#endif
+}
+
+static TARGET_AVX2 void _accumulateGradientAvx2(accumulator_t* pGradient, const activation_t* pActivation,
+                                                accumulator_t error, uint32_t numInputs)
+{
+    _accumulateGradientBody(pGradient, pActivation, error, numInputs);
+}
+
+static TARGET_AVX2 void _applyGradientsAvx2(weight_t* pWeight, accumulator_t* pGradient, uint32_t numWeights)
+{
+    _applyGradientsBody(pWeight, pGradient, numWeights);
+}
+
+/*
+ * The SSE4.2 micro-kernel at twice the width, so the whole tile fits in the
+ * registers at once. VPHADDD works within each 128 bit lane, leaving the
+ * neurons in the order 0 1 4 5 2 3 6 7 until VPERMQ puts them back as the
+ * tile is stored. Float builds broadcast each input against 8 neurons per
+ * register with VFMADD231PS.
+ */
+static TARGET_AVX2 void _gemmMicroKernelAvx2(uint32_t numInputGroups, const activation_t* pInputPanel,
+                                                const weight_t* pWeightPanel, accumulator_t* pTile)
+{
+#ifdef KERNEL_TYPES_U8_S8_S32
+    __m256i accum[GEMM_MR][2];
+
+    for (uint32_t sample = 0; sample < GEMM_MR; sample++)
+    {
+        accum[sample][0] = _mm256_setzero_si256();
+        accum[sample][1] = _mm256_setzero_si256();
+    }
+
+    for (uint32_t group = 0; group < numInputGroups; group++)
+    {
+        const weight_t* pWeightGroup = &pWeightPanel[group * GEMM_NR * GEMM_KU];
+        __m256i weight[4];
+
+        for (uint32_t i = 0; i < 4U; i++)
+        {
+            weight[i] = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) &pWeightGroup[i * 4U * GEMM_KU]));
+        }
+
+        for (uint32_t sample = 0; sample < GEMM_MR; sample++)
+        {
+            int32_t activations;
+            memcpy(&activations, &pInputPanel[(group * GEMM_MR * GEMM_KU) + (sample * GEMM_KU)], sizeof(activations));
+            const __m256i activation = _mm256_cvtepu8_epi16(_mm_set1_epi32(activations));
+
+            for (uint32_t i = 0; i < 2U; i++)
+            {
+                accum[sample][i] = _mm256_add_epi32(accum[sample][i],
+                                                    _mm256_hadd_epi32(_mm256_madd_epi16(activation, weight[2U * i]),
+                                                                _mm256_madd_epi16(activation, weight[(2U * i) + 1U])));
+            }
+        }
+    }
+
+    for (uint32_t sample = 0; sample < GEMM_MR; sample++)
+    {
+        for (uint32_t i = 0; i < 2U; i++)
+        {
+            _mm256_storeu_si256((__m256i*) &pTile[(sample * GEMM_NR) + (i * 8U)],
+                                _mm256_permute4x64_epi64(accum[sample][i], _MM_SHUFFLE(3, 1, 2, 0)));
+        }
+    }
+#elif defined(KERNEL_TYPES_F32)
+    __m256 accum[GEMM_MR][2];
+
+    for (uint32_t sample = 0; sample < GEMM_MR; sample++)
+    {
+        accum[sample][0] = _mm256_setzero_ps();
+        accum[sample][1] = _mm256_setzero_ps();
+    }
+
+    for (uint32_t input = 0; input < numInputGroups; input++)
+    {
+        const weight_t* pWeightRow = &pWeightPanel[input * GEMM_NR];
+        const __m256 weight[2] = { _mm256_loadu_ps(pWeightRow), _mm256_loadu_ps(&pWeightRow[8]) };
+
+        for (uint32_t sample = 0; sample < GEMM_MR; sample++)
+        {
+            const __m256 activation = _mm256_set1_ps(pInputPanel[(input * GEMM_MR) + sample]);
+            accum[sample][0] = _mm256_fmadd_ps(activation, weight[0], accum[sample][0]);
+            accum[sample][1] = _mm256_fmadd_ps(activation, weight[1], accum[sample][1]);
+        }
+    }
+
+    for (uint32_t sample = 0; sample < GEMM_MR; sample++)
+    {
+        _mm256_storeu_ps(&pTile[sample * GEMM_NR], accum[sample][0]);
+        _mm256_storeu_ps(&pTile[(sample * GEMM_NR) + 8U], accum[sample][1]);
+    }
+#else
+    _gemmMicroKernelBody(numInputGroups, pInputPanel, pWeightPanel, pTile);
+#endif
+}
+
+/* The SSE4.2 kernel at twice the width, the packs work per 128 bit lane so the dwords need putting back in order */
+static TARGET_AVX2 void _convertAvx2(activation_t* pActivation, const float* pValue, uint32_t numValues)
+{
+#ifdef KERNEL_ACTIVATION_U8
+    const __m256 low = _mm256_setzero_ps();
+    const __m256 high = _mm256_set1_ps((float) MAX_ACTIVATION);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    uint32_t i = 0;
+
+    for (; (i + 32U) <= numValues; i += 32U)
+    {
+        __m256i value[4];
+
+        for (uint32_t j = 0; j < 4U; j++)
+        {
+            value[j] = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(&pValue[i + (j * 8U)]), low),
+                                                        high));
+        }
+        const __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(value[0], value[1]),
+                                                    _mm256_packs_epi32(value[2], value[3]));
+        _mm256_storeu_si256((__m256i*) &pActivation[i], _mm256_permutevar8x32_epi32(packed, order));
+    }
+    _convertBody(&pActivation[i], &pValue[i], numValues - i);
+#else
+    _convertBody(pActivation, pValue, numValues);
+#endif
+}
+
+
+
+
+
+/*
+ * VPDPBUSD multiplies 4 adjacent u8 * s8 pairs and adds them straight into
+ * each s32 lane, so one instruction does 64 MACs with no intermediate
+ * saturation. The tail is handled with masked loads, the zeroed lanes
+ * contribute nothing to the sum.
+ */
+static TARGET_AVX512 accumulator_t _dotProductAvx512(const activation_t* pActivation, const weight_t* pWeight,
+                                                        uint32_t numInputs)
+{
+#ifdef KERNEL_TYPES_U8_S8_S32
+    __m512i accum = _mm512_setzero_si512();
+    uint32_t i = 0;
+
+    for (; (i + 64U) <= numInputs; i += 64U)
+    {
+        const __m512i activation = _mm512_loadu_si512((const void*) &pActivation[i]);
+        const __m512i weight = _mm512_loadu_si512((const void*) &pWeight[i]);
+        accum = _mm512_dpbusd_epi32(accum, activation, weight);
+    }
+
+    if (i < numInputs)
+    {
+        const __mmask64 tailMask = _cvtu64_mask64((1ULL << (numInputs - i)) - 1U);
+        const __m512i activation = _mm512_maskz_loadu_epi8(tailMask, &pActivation[i]);
+        const __m512i weight = _mm512_maskz_loadu_epi8(tailMask, &pWeight[i]);
+        accum = _mm512_dpbusd_epi32(accum, activation, weight);
+    }
+
+    return _mm512_reduce_add_epi32(accum);
+#else
+    return _dotProductBody(pActivation, pWeight, numInputs);
+#endif
+}
+
+static TARGET_AVX512 void _accumulateGradientAvx512(accumulator_t* pGradient, const activation_t* pActivation,
+                                                    accumulator_t error, uint32_t numInputs)
+{
+    _accumulateGradientBody(pGradient, pActivation, error, numInputs);
+}
+
+static TARGET_AVX512 void _applyGradientsAvx512(weight_t* pWeight, accumulator_t* pGradient, uint32_t numWeights)
+{
+    _applyGradientsBody(pWeight, pGradient, numWeights);
+}
+
+/*
+ * Each input group of a weight panel is GEMM_NR neurons * GEMM_KU inputs, one
+ * whole zmm of s8. Broadcasting a sample's GEMM_KU activations to every lane
+ * lets one VPDPBUSD add that group into all GEMM_NR of its accumulators.
+ * Panels and tiles are only cache line aligned, so the loads and stores are
+ * unaligned; on aligned data they cost the same. Float builds broadcast each
+ * input against a whole zmm of GEMM_NR weights with VFMADD231PS.
+ */
+static TARGET_AVX512 void _gemmMicroKernelAvx512(uint32_t numInputGroups, const activation_t* pInputPanel,
+                                                    const weight_t* pWeightPanel, accumulator_t* pTile)
+{
+#ifdef KERNEL_TYPES_U8_S8_S32
+    __m512i accum[GEMM_MR];
+
+    for (uint32_t sample = 0; sample < GEMM_MR; sample++)
+    {
+        accum[sample] = _mm512_setzero_si512();
+    }
+
+    for (uint32_t group = 0; group < numInputGroups; group++)
+    {
+        const __m512i weight = _mm512_loadu_si512((const void*) &pWeightPanel[group * GEMM_NR * GEMM_KU]);
+
+        for (uint32_t sample = 0; sample < GEMM_MR; sample++)
+        {
+            int32_t activations;
+            memcpy(&activations, &pInputPanel[(group * GEMM_MR * GEMM_KU) + (sample * GEMM_KU)], sizeof(activations));
+            accum[sample] = _mm512_dpbusd_epi32(accum[sample], _mm512_set1_epi32(activations), weight);
+        }
+    }
+
+    for (uint32_t sample = 0; sample < GEMM_MR; sample++)
+    {
+        _mm512_storeu_si512((void*) &pTile[sample * GEMM_NR], accum[sample]);
+    }
+#elif defined(KERNEL_TYPES_F32)
+    __m512 accum[GEMM_MR];
+
+    for (uint32_t sample = 0; sample < GEMM_MR; sample++)
+    {
+        accum[sample] = _mm512_setzero_ps();
+    }
+
+    for (uint32_t input = 0; input < numInputGroups; input++)
+    {
+        const __m512 weight = _mm512_loadu_ps(&pWeightPanel[input * GEMM_NR]);
+
+        for (uint32_t sample = 0; sample < GEMM_MR; sample++)
+        {
+            accum[sample] = _mm512_fmadd_ps(_mm512_set1_ps(pInputPanel[(input * GEMM_MR) + sample]), weight,
+                                            accum[sample]);
+        }
+    }
+
+    for (uint32_t sample = 0; sample < GEMM_MR; sample++)
+    {
+        _mm512_storeu_ps(&pTile[sample * GEMM_NR], accum[sample]);
+    }
+#else
+    _gemmMicroKernelBody(numInputGroups, pInputPanel, pWeightPanel, pTile);
+#endif
+}
+
+/* VPMOVDB narrows straight to bytes, and masking the loads and stores handles the tail */
+static TARGET_AVX512 void _convertAvx512(activation_t* pActivation, const float* pValue, uint32_t numValues)
+{
+#ifdef KERNEL_ACTIVATION_U8
+    const __m512 low = _mm512_setzero_ps();
+    const __m512 high = _mm512_set1_ps((float) MAX_ACTIVATION);
+
+    for (uint32_t i = 0; i < numValues; i += 16U)
+    {
+        const __mmask16 mask = (__mmask16) (((numValues - i) >= 16U) ? 0xFFFFU : ((1U << (numValues - i)) - 1U));
+        const __m512 value = _mm512_maskz_loadu_ps(mask, &pValue[i]);
+        _mm512_mask_cvtepi32_storeu_epi8(&pActivation[i], mask,
+                                            _mm512_cvtps_epi32(_mm512_min_ps(_mm512_max_ps(value, low), high)));
+    }
+#else
+    _convertBody(pActivation, pValue, numValues);
+#endif
+}
+#endif // KERNEL_RUNTIME_DISPATCH
@@ -0,0 +1,271 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+    embann_publish.c - EMbedded Backpropogating Artificial Neural Network.
+    Copyright Peter Frost 2019
+*/
+
+#include "embann.h"
+#include "embann_log.h"
+
+#define TAG "Embann Publish"
+
+/*
+ * Readers announce the network they're about to use in their reading slot,
+ * then check it's still the current one, so a network the publisher finds in
+ * no reading slot after swapping it out can never be picked up again. The
+ * sequentially consistent stores and loads are what make that hold.
+ */
+
+#ifdef CONFIG_MODEL_PUBLISHING
+static bool _isBeingRead(modelPublisher_t* pPublisher, const network_t* pNetwork);
+static bool _isSameShape(const network_t* pNetwork, const network_t* pOther);
+
+
+
+
+
+/*
+ * Starts pPublisher off serving pNetwork. Every network given to a publisher,
+ * this one included, belongs to it from then on and is freed by it.
+ */
+int embann_initPublisher(modelPublisher_t* pPublisher, network_t* pNetwork)
+{
+    if ((pPublisher == NULL) || (pNetwork == NULL))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    atomic_init(&pPublisher->current, pNetwork);
+    for (uint32_t i = 0; i < CONFIG_NUM_MODEL_READERS; i++)
+    {
+        atomic_init(&pPublisher->reading[i].pNetwork, NULL);
+    }
+    pPublisher->numRetired = 0U;
+    return EOK;
+}
+
+
+
+
+
+/*
+ * Makes pNetwork the network readers get from now on, it has to be the same
+ * shape as the current one so sessions fit both. Readers part way through the
+ * old network carry on with it, and it's freed by the first
+ * embann_publishNetwork() or embann_reclaimNetworks() after they've finished.
+ * Only one thread may publish, and pNetwork mustn't change once published.
+ */
+int embann_publishNetwork(modelPublisher_t* pPublisher, network_t* pNetwork)
+{
+    if ((pPublisher == NULL) || (pNetwork == NULL))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    /* Nothing else changes current, so this can't be stale */
+    const network_t* pCurrent = atomic_load_explicit(&pPublisher->current, memory_order_relaxed);
+
+    if ((pNetwork == pCurrent) || !_isSameShape(pNetwork, pCurrent))
+    {
+        EMBANN_LOGE(TAG, "Published networks must be new, and the same shape as the last");
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    /*
+     * Everything still retired is being read, and each reader only reads one
+     * network, so there's always room for one more
+     */
+    pPublisher->retired[pPublisher->numRetired] = atomic_exchange(&pPublisher->current, pNetwork);
+    pPublisher->numRetired++;
+
+    return embann_reclaimNetworks(pPublisher);
+}
+
+
+
+
+
+/* Frees every retired network that no reader is using any more, from the publishing thread only */
+int embann_reclaimNetworks(modelPublisher_t* pPublisher)
+{
+    uint32_t numStillRead = 0U;
+
+    if (pPublisher == NULL)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    for (uint32_t i = 0; i < pPublisher->numRetired; i++)
+    {
+        network_t* pRetired = pPublisher->retired[i];
+
+        if (_isBeingRead(pPublisher, pRetired))
+        {
+            pPublisher->retired[numStillRead] = pRetired;
+            numStillRead++;
+        }
+        else
+        {
+            EMBANN_ERROR_CHECK(embann_freeNetwork(pRetired));
+        }
+    }
+    pPublisher->numRetired = numStillRead;
+    return EOK;
+}
+
+
+
+
+
+/*
+ * Frees every network pPublisher has been given, which has to wait until no
+ * reader has one acquired, EBUSY otherwise
+ */
+int embann_freePublisher(modelPublisher_t* pPublisher)
+{
+    if (pPublisher == NULL)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    for (uint32_t i = 0; i < CONFIG_NUM_MODEL_READERS; i++)
+    {
+        if (atomic_load(&pPublisher->reading[i].pNetwork) != NULL)
+        {
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return EBUSY;
+        }
+    }
+
+    EMBANN_ERROR_CHECK(embann_reclaimNetworks(pPublisher));
+    return embann_freeNetwork(atomic_exchange(&pPublisher->current, NULL));
+}
+
+
+
+
+
+/*
+ * Gives reader the published network in *ppNetwork, which stays valid until
+ * embann_releaseNetwork(), however many networks are published meanwhile.
+ * Never waits on the publisher. reader is 0 to CONFIG_NUM_MODEL_READERS - 1,
+ * and no two threads may use the same reader at once.
+ */
+int embann_acquireNetwork(modelPublisher_t* pPublisher, uint32_t reader, const network_t** ppNetwork)
+{
+    if ((pPublisher == NULL) || (ppNetwork == NULL) || (reader >= CONFIG_NUM_MODEL_READERS))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    network_t* pNetwork = atomic_load(&pPublisher->current);
+    network_t* pAnnounced;
+
+    /* Only goes round again if a network was published in between */
+    do
+    {
+        pAnnounced = pNetwork;
+        atomic_store(&pPublisher->reading[reader].pNetwork, pAnnounced);
+        pNetwork = atomic_load(&pPublisher->current);
+    } while (pNetwork != pAnnounced);
+
+    *ppNetwork = pNetwork;
+    return EOK;
+}
+
+
+
+
+
+int embann_releaseNetwork(modelPublisher_t* pPublisher, uint32_t reader)
+{
+    if ((pPublisher == NULL) || (reader >= CONFIG_NUM_MODEL_READERS))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    /* Release, so everything read from the network happens before it can be freed */
+    atomic_store_explicit(&pPublisher->reading[reader].pNetwork, NULL, memory_order_release);
+    return EOK;
+}
+
+
+
+
+
+/*
+ * embann_forwardPropagateSession() on whichever network is published at the
+ * time, as reader. pSession has to have been set up for a network of the
+ * published shape, and its pNetwork isn't valid afterwards.
+ */
+int embann_forwardPropagatePublished(modelPublisher_t* pPublisher, uint32_t reader, inferenceSession_t* pSession,
+                                        const activation_t* pInputs)
+{
+    const network_t* pNetwork;
+
+    if (pSession == NULL)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    int err = embann_acquireNetwork(pPublisher, reader, &pNetwork);
+    if (err == EOK)
+    {
+        pSession->pNetwork = pNetwork;
+        err = embann_forwardPropagateSession(pSession, pInputs);
+        (void) embann_releaseNetwork(pPublisher, reader);
+    }
+    return err;
+}
+
+
+
+
+
+static bool _isBeingRead(modelPublisher_t* pPublisher, const network_t* pNetwork)
+{
+    bool beingRead = false;
+
+    for (uint32_t i = 0; i < CONFIG_NUM_MODEL_READERS; i++)
+    {
+        beingRead = beingRead || (atomic_load(&pPublisher->reading[i].pNetwork) == pNetwork);
+    }
+    return beingRead;
+}
+
+
+
+
+
+static bool _isSameShape(const network_t* pNetwork, const network_t* pOther)
+{
+    const numLayers_t numHiddenLayers = pNetwork->properties.numHiddenLayers;
+    bool sameShape = (numHiddenLayers == pOther->properties.numHiddenLayers);
+
+    for (numLayers_t i = 0; sameShape && (i <= numHiddenLayers); i++)
+    {
+        const layerDescriptor_t layer = embann_describeLayer(pNetwork, i);
+        const layerDescriptor_t otherLayer = embann_describeLayer(pOther, i);
+
+        sameShape = (layer.numInputs == otherLayer.numInputs) && (layer.numNeurons == otherLayer.numNeurons);
+    }
+    return sameShape;
+}
+#endif // CONFIG_MODEL_PUBLISHING
@@ -0,0 +1,938 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+    embann_quantization.c - EMbedded Backpropogating Artificial Neural Network.
+    Copyright Peter Frost 2019
+*/
+
+#include "embann.h"
+#include "embann_log.h"
+
+#define TAG "Embann Quantization"
+
+/* "EMBQ" read as a little endian uint32_t, the first field of a quantized network file */
+#define QUANTIZED_FILE_MAGIC 0x51424D45UL
+#define QUANTIZED_FILE_VERSION 1UL
+/* Bytes of one neuron in a quantized network file, bias, multiplier, exponent and weights */
+#define QUANTIZED_NEURON_SIZE(numInputs) (4UL + 4UL + 1UL + (numInputs))
+
+
+
+#ifdef CONFIG_REQUANTIZATION
+static activation_t _inputZeroPoint(const network_t* pNetwork, numLayers_t layer);
+#endif
+#ifdef QUANTIZATION_SOURCE
+static void _widenRange(activationRange_t* pRange, const activation_t* pActivation, uint32_t numNeurons);
+static void _activationQuantization(const network_t* pNetwork, const activationRange_t* pRanges, numLayers_t index,
+                                    double* pScale, uint8_t* pZeroPoint);
+static double _weightScale(const layerDescriptor_t* pLayer, uint32_t neuron);
+static int8_t _quantizeWeight(weight_t weight, double weightScale);
+static int _quantizeNeuron(const network_t* pNetwork, const layerDescriptor_t* pLayer, uint32_t neuron,
+                            const activationRange_t* pRanges, numLayers_t layer, int32_t* pBias,
+                            int32_t* pMultiplier, int8_t* pExponent);
+static int _writeQuantizedNetwork(const network_t* pNetwork, const activationRange_t* pRanges, FILE* pFile);
+static int _writeQuantizedHeader(const network_t* pNetwork, const activationRange_t* pRanges, FILE* pFile);
+static void _writeLittleEndian(FILE* pFile, uint32_t value, uint32_t numBytes);
+#endif
+#ifdef QUANTIZATION_TARGET
+static int _checkQuantizedFile(const network_t* pNetwork, FILE* pFile, float* pInputScale);
+static int _readQuantizedFile(network_t* pNetwork, FILE* pFile);
+static uint32_t _readLittleEndian(FILE* pFile, uint32_t numBytes, int* pErr);
+static int _setLayerOutput(network_t* pNetwork, numLayers_t layer, activationFunction_t function, uint8_t zeroPoint);
+#endif
+
+
+
+
+
+/*
+ * Splits a positive real multiplier into the Q0.31 multiplier and power of 2
+ * exponent used by quantParams_t, the same as TensorFlow Lite's
+ * QuantizeMultiplier(). Multipliers too small to represent become 0.
+ */
+int embann_quantizeMultiplier(double realMultiplier, int32_t* pMultiplier, int8_t* pExponent)
+{
+    int exponent;
+
+    if ((realMultiplier < 0.0) || (pMultiplier == NULL) || (pExponent == NULL))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    const double fraction = frexp(realMultiplier, &exponent);
+    int64_t fixedPoint = llround(fraction * (double) (1LL << 31));
+
+    if (fixedPoint == (1LL << 31))
+    {
+        fixedPoint /= 2;
+        exponent++;
+    }
+
+    if (exponent > 30)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ERANGE;
+    }
+
+    if ((fixedPoint == 0) || (exponent < -31))
+    {
+        fixedPoint = 0;
+        exponent = 0;
+    }
+
+    *pMultiplier = (int32_t) fixedPoint;
+    *pExponent = (int8_t) exponent;
+    return EOK;
+}
+
+
+
+
+
+#ifdef CONFIG_REQUANTIZATION
+/*
+ * Layers are numbered as in embann_setActivationFunction(). pMultiplier and
+ * pExponent hold either 1 scale for the whole layer, or numScales equal to
+ * the number of neurons in the layer for one each. zeroPoint is the
+ * activation value that represents 0 at this layer's output.
+ */
+int embann_setRequantization(network_t* pNetwork, numLayers_t layer, const int32_t* pMultiplier,
+                                const int8_t* pExponent, uint32_t numScales, activation_t zeroPoint)
+{
+    if ((layer > pNetwork->properties.numHiddenLayers) || (pMultiplier == NULL) || (pExponent == NULL))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+
+    if ((numScales != 1U) && (numScales != descriptor.numNeurons))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    for (uint32_t i = 0; i < descriptor.numNeurons; i++)
+    {
+        const uint32_t scale = (numScales == 1U) ? 0U : i;
+
+        descriptor.quant.multiplier[i] = pMultiplier[scale];
+        descriptor.quant.exponent[i] = pExponent[scale];
+    }
+
+    if (layer < pNetwork->properties.numHiddenLayers)
+    {
+        pNetwork->hiddenLayer[layer]->quant.zeroPoint = zeroPoint;
+    }
+    else
+    {
+        pNetwork->outputLayer->quant.zeroPoint = zeroPoint;
+    }
+
+    /* The next layer's offsets depend on this zero point */
+    return embann_updateZeroPointOffsets(pNetwork);
+}
+
+
+
+
+
+int embann_setInputZeroPoint(network_t* pNetwork, activation_t zeroPoint)
+{
+    pNetwork->inputLayer->zeroPoint = zeroPoint;
+    return embann_updateZeroPointOffsets(pNetwork);
+}
+
+
+
+
+
+/*
+ * Back to a scale of 1 and zero points of 0 everywhere, which leaves the
+ * accumulators untouched by requantization.
+ */
+int embann_resetRequantization(network_t* pNetwork)
+{
+    const int32_t identityMultiplier = (int32_t) (1UL << 30);
+    const int8_t identityExponent = 1;
+
+    pNetwork->inputLayer->zeroPoint = 0;
+
+    for (numLayers_t layer = 0; layer <= pNetwork->properties.numHiddenLayers; layer++)
+    {
+        EMBANN_ERROR_CHECK(embann_setRequantization(pNetwork, layer, &identityMultiplier, &identityExponent, 1U, 0));
+    }
+    return EOK;
+}
+
+
+
+
+
+/*
+ * The input zero point comes out of every dot product as
+ *     sum((input - zeroPoint) * weight) = sum(input * weight) - (zeroPoint * sum(weight))
+ * so each neuron's -(zeroPoint * sum(weight)) is worked out here once, and
+ * added in the epilogue with the bias. Needs calling again whenever the
+ * weights change.
+ */
+int embann_updateZeroPointOffsets(network_t* pNetwork)
+{
+    for (numLayers_t layer = 0; layer <= pNetwork->properties.numHiddenLayers; layer++)
+    {
+        const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+        const accumulator_t inputZeroPoint = _inputZeroPoint(pNetwork, layer);
+
+        for (uint32_t i = 0; i < descriptor.numNeurons; i++)
+        {
+            accumulator_t rowSum = 0;
+
+            for (uint32_t j = 0; j < descriptor.numInputs; j++)
+            {
+                rowSum += embann_getWeight(&descriptor, i, j);
+            }
+            descriptor.quant.zeroPointOffset[i] = -(inputZeroPoint * rowSum);
+        }
+    }
+    return EOK;
+}
+
+
+
+
+
+#endif // CONFIG_REQUANTIZATION
+
+
+
+
+
+#ifdef QUANTIZATION_SOURCE
+/*
+ * Runs numSamples rows of pInputs through the network and records the range
+ * of every layer's activations. pRanges needs numHiddenLayers + 2 entries,
+ * the inputs first, then each hidden layer, then the output layer.
+ */
+int embann_calibrate(network_t* pNetwork, const activation_t* pInputs, uint32_t numSamples, activationRange_t* pRanges)
+{
+    const numLayers_t numLayers = pNetwork->properties.numHiddenLayers + 1U;
+    const uint32_t numInputs = pNetwork->inputLayer->numNeurons;
+
+    if ((pInputs == NULL) || (pRanges == NULL) || (numSamples == 0U))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    for (numLayers_t i = 0; i <= numLayers; i++)
+    {
+        pRanges[i].min = FLT_MAX;
+        pRanges[i].max = -FLT_MAX;
+    }
+
+    for (uint32_t sample = 0; sample < numSamples; sample++)
+    {
+        memcpy(pNetwork->inputLayer->activation, &pInputs[sample * numInputs], numInputs * sizeof(activation_t));
+        EMBANN_ERROR_CHECK(embann_forwardPropagate(pNetwork));
+
+        _widenRange(&pRanges[0], pNetwork->inputLayer->activation, numInputs);
+        for (numLayers_t layer = 0; layer < numLayers; layer++)
+        {
+            const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+            _widenRange(&pRanges[layer + 1U], descriptor.activation, descriptor.numNeurons);
+        }
+    }
+    return EOK;
+}
+
+
+
+
+
+/*
+ * Quantizes the network with the calibrated pRanges and writes it to pPath,
+ * for embann_loadQuantizedNetwork() in an integer build. Activations become
+ * asymmetric u8, except TANH and SOFTSIGN outputs, which are always
+ * [-1, 1] with a zero point of 128. Weights become symmetric s8 with a scale
+ * per neuron, and biases s32 in units of input scale * weight scale.
+ * Integer TANH is a hard tanh, so it only approximates the float network,
+ * RELU and LEAKY_RELU layers quantize exactly apart from rounding.
+ */
+int embann_saveQuantizedNetwork(const network_t* pNetwork, const activationRange_t* pRanges, const char* pPath)
+{
+    if ((pRanges == NULL) || (pPath == NULL))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    FILE* pFile = fopen(pPath, "wb");
+    if (pFile == NULL)
+    {
+        EMBANN_LOGE(TAG, "Couldn't open %s", pPath);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EIO;
+    }
+
+    int err = _writeQuantizedNetwork(pNetwork, pRanges, pFile);
+    if ((fclose(pFile) != 0) && (err == EOK))
+    {
+        err = EIO;
+    }
+    return err;
+}
+
+
+
+
+
+/*
+ * As embann_saveQuantizedNetwork(), but writes a C header of const arrays
+ * and a quantizedLayers table for embann_loadQuantizedLayers(), for targets
+ * without a filesystem
+ */
+int embann_writeQuantizedHeader(const network_t* pNetwork, const activationRange_t* pRanges, const char* pPath)
+{
+    if ((pRanges == NULL) || (pPath == NULL))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    FILE* pFile = fopen(pPath, "w");
+    if (pFile == NULL)
+    {
+        EMBANN_LOGE(TAG, "Couldn't open %s", pPath);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EIO;
+    }
+
+    int err = _writeQuantizedHeader(pNetwork, pRanges, pFile);
+    if ((fclose(pFile) != 0) && (err == EOK))
+    {
+        err = EIO;
+    }
+    return err;
+}
+
+
+
+
+
+static void _widenRange(activationRange_t* pRange, const activation_t* pActivation, uint32_t numNeurons)
+{
+    for (uint32_t i = 0; i < numNeurons; i++)
+    {
+        pRange->min = (pActivation[i] < pRange->min) ? pActivation[i] : pRange->min;
+        pRange->max = (pActivation[i] > pRange->max) ? pActivation[i] : pRange->max;
+    }
+}
+
+
+
+
+
+/* Scale and zero point of the activations recorded in pRanges[index], index 0 being the inputs */
+static void _activationQuantization(const network_t* pNetwork, const activationRange_t* pRanges, numLayers_t index,
+                                    double* pScale, uint8_t* pZeroPoint)
+{
+    const activationFunction_t function = (index == 0U) ? NUM_ACTIVATION_FUNCTIONS :
+                                            embann_describeLayer(pNetwork, index - 1U).activationFunction;
+
+    if ((function == TANH) || (function == SOFTSIGN))
+    {
+        /* The headroom above the zero point is what integer SOFTSIGN scales to */
+        *pScale = 1.0 / (UINT8_MAX - 128.0);
+        *pZeroPoint = 128U;
+    }
+    else
+    {
+        /* Real 0 has to be exactly representable for RELU */
+        const double min = (pRanges[index].min < 0.0F) ? pRanges[index].min : 0.0;
+        const double max = (pRanges[index].max > 0.0F) ? pRanges[index].max : 0.0;
+        const double scale = (max > min) ? ((max - min) / UINT8_MAX) : 1.0;
+
+        *pScale = scale;
+        *pZeroPoint = (uint8_t) lround(-min / scale);
+    }
+}
+
+
+
+
+
+/* Symmetric, so the largest magnitude weight of the row becomes +-127 */
+static double _weightScale(const layerDescriptor_t* pLayer, uint32_t neuron)
+{
+    double maxMagnitude = 0.0;
+
+    for (uint32_t j = 0; j < pLayer->numInputs; j++)
+    {
+        const double magnitude = fabs(embann_getWeight(pLayer, neuron, j));
+        maxMagnitude = (magnitude > maxMagnitude) ? magnitude : maxMagnitude;
+    }
+    return (maxMagnitude > 0.0) ? (maxMagnitude / INT8_MAX) : 1.0;
+}
+
+
+
+
+
+static int8_t _quantizeWeight(weight_t weight, double weightScale)
+{
+    long quantized = lround(weight / weightScale);
+
+    quantized = (quantized > INT8_MAX) ? INT8_MAX : quantized;
+    quantized = (quantized < -INT8_MAX) ? -INT8_MAX : quantized;
+    return (int8_t) quantized;
+}
+
+
+
+
+
+/*
+ * Bias and requantization of neuron in pLayer, which is layer number layer.
+ * TANH's PI is folded into the multiplier, so the integer hard tanh
+ * saturates where tanh(x * PI) does.
+ */
+static int _quantizeNeuron(const network_t* pNetwork, const layerDescriptor_t* pLayer, uint32_t neuron,
+                            const activationRange_t* pRanges, numLayers_t layer, int32_t* pBias,
+                            int32_t* pMultiplier, int8_t* pExponent)
+{
+    double inputScale;
+    double outputScale;
+    uint8_t zeroPoint;
+
+    _activationQuantization(pNetwork, pRanges, layer, &inputScale, &zeroPoint);
+    _activationQuantization(pNetwork, pRanges, layer + 1U, &outputScale, &zeroPoint);
+
+    const double accumScale = inputScale * _weightScale(pLayer, neuron);
+    const double gain = (pLayer->activationFunction == TANH) ? PI : 1.0;
+    double bias = round(pLayer->bias[neuron] / accumScale);
+
+    bias = (bias > INT32_MAX) ? INT32_MAX : bias;
+    bias = (bias < INT32_MIN) ? INT32_MIN : bias;
+    *pBias = (int32_t) bias;
+
+    return embann_quantizeMultiplier((accumScale * gain) / outputScale, pMultiplier, pExponent);
+}
+
+
+
+
+
+/*
+ * Little endian throughout, starting with
+ *     magic, version, number of layers, number of inputs, input scale, input zero point
+ * each as a uint32_t (the scale as float bits), then for each layer
+ *     number of inputs, number of neurons, activation function, scale, zero point
+ * the same way, followed by each of its neurons'
+ *     int32_t bias, int32_t multiplier, int8_t exponent, int8_t weights[number of inputs]
+ */
+static int _writeQuantizedNetwork(const network_t* pNetwork, const activationRange_t* pRanges, FILE* pFile)
+{
+    const numLayers_t numLayers = pNetwork->properties.numHiddenLayers + 1U;
+    double scale;
+    uint8_t zeroPoint;
+    float floatScale;
+    uint32_t scaleBits;
+
+    _activationQuantization(pNetwork, pRanges, 0U, &scale, &zeroPoint);
+    floatScale = (float) scale;
+    memcpy(&scaleBits, &floatScale, sizeof(scaleBits));
+
+    _writeLittleEndian(pFile, QUANTIZED_FILE_MAGIC, 4U);
+    _writeLittleEndian(pFile, QUANTIZED_FILE_VERSION, 4U);
+    _writeLittleEndian(pFile, numLayers, 4U);
+    _writeLittleEndian(pFile, pNetwork->inputLayer->numNeurons, 4U);
+    _writeLittleEndian(pFile, scaleBits, 4U);
+    _writeLittleEndian(pFile, zeroPoint, 4U);
+
+    for (numLayers_t layer = 0; layer < numLayers; layer++)
+    {
+        const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+
+        _activationQuantization(pNetwork, pRanges, layer + 1U, &scale, &zeroPoint);
+        floatScale = (float) scale;
+        memcpy(&scaleBits, &floatScale, sizeof(scaleBits));
+
+        _writeLittleEndian(pFile, descriptor.numInputs, 4U);
+        _writeLittleEndian(pFile, descriptor.numNeurons, 4U);
+        _writeLittleEndian(pFile, (uint32_t) descriptor.activationFunction, 4U);
+        _writeLittleEndian(pFile, scaleBits, 4U);
+        _writeLittleEndian(pFile, zeroPoint, 4U);
+
+        for (uint32_t i = 0; i < descriptor.numNeurons; i++)
+        {
+            const double weightScale = _weightScale(&descriptor, i);
+            int32_t bias;
+            int32_t multiplier;
+            int8_t exponent;
+
+            EMBANN_ERROR_CHECK(_quantizeNeuron(pNetwork, &descriptor, i, pRanges, layer, &bias, &multiplier,
+                                                &exponent));
+            _writeLittleEndian(pFile, (uint32_t) bias, 4U);
+            _writeLittleEndian(pFile, (uint32_t) multiplier, 4U);
+            _writeLittleEndian(pFile, (uint8_t) exponent, 1U);
+
+            for (uint32_t j = 0; j < descriptor.numInputs; j++)
+            {
+                const int8_t weight = _quantizeWeight(embann_getWeight(&descriptor, i, j), weightScale);
+                _writeLittleEndian(pFile, (uint8_t) weight, 1U);
+            }
+        }
+    }
+    return (ferror(pFile) != 0) ? EIO : EOK;
+}
+
+
+
+
+
+static int _writeQuantizedHeader(const network_t* pNetwork, const activationRange_t* pRanges, FILE* pFile)
+{
+    static const char* const functionNames[NUM_ACTIVATION_FUNCTIONS] = {
+        [SOFTSIGN] = "SOFTSIGN", [RELU] = "RELU", [LEAKY_RELU] = "LEAKY_RELU", [TANH] = "TANH"
+    };
+    const numLayers_t numLayers = pNetwork->properties.numHiddenLayers + 1U;
+    double scale;
+    uint8_t zeroPoint;
+    int32_t bias;
+    int32_t multiplier;
+    int8_t exponent;
+
+    _activationQuantization(pNetwork, pRanges, 0U, &scale, &zeroPoint);
+    fprintf(pFile, "/* File auto-generated by embann_writeQuantizedHeader() */\n");
+    fprintf(pFile, "#pragma once\n#include \"embann.h\"\n\n");
+    fprintf(pFile, "#define QUANTIZED_NUM_LAYERS %uU\n", (unsigned) numLayers);
+    fprintf(pFile, "#define QUANTIZED_INPUT_SCALE %.9gF\n", scale);
+    fprintf(pFile, "#define QUANTIZED_INPUT_ZERO_POINT %uU\n", (unsigned) zeroPoint);
+
+    for (numLayers_t layer = 0; layer < numLayers; layer++)
+    {
+        const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+        const unsigned numNeurons = descriptor.numNeurons;
+
+        fprintf(pFile, "\n\n\n\n/*\n * Layer %u\n */\n", (unsigned) layer);
+        fprintf(pFile, "static const int8_t quantizedWeights_%u[%u] = {", (unsigned) layer,
+                numNeurons * (unsigned) descriptor.numInputs);
+        for (uint32_t i = 0; i < descriptor.numNeurons; i++)
+        {
+            const double weightScale = _weightScale(&descriptor, i);
+
+            fprintf(pFile, "\n   ");
+            for (uint32_t j = 0; j < descriptor.numInputs; j++)
+            {
+                fprintf(pFile, " %d,", _quantizeWeight(embann_getWeight(&descriptor, i, j), weightScale));
+            }
+        }
+
+        fprintf(pFile, "\n};\nstatic const int32_t quantizedBias_%u[%u] = {\n   ", (unsigned) layer, numNeurons);
+        for (uint32_t i = 0; i < descriptor.numNeurons; i++)
+        {
+            EMBANN_ERROR_CHECK(_quantizeNeuron(pNetwork, &descriptor, i, pRanges, layer, &bias, &multiplier,
+                                                &exponent));
+            fprintf(pFile, " %ld,", (long) bias);
+        }
+
+        fprintf(pFile, "\n};\nstatic const int32_t quantizedMultiplier_%u[%u] = {\n   ", (unsigned) layer, numNeurons);
+        for (uint32_t i = 0; i < descriptor.numNeurons; i++)
+        {
+            EMBANN_ERROR_CHECK(_quantizeNeuron(pNetwork, &descriptor, i, pRanges, layer, &bias, &multiplier,
+                                                &exponent));
+            fprintf(pFile, " %ld,", (long) multiplier);
+        }
+
+        fprintf(pFile, "\n};\nstatic const int8_t quantizedExponent_%u[%u] = {\n   ", (unsigned) layer, numNeurons);
+        for (uint32_t i = 0; i < descriptor.numNeurons; i++)
+        {
+            EMBANN_ERROR_CHECK(_quantizeNeuron(pNetwork, &descriptor, i, pRanges, layer, &bias, &multiplier,
+                                                &exponent));
+            fprintf(pFile, " %d,", exponent);
+        }
+        fprintf(pFile, "\n};\n");
+    }
+
+    fprintf(pFile, "\n\n\n\nstatic const quantizedLayer_t quantizedLayers[QUANTIZED_NUM_LAYERS] = {\n");
+    for (numLayers_t layer = 0; layer < numLayers; layer++)
+    {
+        const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+
+        _activationQuantization(pNetwork, pRanges, layer + 1U, &scale, &zeroPoint);
+        fprintf(pFile, "    {\n");
+        fprintf(pFile, "        .numInputs = %uU,\n", (unsigned) descriptor.numInputs);
+        fprintf(pFile, "        .numNeurons = %uU,\n", (unsigned) descriptor.numNeurons);
+        fprintf(pFile, "        .activationFunction = %s,\n", functionNames[descriptor.activationFunction]);
+        fprintf(pFile, "        .weight = quantizedWeights_%u,\n", (unsigned) layer);
+        fprintf(pFile, "        .bias = quantizedBias_%u,\n", (unsigned) layer);
+        fprintf(pFile, "        .multiplier = quantizedMultiplier_%u,\n", (unsigned) layer);
+        fprintf(pFile, "        .exponent = quantizedExponent_%u,\n", (unsigned) layer);
+        fprintf(pFile, "        .zeroPoint = %uU,\n", (unsigned) zeroPoint);
+        fprintf(pFile, "        .scale = %.9gF\n", scale);
+        fprintf(pFile, "    },\n");
+    }
+    fprintf(pFile, "};\n");
+
+    return (ferror(pFile) != 0) ? EIO : EOK;
+}
+
+
+
+
+
+static void _writeLittleEndian(FILE* pFile, uint32_t value, uint32_t numBytes)
+{
+    for (uint32_t i = 0; i < numBytes; i++)
+    {
+        (void) fputc((int) ((value >> (i * 8U)) & 0xFFU), pFile);
+    }
+}
+#endif // QUANTIZATION_SOURCE
+
+
+
+
+
+#ifdef QUANTIZATION_TARGET
+/*
+ * Loads a network generated by embann_writeQuantizedHeader(), numLayers
+ * being its QUANTIZED_NUM_LAYERS. The layer sizes have to match this
+ * network's. Inputs then need quantizing the same way, as
+ * (input / QUANTIZED_INPUT_SCALE) + QUANTIZED_INPUT_ZERO_POINT.
+ */
+int embann_loadQuantizedLayers(network_t* pNetwork, const quantizedLayer_t* pLayers, numLayers_t numLayers,
+                                uint8_t inputZeroPoint)
+{
+    if ((pLayers == NULL) || (numLayers != (pNetwork->properties.numHiddenLayers + 1U)))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+#ifdef CONFIG_SPARSE_WEIGHTS
+    if (embann_isPruned(pNetwork))
+    {
+        EMBANN_LOGE(TAG, "A pruned network has no dense weights to load into");
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOTSUP;
+    }
+#endif
+
+    for (numLayers_t layer = 0; layer < numLayers; layer++)
+    {
+        const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+
+        if ((pLayers[layer].numInputs != descriptor.numInputs) ||
+            (pLayers[layer].numNeurons != descriptor.numNeurons) ||
+            (pLayers[layer].activationFunction >= NUM_ACTIVATION_FUNCTIONS))
+        {
+            EMBANN_LOGE(TAG, "Quantized layer %d doesn't match the network", layer);
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return EINVAL;
+        }
+    }
+
+    for (numLayers_t layer = 0; layer < numLayers; layer++)
+    {
+        const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+        const quantizedLayer_t* pLayer = &pLayers[layer];
+        // Deviation from MISRA C2012 11.8, the descriptor points at this network's own layers
+        // cppcheck-suppress misra-c2012-11.8
+        weight_t* pWeight = (weight_t*) descriptor.weight;
+        // cppcheck-suppress misra-c2012-11.8
+        bias_t* pBias = (bias_t*) descriptor.bias;
+
+        for (uint32_t i = 0; i < descriptor.numNeurons; i++)
+        {
+            memcpy(&pWeight[i * descriptor.weightStride], &pLayer->weight[i * descriptor.numInputs],
+                    descriptor.numInputs * sizeof(weight_t));
+            pBias[i] = pLayer->bias[i];
+            descriptor.quant.multiplier[i] = pLayer->multiplier[i];
+            descriptor.quant.exponent[i] = pLayer->exponent[i];
+        }
+
+        const int err = _setLayerOutput(pNetwork, layer, pLayer->activationFunction, pLayer->zeroPoint);
+        if (err != EOK)
+        {
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return err;
+        }
+    }
+
+    pNetwork->inputLayer->zeroPoint = inputZeroPoint;
+    return embann_updateZeroPointOffsets(pNetwork);
+}
+
+
+
+
+
+/*
+ * Loads a network written by embann_saveQuantizedNetwork(), the whole file
+ * is checked against this network before any of it is loaded. pInputScale
+ * can be NULL, otherwise it gets the scale inputs need quantizing with.
+ */
+int embann_loadQuantizedNetwork(network_t* pNetwork, const char* pPath, float* pInputScale)
+{
+    if (pPath == NULL)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+#ifdef CONFIG_SPARSE_WEIGHTS
+    if (embann_isPruned(pNetwork))
+    {
+        EMBANN_LOGE(TAG, "A pruned network has no dense weights to load into");
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOTSUP;
+    }
+#endif
+
+    FILE* pFile = fopen(pPath, "rb");
+    if (pFile == NULL)
+    {
+        EMBANN_LOGE(TAG, "Couldn't open %s", pPath);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOENT;
+    }
+
+    int err = _checkQuantizedFile(pNetwork, pFile, pInputScale);
+    if (err == EOK)
+    {
+        rewind(pFile);
+        err = _readQuantizedFile(pNetwork, pFile);
+    }
+    (void) fclose(pFile);
+
+    if (err == EOK)
+    {
+        err = embann_updateZeroPointOffsets(pNetwork);
+    }
+    return err;
+}
+
+
+
+
+
+static int _checkQuantizedFile(const network_t* pNetwork, FILE* pFile, float* pInputScale)
+{
+    const numLayers_t numLayers = pNetwork->properties.numHiddenLayers + 1U;
+    int err = EOK;
+
+    const uint32_t magic = _readLittleEndian(pFile, 4U, &err);
+    const uint32_t version = _readLittleEndian(pFile, 4U, &err);
+    const uint32_t fileNumLayers = _readLittleEndian(pFile, 4U, &err);
+    const uint32_t fileNumInputs = _readLittleEndian(pFile, 4U, &err);
+    const uint32_t scaleBits = _readLittleEndian(pFile, 4U, &err);
+    (void) _readLittleEndian(pFile, 4U, &err);
+
+    if (err != EOK)
+    {
+        EMBANN_LOGE(TAG, "Quantized network is truncated");
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return err;
+    }
+
+    if ((magic != QUANTIZED_FILE_MAGIC) || (version != QUANTIZED_FILE_VERSION))
+    {
+        EMBANN_LOGE(TAG, "Not a version %lu quantized network", QUANTIZED_FILE_VERSION);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    if ((fileNumLayers != numLayers) || (fileNumInputs != pNetwork->inputLayer->numNeurons))
+    {
+        EMBANN_LOGE(TAG, "Quantized network has %lu layers and %lu inputs", (unsigned long) fileNumLayers,
+                    (unsigned long) fileNumInputs);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    for (numLayers_t layer = 0; layer < numLayers; layer++)
+    {
+        const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+        const uint32_t numInputs = _readLittleEndian(pFile, 4U, &err);
+        const uint32_t numNeurons = _readLittleEndian(pFile, 4U, &err);
+        const uint32_t function = _readLittleEndian(pFile, 4U, &err);
+
+        if (err != EOK)
+        {
+            EMBANN_LOGE(TAG, "Quantized network is truncated");
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return err;
+        }
+
+        /* Skips the scale and zero point, then the neurons */
+        if ((numInputs != descriptor.numInputs) || (numNeurons != descriptor.numNeurons) ||
+            (function >= (uint32_t) NUM_ACTIVATION_FUNCTIONS) ||
+            (fseek(pFile, (long) (8UL + (numNeurons * QUANTIZED_NEURON_SIZE(numInputs))), SEEK_CUR) != 0))
+        {
+            EMBANN_LOGE(TAG, "Quantized layer %d doesn't match the network", layer);
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return EINVAL;
+        }
+    }
+
+    /* fseek() happily goes past the end, so make sure the last neuron is there */
+    if ((fseek(pFile, -1L, SEEK_CUR) != 0) || (fgetc(pFile) == EOF))
+    {
+        EMBANN_LOGE(TAG, "Quantized network is truncated");
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EIO;
+    }
+
+    if (pInputScale != NULL)
+    {
+        memcpy(pInputScale, &scaleBits, sizeof(*pInputScale));
+    }
+    return EOK;
+}
+
+
+
+
+
+/* Only after _checkQuantizedFile() has passed */
+static int _readQuantizedFile(network_t* pNetwork, FILE* pFile)
+{
+    const numLayers_t numLayers = pNetwork->properties.numHiddenLayers + 1U;
+    int err = EOK;
+
+    /* Magic, version, number of layers, number of inputs and input scale */
+    (void) fseek(pFile, 20L, SEEK_SET);
+    pNetwork->inputLayer->zeroPoint = (uint8_t) _readLittleEndian(pFile, 4U, &err);
+
+    for (numLayers_t layer = 0; layer < numLayers; layer++)
+    {
+        const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+        // Deviation from MISRA C2012 11.8, the descriptor points at this network's own layers
+        // cppcheck-suppress misra-c2012-11.8
+        weight_t* pWeight = (weight_t*) descriptor.weight;
+        // cppcheck-suppress misra-c2012-11.8
+        bias_t* pBias = (bias_t*) descriptor.bias;
+
+        /* Number of inputs and neurons, already checked */
+        (void) fseek(pFile, 8L, SEEK_CUR);
+        const activationFunction_t function = (activationFunction_t) _readLittleEndian(pFile, 4U, &err);
+        (void) _readLittleEndian(pFile, 4U, &err);
+        const uint8_t zeroPoint = (uint8_t) _readLittleEndian(pFile, 4U, &err);
+
+        err = (err == EOK) ? _setLayerOutput(pNetwork, layer, function, zeroPoint) : err;
+        if (err != EOK)
+        {
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return err;
+        }
+
+        for (uint32_t i = 0; i < descriptor.numNeurons; i++)
+        {
+            pBias[i] = (bias_t) _readLittleEndian(pFile, 4U, &err);
+            descriptor.quant.multiplier[i] = (int32_t) _readLittleEndian(pFile, 4U, &err);
+            descriptor.quant.exponent[i] = (int8_t) _readLittleEndian(pFile, 1U, &err);
+
+            if ((err != EOK) ||
+                (fread(&pWeight[i * descriptor.weightStride], sizeof(weight_t), descriptor.numInputs, pFile) !=
+                    descriptor.numInputs))
+            {
+                // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+                // cppcheck-suppress misra-c2012-15.5
+                return EIO;
+            }
+        }
+    }
+    return (ferror(pFile) != 0) ? EIO : EOK;
+}
+
+
+
+
+
+/*
+ * Sets *pErr to EIO if the file ends before numBytes have been read, and
+ * leaves it alone otherwise, so a run of reads only needs checking once
+ */
+static uint32_t _readLittleEndian(FILE* pFile, uint32_t numBytes, int* pErr)
+{
+    uint32_t value = 0;
+
+    for (uint32_t i = 0; i < numBytes; i++)
+    {
+        const int byte = fgetc(pFile);
+
+        if (byte == EOF)
+        {
+            *pErr = EIO;
+        }
+        else
+        {
+            value |= (uint32_t) byte << (i * 8U);
+        }
+    }
+    return value;
+}
+
+
+
+
+
+static int _setLayerOutput(network_t* pNetwork, numLayers_t layer, activationFunction_t function, uint8_t zeroPoint)
+{
+    const int err = embann_setActivationFunction(pNetwork, layer, function);
+    if (err != EOK)
+    {
+        EMBANN_LOGE(TAG, "Quantized layer %d has an unknown activation function", layer);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return err;
+    }
+
+    if (layer < pNetwork->properties.numHiddenLayers)
+    {
+        pNetwork->hiddenLayer[layer]->quant.zeroPoint = zeroPoint;
+    }
+    else
+    {
+        pNetwork->outputLayer->quant.zeroPoint = zeroPoint;
+    }
+    return EOK;
+}
+#endif // QUANTIZATION_TARGET
+
+
+
+
+
+#ifdef CONFIG_REQUANTIZATION
+static activation_t _inputZeroPoint(const network_t* pNetwork, numLayers_t layer)
+{
+    return (layer == 0U) ? pNetwork->inputLayer->zeroPoint :
+                            pNetwork->hiddenLayer[layer - 1U]->quant.zeroPoint;
+}
+#endif // CONFIG_REQUANTIZATION
@@ -0,0 +1,162 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+    embann_session.c - EMbedded Backpropogating Artificial Neural Network.
+    Copyright Peter Frost 2019
+*/
+
+#include "embann.h"
+#include "embann_log.h"
+
+#define TAG "Embann Session"
+
+#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
+#if (CONFIG_NUM_STATIC_SESSIONS == 0)
+#error "Number of static sessions cannot be equal to 0"
+#endif
+
+/* Cache line aligned, so sessions on different threads never share a line */
+typedef struct
+{
+    activation_t hiddenActivations[CONFIG_NUM_HIDDEN_LAYERS][CONFIG_NUM_HIDDEN_NEURONS] CACHE_ALIGNMENT;
+    activation_t outputActivations[CONFIG_NUM_OUTPUT_NEURONS];
+    activation_t* layerActivations[CONFIG_NUM_HIDDEN_LAYERS + 1U];
+    inferenceSession_t session;
+} staticSession_t;
+
+static staticSession_t staticSessions[CONFIG_NUM_STATIC_SESSIONS];
+/* Which of staticSessions embann_initSession() has handed out */
+static bool staticSessionInUse[CONFIG_NUM_STATIC_SESSIONS];
+#endif
+
+
+#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
+static inferenceSession_t* _claimStaticSession(void);
+#endif
+
+
+
+
+
+/*
+ * Sets up a session for running pNetwork with embann_forwardPropagateSession()
+ * and returns it in *ppSession. Each thread running the network needs its own
+ * session, the network is shared between them. Static builds hand out the
+ * CONFIG_NUM_STATIC_SESSIONS sessions, returning ENOMEM when they're all in
+ * use, and embann_initSession() and embann_freeSession() must not race each
+ * other there.
+ */
+int embann_initSession(inferenceSession_t** ppSession, const network_t* pNetwork)
+{
+    if ((ppSession == NULL) || (pNetwork == NULL))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    const numLayers_t numHiddenLayers = pNetwork->properties.numHiddenLayers;
+
+#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
+    if (numHiddenLayers != CONFIG_NUM_HIDDEN_LAYERS)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    inferenceSession_t* pSession = _claimStaticSession();
+    if (pSession == NULL)
+    {
+        EMBANN_LOGE(TAG, "All %d static sessions are in use", CONFIG_NUM_STATIC_SESSIONS);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOMEM;
+    }
+#else
+    size_t numBytes = 0U;
+
+    for (numLayers_t i = 0; i <= numHiddenLayers; i++)
+    {
+        numBytes += ROUND_UP_TO_CACHE_LINE(embann_describeLayer(pNetwork, i).numNeurons * sizeof(activation_t));
+    }
+
+    inferenceSession_t* pSession = (inferenceSession_t*) malloc(sizeof(inferenceSession_t));
+    EMBANN_MALLOC_CHECK(pSession);
+    pSession->activation = (activation_t**) malloc(sizeof(activation_t*) * (numHiddenLayers + 1U));
+    EMBANN_MALLOC_CHECK(pSession->activation);
+
+    /* One block, each layer starting on its own cache line */
+    uint8_t* pBlock = (uint8_t*) EMBANN_ALIGNED_ALLOC(CONFIG_CACHE_LINE_SIZE, numBytes);
+    EMBANN_MALLOC_CHECK(pBlock);
+
+    for (numLayers_t i = 0; i <= numHiddenLayers; i++)
+    {
+        pSession->activation[i] = (activation_t*) pBlock;
+        pBlock += ROUND_UP_TO_CACHE_LINE(embann_describeLayer(pNetwork, i).numNeurons * sizeof(activation_t));
+    }
+#endif
+
+    pSession->pNetwork = pNetwork;
+    pSession->networkResponse = 0U;
+    *ppSession = pSession;
+    return EOK;
+}
+
+
+
+
+
+int embann_freeSession(inferenceSession_t* pSession)
+{
+    if (pSession == NULL)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
+    for (uint32_t i = 0; i < CONFIG_NUM_STATIC_SESSIONS; i++)
+    {
+        if (pSession == &staticSessions[i].session)
+        {
+            staticSessionInUse[i] = false;
+        }
+    }
+#else
+    EMBANN_ALIGNED_FREE(pSession->activation[0]);
+    free(pSession->activation);
+    free(pSession);
+#endif
+    return EOK;
+}
+
+
+
+
+
+#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
+static inferenceSession_t* _claimStaticSession(void)
+{
+    for (uint32_t i = 0; i < CONFIG_NUM_STATIC_SESSIONS; i++)
+    {
+        if (!staticSessionInUse[i])
+        {
+            staticSession_t* pStatic = &staticSessions[i];
+
+            for (numLayers_t j = 0; j < CONFIG_NUM_HIDDEN_LAYERS; j++)
+            {
+                pStatic->layerActivations[j] = pStatic->hiddenActivations[j];
+            }
+            pStatic->layerActivations[CONFIG_NUM_HIDDEN_LAYERS] = pStatic->outputActivations;
+            pStatic->session.activation = pStatic->layerActivations;
+
+            staticSessionInUse[i] = true;
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return &pStatic->session;
+        }
+    }
+    return NULL;
+}
+#endif
@@ -0,0 +1,236 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+    embann_sparse.c - EMbedded Backpropogating Artificial Neural Network.
+    Copyright Peter Frost 2019
+*/
+
+#include "embann.h"
+#include "embann_log.h"
+
+#define TAG "Embann Sparse"
+
+#ifdef CONFIG_SPARSE_WEIGHTS
+#if (CONFIG_SPARSE_BLOCK_SIZE == 0)
+#error "Sparse block size cannot be equal to 0"
+#endif
+
+static bool _isBlockKept(const layerDescriptor_t* pLayer, uint32_t neuron, uint32_t firstInput, weight_t threshold);
+static void _pruneLayer(const layerDescriptor_t* pLayer, sparseWeights_t* pSparse, weight_t threshold);
+
+
+
+
+
+/*
+ * Zeros every weight smaller in magnitude than threshold and stores each layer
+ * as just the blocks of CONFIG_SPARSE_BLOCK_SIZE weights in each row that
+ * still have something in them. Pruning an already pruned network prunes it
+ * further. Pruned networks can be run, saved and loaded, but not trained.
+ */
+int embann_pruneNetwork(network_t* pNetwork, weight_t threshold)
+{
+    if (pNetwork == NULL)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    for (numLayers_t layer = 0; layer <= pNetwork->properties.numHiddenLayers; layer++)
+    {
+        const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+        const uint32_t numRowBlocks = ROUND_UP_TO_MULTIPLE(descriptor.numInputs, CONFIG_SPARSE_BLOCK_SIZE) /
+                                        CONFIG_SPARSE_BLOCK_SIZE;
+        sparseWeights_t sparse;
+        uint32_t numBlocks = 0U;
+
+        for (uint32_t i = 0; i < descriptor.numNeurons; i++)
+        {
+            for (uint32_t j = 0; j < descriptor.numInputs; j += CONFIG_SPARSE_BLOCK_SIZE)
+            {
+                numBlocks += _isBlockKept(&descriptor, i, j, threshold) ? 1U : 0U;
+            }
+        }
+
+        const int err = embann_allocSparseWeights(&sparse, descriptor.numNeurons, numBlocks);
+        if (err != EOK)
+        {
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return err;
+        }
+        _pruneLayer(&descriptor, &sparse, threshold);
+
+        EMBANN_LOGI(TAG, "Layer %d keeps %lu of %lu blocks", layer, (unsigned long) numBlocks,
+                    (unsigned long) (numRowBlocks * descriptor.numNeurons));
+
+#ifdef CONFIG_MAP_NETWORK_FILES
+        /* Otherwise they're in the file mapping, and go with it */
+        if (pNetwork->pFileMapping == NULL)
+#endif
+        {
+            // Deviation from MISRA C2012 11.8, the descriptor points at this network's own layers
+            // cppcheck-suppress misra-c2012-11.8
+            EMBANN_ALIGNED_FREE((weight_t*) descriptor.weight);
+        }
+        embann_setLayerWeights(pNetwork, layer, NULL, &sparse);
+    }
+#ifdef CONFIG_REQUANTIZATION
+    /* The zeroed weights no longer count towards each row's sum */
+    return embann_updateZeroPointOffsets(pNetwork);
+#else
+    return EOK;
+#endif
+}
+
+
+
+
+
+bool embann_isPruned(const network_t* pNetwork)
+{
+    bool isPruned = false;
+
+    for (numLayers_t layer = 0; layer <= pNetwork->properties.numHiddenLayers; layer++)
+    {
+        isPruned = isPruned || (embann_describeLayer(pNetwork, layer).sparse != NULL);
+    }
+    return isPruned;
+}
+
+
+
+
+
+/*
+ * Points layer at pWeight, or at pSparse's blocks when that isn't NULL, and
+ * frees any blocks it had on the heap. The dense weights it had are left to
+ * the caller, as they may be in a file mapping.
+ */
+void embann_setLayerWeights(network_t* pNetwork, numLayers_t layer, weight_t* pWeight,
+                            const sparseWeights_t* pSparse)
+{
+    const sparseWeights_t dense = { .rowStart = NULL };
+    sparseWeights_t* pLayerSparse;
+
+    if (layer < pNetwork->properties.numHiddenLayers)
+    {
+        pNetwork->hiddenLayer[layer]->weight = pWeight;
+        pLayerSparse = &pNetwork->hiddenLayer[layer]->sparse;
+    }
+    else
+    {
+        pNetwork->outputLayer->weight = pWeight;
+        pLayerSparse = &pNetwork->outputLayer->sparse;
+    }
+
+    embann_freeSparseWeights(pLayerSparse);
+    *pLayerSparse = (pSparse != NULL) ? *pSparse : dense;
+}
+
+
+
+
+
+/*
+ * One cache line aligned allocation for numBlocks blocks of a numNeurons
+ * layer, the blocks first then rowStart and blockInput
+ */
+int embann_allocSparseWeights(sparseWeights_t* pSparse, uint32_t numNeurons, uint32_t numBlocks)
+{
+    const size_t weightBytes = ROUND_UP_TO_CACHE_LINE((size_t) numBlocks * CONFIG_SPARSE_BLOCK_SIZE *
+                                                        sizeof(weight_t));
+    const size_t indexBytes = (numNeurons + 1U + numBlocks) * sizeof(uint32_t);
+    uint8_t* pBlock = (uint8_t*) EMBANN_ALIGNED_ALLOC(CONFIG_CACHE_LINE_SIZE,
+                                                        ROUND_UP_TO_CACHE_LINE(weightBytes + indexBytes));
+    EMBANN_MALLOC_CHECK(pBlock);
+
+    memset(pBlock, 0, weightBytes);
+    pSparse->blockWeights = (weight_t*) pBlock;
+    pSparse->rowStart = (uint32_t*) &pBlock[weightBytes];
+    pSparse->blockInput = &pSparse->rowStart[numNeurons + 1U];
+    pSparse->numBlocks = numBlocks;
+    pSparse->pAllocation = pBlock;
+    return EOK;
+}
+
+
+
+
+
+void embann_freeSparseWeights(sparseWeights_t* pSparse)
+{
+    EMBANN_ALIGNED_FREE(pSparse->pAllocation);
+    pSparse->pAllocation = NULL;
+}
+
+
+
+
+
+/* The dot product of neuron's row with pInput, skipping the blocks pruned out of it */
+accumulator_t embann_sparseDotProduct(const sparseWeights_t* pSparse, uint32_t neuron, const activation_t* pInput,
+                                        uint32_t numInputs)
+{
+    accumulator_t accum = 0;
+
+    for (uint32_t b = pSparse->rowStart[neuron]; b < pSparse->rowStart[neuron + 1U]; b++)
+    {
+        const uint32_t firstInput = pSparse->blockInput[b];
+
+        accum += embann_dotProduct(&pInput[firstInput], &pSparse->blockWeights[b * CONFIG_SPARSE_BLOCK_SIZE],
+                                    min(numInputs - firstInput, (uint32_t) CONFIG_SPARSE_BLOCK_SIZE));
+    }
+    return accum;
+}
+
+
+
+
+
+static bool _isBlockKept(const layerDescriptor_t* pLayer, uint32_t neuron, uint32_t firstInput, weight_t threshold)
+{
+    const uint32_t lastInput = min(pLayer->numInputs, firstInput + CONFIG_SPARSE_BLOCK_SIZE);
+    bool isKept = false;
+
+    for (uint32_t j = firstInput; j < lastInput; j++)
+    {
+        const weight_t weight = embann_getWeight(pLayer, neuron, j);
+        isKept = isKept || (((weight < 0) ? -weight : weight) >= threshold);
+    }
+    return isKept;
+}
+
+
+
+
+
+/* Copies the blocks _isBlockKept() keeps into pSparse, zeroing the weights below threshold in them */
+static void _pruneLayer(const layerDescriptor_t* pLayer, sparseWeights_t* pSparse, weight_t threshold)
+{
+    uint32_t numBlocks = 0U;
+
+    for (uint32_t i = 0; i < pLayer->numNeurons; i++)
+    {
+        pSparse->rowStart[i] = numBlocks;
+
+        for (uint32_t j = 0; j < pLayer->numInputs; j += CONFIG_SPARSE_BLOCK_SIZE)
+        {
+            if (_isBlockKept(pLayer, i, j, threshold))
+            {
+                weight_t* pBlockWeights = &pSparse->blockWeights[numBlocks * CONFIG_SPARSE_BLOCK_SIZE];
+                const uint32_t blockLength = min(pLayer->numInputs - j, (uint32_t) CONFIG_SPARSE_BLOCK_SIZE);
+
+                for (uint32_t k = 0; k < blockLength; k++)
+                {
+                    const weight_t weight = embann_getWeight(pLayer, i, j + k);
+                    pBlockWeights[k] = (((weight < 0) ? -weight : weight) >= threshold) ? weight : 0;
+                }
+                pSparse->blockInput[numBlocks] = j;
+                numBlocks++;
+            }
+        }
+    }
+    pSparse->rowStart[pLayer->numNeurons] = numBlocks;
+}
+#endif // CONFIG_SPARSE_WEIGHTS
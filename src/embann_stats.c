@@ -3,45 +3,44 @@
 
 #define TAG "Embann Stats"
 
-extern network_t* pNetworkGlobal;
 
 
 
-int embann_printNetwork(void)
+int embann_printNetwork(const network_t* pNetwork)
 {
     printf("\nInput Layer | Hidden Layer 1 ");
-    for (uint8_t j = 2; j <= pNetworkGlobal->properties.numHiddenLayers; j++)
+    for (uint8_t j = 2; j <= pNetwork->properties.numHiddenLayers; j++)
     {
         printf("| Hidden Layer %d ", j);
     }
     printf("| Output Layer\n");
 
-    uint16_t maxNumNeurons = pNetworkGlobal->inputLayer->numNeurons;
+    uint16_t maxNumNeurons = pNetwork->inputLayer->numNeurons;
     
-    for (uint8_t i = 0; i < pNetworkGlobal->properties.numHiddenLayers; i++)
+    for (uint8_t i = 0; i < pNetwork->properties.numHiddenLayers; i++)
     {
-        maxNumNeurons = (pNetworkGlobal->hiddenLayer[i]->numNeurons > maxNumNeurons) ? 
-                            pNetworkGlobal->hiddenLayer[i]->numNeurons : maxNumNeurons;
+        maxNumNeurons = (pNetwork->hiddenLayer[i]->numNeurons > maxNumNeurons) ? 
+                            pNetwork->hiddenLayer[i]->numNeurons : maxNumNeurons;
     }
-    maxNumNeurons = (pNetworkGlobal->outputLayer->numNeurons > maxNumNeurons) ? 
-                            pNetworkGlobal->outputLayer->numNeurons : maxNumNeurons;
+    maxNumNeurons = (pNetwork->outputLayer->numNeurons > maxNumNeurons) ? 
+                            pNetwork->outputLayer->numNeurons : maxNumNeurons;
 
     for (uint16_t i = 0; i < maxNumNeurons; i++)
     {
-        if (i < pNetworkGlobal->inputLayer->numNeurons)
+        if (i < pNetwork->inputLayer->numNeurons)
         {
-            printf("%-12" ACTIVATION_PRINT "| ", pNetworkGlobal->inputLayer->activation[i]);
+            printf("%-12" ACTIVATION_PRINT "| ", pNetwork->inputLayer->activation[i]);
         }
         else
         {
             printf("            | ");
         }
 
-        for (uint8_t j = 0; j < pNetworkGlobal->properties.numHiddenLayers; j++)
+        for (uint8_t j = 0; j < pNetwork->properties.numHiddenLayers; j++)
         {
-            if (i < pNetworkGlobal->hiddenLayer[j]->numNeurons)
+            if (i < pNetwork->hiddenLayer[j]->numNeurons)
             {
-                printf("%-15" ACTIVATION_PRINT "| ", pNetworkGlobal->hiddenLayer[j]->activation[i]);
+                printf("%-15" ACTIVATION_PRINT "| ", pNetwork->hiddenLayer[j]->activation[i]);
             }
             else
             {
@@ -49,14 +48,14 @@ int embann_printNetwork(void)
             }
         }
 
-        if (i < pNetworkGlobal->outputLayer->numNeurons)
+        if (i < pNetwork->outputLayer->numNeurons)
         {
-            printf("%" ACTIVATION_PRINT, pNetworkGlobal->outputLayer->activation[i]);
+            printf("%" ACTIVATION_PRINT, pNetwork->outputLayer->activation[i]);
         }
         printf("\n");
     }
 
-    printf("I think this is output %d \n", pNetworkGlobal->properties.networkResponse);
+    printf("I think this is output %d \n", pNetwork->properties.networkResponse);
     return EOK;
 }
 
@@ -65,17 +64,17 @@ int embann_printNetwork(void)
 
 
 
-int embann_printInputNeuronDetails(numInputs_t neuronNum)
+int embann_printInputNeuronDetails(const network_t* pNetwork, numInputs_t neuronNum)
 {
-    if (neuronNum < pNetworkGlobal->inputLayer->numNeurons)
+    if (neuronNum < pNetwork->inputLayer->numNeurons)
     {
         printf("\nInput Neuron %d: %" ACTIVATION_PRINT "\n", neuronNum,
-                      pNetworkGlobal->inputLayer->activation[neuronNum]);
+                      pNetwork->inputLayer->activation[neuronNum]);
     }
     else
     {
         printf("\nERROR: You've asked for input neuron %d when only %d exist\n",
-            neuronNum, pNetworkGlobal->inputLayer->numNeurons);
+            neuronNum, pNetwork->inputLayer->numNeurons);
     }
     return EOK;
 }
@@ -85,22 +84,23 @@ int embann_printInputNeuronDetails(numInputs_t neuronNum)
 
 
 
-int embann_printOutputNeuronDetails(numOutputs_t neuronNum)
+int embann_printOutputNeuronDetails(const network_t* pNetwork, numOutputs_t neuronNum)
 {
-    if (neuronNum < pNetworkGlobal->outputLayer->numNeurons)
+    if (neuronNum < pNetwork->outputLayer->numNeurons)
     {
+        const layerDescriptor_t layer = embann_describeLayer(pNetwork, pNetwork->properties.numHiddenLayers);
 
         printf("\nOutput Neuron %d:\n", neuronNum);
 
-        for (uint16_t i = 0; i < pNetworkGlobal->hiddenLayer[0]->numNeurons; i++)
+        for (uint16_t i = 0; i < pNetwork->hiddenLayer[0]->numNeurons; i++)
         {
             printf("%" ACTIVATION_PRINT "-*->%" WEIGHT_PRINT " |", 
-                pNetworkGlobal->hiddenLayer[pNetworkGlobal->properties.numHiddenLayers - 1U]->activation[i],
-                pNetworkGlobal->outputLayer->weight[neuronNum][i]);
+                pNetwork->hiddenLayer[pNetwork->properties.numHiddenLayers - 1U]->activation[i],
+                embann_getWeight(&layer, neuronNum, i));
 
-            if (i == floor(pNetworkGlobal->hiddenLayer[0]->numNeurons / 2U))
+            if (i == floor(pNetwork->hiddenLayer[0]->numNeurons / 2U))
             {
-                printf(" = %" ACTIVATION_PRINT, pNetworkGlobal->outputLayer->activation[neuronNum]);
+                printf(" = %" ACTIVATION_PRINT, pNetwork->outputLayer->activation[neuronNum]);
             }
             printf("\n");
         }
@@ -109,7 +109,7 @@ int embann_printOutputNeuronDetails(numOutputs_t neuronNum)
     {
         printf(
             "\nERROR: You've asked for output neuron %d when only %d exist",
-            neuronNum, pNetworkGlobal->outputLayer->numNeurons);
+            neuronNum, pNetwork->outputLayer->numNeurons);
     }
     return EOK;
 }
@@ -119,39 +119,43 @@ int embann_printOutputNeuronDetails(numOutputs_t neuronNum)
 
 
 
-int embann_printHiddenNeuronDetails(numLayers_t layerNum, numHiddenNeurons_t neuronNum)
+int embann_printHiddenNeuronDetails(const network_t* pNetwork, numLayers_t layerNum, numHiddenNeurons_t neuronNum)
 {
-    if (neuronNum < pNetworkGlobal->hiddenLayer[layerNum]->numNeurons)
+    if (neuronNum < pNetwork->hiddenLayer[layerNum]->numNeurons)
     {
         printf("\nHidden Neuron %d:\n", neuronNum);
 
         if (layerNum == 0U)
         {
-            for (uint16_t i = 0; i < pNetworkGlobal->inputLayer->numNeurons; i++)
+            const layerDescriptor_t layer = embann_describeLayer(pNetwork, 0U);
+
+            for (uint16_t i = 0; i < pNetwork->inputLayer->numNeurons; i++)
             {
                 printf("%" ACTIVATION_PRINT "-*->%" WEIGHT_PRINT " |", 
-                        pNetworkGlobal->inputLayer->activation[i],
-                        pNetworkGlobal->hiddenLayer[0]->weight[neuronNum][i]);
+                        pNetwork->inputLayer->activation[i],
+                        embann_getWeight(&layer, neuronNum, i));
 
-                if (i == floor(pNetworkGlobal->inputLayer->numNeurons / 2U))
+                if (i == floor(pNetwork->inputLayer->numNeurons / 2U))
                 {       
-                    printf(" = %" ACTIVATION_PRINT, pNetworkGlobal->hiddenLayer[0]->activation[neuronNum]);
+                    printf(" = %" ACTIVATION_PRINT, pNetwork->hiddenLayer[0]->activation[neuronNum]);
                 }
                 printf("\n");
             }
         }
         else
         {
-            for (uint16_t i = 0; i < pNetworkGlobal->hiddenLayer[layerNum]->numNeurons; i++)
+            const layerDescriptor_t layer = embann_describeLayer(pNetwork, layerNum - 1U);
+
+            for (uint16_t i = 0; i < pNetwork->hiddenLayer[layerNum]->numNeurons; i++)
             {
                 printf("%" ACTIVATION_PRINT "-*->%" WEIGHT_PRINT " |", 
-                    pNetworkGlobal->hiddenLayer[layerNum - 1U]->activation[i],
-                    pNetworkGlobal->hiddenLayer[layerNum - 1U]->weight[neuronNum][i]);
+                    pNetwork->hiddenLayer[layerNum - 1U]->activation[i],
+                    embann_getWeight(&layer, neuronNum, i));
 
 
-                if (i == floor(pNetworkGlobal->hiddenLayer[layerNum]->numNeurons / 2U))
+                if (i == floor(pNetwork->hiddenLayer[layerNum]->numNeurons / 2U))
                 {
-                    printf(" = %" ACTIVATION_PRINT, pNetworkGlobal->hiddenLayer[layerNum]->activation[neuronNum]);
+                    printf(" = %" ACTIVATION_PRINT, pNetwork->hiddenLayer[layerNum]->activation[neuronNum]);
                 }
                 printf("\n");
             }
@@ -160,7 +164,7 @@ int embann_printHiddenNeuronDetails(numLayers_t layerNum, numHiddenNeurons_t neu
     else
     {
         printf("\nERROR: You've asked for hidden neuron %d when only %d exist",
-            neuronNum, pNetworkGlobal->hiddenLayer[layerNum]->numNeurons);
+            neuronNum, pNetwork->hiddenLayer[layerNum]->numNeurons);
     }
     return EOK;
 }
@@ -170,28 +174,29 @@ int embann_printHiddenNeuronDetails(numLayers_t layerNum, numHiddenNeurons_t neu
 
 
 
-int embann_errorReporting(numOutputs_t correctResponse)
+int embann_errorReporting(const network_t* pNetwork, numOutputs_t correctResponse)
 {
     printf("\nErrors: ");
-    for (uint8_t i = 0; i <= pNetworkGlobal->outputLayer->numNeurons - 1; i++)
+    for (uint8_t i = 0; i <= pNetwork->outputLayer->numNeurons - 1; i++)
     {
         if (i == correctResponse)
         {
-            printf("%-7" ACTIVATION_PRINT " | ", (1 - pNetworkGlobal->outputLayer->activation[correctResponse]));
+            printf("%-7" ACTIVATION_PRINT " | ", (1 - pNetwork->outputLayer->activation[correctResponse]));
         }
         else
         {
-            printf("%-7" ACTIVATION_PRINT " | ", (0 - pNetworkGlobal->outputLayer->activation[i]));
+            printf("%-7" ACTIVATION_PRINT " | ", (0 - pNetwork->outputLayer->activation[i]));
         }
     }
 
-    if (pNetworkGlobal->outputLayer->numNeurons == correctResponse)
+    if (pNetwork->outputLayer->numNeurons == correctResponse)
     {
-        printf("%-7" ACTIVATION_PRINT "\n", (1 - pNetworkGlobal->outputLayer->activation[correctResponse]));
+        printf("%-7" ACTIVATION_PRINT "\n", (1 - pNetwork->outputLayer->activation[correctResponse]));
     }
     else
     {
-        printf("%-7" ACTIVATION_PRINT "\n", (0 - pNetworkGlobal->outputLayer->activation[pNetworkGlobal->outputLayer->numNeurons - 1U]));
+        printf("%-7" ACTIVATION_PRINT "\n",
+                (0 - pNetwork->outputLayer->activation[pNetwork->outputLayer->numNeurons - 1U]));
     }
     return EOK;
 }
@@ -0,0 +1,1232 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+    embann_storage.c - EMbedded Backpropogating Artificial Neural Network.
+    Copyright Peter Frost 2019
+*/
+
+#include "embann.h"
+#include "embann_log.h"
+
+#if defined(CONFIG_MAP_NETWORK_FILES) && !defined(_WIN32) && !defined(ARDUINO)
+#define MAP_NETWORK_FILES
+#endif
+#if defined(CONFIG_MAP_DATASET_FILES) && !defined(_WIN32) && !defined(ARDUINO)
+#define MAP_DATASET_FILES
+#endif
+#if defined(MAP_NETWORK_FILES) || defined(MAP_DATASET_FILES)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define TAG "Embann Storage"
+
+/* "EMBN" read as a little endian uint32_t, files from hosts of the other byte order fail the check */
+#define NETWORK_FILE_MAGIC 0x4E424D45UL
+#define NETWORK_FILE_VERSION 2U
+#define NETWORK_FILE_REQUANTIZATION 0x01U
+
+/* Blocks are cache line aligned in the file, so they are in a page aligned mapping too */
+#define NETWORK_FILE_ALIGNMENT CONFIG_CACHE_LINE_SIZE
+
+/* Kind of type in the top nibble of networkFileHeader_t's type fields, size in bytes in the bottom */
+#define TYPE_KIND_UNSIGNED 0U
+#define TYPE_KIND_SIGNED 1U
+#define TYPE_KIND_FLOAT 2U
+#define TYPE_CODE(kind, type) ((uint8_t) (((kind) << 4U) | sizeof(type)))
+
+#if defined(ACTIVATION_IS_FLOAT)
+#define ACTIVATION_TYPE_CODE TYPE_CODE(TYPE_KIND_FLOAT, activation_t)
+#elif defined(ACTIVATION_IS_SIGNED)
+#define ACTIVATION_TYPE_CODE TYPE_CODE(TYPE_KIND_SIGNED, activation_t)
+#else
+#define ACTIVATION_TYPE_CODE TYPE_CODE(TYPE_KIND_UNSIGNED, activation_t)
+#endif
+
+#if defined(WEIGHT_IS_FLOAT)
+#define WEIGHT_TYPE_CODE TYPE_CODE(TYPE_KIND_FLOAT, weight_t)
+#elif defined(WEIGHT_IS_SIGNED)
+#define WEIGHT_TYPE_CODE TYPE_CODE(TYPE_KIND_SIGNED, weight_t)
+#else
+#define WEIGHT_TYPE_CODE TYPE_CODE(TYPE_KIND_UNSIGNED, weight_t)
+#endif
+
+#if defined(BIAS_IS_FLOAT)
+#define BIAS_TYPE_CODE TYPE_CODE(TYPE_KIND_FLOAT, bias_t)
+#elif defined(BIAS_IS_SIGNED)
+#define BIAS_TYPE_CODE TYPE_CODE(TYPE_KIND_SIGNED, bias_t)
+#else
+#define BIAS_TYPE_CODE TYPE_CODE(TYPE_KIND_UNSIGNED, bias_t)
+#endif
+
+#ifdef CONFIG_REQUANTIZATION
+#define NETWORK_FILE_FLAGS NETWORK_FILE_REQUANTIZATION
+#else
+#define NETWORK_FILE_FLAGS 0U
+#endif
+
+/* "EMBD", dataset files share the network files' alignment and type codes */
+#define DATASET_FILE_MAGIC 0x44424D45UL
+#define DATASET_FILE_VERSION 1U
+#define LABEL_TYPE_CODE TYPE_CODE(TYPE_KIND_UNSIGNED, numOutputs_t)
+
+
+
+static networkFileHeader_t _describeNetworkFile(const network_t* pNetwork);
+static networkFileLayer_t _describeLayerFile(const network_t* pNetwork, numLayers_t layer, uint64_t* pOffset);
+static int _writeNetworkFile(const network_t* pNetwork, FILE* pFile);
+static void _writeBlock(FILE* pFile, const void* pData, size_t size);
+static int _checkNetworkHeader(const network_t* pNetwork, const networkFileHeader_t* pHeader, uint64_t fileSize);
+static int _checkNetworkLayer(const network_t* pNetwork, numLayers_t layer, const networkFileLayer_t* pEntry,
+                                const networkFileHeader_t* pHeader);
+static bool _blockFits(uint64_t offset, uint64_t size, const networkFileHeader_t* pHeader);
+static uint64_t _weightBytes(const networkFileLayer_t* pEntry);
+#ifdef CONFIG_SPARSE_WEIGHTS
+static bool _isSparseIndexValid(const networkFileLayer_t* pEntry, const uint32_t* pRowStart,
+                                const uint32_t* pBlockInput);
+#endif
+static int _setLayerOutput(network_t* pNetwork, numLayers_t layer, const networkFileLayer_t* pEntry);
+#ifdef MAP_NETWORK_FILES
+static int _mapNetworkFile(network_t* pNetwork, uint8_t* pMapping, size_t mappingSize);
+static void _mapLayer(network_t* pNetwork, numLayers_t layer, const networkFileLayer_t* pEntry, uint8_t* pMapping);
+#else
+static int _checkNetworkFile(const network_t* pNetwork, FILE* pFile, networkFileHeader_t* pHeader);
+static int _readNetworkFile(network_t* pNetwork, FILE* pFile, const networkFileHeader_t* pHeader);
+static int _readLayerWeights(network_t* pNetwork, numLayers_t layer, const networkFileLayer_t* pEntry,
+                                FILE* pFile);
+#ifdef CONFIG_SPARSE_WEIGHTS
+static bool _isSparseIndexValidFile(const networkFileLayer_t* pEntry, FILE* pFile);
+#endif
+#endif
+static int _writeDatasetFile(const network_t* pNetwork, FILE* pFile);
+static int _checkDatasetHeader(const network_t* pNetwork, const datasetFileHeader_t* pHeader, uint64_t fileSize);
+static bool _datasetBlockFits(uint64_t offset, uint64_t count, uint64_t itemBytes, const datasetFileHeader_t* pHeader);
+static bool _areLabelsValid(const network_t* pNetwork, const numOutputs_t* pLabels, uint64_t numSets);
+#ifdef MAP_DATASET_FILES
+static int _mapDatasetFile(network_t* pNetwork, uint8_t* pMapping, size_t mappingSize);
+#else
+static int _readDatasetFile(network_t* pNetwork, FILE* pFile);
+#endif
+
+
+
+
+
+/*
+ * Writes the network's weights, biases, activation functions and, with
+ * requantization, its scales and zero points to pPath. Only a build with the
+ * same types, sizes and weight padding can load it again. Pruned layers are
+ * written as just their blocks, and load back pruned.
+ */
+int embann_saveNetwork(const network_t* pNetwork, const char* pPath)
+{
+    if (pPath == NULL)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    FILE* pFile = fopen(pPath, "wb");
+    if (pFile == NULL)
+    {
+        EMBANN_LOGE(TAG, "Couldn't open %s", pPath);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EIO;
+    }
+
+    int err = _writeNetworkFile(pNetwork, pFile);
+    if ((fclose(pFile) != 0) && (err == EOK))
+    {
+        err = EIO;
+    }
+    return err;
+}
+
+
+
+
+
+/*
+ * Loads a file from embann_saveNetwork() into the current network, which
+ * has to have been through embann_init() with the same sizes. With
+ * CONFIG_MAP_NETWORK_FILES the weights and biases are left in the mapping
+ * rather than copied, so the file can't be changed while it's loaded.
+ * Nothing in the network changes unless the whole file checks out.
+ */
+int embann_loadNetwork(network_t* pNetwork, const char* pPath)
+{
+    if (pPath == NULL)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+#ifdef MAP_NETWORK_FILES
+    struct stat fileStat;
+    const int fd = open(pPath, O_RDONLY);
+
+    if ((fd < 0) || (fstat(fd, &fileStat) != 0))
+    {
+        EMBANN_LOGE(TAG, "Couldn't open %s", pPath);
+        if (fd >= 0)
+        {
+            (void) close(fd);
+        }
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOENT;
+    }
+
+    const size_t mappingSize = (size_t) fileStat.st_size;
+    /* Private, so training writes to copies of the pages rather than the file */
+    void* pMapping = (mappingSize >= sizeof(networkFileHeader_t)) ?
+                        mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    (void) close(fd);
+
+    if (pMapping == MAP_FAILED)
+    {
+        EMBANN_LOGE(TAG, "Couldn't map %s", pPath);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EIO;
+    }
+
+    const int err = _mapNetworkFile(pNetwork, (uint8_t*) pMapping, mappingSize);
+    if (err != EOK)
+    {
+        (void) munmap(pMapping, mappingSize);
+    }
+#else
+    networkFileHeader_t header;
+    FILE* pFile = fopen(pPath, "rb");
+
+    if (pFile == NULL)
+    {
+        EMBANN_LOGE(TAG, "Couldn't open %s", pPath);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOENT;
+    }
+
+    int err = _checkNetworkFile(pNetwork, pFile, &header);
+    if (err == EOK)
+    {
+        err = _readNetworkFile(pNetwork, pFile, &header);
+    }
+    (void) fclose(pFile);
+#endif
+
+#ifdef CONFIG_REQUANTIZATION
+    if (err == EOK)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return embann_updateZeroPointOffsets(pNetwork);
+    }
+#endif
+    return err;
+}
+
+
+
+
+
+/*
+ * Writes the network's training samples to pPath, for embann_loadDataset().
+ * Only a build with the same activation_t and numOutputs_t can load it again.
+ */
+int embann_saveDataset(const network_t* pNetwork, const char* pPath)
+{
+    if ((pPath == NULL) || (pNetwork->trainingData.numSets == 0U))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return (pPath == NULL) ? EINVAL : ENOENT;
+    }
+
+    FILE* pFile = fopen(pPath, "wb");
+    if (pFile == NULL)
+    {
+        EMBANN_LOGE(TAG, "Couldn't open %s", pPath);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EIO;
+    }
+
+    int err = _writeDatasetFile(pNetwork, pFile);
+    if ((fclose(pFile) != 0) && (err == EOK))
+    {
+        err = EIO;
+    }
+    return err;
+}
+
+
+
+
+
+/*
+ * Replaces the network's training samples with a file from
+ * embann_saveDataset(). With CONFIG_MAP_DATASET_FILES the file is mapped
+ * rather than read, so it can be bigger than memory and its pages are only
+ * read as training and the statistics functions touch them. It's advised for
+ * random access to suit the training drivers, see embann_adviseDataset().
+ * Its samples have to be as wide as the input layer, EINVAL otherwise. The
+ * samples are left alone if the file's header doesn't check out, but are
+ * cleared if reading the rest of it fails.
+ */
+int embann_loadDataset(network_t* pNetwork, const char* pPath)
+{
+    if (pPath == NULL)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+#ifdef MAP_DATASET_FILES
+    struct stat fileStat;
+    const int fd = open(pPath, O_RDONLY);
+
+    if ((fd < 0) || (fstat(fd, &fileStat) != 0))
+    {
+        EMBANN_LOGE(TAG, "Couldn't open %s", pPath);
+        if (fd >= 0)
+        {
+            (void) close(fd);
+        }
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOENT;
+    }
+
+    const size_t mappingSize = (size_t) fileStat.st_size;
+    /* Shared and read only, so every process training on the file uses the same pages */
+    void* pMapping = (mappingSize >= sizeof(datasetFileHeader_t)) ?
+                        mmap(NULL, mappingSize, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    (void) close(fd);
+
+    if (pMapping == MAP_FAILED)
+    {
+        EMBANN_LOGE(TAG, "Couldn't map %s", pPath);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EIO;
+    }
+
+    const int err = _mapDatasetFile(pNetwork, (uint8_t*) pMapping, mappingSize);
+    if (err != EOK)
+    {
+        (void) munmap(pMapping, mappingSize);
+    }
+#else
+    FILE* pFile = fopen(pPath, "rb");
+
+    if (pFile == NULL)
+    {
+        EMBANN_LOGE(TAG, "Couldn't open %s", pPath);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOENT;
+    }
+
+    const int err = _readDatasetFile(pNetwork, pFile);
+    (void) fclose(pFile);
+#endif
+    return err;
+}
+
+
+
+
+
+#ifdef CONFIG_MAP_DATASET_FILES
+/*
+ * Tells the kernel how the mapped samples are about to be read, so it reads
+ * ahead for whole epochs and statistics but not for random draws. Does
+ * nothing for samples that aren't mapped.
+ */
+int embann_adviseDataset(const network_t* pNetwork, datasetAccess_t access)
+{
+#ifdef MAP_DATASET_FILES
+    const trainingDataCollection_t* pTrainingData = &pNetwork->trainingData;
+    int advice;
+
+    switch (access)
+    {
+        case DATASET_ACCESS_NORMAL:
+            advice = MADV_NORMAL;
+            break;
+        case DATASET_ACCESS_SEQUENTIAL:
+            advice = MADV_SEQUENTIAL;
+            break;
+        case DATASET_ACCESS_RANDOM:
+            advice = MADV_RANDOM;
+            break;
+        case DATASET_ACCESS_WILL_NEED:
+            advice = MADV_WILLNEED;
+            break;
+        default:
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return EINVAL;
+    }
+
+    if ((pTrainingData->pFileMapping != NULL) &&
+        (madvise(pTrainingData->pFileMapping, pTrainingData->fileMappingSize, advice) != 0))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EIO;
+    }
+#else
+    (void) pNetwork;
+    (void) access;
+#endif
+    return EOK;
+}
+#endif
+
+
+
+
+
+static networkFileHeader_t _describeNetworkFile(const network_t* pNetwork)
+{
+    const numLayers_t numLayers = pNetwork->properties.numHiddenLayers + 1U;
+    uint64_t offset = ROUND_UP_TO_MULTIPLE(sizeof(networkFileHeader_t) + (numLayers * sizeof(networkFileLayer_t)),
+                                            NETWORK_FILE_ALIGNMENT);
+
+    /* The blocks go in layer order, so the last layer's end is the end of the file */
+    for (numLayers_t layer = 0; layer < numLayers; layer++)
+    {
+        (void) _describeLayerFile(pNetwork, layer, &offset);
+    }
+
+    return (networkFileHeader_t) {
+        .magic = NETWORK_FILE_MAGIC,
+        .version = NETWORK_FILE_VERSION,
+        .headerSize = (uint16_t) sizeof(networkFileHeader_t),
+        .activationType = ACTIVATION_TYPE_CODE,
+        .weightType = WEIGHT_TYPE_CODE,
+        .biasType = BIAS_TYPE_CODE,
+        .flags = NETWORK_FILE_FLAGS,
+        .alignment = NETWORK_FILE_ALIGNMENT,
+        .numInputs = pNetwork->inputLayer->numNeurons,
+        .numHiddenNeurons = pNetwork->hiddenLayer[0]->numNeurons,
+        .numHiddenLayers = pNetwork->properties.numHiddenLayers,
+        .numOutputs = pNetwork->outputLayer->numNeurons,
+#ifdef CONFIG_REQUANTIZATION
+        .inputZeroPoint = pNetwork->inputLayer->zeroPoint,
+#endif
+        .fileSize = offset
+    };
+}
+
+
+
+
+
+/* Table entry for layer, with its blocks from *pOffset on, which is moved past them */
+static networkFileLayer_t _describeLayerFile(const network_t* pNetwork, numLayers_t layer, uint64_t* pOffset)
+{
+    const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+    networkFileLayer_t entry = {
+        .numInputs = descriptor.numInputs,
+        .numNeurons = descriptor.numNeurons,
+        .weightStride = descriptor.weightStride,
+        .activationFunction = (uint32_t) descriptor.activationFunction,
+#ifdef CONFIG_REQUANTIZATION
+        .zeroPoint = descriptor.quant.zeroPoint,
+#endif
+    };
+
+#ifdef CONFIG_SPARSE_WEIGHTS
+    if (descriptor.sparse != NULL)
+    {
+        entry.sparseBlockSize = CONFIG_SPARSE_BLOCK_SIZE;
+        entry.numBlocks = descriptor.sparse->numBlocks;
+    }
+#endif
+
+    entry.weightOffset = *pOffset;
+    *pOffset += ROUND_UP_TO_MULTIPLE(_weightBytes(&entry), NETWORK_FILE_ALIGNMENT);
+    entry.biasOffset = *pOffset;
+    *pOffset += ROUND_UP_TO_MULTIPLE(descriptor.numNeurons * sizeof(bias_t), NETWORK_FILE_ALIGNMENT);
+#ifdef CONFIG_REQUANTIZATION
+    entry.multiplierOffset = *pOffset;
+    *pOffset += ROUND_UP_TO_MULTIPLE(descriptor.numNeurons * sizeof(int32_t), NETWORK_FILE_ALIGNMENT);
+    entry.exponentOffset = *pOffset;
+    *pOffset += ROUND_UP_TO_MULTIPLE(descriptor.numNeurons * sizeof(int8_t), NETWORK_FILE_ALIGNMENT);
+#endif
+    if (entry.sparseBlockSize != 0U)
+    {
+        entry.rowStartOffset = *pOffset;
+        *pOffset += ROUND_UP_TO_MULTIPLE((descriptor.numNeurons + 1U) * sizeof(uint32_t), NETWORK_FILE_ALIGNMENT);
+        entry.blockInputOffset = *pOffset;
+        *pOffset += ROUND_UP_TO_MULTIPLE(entry.numBlocks * sizeof(uint32_t), NETWORK_FILE_ALIGNMENT);
+    }
+    return entry;
+}
+
+
+
+
+
+static int _writeNetworkFile(const network_t* pNetwork, FILE* pFile)
+{
+    const numLayers_t numLayers = pNetwork->properties.numHiddenLayers + 1U;
+    const networkFileHeader_t header = _describeNetworkFile(pNetwork);
+    uint64_t offset = ROUND_UP_TO_MULTIPLE(sizeof(networkFileHeader_t) + (numLayers * sizeof(networkFileLayer_t)),
+                                            NETWORK_FILE_ALIGNMENT);
+
+    (void) fwrite(&header, sizeof(header), 1U, pFile);
+    for (numLayers_t layer = 0; layer < numLayers; layer++)
+    {
+        const networkFileLayer_t entry = _describeLayerFile(pNetwork, layer, &offset);
+        (void) fwrite(&entry, sizeof(entry), 1U, pFile);
+    }
+    _writeBlock(pFile, NULL, (size_t) (sizeof(networkFileHeader_t) + (numLayers * sizeof(networkFileLayer_t))));
+
+    for (numLayers_t layer = 0; layer < numLayers; layer++)
+    {
+        const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+#ifdef CONFIG_SPARSE_WEIGHTS
+        const sparseWeights_t* pSparse = descriptor.sparse;
+
+        if (pSparse != NULL)
+        {
+            _writeBlock(pFile, pSparse->blockWeights, pSparse->numBlocks * CONFIG_SPARSE_BLOCK_SIZE * sizeof(weight_t));
+        }
+        else
+#endif
+        {
+            _writeBlock(pFile, descriptor.weight, descriptor.numNeurons * descriptor.weightStride * sizeof(weight_t));
+        }
+        _writeBlock(pFile, descriptor.bias, descriptor.numNeurons * sizeof(bias_t));
+#ifdef CONFIG_REQUANTIZATION
+        _writeBlock(pFile, descriptor.quant.multiplier, descriptor.numNeurons * sizeof(int32_t));
+        _writeBlock(pFile, descriptor.quant.exponent, descriptor.numNeurons * sizeof(int8_t));
+#endif
+#ifdef CONFIG_SPARSE_WEIGHTS
+        if (pSparse != NULL)
+        {
+            _writeBlock(pFile, pSparse->rowStart, (descriptor.numNeurons + 1U) * sizeof(uint32_t));
+            _writeBlock(pFile, pSparse->blockInput, pSparse->numBlocks * sizeof(uint32_t));
+        }
+#endif
+    }
+    return (ferror(pFile) != 0) ? EIO : EOK;
+}
+
+
+
+
+
+/* Writes size bytes of pData, if it isn't NULL, then pads to NETWORK_FILE_ALIGNMENT */
+static void _writeBlock(FILE* pFile, const void* pData, size_t size)
+{
+    if (pData != NULL)
+    {
+        (void) fwrite(pData, 1U, size, pFile);
+    }
+
+    for (size_t i = size; i < ROUND_UP_TO_MULTIPLE(size, NETWORK_FILE_ALIGNMENT); i++)
+    {
+        (void) fputc(0, pFile);
+    }
+}
+
+
+
+
+
+static int _checkNetworkHeader(const network_t* pNetwork, const networkFileHeader_t* pHeader, uint64_t fileSize)
+{
+    const numLayers_t numLayers = pNetwork->properties.numHiddenLayers + 1U;
+
+    if ((pHeader->magic != NETWORK_FILE_MAGIC) || (pHeader->version != NETWORK_FILE_VERSION) ||
+        (pHeader->headerSize < sizeof(networkFileHeader_t)))
+    {
+        EMBANN_LOGE(TAG, "Not a version %d network file", NETWORK_FILE_VERSION);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    if ((pHeader->activationType != ACTIVATION_TYPE_CODE) || (pHeader->weightType != WEIGHT_TYPE_CODE) ||
+        (pHeader->biasType != BIAS_TYPE_CODE) || (pHeader->flags != NETWORK_FILE_FLAGS))
+    {
+        EMBANN_LOGE(TAG, "Network file is for a build with different types");
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    if ((pHeader->numInputs != pNetwork->inputLayer->numNeurons) ||
+        (pHeader->numHiddenNeurons != pNetwork->hiddenLayer[0]->numNeurons) ||
+        (pHeader->numHiddenLayers != pNetwork->properties.numHiddenLayers) ||
+        (pHeader->numOutputs != pNetwork->outputLayer->numNeurons))
+    {
+        EMBANN_LOGE(TAG, "Network file is %lu x %lu x %lu x %lu", (unsigned long) pHeader->numInputs,
+                    (unsigned long) pHeader->numHiddenNeurons, (unsigned long) pHeader->numHiddenLayers,
+                    (unsigned long) pHeader->numOutputs);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    if ((pHeader->fileSize != fileSize) || (pHeader->alignment == 0U) ||
+        ((pHeader->alignment % NETWORK_FILE_ALIGNMENT) != 0U) ||
+        ((pHeader->headerSize + (numLayers * sizeof(networkFileLayer_t))) > fileSize))
+    {
+        EMBANN_LOGE(TAG, "Network file is truncated or misaligned");
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EIO;
+    }
+    return EOK;
+}
+
+
+
+
+
+static int _checkNetworkLayer(const network_t* pNetwork, numLayers_t layer, const networkFileLayer_t* pEntry,
+                                const networkFileHeader_t* pHeader)
+{
+    const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+    const uint64_t numNeurons = pEntry->numNeurons;
+    bool valid = (pEntry->numInputs == descriptor.numInputs) && (pEntry->numNeurons == descriptor.numNeurons) &&
+                    (pEntry->weightStride == descriptor.weightStride) &&
+                    (pEntry->activationFunction < (uint32_t) NUM_ACTIVATION_FUNCTIONS);
+
+#ifdef CONFIG_SPARSE_WEIGHTS
+    if (pEntry->sparseBlockSize != 0U)
+    {
+        const uint64_t maxBlocks = numNeurons * (ROUND_UP_TO_MULTIPLE((uint64_t) pEntry->numInputs,
+                                                    CONFIG_SPARSE_BLOCK_SIZE) / CONFIG_SPARSE_BLOCK_SIZE);
+
+        valid = valid && (pEntry->sparseBlockSize == CONFIG_SPARSE_BLOCK_SIZE) && (pEntry->numBlocks <= maxBlocks);
+        valid = valid && _blockFits(pEntry->rowStartOffset, (numNeurons + 1U) * sizeof(uint32_t), pHeader);
+        valid = valid && _blockFits(pEntry->blockInputOffset, pEntry->numBlocks * sizeof(uint32_t), pHeader);
+    }
+#else
+    valid = valid && (pEntry->sparseBlockSize == 0U);
+#endif
+    valid = valid && _blockFits(pEntry->weightOffset, _weightBytes(pEntry), pHeader);
+    valid = valid && _blockFits(pEntry->biasOffset, numNeurons * sizeof(bias_t), pHeader);
+#ifdef CONFIG_REQUANTIZATION
+    valid = valid && _blockFits(pEntry->multiplierOffset, numNeurons * sizeof(int32_t), pHeader);
+    valid = valid && _blockFits(pEntry->exponentOffset, numNeurons * sizeof(int8_t), pHeader);
+#endif
+
+    if (!valid)
+    {
+        EMBANN_LOGE(TAG, "Network file layer %d doesn't match the network", layer);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+    return EOK;
+}
+
+
+
+
+
+static bool _blockFits(uint64_t offset, uint64_t size, const networkFileHeader_t* pHeader)
+{
+    return ((offset % pHeader->alignment) == 0U) && (offset <= pHeader->fileSize) &&
+            (size <= (pHeader->fileSize - offset));
+}
+
+
+
+
+
+/* Size of the layer's weight block, just the blocks left in it for pruned layers */
+static uint64_t _weightBytes(const networkFileLayer_t* pEntry)
+{
+    return (pEntry->sparseBlockSize != 0U) ?
+            ((uint64_t) pEntry->numBlocks * pEntry->sparseBlockSize * sizeof(weight_t)) :
+            ((uint64_t) pEntry->numNeurons * pEntry->weightStride * sizeof(weight_t));
+}
+
+
+
+
+
+#ifdef CONFIG_SPARSE_WEIGHTS
+/*
+ * Rows have to run in order from block 0 to the last, and each block has to
+ * start on a block boundary inside the layer, so no block can be read past
+ */
+static bool _isSparseIndexValid(const networkFileLayer_t* pEntry, const uint32_t* pRowStart,
+                                const uint32_t* pBlockInput)
+{
+    bool valid = (pEntry->sparseBlockSize == 0U) ||
+                    ((pRowStart[0] == 0U) && (pRowStart[pEntry->numNeurons] == pEntry->numBlocks));
+
+    for (uint32_t i = 0; valid && (pEntry->sparseBlockSize != 0U) && (i < pEntry->numNeurons); i++)
+    {
+        valid = (pRowStart[i] <= pRowStart[i + 1U]);
+    }
+    for (uint32_t b = 0; valid && (pEntry->sparseBlockSize != 0U) && (b < pEntry->numBlocks); b++)
+    {
+        valid = (pBlockInput[b] < pEntry->numInputs) && ((pBlockInput[b] % CONFIG_SPARSE_BLOCK_SIZE) == 0U);
+    }
+    return valid;
+}
+#endif
+
+
+
+
+
+static int _setLayerOutput(network_t* pNetwork, numLayers_t layer, const networkFileLayer_t* pEntry)
+{
+    const int err = embann_setActivationFunction(pNetwork, layer, (activationFunction_t) pEntry->activationFunction);
+    if (err != EOK)
+    {
+        EMBANN_LOGE(TAG, "Network file layer %d has an unknown activation function", layer);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return err;
+    }
+#ifdef CONFIG_REQUANTIZATION
+    if (layer < pNetwork->properties.numHiddenLayers)
+    {
+        pNetwork->hiddenLayer[layer]->quant.zeroPoint = (activation_t) pEntry->zeroPoint;
+    }
+    else
+    {
+        pNetwork->outputLayer->quant.zeroPoint = (activation_t) pEntry->zeroPoint;
+    }
+#endif
+    return EOK;
+}
+
+
+
+
+
+#ifdef MAP_NETWORK_FILES
+static int _mapNetworkFile(network_t* pNetwork, uint8_t* pMapping, size_t mappingSize)
+{
+    const numLayers_t numLayers = pNetwork->properties.numHiddenLayers + 1U;
+    const networkFileHeader_t* pHeader = (const networkFileHeader_t*) pMapping;
+
+    const int headerErr = _checkNetworkHeader(pNetwork, pHeader, mappingSize);
+    if (headerErr != EOK)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return headerErr;
+    }
+
+    const networkFileLayer_t* pLayers = (const networkFileLayer_t*) &pMapping[pHeader->headerSize];
+    for (numLayers_t layer = 0; layer < numLayers; layer++)
+    {
+        int err = _checkNetworkLayer(pNetwork, layer, &pLayers[layer], pHeader);
+#ifdef CONFIG_SPARSE_WEIGHTS
+        if ((err == EOK) && !_isSparseIndexValid(&pLayers[layer],
+                                                    (const uint32_t*) &pMapping[pLayers[layer].rowStartOffset],
+                                                    (const uint32_t*) &pMapping[pLayers[layer].blockInputOffset]))
+        {
+            EMBANN_LOGE(TAG, "Network file layer %d has a corrupt sparse index", layer);
+            err = EINVAL;
+        }
+#endif
+        if (err != EOK)
+        {
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return err;
+        }
+    }
+
+    /* Before anything that can't be undone, so a failure leaves the old weights in place */
+    for (numLayers_t layer = 0; layer < numLayers; layer++)
+    {
+        const int err = _setLayerOutput(pNetwork, layer, &pLayers[layer]);
+        if (err != EOK)
+        {
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return err;
+        }
+    }
+
+#ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
+    /* The first file mapped replaces the weights and biases embann_init() allocated, pruned layers have none */
+    if (pNetwork->pFileMapping == NULL)
+    {
+        for (numLayers_t layer = 0; layer < numLayers; layer++)
+        {
+            const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+            // Deviation from MISRA C2012 11.8, the descriptor points at this network's own layers
+            // cppcheck-suppress misra-c2012-11.8
+            EMBANN_ALIGNED_FREE((weight_t*) descriptor.weight);
+            // cppcheck-suppress misra-c2012-11.8
+            free((bias_t*) descriptor.bias);
+        }
+    }
+#endif
+
+    for (numLayers_t layer = 0; layer < numLayers; layer++)
+    {
+        _mapLayer(pNetwork, layer, &pLayers[layer], pMapping);
+    }
+#ifdef CONFIG_REQUANTIZATION
+    pNetwork->inputLayer->zeroPoint = (activation_t) pHeader->inputZeroPoint;
+#endif
+
+    if (pNetwork->pFileMapping != NULL)
+    {
+        (void) munmap(pNetwork->pFileMapping, pNetwork->fileMappingSize);
+    }
+    pNetwork->pFileMapping = pMapping;
+    pNetwork->fileMappingSize = mappingSize;
+    return EOK;
+}
+
+
+
+
+
+static void _mapLayer(network_t* pNetwork, numLayers_t layer, const networkFileLayer_t* pEntry, uint8_t* pMapping)
+{
+    weight_t* pWeight = (weight_t*) &pMapping[pEntry->weightOffset];
+    bias_t* pBias = (bias_t*) &pMapping[pEntry->biasOffset];
+
+    if (layer < pNetwork->properties.numHiddenLayers)
+    {
+        pNetwork->hiddenLayer[layer]->weight = pWeight;
+        pNetwork->hiddenLayer[layer]->bias = pBias;
+    }
+    else
+    {
+        pNetwork->outputLayer->weight = pWeight;
+        pNetwork->outputLayer->bias = pBias;
+    }
+
+#ifdef CONFIG_SPARSE_WEIGHTS
+    const sparseWeights_t sparse = {
+        .rowStart = (uint32_t*) &pMapping[pEntry->rowStartOffset],
+        .blockInput = (uint32_t*) &pMapping[pEntry->blockInputOffset],
+        .blockWeights = pWeight,
+        .numBlocks = pEntry->numBlocks,
+        .pAllocation = NULL
+    };
+
+    if (pEntry->sparseBlockSize != 0U)
+    {
+        embann_setLayerWeights(pNetwork, layer, NULL, &sparse);
+    }
+    else
+    {
+        embann_setLayerWeights(pNetwork, layer, pWeight, NULL);
+    }
+#endif
+
+#ifdef CONFIG_REQUANTIZATION
+    /* A few bytes per neuron, and embann_setRequantization() needs to be able to change them */
+    const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+    memcpy(descriptor.quant.multiplier, &pMapping[pEntry->multiplierOffset], pEntry->numNeurons * sizeof(int32_t));
+    memcpy(descriptor.quant.exponent, &pMapping[pEntry->exponentOffset], pEntry->numNeurons * sizeof(int8_t));
+#endif
+}
+#else
+
+
+
+
+
+/* Reads and checks the header and every layer's table entry, leaving the header in pHeader */
+static int _checkNetworkFile(const network_t* pNetwork, FILE* pFile, networkFileHeader_t* pHeader)
+{
+    const numLayers_t numLayers = pNetwork->properties.numHiddenLayers + 1U;
+    networkFileLayer_t entry;
+    long fileSize;
+
+    if ((fseek(pFile, 0L, SEEK_END) != 0) || ((fileSize = ftell(pFile)) < 0L) ||
+        (fseek(pFile, 0L, SEEK_SET) != 0) || (fread(pHeader, sizeof(*pHeader), 1U, pFile) != 1U))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EIO;
+    }
+
+    const int headerErr = _checkNetworkHeader(pNetwork, pHeader, (uint64_t) fileSize);
+    if (headerErr != EOK)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return headerErr;
+    }
+
+    for (numLayers_t layer = 0; layer < numLayers; layer++)
+    {
+        (void) fseek(pFile, (long) (pHeader->headerSize + (layer * sizeof(entry))), SEEK_SET);
+        int err = (fread(&entry, sizeof(entry), 1U, pFile) == 1U) ?
+                            _checkNetworkLayer(pNetwork, layer, &entry, pHeader) : EIO;
+#ifdef CONFIG_SPARSE_WEIGHTS
+        if ((err == EOK) && !_isSparseIndexValidFile(&entry, pFile))
+        {
+            EMBANN_LOGE(TAG, "Network file layer %d has a corrupt sparse index", layer);
+            err = EINVAL;
+        }
+#endif
+        if (err != EOK)
+        {
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return err;
+        }
+    }
+    return EOK;
+}
+
+
+
+
+
+/* Only after _checkNetworkFile() has passed, copies every block into the network's own arrays */
+static int _readNetworkFile(network_t* pNetwork, FILE* pFile, const networkFileHeader_t* pHeader)
+{
+    const numLayers_t numLayers = pNetwork->properties.numHiddenLayers + 1U;
+    bool readAll = true;
+
+    for (numLayers_t layer = 0; layer < numLayers; layer++)
+    {
+        networkFileLayer_t entry;
+
+        (void) fseek(pFile, (long) (pHeader->headerSize + (layer * sizeof(entry))), SEEK_SET);
+        readAll = readAll && (fread(&entry, sizeof(entry), 1U, pFile) == 1U);
+        readAll = readAll && (_readLayerWeights(pNetwork, layer, &entry, pFile) == EOK);
+
+        /* After the weights, which can move between dense and pruned */
+        const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+        (void) fseek(pFile, (long) entry.biasOffset, SEEK_SET);
+        // Deviation from MISRA C2012 11.8, the descriptor points at this network's own layers
+        // cppcheck-suppress misra-c2012-11.8
+        readAll = readAll && (fread((bias_t*) descriptor.bias, sizeof(bias_t), descriptor.numNeurons, pFile) ==
+                                descriptor.numNeurons);
+#ifdef CONFIG_REQUANTIZATION
+        (void) fseek(pFile, (long) entry.multiplierOffset, SEEK_SET);
+        readAll = readAll && (fread(descriptor.quant.multiplier, sizeof(int32_t), descriptor.numNeurons, pFile) ==
+                                descriptor.numNeurons);
+        (void) fseek(pFile, (long) entry.exponentOffset, SEEK_SET);
+        readAll = readAll && (fread(descriptor.quant.exponent, sizeof(int8_t), descriptor.numNeurons, pFile) ==
+                                descriptor.numNeurons);
+#endif
+        const int err = _setLayerOutput(pNetwork, layer, &entry);
+        if (err != EOK)
+        {
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return err;
+        }
+    }
+#ifdef CONFIG_REQUANTIZATION
+    pNetwork->inputLayer->zeroPoint = (activation_t) pHeader->inputZeroPoint;
+#endif
+
+    return readAll ? EOK : EIO;
+}
+
+
+
+
+
+/* Reads layer's weights, which become pruned or dense to match the file */
+static int _readLayerWeights(network_t* pNetwork, numLayers_t layer, const networkFileLayer_t* pEntry,
+                                FILE* pFile)
+{
+    const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+    const size_t numWeights = descriptor.numNeurons * descriptor.weightStride;
+    // Deviation from MISRA C2012 11.8, the descriptor points at this network's own layers
+    // cppcheck-suppress misra-c2012-11.8
+    weight_t* pWeight = (weight_t*) descriptor.weight;
+
+#ifdef CONFIG_SPARSE_WEIGHTS
+    if (pEntry->sparseBlockSize != 0U)
+    {
+        const size_t numBlockWeights = pEntry->numBlocks * CONFIG_SPARSE_BLOCK_SIZE;
+        sparseWeights_t sparse;
+
+        const int err = embann_allocSparseWeights(&sparse, pEntry->numNeurons, pEntry->numBlocks);
+        if (err != EOK)
+        {
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return err;
+        }
+
+        (void) fseek(pFile, (long) pEntry->weightOffset, SEEK_SET);
+        bool readAll = (fread(sparse.blockWeights, sizeof(weight_t), numBlockWeights, pFile) == numBlockWeights);
+        (void) fseek(pFile, (long) pEntry->rowStartOffset, SEEK_SET);
+        readAll = readAll && (fread(sparse.rowStart, sizeof(uint32_t), pEntry->numNeurons + 1U, pFile) ==
+                                (pEntry->numNeurons + 1U));
+        (void) fseek(pFile, (long) pEntry->blockInputOffset, SEEK_SET);
+        readAll = readAll && (fread(sparse.blockInput, sizeof(uint32_t), pEntry->numBlocks, pFile) ==
+                                pEntry->numBlocks);
+
+        EMBANN_ALIGNED_FREE(pWeight);
+        embann_setLayerWeights(pNetwork, layer, NULL, &sparse);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return readAll ? EOK : EIO;
+    }
+
+    if (pWeight == NULL)
+    {
+        /* Pruned until now, so it needs its dense rows back */
+        const size_t numBytes = ROUND_UP_TO_CACHE_LINE(numWeights * sizeof(weight_t));
+
+        pWeight = (weight_t*) EMBANN_ALIGNED_ALLOC(CONFIG_CACHE_LINE_SIZE, numBytes);
+        EMBANN_MALLOC_CHECK(pWeight);
+        memset(pWeight, 0, numBytes);
+    }
+    embann_setLayerWeights(pNetwork, layer, pWeight, NULL);
+#endif
+
+    (void) fseek(pFile, (long) pEntry->weightOffset, SEEK_SET);
+    return (fread(pWeight, sizeof(weight_t), numWeights, pFile) == numWeights) ? EOK : EIO;
+}
+
+
+
+
+
+#ifdef CONFIG_SPARSE_WEIGHTS
+/* _isSparseIndexValid() on the index as it is in the file, before anything is read into the network */
+static bool _isSparseIndexValidFile(const networkFileLayer_t* pEntry, FILE* pFile)
+{
+    if (pEntry->sparseBlockSize == 0U)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return true;
+    }
+
+    const size_t numEntries = pEntry->numNeurons + 1U + pEntry->numBlocks;
+    uint32_t* pIndex = (uint32_t*) malloc(numEntries * sizeof(uint32_t));
+    bool valid = (pIndex != NULL);
+
+    (void) fseek(pFile, (long) pEntry->rowStartOffset, SEEK_SET);
+    valid = valid && (fread(pIndex, sizeof(uint32_t), pEntry->numNeurons + 1U, pFile) == (pEntry->numNeurons + 1U));
+    (void) fseek(pFile, (long) pEntry->blockInputOffset, SEEK_SET);
+    valid = valid && (fread(&pIndex[pEntry->numNeurons + 1U], sizeof(uint32_t), pEntry->numBlocks, pFile) ==
+                        pEntry->numBlocks);
+    valid = valid && _isSparseIndexValid(pEntry, pIndex, &pIndex[pEntry->numNeurons + 1U]);
+
+    free(pIndex);
+    return valid;
+}
+#endif
+#endif // MAP_NETWORK_FILES
+
+
+
+
+
+/* Header, then the features exactly as they're laid out in memory, then the labels */
+static int _writeDatasetFile(const network_t* pNetwork, FILE* pFile)
+{
+    const trainingDataCollection_t* pTrainingData = &pNetwork->trainingData;
+    const uint64_t featureBytes = (uint64_t) pTrainingData->numSets * pTrainingData->featureStride *
+                                    sizeof(activation_t);
+    const uint64_t labelBytes = (uint64_t) pTrainingData->numSets * sizeof(numOutputs_t);
+    datasetFileHeader_t header = {
+        .magic = DATASET_FILE_MAGIC,
+        .version = DATASET_FILE_VERSION,
+        .headerSize = (uint16_t) sizeof(datasetFileHeader_t),
+        .activationType = ACTIVATION_TYPE_CODE,
+        .labelType = LABEL_TYPE_CODE,
+        .reserved = 0U,
+        .alignment = NETWORK_FILE_ALIGNMENT,
+        .numEntries = pTrainingData->numEntries,
+        .featureStride = pTrainingData->featureStride,
+        .numSets = pTrainingData->numSets,
+        .featuresOffset = ROUND_UP_TO_MULTIPLE(sizeof(datasetFileHeader_t), NETWORK_FILE_ALIGNMENT),
+    };
+    header.labelsOffset = header.featuresOffset + ROUND_UP_TO_MULTIPLE(featureBytes, NETWORK_FILE_ALIGNMENT);
+    header.fileSize = header.labelsOffset + ROUND_UP_TO_MULTIPLE(labelBytes, NETWORK_FILE_ALIGNMENT);
+
+    _writeBlock(pFile, &header, sizeof(header));
+    _writeBlock(pFile, pTrainingData->features, (size_t) featureBytes);
+    _writeBlock(pFile, pTrainingData->labels, (size_t) labelBytes);
+    return (ferror(pFile) != 0) ? EIO : EOK;
+}
+
+
+
+
+
+/* The header has to match this build's types, the network's input layer, and the file's actual size */
+static int _checkDatasetHeader(const network_t* pNetwork, const datasetFileHeader_t* pHeader, uint64_t fileSize)
+{
+    if ((pHeader->magic != DATASET_FILE_MAGIC) || (pHeader->version != DATASET_FILE_VERSION) ||
+        (pHeader->headerSize != sizeof(datasetFileHeader_t)))
+    {
+        EMBANN_LOGE(TAG, "Not a version %d dataset file", DATASET_FILE_VERSION);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    if ((pHeader->activationType != ACTIVATION_TYPE_CODE) || (pHeader->labelType != LABEL_TYPE_CODE) ||
+        (pHeader->numEntries == 0U) || (pHeader->featureStride != TRAINING_DATA_STRIDE(pHeader->numEntries)) ||
+        (pHeader->numSets == 0U) || ((numTrainingDataSets_t) pHeader->numSets != pHeader->numSets))
+    {
+        EMBANN_LOGE(TAG, "Dataset file doesn't match this build's types or sizes");
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    /* Narrower samples would have every forward pass read on into the next one */
+    if (pHeader->numEntries != pNetwork->inputLayer->numNeurons)
+    {
+        EMBANN_LOGE(TAG, "Dataset file has %d entries per sample, the input layer has %d neurons",
+                    pHeader->numEntries, pNetwork->inputLayer->numNeurons);
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    if ((pHeader->fileSize != fileSize) || (pHeader->alignment == 0U) ||
+        ((pHeader->alignment % NETWORK_FILE_ALIGNMENT) != 0U) ||
+        !_datasetBlockFits(pHeader->featuresOffset, pHeader->numSets,
+                            (uint64_t) pHeader->featureStride * sizeof(activation_t), pHeader) ||
+        !_datasetBlockFits(pHeader->labelsOffset, pHeader->numSets, sizeof(numOutputs_t), pHeader))
+    {
+        EMBANN_LOGE(TAG, "Dataset file is truncated or corrupt");
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EIO;
+    }
+
+    return EOK;
+}
+
+
+
+
+
+/* Whether count items of itemBytes at offset are aligned and inside the file, without overflowing */
+static bool _datasetBlockFits(uint64_t offset, uint64_t count, uint64_t itemBytes, const datasetFileHeader_t* pHeader)
+{
+    return ((offset % pHeader->alignment) == 0U) && (offset <= pHeader->fileSize) &&
+            (count <= ((pHeader->fileSize - offset) / itemBytes));
+}
+
+
+
+
+
+/* Labels past the output layer would have training write outside its error arrays */
+static bool _areLabelsValid(const network_t* pNetwork, const numOutputs_t* pLabels, uint64_t numSets)
+{
+    const numOutputs_t numOutputs = embann_describeLayer(pNetwork, pNetwork->properties.numHiddenLayers).numNeurons;
+    bool valid = true;
+
+    for (uint64_t i = 0; i < numSets; i++)
+    {
+        valid = valid && (pLabels[i] < numOutputs);
+    }
+    return valid;
+}
+
+
+
+
+
+#ifdef MAP_DATASET_FILES
+static int _mapDatasetFile(network_t* pNetwork, uint8_t* pMapping, size_t mappingSize)
+{
+    const datasetFileHeader_t* pHeader = (const datasetFileHeader_t*) pMapping;
+    trainingDataCollection_t* pTrainingData = &pNetwork->trainingData;
+
+    int err = _checkDatasetHeader(pNetwork, pHeader, mappingSize);
+    if ((err == EOK) &&
+        !_areLabelsValid(pNetwork, (const numOutputs_t*) &pMapping[pHeader->labelsOffset], pHeader->numSets))
+    {
+        EMBANN_LOGE(TAG, "Dataset file has labels past the output layer");
+        err = EINVAL;
+    }
+    if (err != EOK)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return err;
+    }
+
+    (void) embann_clearTrainingData(pNetwork);
+    pTrainingData->features = (activation_t*) &pMapping[pHeader->featuresOffset];
+    pTrainingData->labels = (numOutputs_t*) &pMapping[pHeader->labelsOffset];
+    pTrainingData->numSets = (numTrainingDataSets_t) pHeader->numSets;
+    pTrainingData->capacity = pTrainingData->numSets;
+    pTrainingData->numEntries = pHeader->numEntries;
+    pTrainingData->featureStride = pHeader->featureStride;
+    pTrainingData->pFileMapping = pMapping;
+    pTrainingData->fileMappingSize = mappingSize;
+
+    /* The training drivers draw samples at random, so reading ahead would only waste memory */
+    (void) madvise(pMapping, mappingSize, MADV_RANDOM);
+    return EOK;
+}
+#else
+/* Checks the header then reads both blocks into the training store in one go */
+static int _readDatasetFile(network_t* pNetwork, FILE* pFile)
+{
+    trainingDataCollection_t* pTrainingData = &pNetwork->trainingData;
+    datasetFileHeader_t header;
+    long fileSize = -1;
+
+    if ((fread(&header, sizeof(header), 1U, pFile) == 1U) && (fseek(pFile, 0L, SEEK_END) == 0))
+    {
+        fileSize = ftell(pFile);
+    }
+
+    int err = (fileSize < 0L) ? EIO : _checkDatasetHeader(pNetwork, &header, (uint64_t) fileSize);
+    if (err == EOK)
+    {
+        err = embann_allocTrainingData(pNetwork, (numTrainingDataSets_t) header.numSets, header.numEntries);
+    }
+    if (err != EOK)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return err;
+    }
+
+    const size_t featureBytes = (size_t) header.numSets * header.featureStride * sizeof(activation_t);
+    const size_t labelBytes = (size_t) header.numSets * sizeof(numOutputs_t);
+
+    if ((fseek(pFile, (long) header.featuresOffset, SEEK_SET) != 0) ||
+        (fread(pTrainingData->features, 1U, featureBytes, pFile) != featureBytes) ||
+        (fseek(pFile, (long) header.labelsOffset, SEEK_SET) != 0) ||
+        (fread(pTrainingData->labels, 1U, labelBytes, pFile) != labelBytes))
+    {
+        err = EIO;
+    }
+    else if (!_areLabelsValid(pNetwork, pTrainingData->labels, header.numSets))
+    {
+        EMBANN_LOGE(TAG, "Dataset file has labels past the output layer");
+        err = EINVAL;
+    }
+
+    if (err != EOK)
+    {
+        (void) embann_clearTrainingData(pNetwork);
+    }
+    return err;
+}
+#endif
@@ -3,148 +3,561 @@
 
 #define TAG "Embann Train"
 
-extern network_t* pNetworkGlobal;
-extern trainingData_t* pTrainingData;
-extern trainingDataCollection_t trainingDataCollection;
+#ifdef CONFIG_PARALLEL_TRAINING
+#if defined(_WIN32) || defined(ARDUINO)
+#error "Parallel training needs POSIX threads"
+#endif
 
+#include <pthread.h>
+#include <time.h>
 
-static int _trainOutput(accumulator_t* totalErrorInCurrentLayer, const numOutputs_t numNeuronsInCurrentLayer, 
-                        const numLayers_t lastHiddenLayer, activation_t learningRate, 
-                        numOutputs_t correctOutput);
-static int _trainHidden(accumulator_t* totalErrorInCurrentLayer, accumulator_t* totalErrorInNextLayer, 
-                        const numLayers_t lastHiddenLayer, activation_t learningRate);
-static int _trainInput(accumulator_t* totalErrorInCurrentLayer, accumulator_t* totalErrorInNextLayer, 
-                        activation_t learningRate);
-static int embann_train(numOutputs_t correctOutput, activation_t learningRate, 
-                        accumulator_t* totalErrorInCurrentLayer, accumulator_t* totalErrorInNextLayer);
+struct syncTraining;
 
+/*
+ * Everything one training thread works on bar the weights, which all of
+ * them share. Cache line aligned, so workers never share a line.
+ */
+typedef struct
+{
+    pthread_t thread CACHE_ALIGNMENT;
+    network_t* pNetwork;
+    inferenceSession_t* pSession;
+    accumulator_t* pGradients;
+    accumulator_t* pErrors;             /* Current then next layer's errors, in pGradients' block */
+    uint32_t numErrors;                 /* Each as wide as the widest layer */
+    uint64_t deadlineMicros;
+    uint64_t elapsedMicros;
+    uint64_t numSamples;
+    uint32_t batchSize;
+    uint32_t randomState;
+    struct syncTraining* pSync;         /* Only for embann_trainDriverInBatches() */
+    uint32_t index;
+    int err;
+} trainingWorker_t;
+
+/* What the embann_trainDriverInBatches() threads share, they take turns at everything else */
+typedef struct syncTraining
+{
+    network_t* pNetwork;
+    trainingWorker_t* pWorkers;
+    numTrainingDataSets_t* pBatch;      /* The current batch's samples, drawn by the first worker */
+    pthread_barrier_t barrier;
+    pthread_mutex_t startMutex;         /* Held until every thread has started, or failed to */
+    size_t numGradients;
+    uint32_t numThreads;
+    uint32_t numBatches;                /* Set to 0 if not every thread could be started */
+    uint32_t batchSize;
+} syncTraining_t;
+#endif
+
+
+static int _trainOutput(network_t* pNetwork, const inferenceSession_t* pSession,
+                        accumulator_t* totalErrorInCurrentLayer, const numOutputs_t numNeuronsInCurrentLayer,
+                        const numLayers_t lastHiddenLayer, accumulator_t* pGradients);
+static int _trainHidden(network_t* pNetwork, const inferenceSession_t* pSession,
+                        accumulator_t* totalErrorInCurrentLayer, accumulator_t* totalErrorInNextLayer,
+                        uint32_t numErrors, const numLayers_t lastHiddenLayer, accumulator_t* pGradients);
+static int _trainInput(network_t* pNetwork, const activation_t* pInputs, accumulator_t* totalErrorInCurrentLayer,
+                        accumulator_t* totalErrorInNextLayer, accumulator_t* pGradients);
+static int embann_train(network_t* pNetwork, const inferenceSession_t* pSession, const activation_t* pInputs,
+                        numOutputs_t correctOutput, accumulator_t* pGradients,
+                        accumulator_t* totalErrorInCurrentLayer, accumulator_t* totalErrorInNextLayer,
+                        uint32_t numErrors);
+static void _outputError(const network_t* pNetwork, const inferenceSession_t* pSession, numOutputs_t correctOutput,
+                            accumulator_t* pError, uint32_t numErrors);
+static uint32_t _widestLayer(const network_t* pNetwork);
+static const activation_t* _layerActivation(const network_t* pNetwork, const inferenceSession_t* pSession,
+                                            numLayers_t layer);
+static void _clampErrors(accumulator_t* pError, uint32_t numErrors);
+static accumulator_t* _allocGradients(const network_t* pNetwork);
+static void _freeGradients(accumulator_t* pGradients);
+static size_t _gradientOffset(const network_t* pNetwork, numLayers_t layer);
+static void _applyGradients(network_t* pNetwork, accumulator_t* pGradients);
+static int _finishTraining(network_t* pNetwork, int err);
+#ifdef CONFIG_PARALLEL_TRAINING
+static void* _trainingWorkerThread(void* pArg);
+static void* _syncWorkerThread(void* pArg);
+static int _trainSample(trainingWorker_t* pWorker, numTrainingDataSets_t sample);
+static void _reduceGradients(const syncTraining_t* pSync, size_t first, size_t last);
+static void _applyGradientRange(network_t* pNetwork, accumulator_t* pGradients, size_t first, size_t last);
+static size_t _gradientSliceStart(const syncTraining_t* pSync, uint32_t index);
+static int _initTrainingWorker(trainingWorker_t* pWorker, network_t* pNetwork, uint32_t batchSize);
+static void _freeTrainingWorker(trainingWorker_t* pWorker);
+static uint32_t _nextRandom(uint32_t* pState);
+static numTrainingDataSets_t _nextRandomBelow(uint32_t* pState, numTrainingDataSets_t limit);
+static uint64_t _monotonicMicros(void);
+#endif
 
 
 
-int embann_trainDriverInTime(activation_t learningRate, uint32_t numSeconds)
+
+/*
+ * Trains for numSeconds, batchSize samples at a time. The updates from every
+ * sample in a batch are summed and applied to the weights once, so a batch of
+ * 1 trains a sample at a time. Samples come from embann_getNextDataSet(), so
+ * each is trained once per epoch.
+ */
+int embann_trainDriverInTime(network_t* pNetwork, activation_t learningRate, uint32_t numSeconds,
+                                uint32_t batchSize)
 {
-    trainingData_t* randomDataSet = NULL;
-#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-    accumulator_t totalErrorInCurrentLayer[CONFIG_NUM_INPUT_NEURONS];
-    accumulator_t totalErrorInNextLayer[CONFIG_NUM_INPUT_NEURONS];
-#else
-    accumulator_t totalErrorInCurrentLayer[CONFIG_NUM_INPUT_NEURONS];
-    accumulator_t totalErrorInNextLayer[CONFIG_NUM_INPUT_NEURONS];
+    numTrainingDataSets_t dataSet = 0U;
+    (void) learningRate;
+
+#ifdef CONFIG_SPARSE_WEIGHTS
+    if (embann_isPruned(pNetwork))
+    {
+        EMBANN_LOGE(TAG, "Pruned networks can't be trained");
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOTSUP;
+    }
 #endif
 
+    if (batchSize == 0U)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    if (pNetwork->trainingData.numSets == 0U)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOENT;
+    }
+
+    accumulator_t* pGradients = _allocGradients(pNetwork);
+    EMBANN_MALLOC_CHECK(pGradients);
+
+    const uint32_t numErrors = _widestLayer(pNetwork);
+    accumulator_t* totalErrorInCurrentLayer = (accumulator_t*) malloc(2U * numErrors * sizeof(accumulator_t));
+    if (totalErrorInCurrentLayer == NULL)
+    {
+        _freeGradients(pGradients);
+    }
+    EMBANN_MALLOC_CHECK(totalErrorInCurrentLayer);
+    accumulator_t* totalErrorInNextLayer = &totalErrorInCurrentLayer[numErrors];
+
     uint32_t startTime = millis();
+    int err = EOK;
 
-    while ((millis() - startTime) < (numSeconds * 1000UL))
+    while ((err == EOK) && ((millis() - startTime) < (numSeconds * 1000UL)))
     {
-        embann_getRandomDataSet(&randomDataSet);
+        for (uint32_t i = 0; (err == EOK) && (i < batchSize); i++)
+        {
+            (void) embann_getNextDataSet(pNetwork, &dataSet);
 
-        embann_inputRaw(randomDataSet->data);
-        EMBANN_ERROR_CHECK(embann_forwardPropagate());
-        EMBANN_ERROR_CHECK(embann_train(randomDataSet->correctResponse, learningRate, totalErrorInCurrentLayer, totalErrorInNextLayer));
+            embann_inputRaw(pNetwork, TRAINING_DATA_FEATURES(&pNetwork->trainingData, dataSet));
+            err = embann_forwardPropagate(pNetwork);
+
+            memset(totalErrorInNextLayer, 0, numErrors * sizeof(accumulator_t));
+            _outputError(pNetwork, NULL, pNetwork->trainingData.labels[dataSet], totalErrorInCurrentLayer,
+                            numErrors);
+            _clampErrors(totalErrorInCurrentLayer, pNetwork->outputLayer->numNeurons);
+
+            err = (err == EOK) ? embann_train(pNetwork, NULL, pNetwork->inputLayer->activation,
+                                                pNetwork->trainingData.labels[dataSet], pGradients,
+                                                totalErrorInCurrentLayer, totalErrorInNextLayer, numErrors) : err;
+        }
+        _applyGradients(pNetwork, pGradients);
     }
-    return EOK;
+
+    free(totalErrorInCurrentLayer);
+    _freeGradients(pGradients);
+    return _finishTraining(pNetwork, err);
 }
 
-int embann_trainDriverInError(activation_t learningRate, activation_t desiredCost)
+
+
+
+
+/*
+ * Trains batchSize samples at a time, as embann_trainDriverInTime(),
+ * until every output of every sample in a batch is within desiredCost
+ */
+int embann_trainDriverInError(network_t* pNetwork, activation_t learningRate, activation_t desiredCost,
+                                uint32_t batchSize)
 {
-    const numOutputs_t numOutputs = pNetworkGlobal->outputLayer->numNeurons;
+    const numOutputs_t numOutputs = pNetwork->outputLayer->numNeurons;
     bool converged = false;
-    trainingData_t* randomDataSet = NULL;
-#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
-    accumulator_t totalErrorInCurrentLayer[CONFIG_NUM_INPUT_NEURONS];
-    accumulator_t totalErrorInNextLayer[CONFIG_NUM_INPUT_NEURONS];
-#else
-    accumulator_t totalErrorInCurrentLayer[CONFIG_NUM_INPUT_NEURONS];
-    accumulator_t totalErrorInNextLayer[CONFIG_NUM_INPUT_NEURONS];
+    numTrainingDataSets_t dataSet = 0U;
+    (void) learningRate;
+
+#ifdef CONFIG_SPARSE_WEIGHTS
+    if (embann_isPruned(pNetwork))
+    {
+        EMBANN_LOGE(TAG, "Pruned networks can't be trained");
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOTSUP;
+    }
 #endif
 
+    if (batchSize == 0U)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+    if (pNetwork->trainingData.numSets == 0U)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOENT;
+    }
+
+    accumulator_t* pGradients = _allocGradients(pNetwork);
+    EMBANN_MALLOC_CHECK(pGradients);
+
+    const uint32_t numErrors = _widestLayer(pNetwork);
+    accumulator_t* totalErrorInCurrentLayer = (accumulator_t*) malloc(2U * numErrors * sizeof(accumulator_t));
+    if (totalErrorInCurrentLayer == NULL)
+    {
+        _freeGradients(pGradients);
+    }
+    EMBANN_MALLOC_CHECK(totalErrorInCurrentLayer);
+    accumulator_t* totalErrorInNextLayer = &totalErrorInCurrentLayer[numErrors];
+
+    int err = EOK;
+
 #if (CONFIG_LOG_DEFAULT_LEVEL >= EMBANN_LOG_INFO)
     uint16_t count = 50000;
 #endif
 
-    while (!converged)
+    while ((err == EOK) && !converged)
     {
         converged = true;
 
-        embann_getRandomDataSet(&randomDataSet);
+        for (uint32_t sample = 0; (err == EOK) && (sample < batchSize); sample++)
+        {
+            (void) embann_getNextDataSet(pNetwork, &dataSet);
 
-        embann_inputRaw(randomDataSet->data);
-        EMBANN_ERROR_CHECK(embann_forwardPropagate());
+            embann_inputRaw(pNetwork, TRAINING_DATA_FEATURES(&pNetwork->trainingData, dataSet));
+            err = embann_forwardPropagate(pNetwork);
 
-        memset(totalErrorInCurrentLayer, 0, sizeof(totalErrorInCurrentLayer));
-        memset(totalErrorInNextLayer, 0, sizeof(totalErrorInNextLayer));
-        totalErrorInCurrentLayer[randomDataSet->correctResponse] = MAX_ACTIVATION;
+            memset(totalErrorInNextLayer, 0, numErrors * sizeof(accumulator_t));
+            _outputError(pNetwork, NULL, pNetwork->trainingData.labels[dataSet], totalErrorInCurrentLayer,
+                            numErrors);
 
-        for (numOutputs_t i = 0; i < numOutputs; i++)
-        {        
-            totalErrorInCurrentLayer[i] = (pNetworkGlobal->outputLayer->activation[i] - totalErrorInCurrentLayer[i]);
-            if (abs(totalErrorInCurrentLayer[i]) > desiredCost)
+            for (numOutputs_t i = 0; i < numOutputs; i++)
             {
-                converged = false;
+                if (abs(totalErrorInCurrentLayer[i]) > desiredCost)
+                {
+                    converged = false;
+                }
             }
-        }
 
 #if (CONFIG_LOG_DEFAULT_LEVEL >= EMBANN_LOG_INFO)
-        if (count == 50000)
-        {
-            accumulator_t averageCost = 0;
-            for (numOutputs_t i = 0; i < numOutputs; i++)
+            if (count == 50000)
             {
-                averageCost += totalErrorInCurrentLayer[i];
+                accumulator_t averageCost = 0;
+                for (numOutputs_t i = 0; i < numOutputs; i++)
+                {
+                    averageCost += totalErrorInCurrentLayer[i];
+                }
+                averageCost /= numOutputs;
+                EMBANN_LOGI(TAG, "Average Cost: %d, e0 %d, e1 %d, e2 %d", averageCost, totalErrorInCurrentLayer[0],
+                                                                            totalErrorInCurrentLayer[1],
+                                                                            totalErrorInCurrentLayer[2]);
+                EMBANN_ERROR_CHECK(embann_printNetwork(pNetwork));
+                EMBANN_LOGI(TAG, "Output Neuron 0 Error = %" ACCUMULATOR_PRINT, totalErrorInCurrentLayer[0]);
+                EMBANN_LOGI(TAG, "Output Weight [0][0] = %" WEIGHT_PRINT, pNetwork->outputLayer->weight[0]);
+                EMBANN_LOGI(TAG, "Hidden Layer 0 Weight [0][0] = %" WEIGHT_PRINT, pNetwork->hiddenLayer[0]->weight[0]);
+                count = 0;
             }
-            averageCost /= numOutputs;
-            EMBANN_LOGI(TAG, "Average Cost: %d, e0 %d, e1 %d, e2 %d", averageCost, totalErrorInCurrentLayer[0],
-                                                                        totalErrorInCurrentLayer[1],
-                                                                        totalErrorInCurrentLayer[2]);
-            EMBANN_ERROR_CHECK(embann_printNetwork());
-            EMBANN_LOGI(TAG, "Output Neuron 0 Error = %" ACCUMULATOR_PRINT, totalErrorInCurrentLayer[0]);
-            EMBANN_LOGI(TAG, "Output Weight [0][0] = %" WEIGHT_PRINT, pNetworkGlobal->outputLayer->weight[0][0]);
-            EMBANN_LOGI(TAG, "Hidden Layer 0 Weight [0][0] = %" WEIGHT_PRINT, pNetworkGlobal->hiddenLayer[0]->weight[0][0]);
-            count = 0;
+            else
+            {
+                count++;
+            }
+#endif
+
+            _clampErrors(totalErrorInCurrentLayer, numOutputs);
+            err = (err == EOK) ? embann_train(pNetwork, NULL, pNetwork->inputLayer->activation,
+                                                pNetwork->trainingData.labels[dataSet], pGradients,
+                                                totalErrorInCurrentLayer, totalErrorInNextLayer, numErrors) : err;
+        }
+        _applyGradients(pNetwork, pGradients);
+    }
+
+    free(totalErrorInCurrentLayer);
+    _freeGradients(pGradients);
+    return _finishTraining(pNetwork, err);
+}
+
+
+
+
+
+#ifdef CONFIG_PARALLEL_TRAINING
+/*
+ * Trains on numThreads threads for numSeconds, each drawing its own random
+ * samples and applying its own batches of batchSize to the shared weights
+ * with no locking at all (Hogwild). An update can be lost when two threads
+ * hit the same weight at once, which is the price of never waiting. Every
+ * thread needs a session, so static builds can run at most
+ * CONFIG_NUM_STATIC_SESSIONS. Setting embann_setNumThreads() to 1 stops each
+ * thread fanning its layers out again. Each thread's samples per second go
+ * in pSamplesPerSecond, numThreads of them, when it isn't NULL.
+ */
+int embann_trainDriverParallel(network_t* pNetwork, activation_t learningRate, uint32_t numSeconds,
+                                uint32_t batchSize, uint32_t numThreads, float* pSamplesPerSecond)
+{
+    (void) learningRate;
+
+    if ((pNetwork == NULL) || (batchSize == 0U) || (numThreads == 0U))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+#ifdef CONFIG_SPARSE_WEIGHTS
+    if (embann_isPruned(pNetwork))
+    {
+        EMBANN_LOGE(TAG, "Pruned networks can't be trained");
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOTSUP;
+    }
+#endif
+
+    if (pNetwork->trainingData.numSets == 0U)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOENT;
+    }
+
+    trainingWorker_t* pWorkers = (trainingWorker_t*) EMBANN_ALIGNED_ALLOC(CONFIG_CACHE_LINE_SIZE,
+                                                        numThreads * sizeof(trainingWorker_t));
+    EMBANN_MALLOC_CHECK(pWorkers);
+
+    uint32_t numReady = 0U;
+    uint32_t numStarted = 0U;
+    int err = EOK;
+
+    while ((err == EOK) && (numReady < numThreads))
+    {
+        err = _initTrainingWorker(&pWorkers[numReady], pNetwork, batchSize);
+        /* Drawn from random(), so srandom() still makes runs repeatable, and never 0 */
+        pWorkers[numReady].randomState = (uint32_t) random() | 1U;
+        numReady += (err == EOK) ? 1U : 0U;
+    }
+
+    /* Every thread stops at the same time, however long the others took to start */
+    const uint64_t deadlineMicros = _monotonicMicros() + ((uint64_t) numSeconds * 1000000U);
+
+    while ((err == EOK) && (numStarted < numReady))
+    {
+        pWorkers[numStarted].deadlineMicros = deadlineMicros;
+        if (pthread_create(&pWorkers[numStarted].thread, NULL, _trainingWorkerThread, &pWorkers[numStarted]) != 0)
+        {
+            EMBANN_LOGE(TAG, "Could only start %d of %d threads", numStarted, numThreads);
+            err = EAGAIN;
         }
         else
         {
-            count++;
+            numStarted++;
+        }
+    }
+
+    float totalSamplesPerSecond = 0.0F;
+    for (uint32_t i = 0; i < numStarted; i++)
+    {
+        const trainingWorker_t* pWorker = &pWorkers[i];
+
+        (void) pthread_join(pWorker->thread, NULL);
+        err = (err == EOK) ? pWorker->err : err;
+
+        const float samplesPerSecond = (pWorker->elapsedMicros == 0U) ? 0.0F :
+                                        ((float) pWorker->numSamples * 1e6F) / (float) pWorker->elapsedMicros;
+        EMBANN_LOGI(TAG, "Thread %d trained %.0f samples per second", i, samplesPerSecond);
+        totalSamplesPerSecond += samplesPerSecond;
+
+        if (pSamplesPerSecond != NULL)
+        {
+            pSamplesPerSecond[i] = samplesPerSecond;
         }
+    }
+    EMBANN_LOGI(TAG, "%d threads trained %.0f samples per second", numStarted, totalSamplesPerSecond);
+
+    for (uint32_t i = 0; i < numReady; i++)
+    {
+        _freeTrainingWorker(&pWorkers[i]);
+    }
+    EMBANN_ALIGNED_FREE(pWorkers);
+    return _finishTraining(pNetwork, err);
+}
+
+
+
+
+
+/*
+ * Trains numBatches batches of batchSize samples, splitting each
+ * batch between numThreads threads that backpropagate into their own
+ * gradients. The gradients are then summed in a fixed order, each thread
+ * summing and applying its own slice of them, so the weights are updated
+ * once per batch exactly as they'd be on one thread. Samples come from
+ * embann_getNextDataSet(), so each is trained once per epoch and, for a given
+ * srandom() seed and thread count, every run ends with bit-identical weights.
+ * Every thread needs a session, so static builds can run at most
+ * CONFIG_NUM_STATIC_SESSIONS.
+ */
+int embann_trainDriverInBatches(network_t* pNetwork, activation_t learningRate, uint32_t numBatches,
+                                uint32_t batchSize, uint32_t numThreads)
+{
+    (void) learningRate;
+
+    if ((pNetwork == NULL) || (batchSize == 0U) || (numThreads == 0U))
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return EINVAL;
+    }
+
+#ifdef CONFIG_SPARSE_WEIGHTS
+    if (embann_isPruned(pNetwork))
+    {
+        EMBANN_LOGE(TAG, "Pruned networks can't be trained");
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOTSUP;
+    }
 #endif
 
-        for (numOutputs_t i = 0; i < numOutputs; i++)
-        {        
-            if (totalErrorInCurrentLayer[i] > 0)
+    if (pNetwork->trainingData.numSets == 0U)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return ENOENT;
+    }
+
+    /* Only this first shuffle can fail, later epochs reuse its order, so the first worker always gets its samples */
+    if (pNetwork->trainingData.numOrdered != pNetwork->trainingData.numSets)
+    {
+        const int err = embann_shuffleTrainingData(pNetwork);
+        if (err != EOK)
+        {
+            // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+            // cppcheck-suppress misra-c2012-15.5
+            return err;
+        }
+    }
+
+    syncTraining_t sync = {
+        .pNetwork = pNetwork,
+        .numGradients = _gradientOffset(pNetwork, pNetwork->properties.numHiddenLayers + 1U),
+        .numThreads = numThreads,
+        .numBatches = numBatches,
+        .batchSize = batchSize,
+    };
+    sync.pBatch = (numTrainingDataSets_t*) malloc(batchSize * sizeof(numTrainingDataSets_t));
+    EMBANN_MALLOC_CHECK(sync.pBatch);
+    sync.pWorkers = (trainingWorker_t*) EMBANN_ALIGNED_ALLOC(CONFIG_CACHE_LINE_SIZE,
+                                                            numThreads * sizeof(trainingWorker_t));
+    EMBANN_MALLOC_CHECK(sync.pWorkers);
+
+    uint32_t numReady = 0U;
+    int err = EOK;
+
+    while ((err == EOK) && (numReady < numThreads))
+    {
+        err = _initTrainingWorker(&sync.pWorkers[numReady], pNetwork, batchSize);
+        sync.pWorkers[numReady].pSync = &sync;
+        sync.pWorkers[numReady].index = numReady;
+        numReady += (err == EOK) ? 1U : 0U;
+    }
+
+    if (err == EOK)
+    {
+        uint32_t numStarted = 1U;
+
+        (void) pthread_barrier_init(&sync.barrier, NULL, numThreads);
+        (void) pthread_mutex_init(&sync.startMutex, NULL);
+        (void) pthread_mutex_lock(&sync.startMutex);
+
+        /* This thread is the first worker */
+        while ((err == EOK) && (numStarted < numThreads))
+        {
+            if (pthread_create(&sync.pWorkers[numStarted].thread, NULL, _syncWorkerThread,
+                                &sync.pWorkers[numStarted]) != 0)
             {
-                totalErrorInCurrentLayer[i] = min(totalErrorInCurrentLayer[i], 1);
+                EMBANN_LOGE(TAG, "Could only start %d of %d threads", numStarted, numThreads);
+                sync.numBatches = 0U;
+                err = EAGAIN;
             }
             else
             {
-                totalErrorInCurrentLayer[i] = max(totalErrorInCurrentLayer[i], -1);
+                numStarted++;
             }
         }
+        (void) pthread_mutex_unlock(&sync.startMutex);
+
+        (void) _syncWorkerThread(&sync.pWorkers[0]);
+        for (uint32_t i = 1U; i < numStarted; i++)
+        {
+            (void) pthread_join(sync.pWorkers[i].thread, NULL);
+        }
+        for (uint32_t i = 0; i < numStarted; i++)
+        {
+            err = (err == EOK) ? sync.pWorkers[i].err : err;
+        }
+
+        const uint64_t elapsedMicros = sync.pWorkers[0].elapsedMicros;
+        if ((err == EOK) && (elapsedMicros != 0U))
+        {
+            EMBANN_LOGI(TAG, "%d threads trained %.0f samples per second", numThreads,
+                        ((float) numBatches * (float) batchSize * 1e6F) / (float) elapsedMicros);
+        }
 
-        EMBANN_ERROR_CHECK(embann_train(randomDataSet->correctResponse, learningRate, totalErrorInCurrentLayer, totalErrorInNextLayer));
+        (void) pthread_mutex_destroy(&sync.startMutex);
+        (void) pthread_barrier_destroy(&sync.barrier);
     }
-    return EOK;
+
+    for (uint32_t i = 0; i < numReady; i++)
+    {
+        _freeTrainingWorker(&sync.pWorkers[i]);
+    }
+    EMBANN_ALIGNED_FREE(sync.pWorkers);
+    free(sync.pBatch);
+    return _finishTraining(pNetwork, err);
 }
+#endif // CONFIG_PARALLEL_TRAINING
 
 
 
 
 
-static int embann_train(numOutputs_t correctOutput, activation_t learningRate, 
-                        accumulator_t* totalErrorInCurrentLayer, accumulator_t* totalErrorInNextLayer)
+/*
+ * Backpropagates one sample's output error, adding its weight updates to
+ * pGradients. Nothing here reads weights that an earlier layer's updates
+ * would have changed, so holding them back until the end of the batch
+ * doesn't change a batch of 1. The sample's activations are pSession's, or
+ * the network's own when that's NULL, and pInputs are what it was run on.
+ */
+static int embann_train(network_t* pNetwork, const inferenceSession_t* pSession, const activation_t* pInputs,
+                        numOutputs_t correctOutput, accumulator_t* pGradients,
+                        accumulator_t* totalErrorInCurrentLayer, accumulator_t* totalErrorInNextLayer,
+                        uint32_t numErrors)
 {
-    const numOutputs_t numOutputs = pNetworkGlobal->outputLayer->numNeurons;
-    const numLayers_t lastHiddenLayer = pNetworkGlobal->properties.numHiddenLayers - 1U;
+    const numOutputs_t numOutputs = pNetwork->outputLayer->numNeurons;
+    const numLayers_t lastHiddenLayer = pNetwork->properties.numHiddenLayers - 1U;
 
     if (correctOutput > numOutputs)
     {
         return ENOENT;
     }
 
-    EMBANN_ERROR_CHECK(_trainOutput(totalErrorInCurrentLayer, numOutputs, lastHiddenLayer, learningRate, correctOutput));
-    memcpy(totalErrorInNextLayer, totalErrorInCurrentLayer, CONFIG_NUM_INPUT_NEURONS * sizeof(accumulator_t));
-    memset(totalErrorInCurrentLayer, 0, CONFIG_NUM_INPUT_NEURONS * sizeof(accumulator_t));
-    EMBANN_ERROR_CHECK(_trainHidden(totalErrorInCurrentLayer, totalErrorInNextLayer, lastHiddenLayer, learningRate));
-    EMBANN_ERROR_CHECK(_trainInput(totalErrorInCurrentLayer, totalErrorInNextLayer, learningRate));
+    EMBANN_ERROR_CHECK(_trainOutput(pNetwork, pSession, totalErrorInCurrentLayer, numOutputs, lastHiddenLayer,
+                                    pGradients));
+    memcpy(totalErrorInNextLayer, totalErrorInCurrentLayer, numErrors * sizeof(accumulator_t));
+    memset(totalErrorInCurrentLayer, 0, numErrors * sizeof(accumulator_t));
+    EMBANN_ERROR_CHECK(_trainHidden(pNetwork, pSession, totalErrorInCurrentLayer, totalErrorInNextLayer, numErrors,
+                                    lastHiddenLayer, pGradients));
+    EMBANN_ERROR_CHECK(_trainInput(pNetwork, pInputs, totalErrorInCurrentLayer, totalErrorInNextLayer, pGradients));
     return EOK;
 }
 
@@ -152,31 +565,23 @@ static int embann_train(numOutputs_t correctOutput, activation_t learningRate,
 
 
 
-static int _trainOutput(accumulator_t* totalErrorInCurrentLayer, const numOutputs_t numNeuronsInCurrentLayer, 
-                        const numLayers_t lastHiddenLayer, activation_t learningRate, 
-                        numOutputs_t correctOutput)
+static int _trainOutput(network_t* pNetwork, const inferenceSession_t* pSession,
+                        accumulator_t* totalErrorInCurrentLayer, const numOutputs_t numNeuronsInCurrentLayer,
+                        const numLayers_t lastHiddenLayer, accumulator_t* pGradients)
 {
     // TODO, add biasing
-    const numHiddenNeurons_t numNeuronsInNextLayer = pNetworkGlobal->hiddenLayer[lastHiddenLayer]->numNeurons;
+    const numHiddenNeurons_t numNeuronsInNextLayer = pNetwork->hiddenLayer[lastHiddenLayer]->numNeurons;
+    const activation_t* pActivation = _layerActivation(pNetwork, pSession, lastHiddenLayer);
+    accumulator_t* pLayerGradients = &pGradients[_gradientOffset(pNetwork, lastHiddenLayer + 1U)];
 
     EMBANN_LOGD(TAG, "Output Layer Error [0] = %" ACCUMULATOR_PRINT, totalErrorInCurrentLayer[0]);
-    EMBANN_LOGD(TAG, "Old Output Weight [0][0] = %" WEIGHT_PRINT, pNetworkGlobal->outputLayer->weight[0][0]);
 
+    PARALLEL_FOR_LAYER(numNeuronsInCurrentLayer * numNeuronsInNextLayer)
     for (numOutputs_t i = 0; i < numNeuronsInCurrentLayer; i++)
     {        
-        for (numHiddenNeurons_t j = 0; j < numNeuronsInNextLayer; j++)
-        {
-            EMBANN_LOGV(TAG, "Old Output Weight [%d][%d] = %" WEIGHT_PRINT, i, j, pNetworkGlobal->outputLayer->weight[i][j]);
-
-            pNetworkGlobal->outputLayer->weight[i][j] -= 
-                        pNetworkGlobal->hiddenLayer[lastHiddenLayer]->activation[j] *
-                        totalErrorInCurrentLayer[i];
-
-            EMBANN_LOGV(TAG, "New Output Weight [%d][%d] = %" WEIGHT_PRINT, i, j, pNetworkGlobal->outputLayer->weight[i][j]);
-        }
+        embann_accumulateGradient(&pLayerGradients[i * pNetwork->outputLayer->weightStride], pActivation,
+                                    totalErrorInCurrentLayer[i], numNeuronsInNextLayer);
     }
-
-    EMBANN_LOGD(TAG, "New Output Weight [0][0] = %" WEIGHT_PRINT, pNetworkGlobal->outputLayer->weight[0][0]);
     return EOK;
 }
 
@@ -185,21 +590,28 @@ static int _trainOutput(accumulator_t* totalErrorInCurrentLayer, const numOutput
 
 
 
-static int _trainHidden(accumulator_t* totalErrorInCurrentLayer, accumulator_t* totalErrorInNextLayer, 
-                        const numLayers_t lastHiddenLayer, activation_t learningRate)
+static int _trainHidden(network_t* pNetwork, const inferenceSession_t* pSession,
+                        accumulator_t* totalErrorInCurrentLayer, accumulator_t* totalErrorInNextLayer,
+                        uint32_t numErrors, const numLayers_t lastHiddenLayer, accumulator_t* pGradients)
 {
     // TODO, add biasing
-    numHiddenNeurons_t numNeuronsInCurrentLayer = pNetworkGlobal->hiddenLayer[lastHiddenLayer]->numNeurons;
-    numHiddenNeurons_t numNeuronsInNextLayer = pNetworkGlobal->outputLayer->numNeurons;
+    numHiddenNeurons_t numNeuronsInCurrentLayer = pNetwork->hiddenLayer[lastHiddenLayer]->numNeurons;
+    numHiddenNeurons_t numNeuronsInNextLayer = pNetwork->outputLayer->numNeurons;
 
     for (numLayers_t i = lastHiddenLayer; i > 0; i--)
     {
+        const uint32_t weightStride = pNetwork->hiddenLayer[i]->weightStride;
+        accumulator_t* pLayerGradients = &pGradients[_gradientOffset(pNetwork, i)];
+        const activation_t* pActivation = _layerActivation(pNetwork, pSession, i - 1U);
+
+        PARALLEL_FOR_LAYER(numNeuronsInCurrentLayer * numNeuronsInNextLayer)
         for (numHiddenNeurons_t j = 0; j < numNeuronsInCurrentLayer; j++)
         {
+            const weight_t* pWeightRow = &pNetwork->hiddenLayer[i]->weight[j * weightStride];
+
             for (numHiddenNeurons_t k = 0; k < numNeuronsInNextLayer; k++)
             {        
-                totalErrorInCurrentLayer[j] += pNetworkGlobal->hiddenLayer[i]->weight[j][k] * 
-                                                    totalErrorInNextLayer[k];
+                totalErrorInCurrentLayer[j] += pWeightRow[k] * totalErrorInNextLayer[k];
 
                 if (totalErrorInCurrentLayer[j] > 0)
                 {
@@ -213,29 +625,19 @@ static int _trainHidden(accumulator_t* totalErrorInCurrentLayer, accumulator_t*
         }
 
         EMBANN_LOGD(TAG, "Hidden Layer %d Error [0] = %" ACCUMULATOR_PRINT, i, totalErrorInCurrentLayer[0]);
-        EMBANN_LOGD(TAG, "Old Hidden Layer %d Weight [0][0] = %" WEIGHT_PRINT, i, pNetworkGlobal->hiddenLayer[i]->weight[0][0]);
 
+        PARALLEL_FOR_LAYER(numNeuronsInCurrentLayer * numNeuronsInNextLayer)
         for (numHiddenNeurons_t j = 0; j < numNeuronsInCurrentLayer; j++)
         {   
-            for (numHiddenNeurons_t k = 0; k < numNeuronsInNextLayer; k++)
-            {  
-                EMBANN_LOGV(TAG, "Old Hidden Layer %d Weight [%d][%d] = %" WEIGHT_PRINT, i, j, k, pNetworkGlobal->hiddenLayer[i]->weight[j][k]);
-
-                pNetworkGlobal->hiddenLayer[i]->weight[j][k] -=
-                            pNetworkGlobal->hiddenLayer[i - 1U]->activation[k] *
-                            totalErrorInCurrentLayer[j];
-
-                EMBANN_LOGV(TAG, "New Hidden Layer %d Weight [%d][%d] = %" WEIGHT_PRINT, i, j, k, pNetworkGlobal->hiddenLayer[i]->weight[j][k]);
-            }
+            embann_accumulateGradient(&pLayerGradients[j * weightStride], pActivation, totalErrorInCurrentLayer[j],
+                                        numNeuronsInNextLayer);
         }
 
-        EMBANN_LOGD(TAG, "New Hidden Layer %d Weight [0][0] = %" WEIGHT_PRINT, i, pNetworkGlobal->hiddenLayer[i]->weight[0][0]);
-
-        memcpy(totalErrorInNextLayer, totalErrorInCurrentLayer, CONFIG_NUM_INPUT_NEURONS * sizeof(accumulator_t));
-        memset(totalErrorInCurrentLayer, 0, CONFIG_NUM_INPUT_NEURONS * sizeof(accumulator_t));
+        memcpy(totalErrorInNextLayer, totalErrorInCurrentLayer, numErrors * sizeof(accumulator_t));
+        memset(totalErrorInCurrentLayer, 0, numErrors * sizeof(accumulator_t));
 
-        numNeuronsInCurrentLayer = pNetworkGlobal->hiddenLayer[i - 1U]->numNeurons;
-        numNeuronsInNextLayer = pNetworkGlobal->hiddenLayer[i]->numNeurons;
+        numNeuronsInCurrentLayer = pNetwork->hiddenLayer[i - 1U]->numNeurons;
+        numNeuronsInNextLayer = pNetwork->hiddenLayer[i]->numNeurons;
     }
 
     return EOK;
@@ -246,19 +648,23 @@ static int _trainHidden(accumulator_t* totalErrorInCurrentLayer, accumulator_t*
 
 
 
-static int _trainInput(accumulator_t* totalErrorInCurrentLayer, accumulator_t* totalErrorInNextLayer, 
-                        activation_t learningRate)
+static int _trainInput(network_t* pNetwork, const activation_t* pInputs, accumulator_t* totalErrorInCurrentLayer,
+                        accumulator_t* totalErrorInNextLayer, accumulator_t* pGradients)
 {
     // TODO, add biasing
-    numHiddenNeurons_t numNeuronsInCurrentLayer = pNetworkGlobal->hiddenLayer[0]->numNeurons;
-    numHiddenNeurons_t numNeuronsInNextLayer = pNetworkGlobal->inputLayer->numNeurons;
-
-    for (numInputs_t i = 0; i < numNeuronsInCurrentLayer; i++)
+    numHiddenNeurons_t numNeuronsInCurrentLayer = pNetwork->hiddenLayer[0]->numNeurons;
+    numHiddenNeurons_t numNeuronsInNextLayer = pNetwork->inputLayer->numNeurons;
+    const uint32_t weightStride = pNetwork->hiddenLayer[0]->weightStride;
+    const weight_t* pWeights = pNetwork->hiddenLayer[0]->weight;
+    accumulator_t* pLayerGradients = pGradients;
+
+    /* Each input's error only depends on its own column, so the columns can be split between threads */
+    PARALLEL_FOR_LAYER(numNeuronsInCurrentLayer * numNeuronsInNextLayer)
+    for (numHiddenNeurons_t j = 0; j < numNeuronsInNextLayer; j++)
     {
-        for (numHiddenNeurons_t j = 0; j < numNeuronsInNextLayer; j++)
+        for (numInputs_t i = 0; i < numNeuronsInCurrentLayer; i++)
         {        
-            totalErrorInCurrentLayer[j] += pNetworkGlobal->hiddenLayer[0]->weight[i][j] * 
-                                                totalErrorInNextLayer[i];
+            totalErrorInCurrentLayer[j] += pWeights[(i * weightStride) + j] * totalErrorInNextLayer[i];
 
             if (totalErrorInCurrentLayer[j] > 0)
             {
@@ -272,24 +678,407 @@ static int _trainInput(accumulator_t* totalErrorInCurrentLayer, accumulator_t* t
     }
 
     EMBANN_LOGD(TAG, "Hidden Layer 0 Error [0] = %" ACCUMULATOR_PRINT, totalErrorInCurrentLayer[0]);
-    EMBANN_LOGD(TAG, "Old Hidden Layer 0 Weight [0][0] = %" WEIGHT_PRINT, pNetworkGlobal->hiddenLayer[0]->weight[0][0]);
 
+    PARALLEL_FOR_LAYER(numNeuronsInCurrentLayer * numNeuronsInNextLayer)
     for (numInputs_t i = 0; i < numNeuronsInCurrentLayer; i++)
     {   
+        accumulator_t* pGradientRow = &pLayerGradients[i * weightStride];
+
         for (numHiddenNeurons_t j = 0; j < numNeuronsInNextLayer; j++)
         {  
-            EMBANN_LOGV(TAG, "Old Hidden Layer 0 Weight [%d][%d] = %" WEIGHT_PRINT, i, j, pNetworkGlobal->hiddenLayer[0]->weight[i][j]);
-            
-            pNetworkGlobal->hiddenLayer[0]->weight[i][j] -=
-                        pNetworkGlobal->inputLayer->activation[j] *
-                        totalErrorInCurrentLayer[j];
+            pGradientRow[j] += pInputs[j] * totalErrorInCurrentLayer[j];
+        }
+    }
+    return EOK;
+}
+
 
-            EMBANN_LOGV(TAG, "New Hidden Layer 0 Weight [%d][%d] = %" WEIGHT_PRINT, i, j, pNetworkGlobal->hiddenLayer[0]->weight[i][j]);
+
+
+
+/*
+ * Starts pError off as the output layer's activations less the one-hot
+ * target for correctOutput, with the rest of its numErrors entries zeroed
+ */
+static void _outputError(const network_t* pNetwork, const inferenceSession_t* pSession, numOutputs_t correctOutput,
+                            accumulator_t* pError, uint32_t numErrors)
+{
+    const activation_t* pOutputs = _layerActivation(pNetwork, pSession, pNetwork->properties.numHiddenLayers);
+
+    memset(pError, 0, numErrors * sizeof(accumulator_t));
+    pError[correctOutput] = MAX_ACTIVATION;
+
+    for (numOutputs_t i = 0; i < pNetwork->outputLayer->numNeurons; i++)
+    {        
+        pError[i] = (pOutputs[i] - pError[i]);
+    }
+}
+
+
+
+
+
+/* Where layer's activations were left, pSession's or the network's own when that's NULL */
+static const activation_t* _layerActivation(const network_t* pNetwork, const inferenceSession_t* pSession,
+                                            numLayers_t layer)
+{
+    return (pSession != NULL) ? pSession->activation[layer] : embann_describeLayer(pNetwork, layer).activation;
+}
+
+
+
+
+
+/* How many neurons pNetwork's widest layer has, so how many errors backpropagation can hold at once */
+static uint32_t _widestLayer(const network_t* pNetwork)
+{
+    uint32_t numNeurons = pNetwork->inputLayer->numNeurons;
+
+    for (numLayers_t layer = 0; layer <= pNetwork->properties.numHiddenLayers; layer++)
+    {
+        numNeurons = max(numNeurons, (uint32_t) embann_describeLayer(pNetwork, layer).numNeurons);
+    }
+    return numNeurons;
+}
+
+
+
+
+
+static void _clampErrors(accumulator_t* pError, uint32_t numErrors)
+{
+    for (uint32_t i = 0; i < numErrors; i++)
+    {        
+        if (pError[i] > 0)
+        {
+            pError[i] = min(pError[i], 1);
+        }
+        else
+        {
+            pError[i] = max(pError[i], -1);
+        }
+    }
+}
+
+
+
+
+
+/* Zeroed gradients for every layer of pNetwork, NULL if there's no memory for them */
+static accumulator_t* _allocGradients(const network_t* pNetwork)
+{
+    const size_t numBytes = _gradientOffset(pNetwork, pNetwork->properties.numHiddenLayers + 1U) *
+                                sizeof(accumulator_t);
+#ifdef CONFIG_MEMORY_ALLOCATION_STATIC
+    accumulator_t* pGradients = pNetwork->gradients;
+#else
+    accumulator_t* pGradients = (accumulator_t*) malloc(numBytes);
+#endif
+
+    if (pGradients != NULL)
+    {
+        memset(pGradients, 0, numBytes);
+    }
+    return pGradients;
+}
+
+
+
+
+
+static void _freeGradients(accumulator_t* pGradients)
+{
+#ifdef CONFIG_MEMORY_ALLOCATION_DYNAMIC
+    free(pGradients);
+#else
+    (void) pGradients;
+#endif
+}
+
+
+
+
+
+/* Where layer's gradients start, layers numbered as in embann_describeLayer() */
+static size_t _gradientOffset(const network_t* pNetwork, numLayers_t layer)
+{
+    size_t offset = 0U;
+
+    for (numLayers_t i = 0; i < layer; i++)
+    {
+        const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, i);
+        offset += descriptor.numNeurons * descriptor.weightStride;
+    }
+    return offset;
+}
+
+
+
+
+
+/* The batch's one weight update, each layer in a single pass that leaves the gradients zeroed */
+static void _applyGradients(network_t* pNetwork, accumulator_t* pGradients)
+{
+    for (numLayers_t layer = 0; layer <= pNetwork->properties.numHiddenLayers; layer++)
+    {
+        const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+        accumulator_t* pLayerGradients = &pGradients[_gradientOffset(pNetwork, layer)];
+        // Deviation from MISRA C2012 11.8, the descriptor points at this network's own layers
+        // cppcheck-suppress misra-c2012-11.8
+        weight_t* pWeights = (weight_t*) descriptor.weight;
+
+        EMBANN_LOGD(TAG, "Old Layer %d Weight [0][0] = %" WEIGHT_PRINT, layer, pWeights[0]);
+
+        PARALLEL_FOR_LAYER(descriptor.numNeurons * descriptor.weightStride)
+        for (uint32_t i = 0; i < descriptor.numNeurons; i++)
+        {
+            embann_applyGradients(&pWeights[i * descriptor.weightStride], &pLayerGradients[i * descriptor.weightStride],
+                                    descriptor.weightStride);
         }
+
+        EMBANN_LOGD(TAG, "New Layer %d Weight [0][0] = %" WEIGHT_PRINT, layer, pWeights[0]);
     }
+}
+
+
 
-    EMBANN_LOGD(TAG, "New Hidden Layer 0 Weight [0][0] = %" WEIGHT_PRINT, pNetworkGlobal->hiddenLayer[0]->weight[0][0]);
 
+
+/* Every driver's last step, as each neuron's zero point offset is summed from weights training has moved */
+static int _finishTraining(network_t* pNetwork, int err)
+{
+#ifdef CONFIG_REQUANTIZATION
+    const int offsetErr = embann_updateZeroPointOffsets(pNetwork);
+    return (err == EOK) ? offsetErr : err;
+#else
+    (void) pNetwork;
+    return err;
+#endif
+}
+
+
+
+
+
+#ifdef CONFIG_PARALLEL_TRAINING
+/*
+ * One embann_trainDriverParallel() thread. Both the forward pass and the
+ * weight update race the other threads on the shared weights, on purpose.
+ */
+static void* _trainingWorkerThread(void* pArg)
+{
+    trainingWorker_t* pWorker = (trainingWorker_t*) pArg;
+    network_t* pNetwork = pWorker->pNetwork;
+    const numTrainingDataSets_t numSets = pNetwork->trainingData.numSets;
+    const uint64_t startMicros = _monotonicMicros();
+    uint64_t nowMicros = startMicros;
+
+    while ((pWorker->err == EOK) && (nowMicros < pWorker->deadlineMicros))
+    {
+        for (uint32_t i = 0; (pWorker->err == EOK) && (i < pWorker->batchSize); i++)
+        {
+            const numTrainingDataSets_t sample = _nextRandomBelow(&pWorker->randomState, numSets);
+            pWorker->err = _trainSample(pWorker, sample);
+        }
+        _applyGradients(pNetwork, pWorker->pGradients);
+        nowMicros = _monotonicMicros();
+    }
+
+    pWorker->elapsedMicros = nowMicros - startMicros;
+    return NULL;
+}
+
+
+
+
+
+/*
+ * One embann_trainDriverInBatches() thread. Each batch goes draw, barrier,
+ * backpropagate this thread's share of the samples, barrier, reduce and
+ * apply this thread's slice of the gradients. Only the reductions write the
+ * weights, and only between the barriers where nothing reads them.
+ */
+static void* _syncWorkerThread(void* pArg)
+{
+    trainingWorker_t* pWorker = (trainingWorker_t*) pArg;
+    syncTraining_t* pSync = pWorker->pSync;
+    const uint32_t firstSample = (pWorker->index * pSync->batchSize) / pSync->numThreads;
+    const uint32_t lastSample = ((pWorker->index + 1U) * pSync->batchSize) / pSync->numThreads;
+    const size_t firstGradient = _gradientSliceStart(pSync, pWorker->index);
+    const size_t lastGradient = _gradientSliceStart(pSync, pWorker->index + 1U);
+    const uint64_t startMicros = _monotonicMicros();
+    bool failed = false;
+
+    (void) pthread_mutex_lock(&pSync->startMutex);
+    (void) pthread_mutex_unlock(&pSync->startMutex);
+
+    for (uint32_t batch = 0; !failed && (batch < pSync->numBatches); batch++)
+    {
+        if (pWorker->index == 0U)
+        {
+            for (uint32_t i = 0; i < pSync->batchSize; i++)
+            {
+                (void) embann_getNextDataSet(pSync->pNetwork, &pSync->pBatch[i]);
+            }
+        }
+        (void) pthread_barrier_wait(&pSync->barrier);
+
+        for (uint32_t i = firstSample; (pWorker->err == EOK) && (i < lastSample); i++)
+        {
+            pWorker->err = _trainSample(pWorker, pSync->pBatch[i]);
+        }
+        (void) pthread_barrier_wait(&pSync->barrier);
+
+        /* Nobody changes their err again until after the next barrier, so everyone agrees on this */
+        for (uint32_t i = 0; i < pSync->numThreads; i++)
+        {
+            failed = failed || (pSync->pWorkers[i].err != EOK);
+        }
+        if (!failed)
+        {
+            _reduceGradients(pSync, firstGradient, lastGradient);
+        }
+    }
+
+    pWorker->elapsedMicros = _monotonicMicros() - startMicros;
+    return NULL;
+}
+
+
+
+
+
+/* Forward and back propagates one sample on pWorker's session, adding its updates to pWorker's gradients */
+static int _trainSample(trainingWorker_t* pWorker, numTrainingDataSets_t sample)
+{
+    network_t* pNetwork = pWorker->pNetwork;
+    const activation_t* pFeatures = TRAINING_DATA_FEATURES(&pNetwork->trainingData, sample);
+    const numOutputs_t label = pNetwork->trainingData.labels[sample];
+
+    int err = embann_forwardPropagateSession(pWorker->pSession, pFeatures);
+
+    accumulator_t* totalErrorInCurrentLayer = pWorker->pErrors;
+    accumulator_t* totalErrorInNextLayer = &pWorker->pErrors[pWorker->numErrors];
+
+    memset(totalErrorInNextLayer, 0, pWorker->numErrors * sizeof(accumulator_t));
+    _outputError(pNetwork, pWorker->pSession, label, totalErrorInCurrentLayer, pWorker->numErrors);
+    _clampErrors(totalErrorInCurrentLayer, pNetwork->outputLayer->numNeurons);
+
+    err = (err == EOK) ? embann_train(pNetwork, pWorker->pSession, pFeatures, label, pWorker->pGradients,
+                                        totalErrorInCurrentLayer, totalErrorInNextLayer, pWorker->numErrors) : err;
+    pWorker->numSamples++;
+    return err;
+}
+
+
+
+
+
+/*
+ * Sums every worker's gradients from first up to last into the first
+ * worker's, pairing them off the same way every time so a float sum only
+ * depends on the number of threads, then takes them off the weights. Leaves
+ * that slice of every worker's gradients zeroed.
+ */
+static void _reduceGradients(const syncTraining_t* pSync, size_t first, size_t last)
+{
+    for (uint32_t stride = 1U; stride < pSync->numThreads; stride *= 2U)
+    {
+        for (uint32_t t = 0; (t + stride) < pSync->numThreads; t += 2U * stride)
+        {
+            accumulator_t* pSum = pSync->pWorkers[t].pGradients;
+            accumulator_t* pOther = pSync->pWorkers[t + stride].pGradients;
+
+            for (size_t i = first; i < last; i++)
+            {
+                pSum[i] += pOther[i];
+                pOther[i] = 0;
+            }
+        }
+    }
+    _applyGradientRange(pSync->pNetwork, pSync->pWorkers[0].pGradients, first, last);
+}
+
+
+
+
+
+/* _applyGradients() for just the gradients from first up to last, counting across every layer in turn */
+static void _applyGradientRange(network_t* pNetwork, accumulator_t* pGradients, size_t first, size_t last)
+{
+    size_t layerStart = 0U;
+
+    for (numLayers_t layer = 0; layer <= pNetwork->properties.numHiddenLayers; layer++)
+    {
+        const layerDescriptor_t descriptor = embann_describeLayer(pNetwork, layer);
+        const size_t layerEnd = layerStart + (descriptor.numNeurons * descriptor.weightStride);
+        // Deviation from MISRA C2012 11.8, the descriptor points at this network's own layers
+        // cppcheck-suppress misra-c2012-11.8
+        weight_t* pWeights = (weight_t*) descriptor.weight;
+
+        const size_t start = max(first, layerStart);
+        const size_t end = min(last, layerEnd);
+
+        if (start < end)
+        {
+            embann_applyGradients(&pWeights[start - layerStart], &pGradients[start], (uint32_t) (end - start));
+        }
+        layerStart = layerEnd;
+    }
+}
+
+
+
+
+
+/* Where index's slice of the gradients starts, on a cache line so no two threads reduce into one */
+static size_t _gradientSliceStart(const syncTraining_t* pSync, uint32_t index)
+{
+    const size_t gradientsPerLine = CONFIG_CACHE_LINE_SIZE / sizeof(accumulator_t);
+    const size_t start = ROUND_UP_TO_MULTIPLE((index * pSync->numGradients) / pSync->numThreads, gradientsPerLine);
+
+    return min(start, pSync->numGradients);
+}
+
+
+
+
+
+/* Gives pWorker its own session, and zeroed gradients with its errors after them in one block on the heap */
+static int _initTrainingWorker(trainingWorker_t* pWorker, network_t* pNetwork, uint32_t batchSize)
+{
+    const size_t gradientBytes = _gradientOffset(pNetwork, pNetwork->properties.numHiddenLayers + 1U) *
+                                    sizeof(accumulator_t);
+    const uint32_t numErrors = _widestLayer(pNetwork);
+    const size_t errorBytes = 2U * numErrors * sizeof(accumulator_t);
+
+    const int err = embann_initSession(&pWorker->pSession, pNetwork);
+    if (err != EOK)
+    {
+        // Deviation from MISRA C2012 15.5 for reasonably simple error return values
+        // cppcheck-suppress misra-c2012-15.5
+        return err;
+    }
+
+    pWorker->pGradients = (accumulator_t*) EMBANN_ALIGNED_ALLOC(CONFIG_CACHE_LINE_SIZE,
+                                                                ROUND_UP_TO_CACHE_LINE(gradientBytes) +
+                                                                ROUND_UP_TO_CACHE_LINE(errorBytes));
+    if (pWorker->pGradients == NULL)
+    {
+        (void) embann_freeSession(pWorker->pSession);
+    }
+    EMBANN_MALLOC_CHECK(pWorker->pGradients);
+    memset(pWorker->pGradients, 0, gradientBytes);
+
+    pWorker->pErrors = &pWorker->pGradients[ROUND_UP_TO_CACHE_LINE(gradientBytes) / sizeof(accumulator_t)];
+    pWorker->numErrors = numErrors;
+
+    pWorker->pNetwork = pNetwork;
+    pWorker->batchSize = batchSize;
+    pWorker->pSync = NULL;
+    pWorker->numSamples = 0U;
+    pWorker->elapsedMicros = 0U;
+    pWorker->err = EOK;
     return EOK;
 }
 
@@ -297,6 +1086,74 @@ static int _trainInput(accumulator_t* totalErrorInCurrentLayer, accumulator_t* t
 
 
 
+static void _freeTrainingWorker(trainingWorker_t* pWorker)
+{
+    (void) embann_freeSession(pWorker->pSession);
+    EMBANN_ALIGNED_FREE(pWorker->pGradients);
+}
+
+
+
+
+
+/* xorshift32, so each thread has its own sample stream without sharing random()'s state */
+static uint32_t _nextRandom(uint32_t* pState)
+{
+    uint32_t x = *pState;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *pState = x;
+    return x;
+}
+
+
+
+
+
+/*
+ * xorshift32 never gives 0, so each draw is one of 2^32 - 1 values, two of
+ * them for anything that might need more. As in the shuffle, draws past the
+ * last whole multiple of limit are thrown away so every sample is equally
+ * likely.
+ */
+static numTrainingDataSets_t _nextRandomBelow(uint32_t* pState, numTrainingDataSets_t limit)
+{
+    const uint64_t drawRange = 0xFFFFFFFFULL;
+    const bool isWide = ((uint64_t) limit > drawRange);
+    const uint64_t range = isWide ? (drawRange * drawRange) : drawRange;
+    const uint64_t numUsable = range - (range % limit);
+    uint64_t bits;
+
+    do
+    {
+        bits = (uint64_t) _nextRandom(pState) - 1U;
+        if (isWide)
+        {
+            bits = (bits * drawRange) + ((uint64_t) _nextRandom(pState) - 1U);
+        }
+    } while (bits >= numUsable);
+    return (numTrainingDataSets_t) (bits % limit);
+}
+
+
+
+
+
+static uint64_t _monotonicMicros(void)
+{
+    struct timespec now;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t) now.tv_sec * 1000000U) + ((uint64_t) now.tv_nsec / 1000U);
+}
+#endif // CONFIG_PARALLEL_TRAINING
+
+
+
+
+
 
 int embann_tanhDerivative(activation_t inputValue, weight_t* outputValue)
 {